@@ -3382,6 +3382,9 @@ int OBSBasic::ResetVideo()
 	ovi.gpu_conversion = true;
 	ovi.scale_type     = GetScaleType(basicConfig);
 
+	obs_set_video_frame_cache_size((uint32_t)config_get_uint(basicConfig,
+			"Video", "FrameCacheSize"));
+
 	if (ovi.base_width == 0 || ovi.base_height == 0) {
 		ovi.base_width = 1920;
 		ovi.base_height = 1080;
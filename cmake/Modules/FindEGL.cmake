@@ -0,0 +1,26 @@
+# - Try to find EGL
+# Once done this will define
+#
+# EGL_FOUND - system has EGL
+# EGL_LIBRARIES - Link these to use EGL
+# EGL_INCLUDE_DIRS - the EGL include dir
+# EGL_DEFINITIONS - compiler switches required for using EGL
+
+IF (NOT WIN32)
+  # use pkg-config to get the directories and then use these values
+  # in the FIND_PATH() and FIND_LIBRARY() calls
+  FIND_PACKAGE(PkgConfig)
+  PKG_CHECK_MODULES(PKG_EGL QUIET egl)
+
+  SET(EGL_DEFINITIONS ${PKG_EGL_CFLAGS})
+
+  FIND_PATH(EGL_INCLUDE_DIR NAMES EGL/egl.h HINTS ${PKG_EGL_INCLUDE_DIRS})
+  FIND_LIBRARY(EGL_LIBRARIES NAMES EGL HINTS ${PKG_EGL_LIBRARY_DIRS})
+
+  SET(EGL_INCLUDE_DIRS ${EGL_INCLUDE_DIR})
+
+  include(FindPackageHandleStandardArgs)
+  FIND_PACKAGE_HANDLE_STANDARD_ARGS(EGL DEFAULT_MSG EGL_LIBRARIES EGL_INCLUDE_DIR)
+
+  MARK_AS_ADVANCED(EGL_INCLUDE_DIR EGL_LIBRARIES)
+ENDIF (NOT WIN32)
@@ -0,0 +1,345 @@
+/******************************************************************************
+    Copyright (C) 2026 by OBS Project
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+/* Headless EGL backend
+ *
+ * Renders without any window system: the context is created on Mesa's
+ * surfaceless platform when available (or the default EGL display
+ * otherwise) and made current on a small pbuffer, or on no surface at all
+ * if pbuffers aren't supported.  All rendering goes to textures, so swap
+ * chains aren't supported.  This is built as a separate graphics module
+ * (libobs-opengl-headless) for benchmarks and CI machines without a
+ * display, and works with Mesa's software rasterizer.
+ */
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <string.h>
+
+#include "gl-subsystem.h"
+
+static const EGLint ctx_attribs[] = {
+#ifdef _DEBUG
+	EGL_CONTEXT_OPENGL_DEBUG, EGL_TRUE,
+#endif
+	EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+	EGL_CONTEXT_MAJOR_VERSION, 3,
+	EGL_CONTEXT_MINOR_VERSION, 2,
+	EGL_NONE
+};
+
+static const EGLint ctx_pbuffer_attribs[] = {
+	EGL_WIDTH, 2,
+	EGL_HEIGHT, 2,
+	EGL_NONE
+};
+
+static const EGLint ctx_config_attribs[] = {
+	EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+	EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+	EGL_RED_SIZE, 8,
+	EGL_GREEN_SIZE, 8,
+	EGL_BLUE_SIZE, 8,
+	EGL_ALPHA_SIZE, 8,
+	EGL_NONE
+};
+
+static const EGLint ctx_surfaceless_config_attribs[] = {
+	EGL_SURFACE_TYPE, 0,
+	EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+	EGL_RED_SIZE, 8,
+	EGL_GREEN_SIZE, 8,
+	EGL_BLUE_SIZE, 8,
+	EGL_ALPHA_SIZE, 8,
+	EGL_NONE
+};
+
+struct gl_windowinfo {
+	uint32_t cx;
+	uint32_t cy;
+};
+
+struct gl_platform {
+	EGLDisplay display;
+	EGLConfig config;
+	EGLContext context;
+
+	/* EGL_NO_SURFACE if the context is used surfaceless */
+	EGLSurface pbuffer;
+};
+
+static const char *egl_error_string(void)
+{
+	switch (eglGetError()) {
+	case EGL_SUCCESS:             return "EGL_SUCCESS";
+	case EGL_NOT_INITIALIZED:     return "EGL_NOT_INITIALIZED";
+	case EGL_BAD_ACCESS:          return "EGL_BAD_ACCESS";
+	case EGL_BAD_ALLOC:           return "EGL_BAD_ALLOC";
+	case EGL_BAD_ATTRIBUTE:       return "EGL_BAD_ATTRIBUTE";
+	case EGL_BAD_CONFIG:          return "EGL_BAD_CONFIG";
+	case EGL_BAD_CONTEXT:         return "EGL_BAD_CONTEXT";
+	case EGL_BAD_DISPLAY:         return "EGL_BAD_DISPLAY";
+	case EGL_BAD_MATCH:           return "EGL_BAD_MATCH";
+	case EGL_BAD_PARAMETER:       return "EGL_BAD_PARAMETER";
+	case EGL_BAD_SURFACE:         return "EGL_BAD_SURFACE";
+	default:                      return "unknown error";
+	}
+}
+
+static bool has_extension(const char *extensions, const char *name)
+{
+	size_t len = strlen(name);
+	const char *pos = extensions;
+
+	while (pos && (pos = strstr(pos, name)) != NULL) {
+		bool start = pos == extensions || pos[-1] == ' ';
+		bool end = pos[len] == ' ' || pos[len] == 0;
+
+		if (start && end)
+			return true;
+
+		pos += len;
+	}
+
+	return false;
+}
+
+static EGLDisplay open_headless_display(void)
+{
+	const char *client_exts = eglQueryString(EGL_NO_DISPLAY,
+			EGL_EXTENSIONS);
+
+	if (has_extension(client_exts, "EGL_MESA_platform_surfaceless")) {
+		PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+			(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress(
+					"eglGetPlatformDisplayEXT");
+
+		if (get_platform_display) {
+			EGLDisplay display = get_platform_display(
+					EGL_PLATFORM_SURFACELESS_MESA,
+					EGL_DEFAULT_DISPLAY, NULL);
+			if (display != EGL_NO_DISPLAY)
+				return display;
+		}
+	}
+
+	blog(LOG_INFO, "EGL surfaceless platform not available, using the "
+	               "default display");
+	return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+static bool choose_config(struct gl_platform *plat, const EGLint *attribs)
+{
+	EGLint num_configs = 0;
+
+	if (!eglChooseConfig(plat->display, attribs, &plat->config, 1,
+				&num_configs))
+		return false;
+
+	return num_configs > 0;
+}
+
+static bool gl_context_create(struct gl_platform *plat)
+{
+	const char *exts = eglQueryString(plat->display, EGL_EXTENSIONS);
+	bool surfaceless = has_extension(exts, "EGL_KHR_surfaceless_context");
+
+	if (!eglBindAPI(EGL_OPENGL_API)) {
+		blog(LOG_ERROR, "Failed to bind the OpenGL API: %s",
+				egl_error_string());
+		return false;
+	}
+
+	if (!choose_config(plat, ctx_config_attribs)) {
+		if (!surfaceless ||
+		    !choose_config(plat, ctx_surfaceless_config_attribs)) {
+			blog(LOG_ERROR, "Failed to find an EGL config: %s",
+					egl_error_string());
+			return false;
+		}
+	}
+
+	plat->context = eglCreateContext(plat->display, plat->config,
+			EGL_NO_CONTEXT, ctx_attribs);
+	if (plat->context == EGL_NO_CONTEXT) {
+		blog(LOG_ERROR, "Failed to create OpenGL context: %s",
+				egl_error_string());
+		return false;
+	}
+
+	plat->pbuffer = eglCreatePbufferSurface(plat->display, plat->config,
+			ctx_pbuffer_attribs);
+	if (plat->pbuffer == EGL_NO_SURFACE && !surfaceless) {
+		blog(LOG_ERROR, "Failed to create OpenGL pbuffer: %s",
+				egl_error_string());
+		eglDestroyContext(plat->display, plat->context);
+		return false;
+	}
+
+	blog(LOG_INFO, "Created headless EGL context (%s)",
+			plat->pbuffer != EGL_NO_SURFACE ?
+			"pbuffer" : "surfaceless");
+	return true;
+}
+
+static void gl_context_destroy(struct gl_platform *plat)
+{
+	eglMakeCurrent(plat->display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+			EGL_NO_CONTEXT);
+
+	if (plat->pbuffer != EGL_NO_SURFACE)
+		eglDestroySurface(plat->display, plat->pbuffer);
+	eglDestroyContext(plat->display, plat->context);
+}
+
+static inline bool make_current(struct gl_platform *plat)
+{
+	return eglMakeCurrent(plat->display, plat->pbuffer, plat->pbuffer,
+			plat->context);
+}
+
+extern struct gl_windowinfo *gl_windowinfo_create(
+		const struct gs_init_data *info)
+{
+	struct gl_windowinfo *wi = bzalloc(sizeof(struct gl_windowinfo));
+	wi->cx = info->cx;
+	wi->cy = info->cy;
+	return wi;
+}
+
+extern void gl_windowinfo_destroy(struct gl_windowinfo *info)
+{
+	bfree(info);
+}
+
+extern struct gl_platform *gl_platform_create(gs_device_t *device,
+		uint32_t adapter)
+{
+	struct gl_platform *plat = bzalloc(sizeof(struct gl_platform));
+	EGLint major, minor;
+
+	plat->display = open_headless_display();
+	if (plat->display == EGL_NO_DISPLAY) {
+		blog(LOG_ERROR, "Unable to open an EGL display");
+		goto fail_display_open;
+	}
+
+	if (!eglInitialize(plat->display, &major, &minor)) {
+		blog(LOG_ERROR, "Unable to initialize EGL: %s",
+				egl_error_string());
+		goto fail_display_open;
+	}
+
+	blog(LOG_INFO, "Initialized EGL %d.%d (%s)", major, minor,
+			eglQueryString(plat->display, EGL_VENDOR));
+
+	device->plat = plat;
+
+	if (!gl_context_create(plat)) {
+		blog(LOG_ERROR, "Failed to create context!");
+		goto fail_context_create;
+	}
+
+	if (!make_current(plat)) {
+		blog(LOG_ERROR, "Failed to make context current: %s",
+				egl_error_string());
+		goto fail_make_current;
+	}
+
+	gladLoadGLLoader((GLADloadproc)eglGetProcAddress);
+	if (!GLVersion.major) {
+		blog(LOG_ERROR, "Failed to load OpenGL entry functions.");
+		goto fail_make_current;
+	}
+
+	UNUSED_PARAMETER(adapter);
+	return plat;
+
+fail_make_current:
+	gl_context_destroy(plat);
+fail_context_create:
+	eglTerminate(plat->display);
+fail_display_open:
+	device->plat = NULL;
+	bfree(plat);
+	return NULL;
+}
+
+extern void gl_platform_destroy(struct gl_platform *plat)
+{
+	if (!plat)
+		return;
+
+	gl_context_destroy(plat);
+	eglTerminate(plat->display);
+	bfree(plat);
+}
+
+extern bool gl_platform_init_swapchain(struct gs_swap_chain *swap)
+{
+	UNUSED_PARAMETER(swap);
+	blog(LOG_ERROR, "Swap chains are not supported by the headless "
+	                "EGL backend");
+	return false;
+}
+
+extern void gl_platform_cleanup_swapchain(struct gs_swap_chain *swap)
+{
+	UNUSED_PARAMETER(swap);
+}
+
+extern void device_enter_context(gs_device_t *device)
+{
+	if (!make_current(device->plat))
+		blog(LOG_ERROR, "Failed to make context current: %s",
+				egl_error_string());
+}
+
+extern void device_leave_context(gs_device_t *device)
+{
+	if (!eglMakeCurrent(device->plat->display, EGL_NO_SURFACE,
+				EGL_NO_SURFACE, EGL_NO_CONTEXT))
+		blog(LOG_ERROR, "Failed to reset current context: %s",
+				egl_error_string());
+}
+
+extern void gl_getclientsize(const struct gs_swap_chain *swap,
+			     uint32_t *width, uint32_t *height)
+{
+	*width  = swap->wi->cx;
+	*height = swap->wi->cy;
+}
+
+extern void gl_update(gs_device_t *device)
+{
+	struct gl_windowinfo *wi = device->cur_swap->wi;
+
+	wi->cx = device->cur_swap->info.cx;
+	wi->cy = device->cur_swap->info.cy;
+}
+
+extern void device_load_swapchain(gs_device_t *device, gs_swapchain_t *swap)
+{
+	device->cur_swap = swap;
+}
+
+extern void device_present(gs_device_t *device)
+{
+	UNUSED_PARAMETER(device);
+	glFlush();
+}
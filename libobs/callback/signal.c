@@ -23,19 +23,50 @@
 struct signal_callback {
 	signal_callback_t callback;
 	void              *data;
-	bool              remove;
+	volatile bool     remove;
 	bool              keep_ref;
 };
 
+/* Emitting never locks: each signal publishes an immutable array of its
+ * callbacks, which is replaced whenever a callback is connected or
+ * disconnected.  Replaced arrays and removed callbacks are retired, and are
+ * only freed once no emission can be referencing them anymore. */
+struct signal_callbacks {
+	DARRAY(struct signal_callback*) array;
+	struct signal_callbacks         *next_retired;
+};
+
 struct signal_info {
 	struct decl_info               func;
-	DARRAY(struct signal_callback) callbacks;
+	struct signal_callbacks        *volatile callbacks;
 	pthread_mutex_t                mutex;
-	bool                           signalling;
+
+	/* emissions in progress, new emissions count themselves in
+	 * active[emit_idx] so that a waiting writer can't be starved */
+	volatile long                  emit_idx;
+	volatile long                  active[2];
+
+	/* threads waiting for emissions to finish, which emissions wake up
+	 * through wait_cond when they're done */
+	volatile long                  waiters;
+	pthread_mutex_t                wait_mutex;
+	pthread_cond_t                 wait_cond;
+
+	struct signal_callbacks        *retired;
+	DARRAY(struct signal_callback*) retired_callbacks;
 
 	struct signal_info             *next;
 };
 
+struct signal_emission {
+	struct signal_info     *sig;
+	signal_handler_t       *handler;
+	long                   idx;
+	struct signal_emission *prev;
+};
+
+static THREAD_LOCAL struct signal_emission *current_emission = NULL;
+
 static inline struct signal_info *signal_info_create(struct decl_info *info)
 {
 	pthread_mutexattr_t attr;
@@ -46,12 +77,9 @@ static inline struct signal_info *signal_info_create(struct decl_info *info)
 	if (pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE) != 0)
 		return NULL;
 
-	si = bmalloc(sizeof(struct signal_info));
+	si = bzalloc(sizeof(struct signal_info));
 
-	si->func       = *info;
-	si->next       = NULL;
-	si->signalling = false;
-	da_init(si->callbacks);
+	si->func = *info;
 
 	if (pthread_mutex_init(&si->mutex, &attr) != 0) {
 		blog(LOG_ERROR, "Could not create signal");
@@ -60,16 +88,66 @@ static inline struct signal_info *signal_info_create(struct decl_info *info)
 		bfree(si);
 		return NULL;
 	}
+	if (pthread_mutex_init(&si->wait_mutex, NULL) != 0) {
+		blog(LOG_ERROR, "Could not create signal wait mutex");
+
+		pthread_mutex_destroy(&si->mutex);
+		decl_info_free(&si->func);
+		bfree(si);
+		return NULL;
+	}
+	if (pthread_cond_init(&si->wait_cond, NULL) != 0) {
+		blog(LOG_ERROR, "Could not create signal wait condition");
+
+		pthread_mutex_destroy(&si->wait_mutex);
+		pthread_mutex_destroy(&si->mutex);
+		decl_info_free(&si->func);
+		bfree(si);
+		return NULL;
+	}
 
 	return si;
 }
 
+static void signal_callbacks_free(struct signal_callbacks *callbacks)
+{
+	if (callbacks) {
+		da_free(callbacks->array);
+		bfree(callbacks);
+	}
+}
+
+static void signal_info_free_retired(struct signal_info *si)
+{
+	while (si->retired) {
+		struct signal_callbacks *next = si->retired->next_retired;
+		signal_callbacks_free(si->retired);
+		si->retired = next;
+	}
+
+	for (size_t i = 0; i < si->retired_callbacks.num; i++)
+		bfree(si->retired_callbacks.array[i]);
+	da_resize(si->retired_callbacks, 0);
+}
+
 static inline void signal_info_destroy(struct signal_info *si)
 {
 	if (si) {
+		struct signal_callbacks *callbacks = si->callbacks;
+
+		if (callbacks) {
+			for (size_t i = 0; i < callbacks->array.num; i++)
+				bfree(callbacks->array.array[i]);
+			signal_callbacks_free(callbacks);
+		}
+
+		signal_info_free_retired(si);
+		da_free(si->retired_callbacks);
+
+		pthread_cond_destroy(&si->wait_cond);
+		pthread_mutex_destroy(&si->wait_mutex);
 		pthread_mutex_destroy(&si->mutex);
 		decl_info_free(&si->func);
-		da_free(si->callbacks);
 		bfree(si);
 	}
 }
@@ -77,8 +155,12 @@ static inline void signal_info_destroy(struct signal_info *si)
 static inline size_t signal_get_callback_idx(struct signal_info *si,
 		signal_callback_t callback, void *data)
 {
-	for (size_t i = 0; i < si->callbacks.num; i++) {
-		struct signal_callback *sc = si->callbacks.array+i;
+	struct signal_callbacks *callbacks = si->callbacks;
+	if (!callbacks)
+		return DARRAY_INVALID;
+
+	for (size_t i = 0; i < callbacks->array.num; i++) {
+		struct signal_callback *sc = callbacks->array.array[i];
 
 		if (sc->callback == callback && sc->data == data)
 			return i;
@@ -87,6 +169,101 @@ static inline size_t signal_get_callback_idx(struct signal_info *si,
 	return DARRAY_INVALID;
 }
 
+/* number of emissions of this signal the current thread is inside of */
+static long own_emissions(struct signal_info *si, long idx)
+{
+	struct signal_emission *emission = current_emission;
+	long count = 0;
+
+	while (emission) {
+		if (emission->sig == si && (idx == -1 || emission->idx == idx))
+			count++;
+		emission = emission->prev;
+	}
+
+	return count;
+}
+
+/* call with the signal mutex locked, after the callbacks were replaced */
+static void signal_info_try_free_retired(struct signal_info *si)
+{
+	if (own_emissions(si, -1))
+		return;
+	if (os_atomic_load_long(&si->active[0]) ||
+	    os_atomic_load_long(&si->active[1]))
+		return;
+
+	signal_info_free_retired(si);
+}
+
+/* replaces the published callbacks, call with the signal mutex locked */
+static void signal_info_replace(struct signal_info *si,
+		struct signal_callback *add, size_t remove_idx)
+{
+	struct signal_callbacks *old = si->callbacks;
+	struct signal_callbacks *callbacks = bzalloc(sizeof(*callbacks));
+
+	if (old) {
+		da_reserve(callbacks->array, old->array.num + 1);
+		for (size_t i = 0; i < old->array.num; i++) {
+			if (i != remove_idx)
+				da_push_back(callbacks->array,
+						&old->array.array[i]);
+		}
+	}
+
+	if (add)
+		da_push_back(callbacks->array, &add);
+
+	if (remove_idx != DARRAY_INVALID) {
+		struct signal_callback *cb = old->array.array[remove_idx];
+		os_atomic_set_bool(&cb->remove, true);
+		da_push_back(si->retired_callbacks, &cb);
+	}
+
+	/* full barrier, emissions that started before the new array was
+	 * published are always seen by the check of active[] below */
+	os_atomic_exchange_ptr((void *volatile*)&si->callbacks, callbacks);
+
+	if (old) {
+		old->next_retired = si->retired;
+		si->retired = old;
+	}
+
+	signal_info_try_free_retired(si);
+}
+
+/* waits until emissions on other threads that may still call a removed
+ * callback have finished */
+static void signal_info_wait_emissions(struct signal_info *si)
+{
+	pthread_mutex_lock(&si->wait_mutex);
+	os_atomic_inc_long(&si->waiters);
+
+	for (long idx = 0; idx < 2; idx++) {
+		long own = own_emissions(si, idx);
+
+		os_atomic_set_long(&si->emit_idx, 1 - idx);
+
+		while (os_atomic_load_long(&si->active[idx]) > own)
+			pthread_cond_wait(&si->wait_cond, &si->wait_mutex);
+	}
+
+	os_atomic_dec_long(&si->waiters);
+	pthread_mutex_unlock(&si->wait_mutex);
+}
+
+/* wakes up threads waiting for emissions to finish, after the emission was
+ * uncounted */
+static inline void signal_info_emission_done(struct signal_info *si)
+{
+	if (os_atomic_load_long(&si->waiters)) {
+		pthread_mutex_lock(&si->wait_mutex);
+		pthread_cond_broadcast(&si->wait_cond);
+		pthread_mutex_unlock(&si->wait_mutex);
+	}
+}
+
 struct global_callback_info {
 	global_signal_callback_t callback;
 	void                     *data;
@@ -101,6 +278,7 @@ struct signal_handler {
 
 	DARRAY(struct global_callback_info) global_callbacks;
 	pthread_mutex_t                     global_callbacks_mutex;
+	volatile long                       global_callbacks_count;
 };
 
 static struct signal_info *getsignal(signal_handler_t *handler,
@@ -210,7 +388,6 @@ static void signal_handler_connect_internal(signal_handler_t *handler,
 		bool keep_ref)
 {
 	struct signal_info *sig, *last;
-	struct signal_callback cb_data = {callback, data, false, keep_ref};
 	size_t idx;
 
 	if (!handler)
@@ -234,8 +411,14 @@ static void signal_handler_connect_internal(signal_handler_t *handler,
 		os_atomic_inc_long(&handler->refs);
 
 	idx = signal_get_callback_idx(sig, callback, data);
-	if (keep_ref || idx == DARRAY_INVALID)
-		da_push_back(sig->callbacks, &cb_data);
+	if (keep_ref || idx == DARRAY_INVALID) {
+		struct signal_callback *cb = bzalloc(sizeof(*cb));
+		cb->callback = callback;
+		cb->data     = data;
+		cb->keep_ref = keep_ref;
+
+		signal_info_replace(sig, cb, DARRAY_INVALID);
+	}
 
 	pthread_mutex_unlock(&sig->mutex);
 }
@@ -272,6 +455,7 @@ void signal_handler_disconnect(signal_handler_t *handler, const char *signal,
 {
 	struct signal_info *sig = getsignal_locked(handler, signal);
 	bool keep_ref = false;
+	bool removed = false;
 	size_t idx;
 
 	if (!sig)
@@ -281,16 +465,25 @@ void signal_handler_disconnect(signal_handler_t *handler, const char *signal,
 
 	idx = signal_get_callback_idx(sig, callback, data);
 	if (idx != DARRAY_INVALID) {
-		if (sig->signalling) {
-			sig->callbacks.array[idx].remove = true;
-		} else {
-			keep_ref = sig->callbacks.array[idx].keep_ref;
-			da_erase(sig->callbacks, idx);
-		}
+		keep_ref = sig->callbacks->array.array[idx]->keep_ref;
+		signal_info_replace(sig, NULL, idx);
+		removed = true;
 	}
 
 	pthread_mutex_unlock(&sig->mutex);
 
+	/* the callback must not be running anymore once this returns.  if
+	 * disconnecting from within an emission of the same signal, only the
+	 * remove flag is relied upon, as waiting could deadlock with another
+	 * thread doing the same */
+	if (removed && !own_emissions(sig, -1)) {
+		signal_info_wait_emissions(sig);
+
+		pthread_mutex_lock(&sig->mutex);
+		signal_info_try_free_retired(sig);
+		pthread_mutex_unlock(&sig->mutex);
+	}
+
 	if (keep_ref && os_atomic_dec_long(&handler->refs) == 0) {
 		signal_handler_actually_destroy(handler);
 	}
@@ -301,78 +494,128 @@ static THREAD_LOCAL struct global_callback_info *current_global_cb = NULL;
 
 void signal_handler_remove_current(void)
 {
-	if (current_signal_cb)
-		current_signal_cb->remove = true;
-	else if (current_global_cb)
+	if (current_signal_cb) {
+		struct signal_info *sig = current_emission->sig;
+		size_t idx;
+
+		pthread_mutex_lock(&sig->mutex);
+
+		idx = signal_get_callback_idx(sig,
+				current_signal_cb->callback,
+				current_signal_cb->data);
+		if (idx != DARRAY_INVALID &&
+		    sig->callbacks->array.array[idx] == current_signal_cb) {
+			signal_info_replace(sig, NULL, idx);
+
+			/* the handler is still in use by the emission */
+			if (current_signal_cb->keep_ref)
+				os_atomic_dec_long(&current_emission->handler->refs);
+		}
+
+		pthread_mutex_unlock(&sig->mutex);
+
+	} else if (current_global_cb) {
 		current_global_cb->remove = true;
+	}
 }
 
-void signal_handler_signal(signal_handler_t *handler, const char *signal,
-		calldata_t *params)
+signal_id_t *signal_handler_get_id(signal_handler_t *handler,
+		const char *signal)
 {
 	struct signal_info *sig = getsignal_locked(handler, signal);
-	long remove_refs = 0;
 
-	if (!sig)
+	if (!sig && handler)
+		blog(LOG_WARNING, "signal_handler_get_id: "
+		                  "signal '%s' not found", signal);
+
+	return sig;
+}
+
+static void signal_global_callbacks(signal_handler_t *handler,
+		const char *signal, calldata_t *params)
+{
+	struct signal_callback *prev_signal_cb = current_signal_cb;
+
+	if (!os_atomic_load_long(&handler->global_callbacks_count))
 		return;
 
-	pthread_mutex_lock(&sig->mutex);
-	sig->signalling = true;
+	pthread_mutex_lock(&handler->global_callbacks_mutex);
+	current_signal_cb = NULL;
+
+	for (size_t i = 0; i < handler->global_callbacks.num; i++) {
+		struct global_callback_info *cb =
+			handler->global_callbacks.array + i;
 
-	for (size_t i = 0; i < sig->callbacks.num; i++) {
-		struct signal_callback *cb = sig->callbacks.array+i;
 		if (!cb->remove) {
-			current_signal_cb = cb;
-			cb->callback(cb->data, params);
-			current_signal_cb = NULL;
+			cb->signaling++;
+			current_global_cb = cb;
+			cb->callback(cb->data, signal, params);
+			current_global_cb = NULL;
+			cb->signaling--;
 		}
 	}
 
-	for (size_t i = sig->callbacks.num; i > 0; i--) {
-		struct signal_callback *cb = sig->callbacks.array+i-1;
-		if (cb->remove) {
-			if (cb->keep_ref)
-				remove_refs++;
+	for (size_t i = handler->global_callbacks.num; i > 0; i--) {
+		struct global_callback_info *cb =
+			handler->global_callbacks.array + (i - 1);
 
-			da_erase(sig->callbacks, i-1);
-		}
+		if (cb->remove && !cb->signaling)
+			da_erase(handler->global_callbacks, i - 1);
 	}
 
-	sig->signalling = false;
-	pthread_mutex_unlock(&sig->mutex);
+	os_atomic_set_long(&handler->global_callbacks_count,
+			(long)handler->global_callbacks.num);
 
-	pthread_mutex_lock(&handler->global_callbacks_mutex);
+	current_signal_cb = prev_signal_cb;
+	pthread_mutex_unlock(&handler->global_callbacks_mutex);
+}
 
-	if (handler->global_callbacks.num) {
-		for (size_t i = 0; i < handler->global_callbacks.num; i++) {
-			struct global_callback_info *cb =
-				handler->global_callbacks.array + i;
-
-			if (!cb->remove) {
-				cb->signaling++;
-				current_global_cb = cb;
-				cb->callback(cb->data, signal, params);
-				current_global_cb = NULL;
-				cb->signaling--;
-			}
-		}
+void signal_handler_signal_id(signal_handler_t *handler, signal_id_t *id,
+		calldata_t *params)
+{
+	struct signal_callback *prev_signal_cb = current_signal_cb;
+	struct signal_callbacks *callbacks;
+	struct signal_emission emission;
 
-		for (size_t i = handler->global_callbacks.num; i > 0; i--) {
-			struct global_callback_info *cb =
-				handler->global_callbacks.array + (i - 1);
+	if (!handler || !id)
+		return;
 
-			if (cb->remove && !cb->signaling)
-				da_erase(handler->global_callbacks, i - 1);
-		}	
-	}
+	emission.sig     = id;
+	emission.handler = handler;
+	emission.idx     = os_atomic_load_long(&id->emit_idx);
+	emission.prev    = current_emission;
 
-	pthread_mutex_unlock(&handler->global_callbacks_mutex);
+	/* full barrier, the callbacks are loaded after being counted */
+	os_atomic_inc_long(&id->active[emission.idx]);
+	current_emission = &emission;
+
+	callbacks = os_atomic_load_ptr((void *const volatile*)&id->callbacks);
 
-	if (remove_refs) {
-		os_atomic_set_long(&handler->refs,
-				os_atomic_load_long(&handler->refs) -
-				remove_refs);
+	for (size_t i = 0; callbacks && i < callbacks->array.num; i++) {
+		struct signal_callback *cb = callbacks->array.array[i];
+		if (!os_atomic_load_bool(&cb->remove)) {
+			current_signal_cb = cb;
+			cb->callback(cb->data, params);
+			current_signal_cb = prev_signal_cb;
+		}
 	}
+
+	current_emission = emission.prev;
+	os_atomic_dec_long(&id->active[emission.idx]);
+	signal_info_emission_done(id);
+
+	signal_global_callbacks(handler, id->func.name, params);
+}
+
+void signal_handler_signal(signal_handler_t *handler, const char *signal,
+		calldata_t *params)
+{
+	struct signal_info *sig = getsignal_locked(handler, signal);
+
+	if (!sig)
+		return;
+
+	signal_handler_signal_id(handler, sig, params);
 }
 
 void signal_handler_connect_global(signal_handler_t *handler,
@@ -390,6 +633,9 @@ void signal_handler_connect_global(signal_handler_t *handler,
 	if (idx == DARRAY_INVALID)
 		da_push_back(handler->global_callbacks, &cb_data);
 
+	os_atomic_set_long(&handler->global_callbacks_count,
+			(long)handler->global_callbacks.num);
+
 	pthread_mutex_unlock(&handler->global_callbacks_mutex);
 }
 
@@ -415,5 +661,8 @@ void signal_handler_disconnect_global(signal_handler_t *handler,
 			da_erase(handler->global_callbacks, idx);
 	}
 
+	os_atomic_set_long(&handler->global_callbacks_count,
+			(long)handler->global_callbacks.num);
+
 	pthread_mutex_unlock(&handler->global_callbacks_mutex);
 }
@@ -32,7 +32,9 @@ extern "C" {
  */
 
 struct signal_handler;
+struct signal_info;
 typedef struct signal_handler signal_handler_t;
+typedef struct signal_info signal_id_t;
 typedef void (*global_signal_callback_t)(void*, const char*, calldata_t*);
 typedef void (*signal_callback_t)(void*, calldata_t*);
 
@@ -56,6 +58,14 @@ static inline bool signal_handler_add_array(signal_handler_t *handler,
 	return success;
 }
 
+/**
+ * Emitting a signal doesn't lock the signal: when a signal is emitted on
+ * several threads at once, its callbacks may be called concurrently, and
+ * callbacks connected while a signal is being emitted are only called by
+ * later emissions.  Disconnecting a callback blocks until emissions on other
+ * threads that may still call it have returned, unless called from within an
+ * emission of the same signal.
+ */
 EXPORT void signal_handler_connect(signal_handler_t *handler,
 		const char *signal, signal_callback_t callback, void *data);
 EXPORT void signal_handler_connect_ref(signal_handler_t *handler,
@@ -73,6 +83,16 @@ EXPORT void signal_handler_remove_current(void);
 EXPORT void signal_handler_signal(signal_handler_t *handler, const char *signal,
 		calldata_t *params);
 
+/**
+ * Resolves a signal name once so that frequently emitted signals don't have
+ * to be looked up by name on every emission.  The ID stays valid for the
+ * lifetime of the signal handler.
+ */
+EXPORT signal_id_t *signal_handler_get_id(signal_handler_t *handler,
+		const char *signal);
+EXPORT void signal_handler_signal_id(signal_handler_t *handler,
+		signal_id_t *id, calldata_t *params);
+
 #ifdef __cplusplus
 }
 #endif
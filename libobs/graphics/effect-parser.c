@@ -1813,5 +1813,7 @@ static bool ep_compile(struct effect_parser *ep)
 			success = false;
 	}
 
+	effect_build_name_tables(ep->effect);
+
 	return success;
 }
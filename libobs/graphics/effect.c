@@ -17,6 +17,7 @@
 
 #include "effect.h"
 #include "graphics-internal.h"
+#include "../util/hash.h"
 #include "vec2.h"
 #include "vec3.h"
 #include "vec4.h"
@@ -35,11 +36,97 @@ void gs_effect_destroy(gs_effect_t *effect)
 	}
 }
 
+static inline uint64_t hash_name(const char *name)
+{
+	return fnv1a_hash(name, strlen(name));
+}
+
+static void build_name_table(struct effect_name_table *table,
+		const void *array, size_t num, size_t stride)
+{
+	size_t size = 8;
+
+	while (size < num * 2)
+		size <<= 1;
+
+	bfree(table->entries);
+	table->entries = bzalloc(size * sizeof(struct effect_name_entry));
+	table->mask = size - 1;
+
+	for (size_t i = 0; i < num; i++) {
+		/* params and techniques both start with their name */
+		const char *name = *(char**)((uint8_t*)array + i * stride);
+		uint64_t hash;
+		size_t pos;
+
+		if (!name)
+			continue;
+
+		hash = hash_name(name);
+		pos = (size_t)(hash & table->mask);
+
+		while (table->entries[pos].idx)
+			pos = (pos + 1) & table->mask;
+
+		table->entries[pos].hash = hash;
+		table->entries[pos].idx = (uint32_t)(i + 1);
+	}
+}
+
+static size_t find_name(const struct effect_name_table *table,
+		const void *array, size_t stride, const char *name)
+{
+	uint64_t hash = hash_name(name);
+	size_t pos = (size_t)(hash & table->mask);
+
+	for (;;) {
+		const struct effect_name_entry *entry = &table->entries[pos];
+		const char *entry_name;
+
+		if (!entry->idx)
+			return DARRAY_INVALID;
+
+		entry_name = *(char**)((uint8_t*)array +
+				(entry->idx - 1) * stride);
+		if (entry->hash == hash && strcmp(entry_name, name) == 0)
+			return entry->idx - 1;
+
+		pos = (pos + 1) & table->mask;
+	}
+}
+
+void effect_build_name_tables(gs_effect_t *effect)
+{
+	build_name_table(&effect->param_names, effect->params.array,
+			effect->params.num, sizeof(struct gs_effect_param));
+	build_name_table(&effect->technique_names, effect->techniques.array,
+			effect->techniques.num,
+			sizeof(struct gs_effect_technique));
+
+	for (size_t i = 0; i < effect->techniques.num; i++) {
+		struct gs_effect_technique *tech = effect->techniques.array + i;
+
+		for (size_t j = 0; j < tech->passes.num; j++) {
+			struct gs_effect_pass *pass = tech->passes.array + j;
+			if (pass->name)
+				pass->name_hash = hash_name(pass->name);
+		}
+	}
+}
+
 gs_technique_t *gs_effect_get_technique(const gs_effect_t *effect,
 		const char *name)
 {
 	if (!effect) return NULL;
 
+	if (effect->technique_names.entries) {
+		size_t idx = find_name(&effect->technique_names,
+				effect->techniques.array,
+				sizeof(struct gs_effect_technique), name);
+		return idx != DARRAY_INVALID ?
+			effect->techniques.array + idx : NULL;
+	}
+
 	for (size_t i = 0; i < effect->techniques.num; i++) {
 		struct gs_effect_technique *tech = effect->techniques.array+i;
 		if (strcmp(tech->name, name) == 0)
@@ -276,6 +363,12 @@ gs_eparam_t *gs_effect_get_param_by_name(const gs_effect_t *effect,
 
 	struct gs_effect_param *params = effect->params.array;
 
+	if (effect->param_names.entries) {
+		size_t idx = find_name(&effect->param_names, params,
+				sizeof(struct gs_effect_param), name);
+		return idx != DARRAY_INVALID ? params + idx : NULL;
+	}
+
 	for (size_t i = 0; i < effect->params.num; i++) {
 		struct gs_effect_param *param = params+i;
 
@@ -334,10 +427,12 @@ gs_epass_t *gs_technique_get_pass_by_name(const gs_technique_t *technique,
 {
 	if (!technique) return NULL;
 	struct gs_effect_pass *passes = technique->passes.array;
+	uint64_t hash = hash_name(name);
 
 	for (size_t i = 0; i < technique->passes.num; i++) {
 		struct gs_effect_pass *g_pass = passes + i;
-		if (strcmp(g_pass->name, name) == 0)
+		if (g_pass->name && g_pass->name_hash == hash &&
+		    strcmp(g_pass->name, name) == 0)
 			return g_pass;
 	}
 	return NULL;
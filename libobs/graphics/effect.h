@@ -97,6 +97,7 @@ struct pass_shaderparam {
 
 struct gs_effect_pass {
 	char *name;
+	uint64_t name_hash;
 	enum effect_section section;
 
 	gs_shader_t *vertshader;
@@ -147,6 +148,19 @@ static inline void effect_technique_free(struct gs_effect_technique *t)
 
 /* ------------------------------------------------------------------------- */
 
+/* open addressing table of parameter/technique names, built once the effect
+ * has been compiled so that lookups by name don't have to compare against
+ * every name */
+struct effect_name_entry {
+	uint64_t hash;
+	uint32_t idx; /* index + 1, 0 when unused */
+};
+
+struct effect_name_table {
+	size_t mask;
+	struct effect_name_entry *entries;
+};
+
 struct gs_effect {
 	bool processing;
 	bool cached;
@@ -155,6 +169,9 @@ struct gs_effect {
 	DARRAY(struct gs_effect_param) params;
 	DARRAY(struct gs_effect_technique) techniques;
 
+	struct effect_name_table param_names;
+	struct effect_name_table technique_names;
+
 	struct gs_effect_technique *cur_technique;
 	struct gs_effect_pass *cur_pass;
 
@@ -183,12 +200,18 @@ static inline void effect_free(gs_effect_t *effect)
 	da_free(effect->params);
 	da_free(effect->techniques);
 
+	bfree(effect->param_names.entries);
+	bfree(effect->technique_names.entries);
+	effect->param_names.entries = NULL;
+	effect->technique_names.entries = NULL;
+
 	bfree(effect->effect_path);
 	bfree(effect->effect_dir);
 	effect->effect_path = NULL;
 	effect->effect_dir = NULL;
 }
 
+EXPORT void effect_build_name_tables(gs_effect_t *effect);
 EXPORT void effect_upload_params(gs_effect_t *effect, bool changed_only);
 EXPORT void effect_upload_shader_params(gs_effect_t *effect,
 		gs_shader_t *shader, struct darray *pass_params,
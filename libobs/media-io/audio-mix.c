@@ -0,0 +1,421 @@
+/******************************************************************************
+    Copyright (C) 2026 by OBS Project
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include "audio-mix.h"
+#include "../util/platform.h"
+#include "../util/threading.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || \
+    defined(__x86_64__)
+#define MIX_X86 1
+#endif
+
+#if defined(MIX_X86) || defined(NO_WARN_X86_INTRINSICS)
+#define MIX_SSE 1
+#include <xmmintrin.h>
+#endif
+
+#ifdef MIX_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#define AVX_FUNC
+#else
+#define AVX_FUNC __attribute__((target("avx")))
+#endif
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+#define MIX_NEON 1
+#include <arm_neon.h>
+#endif
+
+/* the SIMD versions never fuse products and sums, so they round the same way
+ * as the scalar versions (as long as the compiler doesn't contract those).
+ * they all process two vectors per iteration, and the rest one at a time */
+
+/* ------------------------------------------------------------------------- */
+/* scalar versions */
+
+static void mix_add_c(float *dst, const float *src, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+		dst[i] += src[i];
+}
+
+static void mix_add_mul_c(float *dst, const float *src, const float *vol,
+		size_t count)
+{
+	for (size_t i = 0; i < count; i++) {
+		float val = src[i] * vol[i];
+		dst[i] += val;
+	}
+}
+
+static void mul_scalar_c(float *dst, float vol, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+		dst[i] *= vol;
+}
+
+static void mul_c(float *dst, const float *vol, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+		dst[i] *= vol[i];
+}
+
+/* ------------------------------------------------------------------------- */
+/* SSE versions */
+
+#ifdef MIX_SSE
+static void mix_add_sse(float *dst, const float *src, size_t count)
+{
+	size_t i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		__m128 a0 = _mm_add_ps(_mm_loadu_ps(dst + i),
+				_mm_loadu_ps(src + i));
+		__m128 a1 = _mm_add_ps(_mm_loadu_ps(dst + i + 4),
+				_mm_loadu_ps(src + i + 4));
+		_mm_storeu_ps(dst + i, a0);
+		_mm_storeu_ps(dst + i + 4, a1);
+	}
+
+	mix_add_c(dst + i, src + i, count - i);
+}
+
+static void mix_add_mul_sse(float *dst, const float *src, const float *vol,
+		size_t count)
+{
+	size_t i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		__m128 v0 = _mm_mul_ps(_mm_loadu_ps(src + i),
+				_mm_loadu_ps(vol + i));
+		__m128 v1 = _mm_mul_ps(_mm_loadu_ps(src + i + 4),
+				_mm_loadu_ps(vol + i + 4));
+		_mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), v0));
+		_mm_storeu_ps(dst + i + 4,
+				_mm_add_ps(_mm_loadu_ps(dst + i + 4), v1));
+	}
+
+	mix_add_mul_c(dst + i, src + i, vol + i, count - i);
+}
+
+static void mul_scalar_sse(float *dst, float vol, size_t count)
+{
+	__m128 vol_4 = _mm_set1_ps(vol);
+	size_t i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		__m128 a0 = _mm_mul_ps(_mm_loadu_ps(dst + i), vol_4);
+		__m128 a1 = _mm_mul_ps(_mm_loadu_ps(dst + i + 4), vol_4);
+		_mm_storeu_ps(dst + i, a0);
+		_mm_storeu_ps(dst + i + 4, a1);
+	}
+
+	mul_scalar_c(dst + i, vol, count - i);
+}
+
+static void mul_sse(float *dst, const float *vol, size_t count)
+{
+	size_t i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		__m128 a0 = _mm_mul_ps(_mm_loadu_ps(dst + i),
+				_mm_loadu_ps(vol + i));
+		__m128 a1 = _mm_mul_ps(_mm_loadu_ps(dst + i + 4),
+				_mm_loadu_ps(vol + i + 4));
+		_mm_storeu_ps(dst + i, a0);
+		_mm_storeu_ps(dst + i + 4, a1);
+	}
+
+	mul_c(dst + i, vol + i, count - i);
+}
+#endif
+
+/* ------------------------------------------------------------------------- */
+/* AVX versions */
+
+#ifdef MIX_X86
+static AVX_FUNC void mix_add_avx(float *dst, const float *src, size_t count)
+{
+	size_t i = 0;
+
+	for (; i + 16 <= count; i += 16) {
+		__m256 a0 = _mm256_add_ps(_mm256_loadu_ps(dst + i),
+				_mm256_loadu_ps(src + i));
+		__m256 a1 = _mm256_add_ps(_mm256_loadu_ps(dst + i + 8),
+				_mm256_loadu_ps(src + i + 8));
+		_mm256_storeu_ps(dst + i, a0);
+		_mm256_storeu_ps(dst + i + 8, a1);
+	}
+
+	mix_add_c(dst + i, src + i, count - i);
+}
+
+static AVX_FUNC void mix_add_mul_avx(float *dst, const float *src,
+		const float *vol, size_t count)
+{
+	size_t i = 0;
+
+	for (; i + 16 <= count; i += 16) {
+		__m256 v0 = _mm256_mul_ps(_mm256_loadu_ps(src + i),
+				_mm256_loadu_ps(vol + i));
+		__m256 v1 = _mm256_mul_ps(_mm256_loadu_ps(src + i + 8),
+				_mm256_loadu_ps(vol + i + 8));
+		_mm256_storeu_ps(dst + i,
+				_mm256_add_ps(_mm256_loadu_ps(dst + i), v0));
+		_mm256_storeu_ps(dst + i + 8,
+				_mm256_add_ps(_mm256_loadu_ps(dst + i + 8), v1));
+	}
+
+	mix_add_mul_c(dst + i, src + i, vol + i, count - i);
+}
+
+static AVX_FUNC void mul_scalar_avx(float *dst, float vol, size_t count)
+{
+	__m256 vol_8 = _mm256_set1_ps(vol);
+	size_t i = 0;
+
+	for (; i + 16 <= count; i += 16) {
+		__m256 a0 = _mm256_mul_ps(_mm256_loadu_ps(dst + i), vol_8);
+		__m256 a1 = _mm256_mul_ps(_mm256_loadu_ps(dst + i + 8), vol_8);
+		_mm256_storeu_ps(dst + i, a0);
+		_mm256_storeu_ps(dst + i + 8, a1);
+	}
+
+	mul_scalar_c(dst + i, vol, count - i);
+}
+
+static AVX_FUNC void mul_avx(float *dst, const float *vol, size_t count)
+{
+	size_t i = 0;
+
+	for (; i + 16 <= count; i += 16) {
+		__m256 a0 = _mm256_mul_ps(_mm256_loadu_ps(dst + i),
+				_mm256_loadu_ps(vol + i));
+		__m256 a1 = _mm256_mul_ps(_mm256_loadu_ps(dst + i + 8),
+				_mm256_loadu_ps(vol + i + 8));
+		_mm256_storeu_ps(dst + i, a0);
+		_mm256_storeu_ps(dst + i + 8, a1);
+	}
+
+	mul_c(dst + i, vol + i, count - i);
+}
+#endif
+
+/* ------------------------------------------------------------------------- */
+/* NEON versions */
+
+#ifdef MIX_NEON
+static void mix_add_neon(float *dst, const float *src, size_t count)
+{
+	size_t i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		float32x4_t a0 = vaddq_f32(vld1q_f32(dst + i),
+				vld1q_f32(src + i));
+		float32x4_t a1 = vaddq_f32(vld1q_f32(dst + i + 4),
+				vld1q_f32(src + i + 4));
+		vst1q_f32(dst + i, a0);
+		vst1q_f32(dst + i + 4, a1);
+	}
+
+	mix_add_c(dst + i, src + i, count - i);
+}
+
+static void mix_add_mul_neon(float *dst, const float *src, const float *vol,
+		size_t count)
+{
+	size_t i = 0;
+
+	/* vmlaq_f32 may be fused, so multiply and add separately */
+	for (; i + 8 <= count; i += 8) {
+		float32x4_t v0 = vmulq_f32(vld1q_f32(src + i),
+				vld1q_f32(vol + i));
+		float32x4_t v1 = vmulq_f32(vld1q_f32(src + i + 4),
+				vld1q_f32(vol + i + 4));
+		vst1q_f32(dst + i, vaddq_f32(vld1q_f32(dst + i), v0));
+		vst1q_f32(dst + i + 4, vaddq_f32(vld1q_f32(dst + i + 4), v1));
+	}
+
+	mix_add_mul_c(dst + i, src + i, vol + i, count - i);
+}
+
+static void mul_scalar_neon(float *dst, float vol, size_t count)
+{
+	size_t i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		float32x4_t a0 = vmulq_n_f32(vld1q_f32(dst + i), vol);
+		float32x4_t a1 = vmulq_n_f32(vld1q_f32(dst + i + 4), vol);
+		vst1q_f32(dst + i, a0);
+		vst1q_f32(dst + i + 4, a1);
+	}
+
+	mul_scalar_c(dst + i, vol, count - i);
+}
+
+static void mul_neon(float *dst, const float *vol, size_t count)
+{
+	size_t i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		float32x4_t a0 = vmulq_f32(vld1q_f32(dst + i),
+				vld1q_f32(vol + i));
+		float32x4_t a1 = vmulq_f32(vld1q_f32(dst + i + 4),
+				vld1q_f32(vol + i + 4));
+		vst1q_f32(dst + i, a0);
+		vst1q_f32(dst + i + 4, a1);
+	}
+
+	mul_c(dst + i, vol + i, count - i);
+}
+#endif
+
+/* ------------------------------------------------------------------------- */
+/* runtime dispatch */
+
+struct mix_funcs {
+	void (*mix_add)(float *dst, const float *src, size_t count);
+	void (*mix_add_mul)(float *dst, const float *src, const float *vol,
+			size_t count);
+	void (*mul_scalar)(float *dst, float vol, size_t count);
+	void (*mul)(float *dst, const float *vol, size_t count);
+};
+
+static const struct mix_funcs funcs_c = {
+	mix_add_c,
+	mix_add_mul_c,
+	mul_scalar_c,
+	mul_c
+};
+
+#ifdef MIX_SSE
+static const struct mix_funcs funcs_sse = {
+	mix_add_sse,
+	mix_add_mul_sse,
+	mul_scalar_sse,
+	mul_sse
+};
+#endif
+
+#ifdef MIX_X86
+static const struct mix_funcs funcs_avx = {
+	mix_add_avx,
+	mix_add_mul_avx,
+	mul_scalar_avx,
+	mul_avx
+};
+#endif
+
+#ifdef MIX_NEON
+static const struct mix_funcs funcs_neon = {
+	mix_add_neon,
+	mix_add_mul_neon,
+	mul_scalar_neon,
+	mul_neon
+};
+#endif
+
+static const struct mix_funcs *get_funcs(enum audio_mix_impl impl)
+{
+	switch (impl) {
+	case AUDIO_MIX_AUTO:
+		break;
+	case AUDIO_MIX_SCALAR:
+		return &funcs_c;
+	case AUDIO_MIX_SSE:
+#ifdef MIX_SSE
+		return &funcs_sse;
+#else
+		return NULL;
+#endif
+	case AUDIO_MIX_AVX:
+#ifdef MIX_X86
+		return os_cpu_has_avx() ? &funcs_avx : NULL;
+#else
+		return NULL;
+#endif
+	case AUDIO_MIX_NEON:
+#ifdef MIX_NEON
+		return &funcs_neon;
+#else
+		return NULL;
+#endif
+	}
+
+#ifdef MIX_X86
+	if (os_cpu_has_avx())
+		return &funcs_avx;
+#endif
+#if defined(MIX_SSE)
+	return &funcs_sse;
+#elif defined(MIX_NEON)
+	return &funcs_neon;
+#else
+	return &funcs_c;
+#endif
+}
+
+static pthread_once_t funcs_init_token = PTHREAD_ONCE_INIT;
+static const struct mix_funcs *volatile cur_funcs = NULL;
+
+static void init_funcs(void)
+{
+	os_atomic_exchange_ptr((void *volatile*)&cur_funcs,
+			(void*)get_funcs(AUDIO_MIX_AUTO));
+}
+
+static inline const struct mix_funcs *funcs(void)
+{
+	pthread_once(&funcs_init_token, init_funcs);
+	return os_atomic_load_ptr((void *const volatile*)&cur_funcs);
+}
+
+bool audio_mix_set_impl(enum audio_mix_impl impl)
+{
+	const struct mix_funcs *new_funcs = get_funcs(impl);
+	if (!new_funcs)
+		return false;
+
+	pthread_once(&funcs_init_token, init_funcs);
+	os_atomic_exchange_ptr((void *volatile*)&cur_funcs,
+			(void*)new_funcs);
+	return true;
+}
+
+void audio_mix_add(float *dst, const float *src, size_t count)
+{
+	funcs()->mix_add(dst, src, count);
+}
+
+void audio_mix_add_mul(float *dst, const float *src, const float *vol,
+		size_t count)
+{
+	funcs()->mix_add_mul(dst, src, vol, count);
+}
+
+void audio_mix_mul_scalar(float *dst, float vol, size_t count)
+{
+	funcs()->mul_scalar(dst, vol, count);
+}
+
+void audio_mix_mul(float *dst, const float *vol, size_t count)
+{
+	funcs()->mul(dst, vol, count);
+}
@@ -0,0 +1,59 @@
+/******************************************************************************
+    Copyright (C) 2026 by OBS Project
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#pragma once
+
+#include "../util/c99defs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Float audio mixing and volume functions.  The fastest implementation
+ * supported by the CPU is selected at runtime; the SIMD implementations give
+ * the same results as the scalar one.  The implementation can be forced,
+ * which is mostly useful for testing and benchmarking.
+ */
+
+enum audio_mix_impl {
+	AUDIO_MIX_AUTO,
+	AUDIO_MIX_SCALAR,
+	AUDIO_MIX_SSE,
+	AUDIO_MIX_AVX,
+	AUDIO_MIX_NEON,
+};
+
+/* returns false if the implementation is not supported on this CPU */
+EXPORT bool audio_mix_set_impl(enum audio_mix_impl impl);
+
+/* dst[i] += src[i] */
+EXPORT void audio_mix_add(float *dst, const float *src, size_t count);
+
+/* dst[i] += src[i] * vol[i] */
+EXPORT void audio_mix_add_mul(float *dst, const float *src, const float *vol,
+		size_t count);
+
+/* dst[i] *= vol */
+EXPORT void audio_mix_mul_scalar(float *dst, float vol, size_t count);
+
+/* dst[i] *= vol[i] */
+EXPORT void audio_mix_mul(float *dst, const float *vol, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
@@ -16,8 +16,275 @@
 ******************************************************************************/
 
 #include "format-conversion.h"
+#include "../util/platform.h"
+#include "../util/threading.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || \
+    defined(__x86_64__)
+#define CONVERT_X86 1
+#endif
+
+#if defined(CONVERT_X86) || defined(NO_WARN_X86_INTRINSICS)
+#define CONVERT_SSE2 1
 #include <xmmintrin.h>
 #include <emmintrin.h>
+#endif
+
+#ifdef CONVERT_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#define AVX2_FUNC
+#else
+#define AVX2_FUNC __attribute__((target("avx2")))
+#endif
+#endif
+
+static FORCE_INLINE uint32_t min_uint32(uint32_t a, uint32_t b)
+{
+	return a < b ? a : b;
+}
+
+/* ------------------------------------------------------------------------- */
+/* scalar versions, bit-exact with the SIMD versions.  like the SIMD versions,
+ * these process pixels in groups of four. */
+
+static inline uint32_t align_4(uint32_t val)
+{
+	return (val + 3) & ~3;
+}
+
+static void compress_uyvx_to_i420_c(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	uint8_t  *lum_plane   = output[0];
+	uint8_t  *u_plane     = output[1];
+	uint8_t  *v_plane     = output[2];
+	uint32_t width        = align_4(min_uint32(in_linesize,
+				out_linesize[0]));
+	uint32_t y;
+
+	for (y = start_y; y < end_y; y += 2) {
+		const uint8_t *line1  = input + y * in_linesize;
+		const uint8_t *line2  = line1 + in_linesize;
+		uint8_t       *lum0   = lum_plane + y * out_linesize[0];
+		uint8_t       *lum1   = lum0 + out_linesize[0];
+		uint32_t chroma_y_pos = (y>>1) * out_linesize[1];
+		uint32_t x;
+
+		for (x = 0; x < width; x += 2) {
+			const uint8_t *p1 = line1 + x*4;
+			const uint8_t *p2 = line2 + x*4;
+
+			lum0[x]     = p1[1];
+			lum0[x + 1] = p1[5];
+			lum1[x]     = p2[1];
+			lum1[x + 1] = p2[5];
+
+			u_plane[chroma_y_pos + (x>>1)] = (uint8_t)(
+					(p1[0] + p1[4] + p2[0] + p2[4]) >> 2);
+			v_plane[chroma_y_pos + (x>>1)] = (uint8_t)(
+					(p1[2] + p1[6] + p2[2] + p2[6]) >> 2);
+		}
+	}
+}
+
+static void compress_uyvx_to_nv12_c(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	uint8_t *lum_plane    = output[0];
+	uint8_t *chroma_plane = output[1];
+	uint32_t width        = align_4(min_uint32(in_linesize,
+				out_linesize[0]));
+	uint32_t y;
+
+	for (y = start_y; y < end_y; y += 2) {
+		const uint8_t *line1  = input + y * in_linesize;
+		const uint8_t *line2  = line1 + in_linesize;
+		uint8_t       *lum0   = lum_plane + y * out_linesize[0];
+		uint8_t       *lum1   = lum0 + out_linesize[0];
+		uint8_t       *chroma = chroma_plane + (y>>1) * out_linesize[1];
+		uint32_t x;
+
+		for (x = 0; x < width; x += 2) {
+			const uint8_t *p1 = line1 + x*4;
+			const uint8_t *p2 = line2 + x*4;
+
+			lum0[x]     = p1[1];
+			lum0[x + 1] = p1[5];
+			lum1[x]     = p2[1];
+			lum1[x + 1] = p2[5];
+
+			chroma[x]     = (uint8_t)(
+					(p1[0] + p1[4] + p2[0] + p2[4]) >> 2);
+			chroma[x + 1] = (uint8_t)(
+					(p1[2] + p1[6] + p2[2] + p2[6]) >> 2);
+		}
+	}
+}
+
+static void convert_uyvx_to_i444_c(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	uint8_t  *lum_plane   = output[0];
+	uint8_t  *u_plane     = output[1];
+	uint8_t  *v_plane     = output[2];
+	uint32_t width        = align_4(min_uint32(in_linesize,
+				out_linesize[0]));
+	uint32_t y;
+
+	for (y = start_y; y < end_y; y += 2) {
+		const uint8_t *line1 = input + y * in_linesize;
+		const uint8_t *line2 = line1 + in_linesize;
+		uint32_t pos0        = y * out_linesize[0];
+		uint32_t pos1        = pos0 + out_linesize[0];
+		uint32_t x;
+
+		for (x = 0; x < width; x++) {
+			const uint8_t *p1 = line1 + x*4;
+			const uint8_t *p2 = line2 + x*4;
+
+			lum_plane[pos0 + x] = p1[1];
+			u_plane[pos0 + x]   = p1[0];
+			v_plane[pos0 + x]   = p1[2];
+
+			lum_plane[pos1 + x] = p2[1];
+			u_plane[pos1 + x]   = p2[0];
+			v_plane[pos1 + x]   = p2[2];
+		}
+	}
+}
+
+static void decompress_420_c(
+		const uint8_t *const input[], const uint32_t in_linesize[],
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output, uint32_t out_linesize)
+{
+	uint32_t start_y_d2 = start_y/2;
+	uint32_t width_d2   = in_linesize[0]/2;
+	uint32_t height_d2  = end_y/2;
+	uint32_t y;
+
+	for (y = start_y_d2; y < height_d2; y++) {
+		const uint8_t *chroma0 = input[1] + y * in_linesize[1];
+		const uint8_t *chroma1 = input[2] + y * in_linesize[2];
+		register const uint8_t *lum0, *lum1;
+		register uint32_t *output0, *output1;
+		uint32_t x;
+
+		lum0 = input[0] + y * 2 * in_linesize[0];
+		lum1 = lum0 + in_linesize[0];
+		output0 = (uint32_t*)(output + y * 2 * out_linesize);
+		output1 = (uint32_t*)((uint8_t*)output0 + out_linesize);
+
+		for (x = 0; x < width_d2; x++) {
+			uint32_t out;
+			out = (*(chroma0++) << 8) | *(chroma1++);
+
+			*(output0++) = (*(lum0++) << 16) | out;
+			*(output0++) = (*(lum0++) << 16) | out;
+
+			*(output1++) = (*(lum1++) << 16) | out;
+			*(output1++) = (*(lum1++) << 16) | out;
+		}
+	}
+}
+
+static void decompress_nv12_c(
+		const uint8_t *const input[], const uint32_t in_linesize[],
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output, uint32_t out_linesize)
+{
+	uint32_t start_y_d2 = start_y/2;
+	uint32_t width_d2   = min_uint32(in_linesize[0], out_linesize)/2;
+	uint32_t height_d2  = end_y/2;
+	uint32_t y;
+
+	for (y = start_y_d2; y < height_d2; y++) {
+		const uint16_t *chroma;
+		register const uint8_t *lum0, *lum1;
+		register uint32_t *output0, *output1;
+		uint32_t x;
+
+		chroma = (const uint16_t*)(input[1] + y * in_linesize[1]);
+		lum0 = input[0] + y * 2 * in_linesize[0];
+		lum1 = lum0 + in_linesize[0];
+		output0 = (uint32_t*)(output + y * 2 * out_linesize);
+		output1 = (uint32_t*)((uint8_t*)output0 + out_linesize);
+
+		for (x = 0; x < width_d2; x++) {
+			uint32_t out = *(chroma++) << 8;
+
+			*(output0++) = *(lum0++) | out;
+			*(output0++) = *(lum0++) | out;
+
+			*(output1++) = *(lum1++) | out;
+			*(output1++) = *(lum1++) | out;
+		}
+	}
+}
+
+static void decompress_422_c(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output, uint32_t out_linesize,
+		bool leading_lum)
+{
+	uint32_t width_d2 = min_uint32(in_linesize, out_linesize)/2;
+	uint32_t y;
+
+	register const uint32_t *input32;
+	register const uint32_t *input32_end;
+	register uint32_t       *output32;
+
+	if (leading_lum) {
+		for (y = start_y; y < end_y; y++) {
+			input32     = (const uint32_t*)(input + y*in_linesize);
+			input32_end = input32 + width_d2;
+			output32    = (uint32_t*)(output + y*out_linesize);
+
+			while(input32 < input32_end) {
+				register uint32_t dw = *input32;
+
+				output32[0] = dw;
+				dw &= 0xFFFFFF00;
+				dw |= (uint8_t)(dw>>16);
+				output32[1] = dw;
+
+				output32 += 2;
+				input32++;
+			}
+		}
+	} else {
+		for (y = start_y; y < end_y; y++) {
+			input32     = (const uint32_t*)(input + y*in_linesize);
+			input32_end = input32 + width_d2;
+			output32    = (uint32_t*)(output + y*out_linesize);
+
+			while (input32 < input32_end) {
+				register uint32_t dw = *input32;
+
+				output32[0] = dw;
+				dw &= 0xFFFF00FF;
+				dw |= (dw>>16) & 0xFF00;
+				output32[1] = dw;
+
+				output32 += 2;
+				input32++;
+			}
+		}
+	}
+}
+
+#ifdef CONVERT_SSE2
+
+/* ------------------------------------------------------------------------- */
+/* SSE2 versions */
 
 /* ...surprisingly, if I don't use a macro to force inlining, it causes the
  * CPU usage to boost by a tremendous amount in debug builds. */
@@ -84,20 +351,17 @@ do {                                                                          \
 } while (false)
 
 
-static FORCE_INLINE uint32_t min_uint32(uint32_t a, uint32_t b)
-{
-	return a < b ? a : b;
-}
-
-void compress_uyvx_to_i420(
+/* converts the pixels from start_x to end_x of each line, so that the AVX2
+ * version can finish its lines with this */
+static inline void compress_uyvx_to_i420_sse2_range(
 		const uint8_t *input, uint32_t in_linesize,
 		uint32_t start_y, uint32_t end_y,
+		uint32_t start_x, uint32_t end_x,
 		uint8_t *output[], const uint32_t out_linesize[])
 {
 	uint8_t  *lum_plane   = output[0];
 	uint8_t  *u_plane     = output[1];
 	uint8_t  *v_plane     = output[2];
-	uint32_t width        = min_uint32(in_linesize, out_linesize[0]);
 	uint32_t y;
 
 	__m128i lum_mask = _mm_set1_epi32(0x0000FF00);
@@ -109,7 +373,7 @@ void compress_uyvx_to_i420(
 		uint32_t lum_y_pos    = y      * out_linesize[0];
 		uint32_t x;
 
-		for (x = 0; x < width; x += 4) {
+		for (x = start_x; x < end_x; x += 4) {
 			const uint8_t *img = input + y_pos + x*4;
 			uint32_t lum_pos0  = lum_y_pos + x;
 			uint32_t lum_pos1  = lum_pos0 + out_linesize[0];
@@ -127,14 +391,26 @@ void compress_uyvx_to_i420(
 	}
 }
 
-void compress_uyvx_to_nv12(
+static void compress_uyvx_to_i420_sse2(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	compress_uyvx_to_i420_sse2_range(input, in_linesize, start_y, end_y,
+			0, min_uint32(in_linesize, out_linesize[0]),
+			output, out_linesize);
+}
+
+/* converts the pixels from start_x to end_x of each line, so that the AVX2
+ * version can finish its lines with this */
+static inline void compress_uyvx_to_nv12_sse2_range(
 		const uint8_t *input, uint32_t in_linesize,
 		uint32_t start_y, uint32_t end_y,
+		uint32_t start_x, uint32_t end_x,
 		uint8_t *output[], const uint32_t out_linesize[])
 {
 	uint8_t *lum_plane    = output[0];
 	uint8_t *chroma_plane = output[1];
-	uint32_t width        = min_uint32(in_linesize, out_linesize[0]);
 	uint32_t y;
 
 	__m128i lum_mask = _mm_set1_epi32(0x0000FF00);
@@ -146,7 +422,7 @@ void compress_uyvx_to_nv12(
 		uint32_t lum_y_pos    = y      * out_linesize[0];
 		uint32_t x;
 
-		for (x = 0; x < width; x += 4) {
+		for (x = start_x; x < end_x; x += 4) {
 			const uint8_t *img = input + y_pos + x*4;
 			uint32_t lum_pos0  = lum_y_pos + x;
 			uint32_t lum_pos1  = lum_pos0 + out_linesize[0];
@@ -163,7 +439,17 @@ void compress_uyvx_to_nv12(
 	}
 }
 
-void convert_uyvx_to_i444(
+static void compress_uyvx_to_nv12_sse2(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	compress_uyvx_to_nv12_sse2_range(input, in_linesize, start_y, end_y,
+			0, min_uint32(in_linesize, out_linesize[0]),
+			output, out_linesize);
+}
+
+static void convert_uyvx_to_i444_sse2(
 		const uint8_t *input, uint32_t in_linesize,
 		uint32_t start_y, uint32_t end_y,
 		uint8_t *output[], const uint32_t out_linesize[])
@@ -202,7 +488,17 @@ void convert_uyvx_to_i444(
 	}
 }
 
-void decompress_420(
+/* interleaves the low 16 bits of each output pixel with the high 16 bits and
+ * stores the resulting 8 pixels */
+static inline void store_8_pixels_sse2(uint32_t *output,
+		__m128i lo16, __m128i hi16)
+{
+	_mm_storeu_si128((__m128i*)output, _mm_unpacklo_epi16(lo16, hi16));
+	_mm_storeu_si128((__m128i*)(output + 4),
+			_mm_unpackhi_epi16(lo16, hi16));
+}
+
+static void decompress_420_sse2(
 		const uint8_t *const input[], const uint32_t in_linesize[],
 		uint32_t start_y, uint32_t end_y,
 		uint8_t *output, uint32_t out_linesize)
@@ -212,11 +508,13 @@ void decompress_420(
 	uint32_t height_d2  = end_y/2;
 	uint32_t y;
 
+	__m128i zero = _mm_setzero_si128();
+
 	for (y = start_y_d2; y < height_d2; y++) {
 		const uint8_t *chroma0 = input[1] + y * in_linesize[1];
 		const uint8_t *chroma1 = input[2] + y * in_linesize[2];
-		register const uint8_t *lum0, *lum1;
-		register uint32_t *output0, *output1;
+		const uint8_t *lum0, *lum1;
+		uint32_t *output0, *output1;
 		uint32_t x;
 
 		lum0 = input[0] + y * 2 * in_linesize[0];
@@ -224,20 +522,43 @@ void decompress_420(
 		output0 = (uint32_t*)(output + y * 2 * out_linesize);
 		output1 = (uint32_t*)((uint8_t*)output0 + out_linesize);
 
-		for (x = 0; x < width_d2; x++) {
-			uint32_t out;
-			out = (*(chroma0++) << 8) | *(chroma1++);
+		for (x = 0; x + 8 <= width_d2; x += 8) {
+			__m128i u  = _mm_loadl_epi64(
+					(const __m128i*)(chroma0 + x));
+			__m128i v  = _mm_loadl_epi64(
+					(const __m128i*)(chroma1 + x));
+			__m128i uv = _mm_unpacklo_epi8(v, u);
+			__m128i uv_lo = _mm_unpacklo_epi16(uv, uv);
+			__m128i uv_hi = _mm_unpackhi_epi16(uv, uv);
 
-			*(output0++) = (*(lum0++) << 16) | out;
-			*(output0++) = (*(lum0++) << 16) | out;
+			__m128i y0 = _mm_loadu_si128(
+					(const __m128i*)(lum0 + x*2));
+			__m128i y1 = _mm_loadu_si128(
+					(const __m128i*)(lum1 + x*2));
 
-			*(output1++) = (*(lum1++) << 16) | out;
-			*(output1++) = (*(lum1++) << 16) | out;
+			store_8_pixels_sse2(output0 + x*2, uv_lo,
+					_mm_unpacklo_epi8(y0, zero));
+			store_8_pixels_sse2(output0 + x*2 + 8, uv_hi,
+					_mm_unpackhi_epi8(y0, zero));
+			store_8_pixels_sse2(output1 + x*2, uv_lo,
+					_mm_unpacklo_epi8(y1, zero));
+			store_8_pixels_sse2(output1 + x*2 + 8, uv_hi,
+					_mm_unpackhi_epi8(y1, zero));
+		}
+
+		for (; x < width_d2; x++) {
+			uint32_t out = (chroma0[x] << 8) | chroma1[x];
+
+			output0[x*2]     = (lum0[x*2]     << 16) | out;
+			output0[x*2 + 1] = (lum0[x*2 + 1] << 16) | out;
+
+			output1[x*2]     = (lum1[x*2]     << 16) | out;
+			output1[x*2 + 1] = (lum1[x*2 + 1] << 16) | out;
 		}
 	}
 }
 
-void decompress_nv12(
+static void decompress_nv12_sse2(
 		const uint8_t *const input[], const uint32_t in_linesize[],
 		uint32_t start_y, uint32_t end_y,
 		uint8_t *output, uint32_t out_linesize)
@@ -247,10 +568,12 @@ void decompress_nv12(
 	uint32_t height_d2  = end_y/2;
 	uint32_t y;
 
+	__m128i zero = _mm_setzero_si128();
+
 	for (y = start_y_d2; y < height_d2; y++) {
 		const uint16_t *chroma;
-		register const uint8_t *lum0, *lum1;
-		register uint32_t *output0, *output1;
+		const uint8_t *lum0, *lum1;
+		uint32_t *output0, *output1;
 		uint32_t x;
 
 		chroma = (const uint16_t*)(input[1] + y * in_linesize[1]);
@@ -259,19 +582,48 @@ void decompress_nv12(
 		output0 = (uint32_t*)(output + y * 2 * out_linesize);
 		output1 = (uint32_t*)((uint8_t*)output0 + out_linesize);
 
-		for (x = 0; x < width_d2; x++) {
-			uint32_t out = *(chroma++) << 8;
+		for (x = 0; x + 8 <= width_d2; x += 8) {
+			__m128i uv = _mm_loadu_si128(
+					(const __m128i*)(chroma + x));
+			__m128i uv_lo = _mm_unpacklo_epi16(uv, uv);
+			__m128i uv_hi = _mm_unpackhi_epi16(uv, uv);
+			__m128i u_lo  = _mm_slli_epi16(uv_lo, 8);
+			__m128i u_hi  = _mm_slli_epi16(uv_hi, 8);
+			__m128i v_lo  = _mm_srli_epi16(uv_lo, 8);
+			__m128i v_hi  = _mm_srli_epi16(uv_hi, 8);
 
-			*(output0++) = *(lum0++) | out;
-			*(output0++) = *(lum0++) | out;
+			__m128i y0 = _mm_loadu_si128(
+					(const __m128i*)(lum0 + x*2));
+			__m128i y1 = _mm_loadu_si128(
+					(const __m128i*)(lum1 + x*2));
 
-			*(output1++) = *(lum1++) | out;
-			*(output1++) = *(lum1++) | out;
+			store_8_pixels_sse2(output0 + x*2, _mm_or_si128(
+					_mm_unpacklo_epi8(y0, zero), u_lo),
+					v_lo);
+			store_8_pixels_sse2(output0 + x*2 + 8, _mm_or_si128(
+					_mm_unpackhi_epi8(y0, zero), u_hi),
+					v_hi);
+			store_8_pixels_sse2(output1 + x*2, _mm_or_si128(
+					_mm_unpacklo_epi8(y1, zero), u_lo),
+					v_lo);
+			store_8_pixels_sse2(output1 + x*2 + 8, _mm_or_si128(
+					_mm_unpackhi_epi8(y1, zero), u_hi),
+					v_hi);
+		}
+
+		for (; x < width_d2; x++) {
+			uint32_t out = chroma[x] << 8;
+
+			output0[x*2]     = lum0[x*2]     | out;
+			output0[x*2 + 1] = lum0[x*2 + 1] | out;
+
+			output1[x*2]     = lum1[x*2]     | out;
+			output1[x*2 + 1] = lum1[x*2 + 1] | out;
 		}
 	}
 }
 
-void decompress_422(
+static void decompress_422_sse2(
 		const uint8_t *input, uint32_t in_linesize,
 		uint32_t start_y, uint32_t end_y,
 		uint8_t *output, uint32_t out_linesize,
@@ -280,45 +632,609 @@ void decompress_422(
 	uint32_t width_d2 = min_uint32(in_linesize, out_linesize)/2;
 	uint32_t y;
 
-	register const uint32_t *input32;
-	register const uint32_t *input32_end;
-	register uint32_t       *output32;
+	/* the second pixel of each pair repeats the pair's chroma with its
+	 * own luma copied over the luma of the first pixel */
+	const __m128i keep_mask = _mm_set1_epi32((int)(leading_lum ?
+			0xFFFFFF00 : 0xFFFF00FF));
+	const __m128i lum_mask = _mm_set1_epi32(leading_lum ?
+			0x000000FF : 0x0000FF00);
 
-	if (leading_lum) {
-		for (y = start_y; y < end_y; y++) {
-			input32     = (const uint32_t*)(input + y*in_linesize);
-			input32_end = input32 + width_d2;
-			output32    = (uint32_t*)(output + y*out_linesize);
+	for (y = start_y; y < end_y; y++) {
+		const uint32_t *input32 =
+			(const uint32_t*)(input + y*in_linesize);
+		uint32_t *output32 = (uint32_t*)(output + y*out_linesize);
+		uint32_t x;
 
-			while(input32 < input32_end) {
-				register uint32_t dw = *input32;
+		for (x = 0; x + 4 <= width_d2; x += 4) {
+			__m128i dw = _mm_loadu_si128(
+					(const __m128i*)(input32 + x));
+			__m128i dw2 = _mm_or_si128(
+					_mm_and_si128(dw, keep_mask),
+					_mm_and_si128(_mm_srli_epi32(dw, 16),
+						lum_mask));
 
-				output32[0] = dw;
-				dw &= 0xFFFFFF00;
-				dw |= (uint8_t)(dw>>16);
-				output32[1] = dw;
+			_mm_storeu_si128((__m128i*)(output32 + x*2),
+					_mm_unpacklo_epi32(dw, dw2));
+			_mm_storeu_si128((__m128i*)(output32 + x*2 + 4),
+					_mm_unpackhi_epi32(dw, dw2));
+		}
 
-				output32 += 2;
-				input32++;
+		for (; x < width_d2; x++) {
+			uint32_t dw = input32[x];
+
+			output32[x*2] = dw;
+			if (leading_lum) {
+				dw &= 0xFFFFFF00;
+				dw |= (uint8_t)(dw>>16);
+			} else {
+				dw &= 0xFFFF00FF;
+				dw |= (dw>>16) & 0xFF00;
 			}
+			output32[x*2 + 1] = dw;
 		}
-	} else {
-		for (y = start_y; y < end_y; y++) {
-			input32     = (const uint32_t*)(input + y*in_linesize);
-			input32_end = input32 + width_d2;
-			output32    = (uint32_t*)(output + y*out_linesize);
+	}
+}
 
-			while (input32 < input32_end) {
-				register uint32_t dw = *input32;
+#endif
 
-				output32[0] = dw;
+#ifdef CONVERT_X86
+
+/* ------------------------------------------------------------------------- */
+/* AVX2 versions.  these handle eight pixels at a time and fall back to the
+ * SSE2/scalar code for the remainder of each line. */
+
+#define X  -1
+
+/* gathers a byte of each pixel of a line in to the low 8 bytes */
+static inline AVX2_FUNC __m128i fold_lanes(__m256i val)
+{
+	return _mm_or_si128(_mm256_castsi256_si128(val),
+			_mm256_extracti128_si256(val, 1));
+}
+
+static inline AVX2_FUNC __m256i avg_chroma_avx2(__m256i line1, __m256i line2)
+{
+	const __m256i uv_mask = _mm256_set1_epi16(0x00FF);
+
+	__m256i sum = _mm256_add_epi16(
+			_mm256_and_si256(line1, uv_mask),
+			_mm256_and_si256(line2, uv_mask));
+	sum = _mm256_add_epi16(sum,
+			_mm256_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm256_srli_epi16(sum, 2);
+}
+
+static inline AVX2_FUNC void store_lum_avx2(uint8_t *lum0, uint8_t *lum1,
+		__m256i line1, __m256i line2)
+{
+	const __m256i lum_shuf = _mm256_setr_epi8(
+			1, 5, 9, 13, X, X, X, X, X, X, X, X, X, X, X, X,
+			X, X, X, X, 1, 5, 9, 13, X, X, X, X, X, X, X, X);
+
+	_mm_storel_epi64((__m128i*)lum0,
+			fold_lanes(_mm256_shuffle_epi8(line1, lum_shuf)));
+	_mm_storel_epi64((__m128i*)lum1,
+			fold_lanes(_mm256_shuffle_epi8(line2, lum_shuf)));
+}
+
+static AVX2_FUNC void compress_uyvx_to_i420_avx2(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	uint8_t  *lum_plane   = output[0];
+	uint8_t  *u_plane     = output[1];
+	uint8_t  *v_plane     = output[2];
+	uint32_t width        = align_4(min_uint32(in_linesize,
+				out_linesize[0]));
+	uint32_t y;
+
+	const __m256i uv_shuf = _mm256_setr_epi8(
+			0, 8, X, X, 2, 10, X, X, X, X, X, X, X, X, X, X,
+			X, X, 0, 8, X, X, 2, 10, X, X, X, X, X, X, X, X);
+
+	for (y = start_y; y < end_y; y += 2) {
+		uint32_t y_pos        = y      * in_linesize;
+		uint32_t chroma_y_pos = (y>>1) * out_linesize[1];
+		uint32_t lum_y_pos    = y      * out_linesize[0];
+		uint32_t x;
+
+		for (x = 0; x + 8 <= width; x += 8) {
+			const uint8_t *img = input + y_pos + x*4;
+			uint32_t lum_pos0  = lum_y_pos + x;
+			uint32_t lum_pos1  = lum_pos0 + out_linesize[0];
+			uint32_t uv_pos    = chroma_y_pos + (x>>1);
+
+			__m256i line1 = _mm256_loadu_si256((const __m256i*)img);
+			__m256i line2 = _mm256_loadu_si256(
+					(const __m256i*)(img + in_linesize));
+
+			store_lum_avx2(lum_plane + lum_pos0,
+					lum_plane + lum_pos1, line1, line2);
+
+			__m128i uv = fold_lanes(_mm256_shuffle_epi8(
+					avg_chroma_avx2(line1, line2),
+					uv_shuf));
+
+			*(uint32_t*)(u_plane + uv_pos) =
+				(uint32_t)_mm_cvtsi128_si32(uv);
+			*(uint32_t*)(v_plane + uv_pos) =
+				(uint32_t)_mm_cvtsi128_si32(
+						_mm_srli_si128(uv, 4));
+		}
+
+		if (x < width)
+			compress_uyvx_to_i420_sse2_range(input, in_linesize,
+					y, y + 2, x, width,
+					output, out_linesize);
+	}
+}
+
+static AVX2_FUNC void compress_uyvx_to_nv12_avx2(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	uint8_t *lum_plane    = output[0];
+	uint8_t *chroma_plane = output[1];
+	uint32_t width        = align_4(min_uint32(in_linesize,
+				out_linesize[0]));
+	uint32_t y;
+
+	const __m256i uv_shuf = _mm256_setr_epi8(
+			0, 2, 8, 10, X, X, X, X, X, X, X, X, X, X, X, X,
+			X, X, X, X, 0, 2, 8, 10, X, X, X, X, X, X, X, X);
+
+	for (y = start_y; y < end_y; y += 2) {
+		uint32_t y_pos        = y      * in_linesize;
+		uint32_t chroma_y_pos = (y>>1) * out_linesize[1];
+		uint32_t lum_y_pos    = y      * out_linesize[0];
+		uint32_t x;
+
+		for (x = 0; x + 8 <= width; x += 8) {
+			const uint8_t *img = input + y_pos + x*4;
+			uint32_t lum_pos0  = lum_y_pos + x;
+			uint32_t lum_pos1  = lum_pos0 + out_linesize[0];
+
+			__m256i line1 = _mm256_loadu_si256((const __m256i*)img);
+			__m256i line2 = _mm256_loadu_si256(
+					(const __m256i*)(img + in_linesize));
+
+			store_lum_avx2(lum_plane + lum_pos0,
+					lum_plane + lum_pos1, line1, line2);
+
+			_mm_storel_epi64(
+				(__m128i*)(chroma_plane + chroma_y_pos + x),
+				fold_lanes(_mm256_shuffle_epi8(
+					avg_chroma_avx2(line1, line2),
+					uv_shuf)));
+		}
+
+		if (x < width)
+			compress_uyvx_to_nv12_sse2_range(input, in_linesize,
+					y, y + 2, x, width,
+					output, out_linesize);
+	}
+}
+
+static inline AVX2_FUNC void convert_uyvx_line_to_i444_avx2(
+		const uint8_t *line, uint32_t width,
+		uint8_t *lum, uint8_t *u, uint8_t *v)
+{
+	const __m256i yu_shuf = _mm256_setr_epi8(
+			1, 5, 9, 13, X, X, X, X, 0, 4, 8, 12, X, X, X, X,
+			X, X, X, X, 1, 5, 9, 13, X, X, X, X, 0, 4, 8, 12);
+	const __m256i v_shuf = _mm256_setr_epi8(
+			2, 6, 10, 14, X, X, X, X, X, X, X, X, X, X, X, X,
+			X, X, X, X, 2, 6, 10, 14, X, X, X, X, X, X, X, X);
+	uint32_t x;
+
+	for (x = 0; x + 8 <= width; x += 8) {
+		__m256i pixels = _mm256_loadu_si256(
+				(const __m256i*)(line + x*4));
+		__m128i yu = fold_lanes(_mm256_shuffle_epi8(pixels, yu_shuf));
+		__m128i vv = fold_lanes(_mm256_shuffle_epi8(pixels, v_shuf));
+
+		_mm_storel_epi64((__m128i*)(lum + x), yu);
+		_mm_storel_epi64((__m128i*)(u + x), _mm_unpackhi_epi64(yu, yu));
+		_mm_storel_epi64((__m128i*)(v + x), vv);
+	}
+
+	for (; x < width; x++) {
+		lum[x] = line[x*4 + 1];
+		u[x]   = line[x*4];
+		v[x]   = line[x*4 + 2];
+	}
+}
+
+static AVX2_FUNC void convert_uyvx_to_i444_avx2(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	uint8_t  *lum_plane   = output[0];
+	uint8_t  *u_plane     = output[1];
+	uint8_t  *v_plane     = output[2];
+	uint32_t width        = align_4(min_uint32(in_linesize,
+				out_linesize[0]));
+	uint32_t y;
+
+	for (y = start_y; y < end_y; y += 2) {
+		const uint8_t *line = input + y * in_linesize;
+		uint32_t pos0       = y * out_linesize[0];
+		uint32_t pos1       = pos0 + out_linesize[0];
+
+		convert_uyvx_line_to_i444_avx2(line, width,
+				lum_plane + pos0, u_plane + pos0,
+				v_plane + pos0);
+		convert_uyvx_line_to_i444_avx2(line + in_linesize, width,
+				lum_plane + pos1, u_plane + pos1,
+				v_plane + pos1);
+	}
+}
+
+#undef X
+
+/* interleaves the low 16 bits of each output pixel with the high 16 bits and
+ * stores the resulting 16 pixels */
+static inline AVX2_FUNC void store_16_pixels_avx2(uint32_t *output,
+		__m256i lo16, __m256i hi16)
+{
+	__m256i first  = _mm256_unpacklo_epi16(lo16, hi16);
+	__m256i second = _mm256_unpackhi_epi16(lo16, hi16);
+
+	_mm256_storeu_si256((__m256i*)output,
+			_mm256_permute2x128_si256(first, second, 0x20));
+	_mm256_storeu_si256((__m256i*)(output + 8),
+			_mm256_permute2x128_si256(first, second, 0x31));
+}
+
+/* duplicates each 16 bit value so each chroma sample covers two pixels */
+static inline AVX2_FUNC __m256i dup_16_avx2(__m128i val)
+{
+	return _mm256_inserti128_si256(
+			_mm256_castsi128_si256(_mm_unpacklo_epi16(val, val)),
+			_mm_unpackhi_epi16(val, val), 1);
+}
+
+static AVX2_FUNC void decompress_420_avx2(
+		const uint8_t *const input[], const uint32_t in_linesize[],
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output, uint32_t out_linesize)
+{
+	uint32_t start_y_d2 = start_y/2;
+	uint32_t width_d2   = in_linesize[0]/2;
+	uint32_t height_d2  = end_y/2;
+	uint32_t y;
+
+	for (y = start_y_d2; y < height_d2; y++) {
+		const uint8_t *chroma0 = input[1] + y * in_linesize[1];
+		const uint8_t *chroma1 = input[2] + y * in_linesize[2];
+		const uint8_t *lum0, *lum1;
+		uint32_t *output0, *output1;
+		uint32_t x;
+
+		lum0 = input[0] + y * 2 * in_linesize[0];
+		lum1 = lum0 + in_linesize[0];
+		output0 = (uint32_t*)(output + y * 2 * out_linesize);
+		output1 = (uint32_t*)((uint8_t*)output0 + out_linesize);
+
+		for (x = 0; x + 8 <= width_d2; x += 8) {
+			__m128i u = _mm_loadl_epi64(
+					(const __m128i*)(chroma0 + x));
+			__m128i v = _mm_loadl_epi64(
+					(const __m128i*)(chroma1 + x));
+			__m256i uv = dup_16_avx2(_mm_unpacklo_epi8(v, u));
+
+			__m256i y0 = _mm256_cvtepu8_epi16(_mm_loadu_si128(
+					(const __m128i*)(lum0 + x*2)));
+			__m256i y1 = _mm256_cvtepu8_epi16(_mm_loadu_si128(
+					(const __m128i*)(lum1 + x*2)));
+
+			store_16_pixels_avx2(output0 + x*2, uv, y0);
+			store_16_pixels_avx2(output1 + x*2, uv, y1);
+		}
+
+		for (; x < width_d2; x++) {
+			uint32_t out = (chroma0[x] << 8) | chroma1[x];
+
+			output0[x*2]     = (lum0[x*2]     << 16) | out;
+			output0[x*2 + 1] = (lum0[x*2 + 1] << 16) | out;
+
+			output1[x*2]     = (lum1[x*2]     << 16) | out;
+			output1[x*2 + 1] = (lum1[x*2 + 1] << 16) | out;
+		}
+	}
+}
+
+static AVX2_FUNC void decompress_nv12_avx2(
+		const uint8_t *const input[], const uint32_t in_linesize[],
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output, uint32_t out_linesize)
+{
+	uint32_t start_y_d2 = start_y/2;
+	uint32_t width_d2   = min_uint32(in_linesize[0], out_linesize)/2;
+	uint32_t height_d2  = end_y/2;
+	uint32_t y;
+
+	for (y = start_y_d2; y < height_d2; y++) {
+		const uint16_t *chroma;
+		const uint8_t *lum0, *lum1;
+		uint32_t *output0, *output1;
+		uint32_t x;
+
+		chroma = (const uint16_t*)(input[1] + y * in_linesize[1]);
+		lum0 = input[0] + y * 2 * in_linesize[0];
+		lum1 = lum0 + in_linesize[0];
+		output0 = (uint32_t*)(output + y * 2 * out_linesize);
+		output1 = (uint32_t*)((uint8_t*)output0 + out_linesize);
+
+		for (x = 0; x + 8 <= width_d2; x += 8) {
+			__m256i uv = dup_16_avx2(_mm_loadu_si128(
+					(const __m128i*)(chroma + x)));
+			__m256i u  = _mm256_slli_epi16(uv, 8);
+			__m256i v  = _mm256_srli_epi16(uv, 8);
+
+			__m256i y0 = _mm256_cvtepu8_epi16(_mm_loadu_si128(
+					(const __m128i*)(lum0 + x*2)));
+			__m256i y1 = _mm256_cvtepu8_epi16(_mm_loadu_si128(
+					(const __m128i*)(lum1 + x*2)));
+
+			store_16_pixels_avx2(output0 + x*2,
+					_mm256_or_si256(y0, u), v);
+			store_16_pixels_avx2(output1 + x*2,
+					_mm256_or_si256(y1, u), v);
+		}
+
+		for (; x < width_d2; x++) {
+			uint32_t out = chroma[x] << 8;
+
+			output0[x*2]     = lum0[x*2]     | out;
+			output0[x*2 + 1] = lum0[x*2 + 1] | out;
+
+			output1[x*2]     = lum1[x*2]     | out;
+			output1[x*2 + 1] = lum1[x*2 + 1] | out;
+		}
+	}
+}
+
+static AVX2_FUNC void decompress_422_avx2(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output, uint32_t out_linesize,
+		bool leading_lum)
+{
+	uint32_t width_d2 = min_uint32(in_linesize, out_linesize)/2;
+	uint32_t y;
+
+	/* the second pixel of each pair repeats the pair's chroma with its
+	 * own luma copied over the luma of the first pixel */
+	const __m256i keep_mask = _mm256_set1_epi32((int)(leading_lum ?
+			0xFFFFFF00 : 0xFFFF00FF));
+	const __m256i lum_mask = _mm256_set1_epi32(leading_lum ?
+			0x000000FF : 0x0000FF00);
+
+	for (y = start_y; y < end_y; y++) {
+		const uint32_t *input32 =
+			(const uint32_t*)(input + y*in_linesize);
+		uint32_t *output32 = (uint32_t*)(output + y*out_linesize);
+		uint32_t x;
+
+		for (x = 0; x + 8 <= width_d2; x += 8) {
+			__m256i dw = _mm256_loadu_si256(
+					(const __m256i*)(input32 + x));
+			__m256i dw2 = _mm256_or_si256(
+					_mm256_and_si256(dw, keep_mask),
+					_mm256_and_si256(
+						_mm256_srli_epi32(dw, 16),
+						lum_mask));
+
+			__m256i first  = _mm256_unpacklo_epi32(dw, dw2);
+			__m256i second = _mm256_unpackhi_epi32(dw, dw2);
+
+			_mm256_storeu_si256((__m256i*)(output32 + x*2),
+					_mm256_permute2x128_si256(
+						first, second, 0x20));
+			_mm256_storeu_si256((__m256i*)(output32 + x*2 + 8),
+					_mm256_permute2x128_si256(
+						first, second, 0x31));
+		}
+
+		for (; x < width_d2; x++) {
+			uint32_t dw = input32[x];
+
+			output32[x*2] = dw;
+			if (leading_lum) {
+				dw &= 0xFFFFFF00;
+				dw |= (uint8_t)(dw>>16);
+			} else {
 				dw &= 0xFFFF00FF;
 				dw |= (dw>>16) & 0xFF00;
-				output32[1] = dw;
-
-				output32 += 2;
-				input32++;
 			}
+			output32[x*2 + 1] = dw;
 		}
 	}
 }
+
+#endif
+
+/* ------------------------------------------------------------------------- */
+/* runtime dispatch */
+
+struct conversion_funcs {
+	void (*compress_uyvx_to_i420)(
+			const uint8_t *input, uint32_t in_linesize,
+			uint32_t start_y, uint32_t end_y,
+			uint8_t *output[], const uint32_t out_linesize[]);
+	void (*compress_uyvx_to_nv12)(
+			const uint8_t *input, uint32_t in_linesize,
+			uint32_t start_y, uint32_t end_y,
+			uint8_t *output[], const uint32_t out_linesize[]);
+	void (*convert_uyvx_to_i444)(
+			const uint8_t *input, uint32_t in_linesize,
+			uint32_t start_y, uint32_t end_y,
+			uint8_t *output[], const uint32_t out_linesize[]);
+	void (*decompress_420)(
+			const uint8_t *const input[],
+			const uint32_t in_linesize[],
+			uint32_t start_y, uint32_t end_y,
+			uint8_t *output, uint32_t out_linesize);
+	void (*decompress_nv12)(
+			const uint8_t *const input[],
+			const uint32_t in_linesize[],
+			uint32_t start_y, uint32_t end_y,
+			uint8_t *output, uint32_t out_linesize);
+	void (*decompress_422)(
+			const uint8_t *input, uint32_t in_linesize,
+			uint32_t start_y, uint32_t end_y,
+			uint8_t *output, uint32_t out_linesize,
+			bool leading_lum);
+};
+
+static const struct conversion_funcs funcs_c = {
+	compress_uyvx_to_i420_c,
+	compress_uyvx_to_nv12_c,
+	convert_uyvx_to_i444_c,
+	decompress_420_c,
+	decompress_nv12_c,
+	decompress_422_c
+};
+
+#ifdef CONVERT_SSE2
+static const struct conversion_funcs funcs_sse2 = {
+	compress_uyvx_to_i420_sse2,
+	compress_uyvx_to_nv12_sse2,
+	convert_uyvx_to_i444_sse2,
+	decompress_420_sse2,
+	decompress_nv12_sse2,
+	decompress_422_sse2
+};
+#endif
+
+#ifdef CONVERT_X86
+static const struct conversion_funcs funcs_avx2 = {
+	compress_uyvx_to_i420_avx2,
+	compress_uyvx_to_nv12_avx2,
+	convert_uyvx_to_i444_avx2,
+	decompress_420_avx2,
+	decompress_nv12_avx2,
+	decompress_422_avx2
+};
+#endif
+
+static const struct conversion_funcs *get_funcs(
+		enum format_conversion_impl impl)
+{
+	switch (impl) {
+	case FORMAT_CONVERSION_AUTO:
+		break;
+	case FORMAT_CONVERSION_SCALAR:
+		return &funcs_c;
+	case FORMAT_CONVERSION_SSE2:
+#ifdef CONVERT_SSE2
+		return &funcs_sse2;
+#else
+		return NULL;
+#endif
+	case FORMAT_CONVERSION_AVX2:
+#ifdef CONVERT_X86
+		return os_cpu_has_avx2() ? &funcs_avx2 : NULL;
+#else
+		return NULL;
+#endif
+	}
+
+#ifdef CONVERT_X86
+	if (os_cpu_has_avx2())
+		return &funcs_avx2;
+#endif
+#ifdef CONVERT_SSE2
+	return &funcs_sse2;
+#else
+	return &funcs_c;
+#endif
+}
+
+/* selected once, before the first conversion or the first call to
+ * format_conversion_set_impl, whichever comes first */
+static pthread_once_t funcs_init_token = PTHREAD_ONCE_INIT;
+static const struct conversion_funcs *volatile cur_funcs = NULL;
+
+static void init_funcs(void)
+{
+	os_atomic_exchange_ptr((void *volatile*)&cur_funcs,
+			(void*)get_funcs(FORMAT_CONVERSION_AUTO));
+}
+
+static inline const struct conversion_funcs *funcs(void)
+{
+	pthread_once(&funcs_init_token, init_funcs);
+	return os_atomic_load_ptr((void *const volatile*)&cur_funcs);
+}
+
+bool format_conversion_set_impl(enum format_conversion_impl impl)
+{
+	const struct conversion_funcs *new_funcs = get_funcs(impl);
+	if (!new_funcs)
+		return false;
+
+	pthread_once(&funcs_init_token, init_funcs);
+	os_atomic_exchange_ptr((void *volatile*)&cur_funcs,
+			(void*)new_funcs);
+	return true;
+}
+
+void compress_uyvx_to_i420(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	funcs()->compress_uyvx_to_i420(input, in_linesize, start_y, end_y,
+			output, out_linesize);
+}
+
+void compress_uyvx_to_nv12(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	funcs()->compress_uyvx_to_nv12(input, in_linesize, start_y, end_y,
+			output, out_linesize);
+}
+
+void convert_uyvx_to_i444(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	funcs()->convert_uyvx_to_i444(input, in_linesize, start_y, end_y,
+			output, out_linesize);
+}
+
+void decompress_420(
+		const uint8_t *const input[], const uint32_t in_linesize[],
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output, uint32_t out_linesize)
+{
+	funcs()->decompress_420(input, in_linesize, start_y, end_y,
+			output, out_linesize);
+}
+
+void decompress_nv12(
+		const uint8_t *const input[], const uint32_t in_linesize[],
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output, uint32_t out_linesize)
+{
+	funcs()->decompress_nv12(input, in_linesize, start_y, end_y,
+			output, out_linesize);
+}
+
+void decompress_422(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output, uint32_t out_linesize,
+		bool leading_lum)
+{
+	funcs()->decompress_422(input, in_linesize, start_y, end_y,
+			output, out_linesize, leading_lum);
+}
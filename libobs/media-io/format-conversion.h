@@ -23,6 +23,22 @@
 extern "C" {
 #endif
 
+/*
+ * Implementation used by the conversion functions.  The fastest one supported
+ * by the CPU is selected automatically; forcing a specific one is mainly
+ * useful for testing and benchmarking.
+ */
+
+enum format_conversion_impl {
+	FORMAT_CONVERSION_AUTO,
+	FORMAT_CONVERSION_SCALAR,
+	FORMAT_CONVERSION_SSE2,
+	FORMAT_CONVERSION_AVX2,
+};
+
+/* returns false if the implementation is not supported on this CPU */
+EXPORT bool format_conversion_set_impl(enum format_conversion_impl impl);
+
 /*
  * Functions for converting to and from packed 444 YUV
  */
@@ -22,6 +22,7 @@
 #include "../util/profiler.h"
 #include "../util/threading.h"
 #include "../util/darray.h"
+#include "../util/circlebuf.h"
 
 #include "format-conversion.h"
 #include "video-io.h"
@@ -31,15 +32,31 @@
 extern profiler_name_store_t *obs_get_profiler_name_store(void);
 
 #define MAX_CONVERT_BUFFERS 3
-#define MAX_CACHE_SIZE 16
+
+/* The frame cache is a single-producer ring: the graphics thread fills
+ * frames at write_pos, the video thread hands them to the inputs starting at
+ * read_pos, and frames are recycled from free_pos once every reference to
+ * them has been released.  write_pos and free_pos are only ever touched by
+ * the producer and read_pos only by the video thread, so the only shared
+ * state is the per-frame counters, which are accessed atomically. */
 
 struct cached_frame_info {
 	struct video_data frame;
-	int skipped;
-	int count;
+	volatile long skipped;
+	volatile long count;
+
+	/* one reference for the video thread until all repeats of the frame
+	 * have been handed off, plus one per queued input frame */
+	volatile long refs;
+};
+
+struct queued_frame {
+	struct cached_frame_info  *cfi;
+	uint64_t                  timestamp;
 };
 
 struct video_input {
+	struct video_output       *video;
 	struct video_scale_info   conversion;
 	video_scaler_t            *scaler;
 	struct video_frame        frame[MAX_CONVERT_BUFFERS];
@@ -47,36 +64,47 @@ struct video_input {
 
 	void (*callback)(void *param, struct video_data *frame);
 	void *param;
-};
 
-static inline void video_input_free(struct video_input *input)
-{
-	for (size_t i = 0; i < MAX_CONVERT_BUFFERS; i++)
-		video_frame_free(&input->frame[i]);
-	video_scaler_destroy(input->scaler);
-}
+	/* threaded inputs only */
+	pthread_t                 thread;
+	bool                      thread_active;
+	volatile bool             stop;
+	volatile bool             exited;
+	os_sem_t                  *queue_semaphore;
+	pthread_mutex_t           queue_mutex;
+	struct circlebuf          queue;
+
+	uint32_t                  skipped_frames;
+	uint32_t                  total_frames;
+};
 
 struct video_output {
 	struct video_output_info   info;
 
 	pthread_t                  thread;
-	pthread_mutex_t            data_mutex;
 	bool                       stop;
 
 	os_sem_t                   *update_semaphore;
 	uint64_t                   frame_time;
-	uint32_t                   skipped_frames;
+	volatile long              skipped_frames;
 	uint32_t                   total_frames;
 
 	bool                       initialized;
 
 	pthread_mutex_t            input_mutex;
-	DARRAY(struct video_input) inputs;
-
-	size_t                     available_frames;
-	size_t                     first_added;
-	size_t                     last_added;
-	struct cached_frame_info   cache[MAX_CACHE_SIZE];
+	DARRAY(struct video_input*) inputs;
+	size_t                     input_queue_size;
+
+	/* threaded inputs that were disconnected from their own thread, which
+	 * can't join itself.  they're destroyed by the next connect/disconnect
+	 * once their thread has exited, or when the output is closed */
+	DARRAY(struct video_input*) stopped_inputs;
+
+	struct cached_frame_info   *cache;
+	size_t                     write_pos;
+	size_t                     free_pos;
+	size_t                     used_frames;
+	size_t                     read_pos;
 };
 
 /* ------------------------------------------------------------------------- */
@@ -112,54 +140,126 @@ static inline bool scale_video_output(struct video_input *input,
 	return success;
 }
 
-static inline bool video_output_cur_frame(struct video_output *video)
+static inline void video_output_release_frame(struct cached_frame_info *cfi)
 {
-	struct cached_frame_info *frame_info;
-	bool complete;
-	bool skipped;
+	os_atomic_dec_long(&cfi->refs);
+}
 
-	/* -------------------------------- */
+/* ------------------------------------------------------------------------- */
+/* threaded inputs: each input runs on its own thread and holds a reference to
+ * each cached frame in its queue until it has been processed */
+
+static void video_input_queue_frame(struct video_input *input,
+		struct cached_frame_info *cfi, uint64_t timestamp)
+{
+	struct video_output *video = input->video;
+	struct queued_frame qf = {cfi, timestamp};
+	bool queued = false;
+
+	pthread_mutex_lock(&input->queue_mutex);
+
+	input->total_frames++;
+
+	if (input->queue.size / sizeof(qf) < video->input_queue_size) {
+		os_atomic_inc_long(&cfi->refs);
+		circlebuf_push_back(&input->queue, &qf, sizeof(qf));
+		queued = true;
+	} else {
+		input->skipped_frames++;
+	}
+
+	pthread_mutex_unlock(&input->queue_mutex);
+
+	if (queued)
+		os_sem_post(input->queue_semaphore);
+	else
+		os_atomic_inc_long(&video->skipped_frames);
+}
+
+static void *video_input_thread(void *param)
+{
+	struct video_input *input = param;
+	struct video_output *video = input->video;
+
+	os_set_thread_name("video-io: input thread");
+
+	const char *input_thread_name =
+		profile_store_name(obs_get_profiler_name_store(),
+				"video_input_thread(%s)", video->info.name);
+
+	while (os_sem_wait(input->queue_semaphore) == 0) {
+		struct queued_frame qf;
+
+		if (input->stop)
+			break;
 
-	pthread_mutex_lock(&video->data_mutex);
+		pthread_mutex_lock(&input->queue_mutex);
+		circlebuf_pop_front(&input->queue, &qf, sizeof(qf));
+		pthread_mutex_unlock(&input->queue_mutex);
 
-	frame_info = &video->cache[video->first_added];
+		profile_start(input_thread_name);
 
-	pthread_mutex_unlock(&video->data_mutex);
+		struct video_data frame = qf.cfi->frame;
+		frame.timestamp = qf.timestamp;
+
+		if (scale_video_output(input, &frame))
+			input->callback(input->param, &frame);
+
+		video_output_release_frame(qf.cfi);
+
+		profile_end(input_thread_name);
+
+		profile_reenable_thread();
+	}
+
+	os_atomic_set_bool(&input->exited, true);
+	return NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static inline bool video_output_cur_frame(struct video_output *video)
+{
+	struct cached_frame_info *frame_info;
+	bool complete;
+
+	frame_info = &video->cache[video->read_pos];
 
 	/* -------------------------------- */
 
 	pthread_mutex_lock(&video->input_mutex);
 
 	for (size_t i = 0; i < video->inputs.num; i++) {
-		struct video_input *input = video->inputs.array+i;
-		struct video_data frame = frame_info->frame;
+		struct video_input *input = video->inputs.array[i];
 
-		if (scale_video_output(input, &frame))
-			input->callback(input->param, &frame);
+		if (video->info.threaded_inputs) {
+			video_input_queue_frame(input, frame_info,
+					frame_info->frame.timestamp);
+		} else {
+			struct video_data frame = frame_info->frame;
+
+			if (scale_video_output(input, &frame))
+				input->callback(input->param, &frame);
+		}
 	}
 
 	pthread_mutex_unlock(&video->input_mutex);
 
 	/* -------------------------------- */
 
-	pthread_mutex_lock(&video->data_mutex);
-
 	frame_info->frame.timestamp += video->frame_time;
-	complete = --frame_info->count == 0;
-	skipped = frame_info->skipped > 0;
+	complete = os_atomic_dec_long(&frame_info->count) == 0;
 
 	if (complete) {
-		if (++video->first_added == video->info.cache_size)
-			video->first_added = 0;
-
-		if (++video->available_frames == video->info.cache_size)
-			video->last_added = video->first_added;
-	} else if (skipped) {
-		--frame_info->skipped;
-		++video->skipped_frames;
-	}
+		if (++video->read_pos == video->info.cache_size)
+			video->read_pos = 0;
 
-	pthread_mutex_unlock(&video->data_mutex);
+		video_output_release_frame(frame_info);
+
+	} else if (os_atomic_load_long(&frame_info->skipped) > 0) {
+		os_atomic_dec_long(&frame_info->skipped);
+		os_atomic_inc_long(&video->skipped_frames);
+	}
 
 	/* -------------------------------- */
 
@@ -194,8 +294,6 @@ static void *video_thread(void *param)
 	return NULL;
 }
 
-/* ------------------------------------------------------------------------- */
-
 static inline bool valid_video_params(const struct video_output_info *info)
 {
 	return info->height != 0 && info->width != 0 && info->fps_den != 0 &&
@@ -204,8 +302,11 @@ static inline bool valid_video_params(const struct video_output_info *info)
 
 static inline void init_cache(struct video_output *video)
 {
-	if (video->info.cache_size > MAX_CACHE_SIZE)
-		video->info.cache_size = MAX_CACHE_SIZE;
+	if (!video->info.cache_size)
+		video->info.cache_size = 1;
+
+	video->cache = bzalloc(sizeof(struct cached_frame_info) *
+			video->info.cache_size);
 
 	for (size_t i = 0; i < video->info.cache_size; i++) {
 		struct video_frame *frame;
@@ -215,7 +316,9 @@ static inline void init_cache(struct video_output *video)
 				video->info.width, video->info.height);
 	}
 
-	video->available_frames = video->info.cache_size;
+	video->input_queue_size = video->info.cache_size / 2;
+	if (!video->input_queue_size)
+		video->input_queue_size = 1;
 }
 
 int video_output_open(video_t **video, struct video_output_info *info)
@@ -239,17 +342,15 @@ int video_output_open(video_t **video, struct video_output_info *info)
 		goto fail;
 	if (pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE) != 0)
 		goto fail;
-	if (pthread_mutex_init(&out->data_mutex, &attr) != 0)
-		goto fail;
 	if (pthread_mutex_init(&out->input_mutex, &attr) != 0)
 		goto fail;
 	if (os_sem_init(&out->update_semaphore, 0) != 0)
 		goto fail;
+	init_cache(out);
+
 	if (pthread_create(&out->thread, NULL, video_thread, out) != 0)
 		goto fail;
 
-	init_cache(out);
-
 	out->initialized = true;
 	*video = out;
 	return VIDEO_OUTPUT_SUCCESS;
@@ -259,6 +360,8 @@ fail:
 	return VIDEO_OUTPUT_FAIL;
 }
 
+static void video_input_destroy(struct video_input *input);
+
 void video_output_close(video_t *video)
 {
 	if (!video)
@@ -267,14 +370,21 @@ void video_output_close(video_t *video)
 	video_output_stop(video);
 
 	for (size_t i = 0; i < video->inputs.num; i++)
-		video_input_free(&video->inputs.array[i]);
+		video_input_destroy(video->inputs.array[i]);
 	da_free(video->inputs);
 
-	for (size_t i = 0; i < video->info.cache_size; i++)
-		video_frame_free((struct video_frame*)&video->cache[i]);
+	for (size_t i = 0; i < video->stopped_inputs.num; i++)
+		video_input_destroy(video->stopped_inputs.array[i]);
+	da_free(video->stopped_inputs);
+
+	if (video->cache) {
+		for (size_t i = 0; i < video->info.cache_size; i++)
+			video_frame_free(
+				(struct video_frame*)&video->cache[i]);
+		bfree(video->cache);
+	}
 
 	os_sem_destroy(video->update_semaphore);
-	pthread_mutex_destroy(&video->data_mutex);
 	pthread_mutex_destroy(&video->input_mutex);
 	bfree(video);
 }
@@ -284,7 +394,7 @@ static size_t video_get_input_idx(const video_t *video,
 		void *param)
 {
 	for (size_t i = 0; i < video->inputs.num; i++) {
-		struct video_input *input = video->inputs.array+i;
+		struct video_input *input = video->inputs.array[i];
 		if (input->callback == callback && input->param == param)
 			return i;
 	}
@@ -327,9 +437,80 @@ static inline bool video_input_init(struct video_input *input,
 					input->conversion.height);
 	}
 
+	if (video->info.threaded_inputs) {
+		if (pthread_mutex_init(&input->queue_mutex, NULL) != 0)
+			return false;
+		if (os_sem_init(&input->queue_semaphore, 0) != 0)
+			return false;
+		if (pthread_create(&input->thread, NULL, video_input_thread,
+					input) != 0)
+			return false;
+
+		input->thread_active = true;
+	}
+
 	return true;
 }
 
+static void video_input_destroy(struct video_input *input)
+{
+	if (input->thread_active) {
+		void *thread_ret;
+
+		input->stop = true;
+		os_sem_post(input->queue_semaphore);
+		pthread_join(input->thread, &thread_ret);
+	}
+
+	while (input->queue.size) {
+		struct queued_frame qf;
+		circlebuf_pop_front(&input->queue, &qf, sizeof(qf));
+		video_output_release_frame(qf.cfi);
+	}
+
+	circlebuf_free(&input->queue);
+	os_sem_destroy(input->queue_semaphore);
+	pthread_mutex_destroy(&input->queue_mutex);
+
+	for (size_t i = 0; i < MAX_CONVERT_BUFFERS; i++)
+		video_frame_free(&input->frame[i]);
+	video_scaler_destroy(input->scaler);
+	bfree(input);
+}
+
+static inline bool is_input_thread(const struct video_input *input)
+{
+	return input->thread_active &&
+		pthread_equal(pthread_self(), input->thread);
+}
+
+/* destroys the stopped inputs whose thread has already exited.  inputs that
+ * are still inside their callback are left alone, as the callback may be
+ * waiting on something the caller holds, and joining it could deadlock */
+static void video_output_reap_inputs(struct video_output *video)
+{
+	DARRAY(struct video_input*) reap;
+
+	da_init(reap);
+
+	pthread_mutex_lock(&video->input_mutex);
+
+	for (size_t i = video->stopped_inputs.num; i > 0; i--) {
+		struct video_input *input = video->stopped_inputs.array[i - 1];
+
+		if (os_atomic_load_bool(&input->exited)) {
+			da_push_back(reap, &input);
+			da_erase(video->stopped_inputs, i - 1);
+		}
+	}
+
+	pthread_mutex_unlock(&video->input_mutex);
+
+	for (size_t i = 0; i < reap.num; i++)
+		video_input_destroy(reap.array[i]);
+	da_free(reap);
+}
+
 bool video_output_connect(video_t *video,
 		const struct video_scale_info *conversion,
 		void (*callback)(void *param, struct video_data *frame),
@@ -340,36 +521,41 @@ bool video_output_connect(video_t *video,
 	if (!video || !callback)
 		return false;
 
+	video_output_reap_inputs(video);
+
 	pthread_mutex_lock(&video->input_mutex);
 
 	if (video->inputs.num == 0) {
-		video->skipped_frames = 0;
+		os_atomic_set_long(&video->skipped_frames, 0);
 		video->total_frames = 0;
 	}
 
 	if (video_get_input_idx(video, callback, param) == DARRAY_INVALID) {
-		struct video_input input;
-		memset(&input, 0, sizeof(input));
+		struct video_input *input = bzalloc(sizeof(*input));
 
-		input.callback = callback;
-		input.param    = param;
+		pthread_mutex_init_value(&input->queue_mutex);
+		input->video    = video;
+		input->callback = callback;
+		input->param    = param;
 
 		if (conversion) {
-			input.conversion = *conversion;
+			input->conversion = *conversion;
 		} else {
-			input.conversion.format    = video->info.format;
-			input.conversion.width     = video->info.width;
-			input.conversion.height    = video->info.height;
+			input->conversion.format    = video->info.format;
+			input->conversion.width     = video->info.width;
+			input->conversion.height    = video->info.height;
 		}
 
-		if (input.conversion.width == 0)
-			input.conversion.width = video->info.width;
-		if (input.conversion.height == 0)
-			input.conversion.height = video->info.height;
+		if (input->conversion.width == 0)
+			input->conversion.width = video->info.width;
+		if (input->conversion.height == 0)
+			input->conversion.height = video->info.height;
 
-		success = video_input_init(&input, video);
+		success = video_input_init(input, video);
 		if (success)
 			da_push_back(video->inputs, &input);
+		else
+			video_input_destroy(input);
 	}
 
 	pthread_mutex_unlock(&video->input_mutex);
@@ -384,24 +570,60 @@ void video_output_disconnect(video_t *video,
 	if (!video || !callback)
 		return;
 
+	struct video_input *input = NULL;
+	bool deferred = false;
+
+	video_output_reap_inputs(video);
+
 	pthread_mutex_lock(&video->input_mutex);
 
 	size_t idx = video_get_input_idx(video, callback, param);
 	if (idx != DARRAY_INVALID) {
-		video_input_free(video->inputs.array+idx);
+		input = video->inputs.array[idx];
 		da_erase(video->inputs, idx);
+
+		/* disconnecting from the input's own callback (for example
+		 * when an encoder fails): the thread stops once the callback
+		 * returns and is joined later */
+		if (is_input_thread(input)) {
+			input->stop = true;
+			os_sem_post(input->queue_semaphore);
+			da_push_back(video->stopped_inputs, &input);
+			deferred = true;
+		}
+	}
+
+	pthread_mutex_unlock(&video->input_mutex);
+
+	/* the input thread may still be inside the callback, so it has to be
+	 * joined without holding the input mutex */
+	if (input) {
+		if (input->skipped_frames)
+			blog(LOG_INFO, "Video input disconnected, number of "
+					"skipped frames due to encoding lag: "
+					"%"PRIu32"/%"PRIu32" (%0.1f%%)",
+					input->skipped_frames,
+					input->total_frames,
+					(double)input->skipped_frames /
+					(double)input->total_frames * 100.0);
+
+		if (!deferred)
+			video_input_destroy(input);
 	}
 
+	pthread_mutex_lock(&video->input_mutex);
+
 	if (video->inputs.num == 0) {
-		double percentage_skipped = (double)video->skipped_frames /
+		uint32_t skipped = video_output_get_skipped_frames(video);
+		double percentage_skipped = (double)skipped /
 			(double)video->total_frames * 100.0;
 
-		if (video->skipped_frames)
+		if (skipped)
 			blog(LOG_INFO, "Video stopped, number of "
 					"skipped frames due "
 					"to encoding lag: "
 					"%"PRIu32"/%"PRIu32" (%0.1f%%)",
-					video->skipped_frames,
+					skipped,
 					video->total_frames,
 					percentage_skipped);
 	}
@@ -420,52 +642,79 @@ const struct video_output_info *video_output_get_info(const video_t *video)
 	return video ? &video->info : NULL;
 }
 
-bool video_output_lock_frame(video_t *video, struct video_frame *frame,
-		int count, uint64_t timestamp)
+/* frees up frames from the front of the cache that are no longer referenced.
+ * frames can be released out of order when a threaded input has skipped some
+ * of them, so this only advances while the oldest frame is free. */
+static inline void video_output_reclaim_frames(struct video_output *video)
 {
-	struct cached_frame_info *cfi;
-	bool locked;
+	while (video->used_frames) {
+		struct cached_frame_info *cfi = &video->cache[video->free_pos];
 
-	if (!video) return false;
-
-	pthread_mutex_lock(&video->data_mutex);
+		if (os_atomic_load_long(&cfi->refs))
+			break;
 
-	if (video->available_frames == 0) {
-		video->cache[video->last_added].count += count;
-		video->cache[video->last_added].skipped += count;
-		locked = false;
+		if (++video->free_pos == video->info.cache_size)
+			video->free_pos = 0;
+		video->used_frames--;
+	}
+}
 
-	} else {
-		if (video->available_frames != video->info.cache_size) {
-			if (++video->last_added == video->info.cache_size)
-				video->last_added = 0;
+/* called when the cache is full: repeat the newest frame if it has not been
+ * fully handed off to the inputs yet, otherwise it's a plain skip */
+static inline void video_output_repeat_last_frame(struct video_output *video,
+		int count)
+{
+	size_t last = video->write_pos ?
+		video->write_pos - 1 : video->info.cache_size - 1;
+	struct cached_frame_info *cfi = &video->cache[last];
+	long cur;
+
+	for (int i = 0; i < count; i++)
+		os_atomic_inc_long(&cfi->skipped);
+
+	do {
+		cur = os_atomic_load_long(&cfi->count);
+		if (!cur) {
+			for (int i = 0; i < count; i++)
+				os_atomic_inc_long(&video->skipped_frames);
+			return;
 		}
+	} while (!os_atomic_compare_swap_long(&cfi->count, cur, cur + count));
+}
 
-		cfi = &video->cache[video->last_added];
-		cfi->frame.timestamp = timestamp;
-		cfi->count = count;
-		cfi->skipped = 0;
+bool video_output_lock_frame(video_t *video, struct video_frame *frame,
+		int count, uint64_t timestamp)
+{
+	struct cached_frame_info *cfi;
+
+	if (!video) return false;
 
-		memcpy(frame, &cfi->frame, sizeof(*frame));
+	video_output_reclaim_frames(video);
 
-		locked = true;
+	if (video->used_frames == video->info.cache_size) {
+		video_output_repeat_last_frame(video, count);
+		return false;
 	}
 
-	pthread_mutex_unlock(&video->data_mutex);
+	cfi = &video->cache[video->write_pos];
+	cfi->frame.timestamp = timestamp;
+	cfi->skipped = 0;
+	cfi->refs = 1;
+	os_atomic_set_long(&cfi->count, count);
 
-	return locked;
+	memcpy(frame, &cfi->frame, sizeof(*frame));
+	return true;
 }
 
 void video_output_unlock_frame(video_t *video)
 {
 	if (!video) return;
 
-	pthread_mutex_lock(&video->data_mutex);
+	if (++video->write_pos == video->info.cache_size)
+		video->write_pos = 0;
+	video->used_frames++;
 
-	video->available_frames--;
 	os_sem_post(video->update_semaphore);
-
-	pthread_mutex_unlock(&video->data_mutex);
 }
 
 uint64_t video_output_get_frame_time(const video_t *video)
@@ -521,7 +770,7 @@ double video_output_get_frame_rate(const video_t *video)
 
 uint32_t video_output_get_skipped_frames(const video_t *video)
 {
-	return video->skipped_frames;
+	return (uint32_t)os_atomic_load_long(&video->skipped_frames);
 }
 
 uint32_t video_output_get_total_frames(const video_t *video)
@@ -82,6 +82,10 @@ struct video_output_info {
 
 	enum video_colorspace colorspace;
 	enum video_range_type range;
+
+	/* run each connected input on its own thread with its own frame
+	 * queue, so a slow input cannot hold up the others */
+	bool              threaded_inputs;
 };
 
 static inline bool format_is_yuv(enum video_format format)
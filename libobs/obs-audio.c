@@ -17,6 +17,7 @@
 
 #include <inttypes.h>
 #include "obs-internal.h"
+#include "media-io/audio-mix.h"
 
 struct ts_info {
 	uint64_t start;
@@ -64,17 +65,94 @@ static inline void mix_audio(struct audio_output_data *mixes,
 
 	for (size_t mix_idx = 0; mix_idx < MAX_AUDIO_MIXES; mix_idx++) {
 		for (size_t ch = 0; ch < channels; ch++) {
-			register float *mix = mixes[mix_idx].data[ch];
-			register float *aud =
-				source->audio_output_buf[mix_idx][ch];
-			register float *end;
+			float *mix = mixes[mix_idx].data[ch];
+			float *aud = source->audio_output_buf[mix_idx][ch];
 
-			mix += start_point;
-			end = aud + total_floats;
+			audio_mix_add(mix + start_point, aud, total_floats);
+		}
+	}
+}
+
+struct audio_render_job {
+	obs_source_t **sources;
+	size_t       num;
+	size_t       per_job;
+	uint32_t     mixers;
+	size_t       channels;
+	size_t       sample_rate;
+	size_t       size;
+};
+
+static void render_audio_source_job(void *param, size_t idx)
+{
+	struct audio_render_job *job = param;
+	size_t start = idx * job->per_job;
+	size_t end = start + job->per_job;
+
+	if (end > job->num)
+		end = job->num;
+
+	for (size_t i = start; i < end; i++)
+		obs_source_audio_render(job->sources[i], job->mixers,
+				job->channels, job->sample_rate, job->size);
+}
+
+/* rendering a source without an audio_render callback is only a copy and a
+ * volume multiply, a few microseconds, so the pool is only used when every
+ * thread gets a batch of sources that outweighs waking it up */
+#define AUDIO_RENDER_SOURCES_PER_JOB 16
+
+/* sources without an audio_render callback only touch their own buffers, so
+ * when there are enough of them they are rendered in parallel first.  sources
+ * that render the audio of their children are then rendered in the original
+ * order, after all of their children. */
+static void render_audio_sources(struct obs_core_audio *audio,
+		uint32_t mixers, size_t channels, size_t sample_rate,
+		size_t size)
+{
+	struct audio_render_job job;
+	size_t jobs = 0;
+
+	if (audio->render_pool) {
+		size_t width = work_pool_get_width(audio->render_pool);
+
+		da_resize(audio->render_leaves, 0);
 
-			while (aud < end)
-				*(mix++) += *(aud++);
+		for (size_t i = 0; i < audio->render_order.num; i++) {
+			obs_source_t *source = audio->render_order.array[i];
+			if (!source->info.audio_render)
+				da_push_back(audio->render_leaves, &source);
 		}
+
+		jobs = audio->render_leaves.num / AUDIO_RENDER_SOURCES_PER_JOB;
+		if (jobs > width)
+			jobs = width;
+	}
+
+	if (jobs < 2) {
+		for (size_t i = 0; i < audio->render_order.num; i++) {
+			obs_source_t *source = audio->render_order.array[i];
+			obs_source_audio_render(source, mixers, channels,
+					sample_rate, size);
+		}
+		return;
+	}
+
+	job.sources     = audio->render_leaves.array;
+	job.num         = audio->render_leaves.num;
+	job.per_job     = (job.num + jobs - 1) / jobs;
+	job.mixers      = mixers;
+	job.channels    = channels;
+	job.sample_rate = sample_rate;
+	job.size        = size;
+	work_pool_run(audio->render_pool, render_audio_source_job, &job,
+			(job.num + job.per_job - 1) / job.per_job);
+
+	for (size_t i = 0; i < audio->render_order.num; i++) {
+		obs_source_t *source = audio->render_order.array[i];
+		if (source->info.audio_render)
+			obs_source_audio_render(source, mixers, channels,
+					sample_rate, size);
 	}
 }
 
@@ -423,11 +501,7 @@ bool audio_callback(void *param,
 
 	/* ------------------------------------------------ */
 	/* render audio data */
-	for (size_t i = 0; i < audio->render_order.num; i++) {
-		obs_source_t *source = audio->render_order.array[i];
-		obs_source_audio_render(source, mixers, channels, sample_rate,
-				audio_size);
-	}
+	render_audio_sources(audio, mixers, channels, sample_rate, audio_size);
 
 	/* ------------------------------------------------ */
 	/* get minimum audio timestamp */
@@ -20,6 +20,7 @@
 #include "util/dstr.h"
 #include "util/darray.h"
 #include "util/platform.h"
+#include "util/hash.h"
 #include "graphics/vec2.h"
 #include "graphics/vec3.h"
 #include "graphics/vec4.h"
@@ -32,6 +33,7 @@ struct obs_data_item {
 	volatile long        ref;
 	struct obs_data      *parent;
 	struct obs_data_item *next;
+	uint64_t             name_hash;
 	enum obs_data_type   type;
 	size_t               name_len;
 	size_t               data_len;
@@ -46,6 +48,12 @@ struct obs_data {
 	volatile long        ref;
 	char                 *json;
 	struct obs_data_item *first_item;
+
+	/* hashed by name once there are more than INDEX_MIN_ITEMS items,
+	 * open addressing with linear probing */
+	size_t               num_items;
+	struct obs_data_item **index;
+	size_t               index_size;
 };
 
 struct obs_data_array {
@@ -261,6 +269,121 @@ static inline void item_autoselect_data_addref(struct obs_data_item *item)
 	}
 }
 
+/* ------------------------------------------------------------------------- */
+/* Name index */
+
+#define INDEX_MIN_ITEMS 8
+#define INDEX_MIN_SIZE  32
+#define INDEX_INVALID   ((size_t)-1)
+
+static inline void index_insert(struct obs_data *data,
+		struct obs_data_item *item)
+{
+	size_t mask = data->index_size - 1;
+	size_t i    = (size_t)(item->name_hash & mask);
+
+	while (data->index[i])
+		i = (i + 1) & mask;
+
+	data->index[i] = item;
+}
+
+static void index_rebuild(struct obs_data *data)
+{
+	struct obs_data_item *item = data->first_item;
+	size_t size = INDEX_MIN_SIZE;
+
+	while (size < data->num_items * 4)
+		size *= 2;
+
+	bfree(data->index);
+	data->index      = bzalloc(size * sizeof(struct obs_data_item*));
+	data->index_size = size;
+
+	while (item) {
+		index_insert(data, item);
+		item = item->next;
+	}
+}
+
+/* only compares pointers, the item at ptr may already have been freed */
+static size_t index_find_slot(struct obs_data *data, uint64_t hash,
+		struct obs_data_item *ptr)
+{
+	size_t mask = data->index_size - 1;
+	size_t i    = (size_t)(hash & mask);
+
+	while (data->index[i]) {
+		if (data->index[i] == ptr)
+			return i;
+		i = (i + 1) & mask;
+	}
+
+	return INDEX_INVALID;
+}
+
+/* call after the item has been linked in to the data's item list */
+static void index_add(struct obs_data *data, struct obs_data_item *item)
+{
+	data->num_items++;
+
+	if (data->index && data->num_items * 2 <= data->index_size)
+		index_insert(data, item);
+	else if (data->num_items > INDEX_MIN_ITEMS)
+		index_rebuild(data);
+}
+
+static void index_remove(struct obs_data *data, struct obs_data_item *item)
+{
+	size_t mask, i, j;
+
+	data->num_items--;
+
+	if (!data->index)
+		return;
+
+	i = index_find_slot(data, item->name_hash, item);
+	if (i == INDEX_INVALID)
+		return;
+
+	/* shift back any following items that would otherwise no longer be
+	 * reachable from their home slot */
+	mask = data->index_size - 1;
+	j = i;
+
+	for (;;) {
+		size_t home;
+
+		j = (j + 1) & mask;
+		if (!data->index[j])
+			break;
+
+		home = (size_t)(data->index[j]->name_hash & mask);
+		if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+			continue;
+
+		data->index[i] = data->index[j];
+		i = j;
+	}
+
+	data->index[i] = NULL;
+}
+
+static inline void index_replace(struct obs_data *data,
+		struct obs_data_item *old_ptr, struct obs_data_item *new_ptr)
+{
+	size_t i;
+
+	if (!data->index)
+		return;
+
+	i = index_find_slot(data, new_ptr->name_hash, old_ptr);
+	if (i != INDEX_INVALID)
+		data->index[i] = new_ptr;
+}
+
+/* ------------------------------------------------------------------------- */
+
 static struct obs_data_item *obs_data_item_create(const char *name,
 		const void *data, size_t size, enum obs_data_type type,
 		bool default_data, bool autoselect_data)
@@ -295,6 +418,7 @@ static struct obs_data_item *obs_data_item_create(const char *name,
 
 	strcpy(get_item_name(item), name);
 	memcpy(get_item_data(item), data, size);
+	item->name_hash = fnv1a_hash(name, strlen(name));
 
 	item_data_addref(item);
 	return item;
@@ -328,6 +452,7 @@ static inline void obs_data_item_detach(struct obs_data_item *item)
 	if (prev_next) {
 		*prev_next = item->next;
 		item->next = NULL;
+		index_remove(item->parent, item);
 	}
 }
 
@@ -337,8 +462,10 @@ static inline void obs_data_item_reattach(struct obs_data_item *old_ptr,
 	struct obs_data_item **prev_next = get_item_prev_next(new_ptr->parent,
 			old_ptr);
 
-	if (prev_next)
+	if (prev_next) {
 		*prev_next = new_ptr;
+		index_replace(new_ptr->parent, old_ptr, new_ptr);
+	}
 }
 
 static struct obs_data_item *obs_data_item_ensure_capacity(
@@ -703,6 +830,9 @@ static inline void obs_data_destroy(struct obs_data *data)
 {
 	struct obs_data_item *item = data->first_item;
 
+	bfree(data->index);
+	data->index = NULL;
+
 	while (item) {
 		struct obs_data_item *next = item->next;
 		obs_data_item_release(&item);
@@ -766,6 +896,22 @@ static struct obs_data_item *get_item(struct obs_data *data, const char *name)
 {
 	if (!data) return NULL;
 
+	if (data->index) {
+		uint64_t hash = fnv1a_hash(name, strlen(name));
+		size_t   mask = data->index_size - 1;
+		size_t   i    = (size_t)(hash & mask);
+		struct obs_data_item *item;
+
+		while ((item = data->index[i]) != NULL) {
+			if (item->name_hash == hash &&
+			    strcmp(get_item_name(item), name) == 0)
+				return item;
+			i = (i + 1) & mask;
+		}
+
+		return NULL;
+	}
+
 	struct obs_data_item *item = data->first_item;
 
 	while (item) {
@@ -811,6 +957,8 @@ static void set_item_data(struct obs_data *data, struct obs_data_item **item,
 		if (!prev)
 			data->first_item = new_item;
 
+		index_add(data, new_item);
+
 		obs_data_item_release(&prev);
 		obs_data_item_release(&next);
 
@@ -1055,15 +1055,154 @@ void obs_encoder_remove_output(struct obs_encoder *encoder,
 	pthread_mutex_unlock(&encoder->outputs_mutex);
 }
 
+/* ------------------------------------------------------------------------- */
+/* Packet payloads are allocated in size classes: four per power of two, from
+ * 256 bytes up to 8 megabytes, and go back to the pool of their class when
+ * the last reference is released.  Larger payloads are not pooled. */
+
+#define PACKET_POOL_MAX_BYTES (32 * 1024 * 1024)
+
+struct packet_block {
+	long refs;
+	int  size_class;
+};
+
+/* keeps the payload following the header aligned */
+#define PACKET_BLOCK_HEADER_SIZE \
+	((sizeof(struct packet_block) + 15) & ~(size_t)15)
+
+static inline struct packet_block *get_packet_block(uint8_t *data)
+{
+	return (struct packet_block*)(data - PACKET_BLOCK_HEADER_SIZE);
+}
+
+static inline size_t packet_class_size(int size_class)
+{
+	size_t shift;
+	size_t step;
+
+	if (size_class == 0)
+		return (size_t)1 << PACKET_POOL_MIN_SHIFT;
+
+	shift = (size_class - 1) / 4 + PACKET_POOL_MIN_SHIFT;
+	step = (size_t)1 << (shift - 2);
+	return ((size_t)1 << shift) + ((size_class - 1) % 4 + 1) * step;
+}
+
+static inline int packet_size_class(size_t size)
+{
+	size_t shift = PACKET_POOL_MIN_SHIFT;
+
+	if (size <= ((size_t)1 << PACKET_POOL_MIN_SHIFT))
+		return 0;
+
+	while (((size - 1) >> (shift + 1)) != 0)
+		shift++;
+	if (shift >= PACKET_POOL_MAX_SHIFT)
+		return -1;
+
+	return (int)((shift - PACKET_POOL_MIN_SHIFT) * 4 +
+		((size - 1 - ((size_t)1 << shift)) >> (shift - 2)) + 1);
+}
+
+bool obs_init_packet_pool(struct obs_packet_pool *pool)
+{
+	return pthread_mutex_init(&pool->mutex, NULL) == 0;
+}
+
+void obs_free_packet_pool(struct obs_packet_pool *pool)
+{
+	for (size_t i = 0; i < PACKET_POOL_CLASSES; i++) {
+		for (size_t j = 0; j < pool->free_blocks[i].num; j++)
+			bfree(pool->free_blocks[i].array[j]);
+		da_free(pool->free_blocks[i]);
+	}
+
+	pthread_mutex_destroy(&pool->mutex);
+}
+
+uint8_t *obs_packet_pool_alloc(size_t size)
+{
+	struct obs_packet_pool *pool = obs ? &obs->packet_pool : NULL;
+	int size_class = packet_size_class(size);
+	struct packet_block *block = NULL;
+
+	if (!pool || size_class < 0) {
+		block = bmalloc(PACKET_BLOCK_HEADER_SIZE + size);
+		block->size_class = -1;
+
+	} else {
+		size_t class_size = packet_class_size(size_class);
+
+		pthread_mutex_lock(&pool->mutex);
+		pool->allocations++;
+		pool->bytes_in_use += class_size;
+
+		if (pool->free_blocks[size_class].num) {
+			block = *(struct packet_block**)da_end(
+					pool->free_blocks[size_class]);
+			da_pop_back(pool->free_blocks[size_class]);
+
+			pool->bytes_held -= class_size;
+			pool->hits++;
+		}
+		pthread_mutex_unlock(&pool->mutex);
+
+		if (!block)
+			block = bmalloc(PACKET_BLOCK_HEADER_SIZE + class_size);
+		block->size_class = size_class;
+	}
+
+	block->refs = 1;
+	return (uint8_t*)block + PACKET_BLOCK_HEADER_SIZE;
+}
+
+static void packet_pool_free(struct packet_block *block)
+{
+	struct obs_packet_pool *pool = obs ? &obs->packet_pool : NULL;
+
+	if (pool && block->size_class >= 0) {
+		size_t class_size = packet_class_size(block->size_class);
+
+		pthread_mutex_lock(&pool->mutex);
+		pool->bytes_in_use -= class_size;
+
+		if (pool->bytes_held + class_size <= PACKET_POOL_MAX_BYTES) {
+			da_push_back(pool->free_blocks[block->size_class],
+					&block);
+			pool->bytes_held += class_size;
+			block = NULL;
+		}
+		pthread_mutex_unlock(&pool->mutex);
+	}
+
+	bfree(block);
+}
+
+void obs_get_encoder_packet_pool_stats(
+		struct obs_encoder_packet_pool_stats *stats)
+{
+	struct obs_packet_pool *pool;
+
+	memset(stats, 0, sizeof(*stats));
+	if (!obs)
+		return;
+
+	pool = &obs->packet_pool;
+
+	pthread_mutex_lock(&pool->mutex);
+	stats->allocations  = pool->allocations;
+	stats->hits         = pool->hits;
+	stats->bytes_held   = pool->bytes_held;
+	stats->bytes_in_use = pool->bytes_in_use;
+	pthread_mutex_unlock(&pool->mutex);
+}
+
 void obs_encoder_packet_create_instance(struct encoder_packet *dst,
 		const struct encoder_packet *src)
 {
-	long *p_refs;
-
 	*dst = *src;
-	p_refs = bmalloc(src->size + sizeof(long));
-	dst->data = (void*)(p_refs + 1);
-	*p_refs = 1;
+	dst->data = obs_packet_pool_alloc(src->size);
 	memcpy(dst->data, src->data, src->size);
 }
 
@@ -1085,8 +1224,8 @@ void obs_encoder_packet_ref(struct encoder_packet *dst,
 		return;
 
 	if (src->data) {
-		long *p_refs = ((long*)src->data) - 1;
-		os_atomic_inc_long(p_refs);
+		struct packet_block *block = get_packet_block(src->data);
+		os_atomic_inc_long(&block->refs);
 	}
 
 	*dst = *src;
@@ -1098,9 +1237,9 @@ void obs_encoder_packet_release(struct encoder_packet *pkt)
 		return;
 
 	if (pkt->data) {
-		long *p_refs = ((long*)pkt->data) - 1;
-		if (os_atomic_dec_long(p_refs) == 0)
-			bfree(p_refs);
+		struct packet_block *block = get_packet_block(pkt->data);
+		if (os_atomic_dec_long(&block->refs) == 0)
+			packet_pool_free(block);
 	}
 
 	memset(pkt, 0, sizeof(struct encoder_packet));
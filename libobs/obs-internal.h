@@ -24,6 +24,7 @@
 #include "util/threading.h"
 #include "util/platform.h"
 #include "util/profiler.h"
+#include "util/work-pool.h"
 #include "callback/signal.h"
 #include "callback/proc.h"
 
@@ -225,6 +226,44 @@ struct obs_vframe_info {
 	int count;
 };
 
+/* format_conversion.effect parameters, resolved once the effect is loaded so
+ * that converting doesn't need to look them up by name every frame */
+struct obs_conversion_params {
+	gs_eparam_t                     *image;
+	gs_eparam_t                     *width;
+	gs_eparam_t                     *height;
+	gs_eparam_t                     *width_i;
+	gs_eparam_t                     *height_i;
+	gs_eparam_t                     *width_d2;
+	gs_eparam_t                     *height_d2;
+	gs_eparam_t                     *width_d2_i;
+	gs_eparam_t                     *height_d2_i;
+	gs_eparam_t                     *input_height;
+	gs_eparam_t                     *input_width_i_d2;
+	gs_eparam_t                     *u_plane_offset;
+	gs_eparam_t                     *v_plane_offset;
+	gs_eparam_t                     *int_width;
+	gs_eparam_t                     *int_input_width;
+	gs_eparam_t                     *int_u_plane_offset;
+	gs_eparam_t                     *int_v_plane_offset;
+	gs_technique_t                  *technique;
+};
+
+/* effect of a run of filters that are rendered in a single pass, cached by
+ * the generated code */
+struct obs_fused_effect {
+	char                            *code;
+	uint64_t                        hash;
+	gs_effect_t                     *effect;
+};
+
+/* identifies the code a filter contributed to a fused run.  filters can
+ * free and reallocate their code, so the code itself is compared by hash */
+struct obs_fused_shader_key {
+	const char                      *id;
+	uint64_t                        hash;
+};
+
 struct obs_core_video {
 	graphics_t                      *graphics;
 	gs_stagesurf_t                  *copy_surfaces[NUM_TEXTURES];
@@ -241,10 +280,12 @@ struct obs_core_video {
 	gs_effect_t                     *opaque_effect;
 	gs_effect_t                     *solid_effect;
 	gs_effect_t                     *conversion_effect;
+	struct obs_conversion_params    conversion_params;
 	gs_effect_t                     *bicubic_effect;
 	gs_effect_t                     *lanczos_effect;
 	gs_effect_t                     *bilinear_lowres_effect;
 	gs_effect_t                     *premultiplied_alpha_effect;
+	DARRAY(struct obs_fused_effect) fused_effects;
 	gs_samplerstate_t               *point_sampler;
 	gs_stagesurf_t                  *mapped_surface;
 	int                             cur_texture;
@@ -258,6 +299,7 @@ struct obs_core_video {
 	uint32_t                        total_frames;
 	uint32_t                        lagged_frames;
 	bool                            thread_initialized;
+	work_pool_t                     *work_pool;
 
 	bool                            gpu_conversion;
 	const char                      *conversion_tech;
@@ -293,7 +335,9 @@ struct obs_core_audio {
 	audio_t                         *audio;
 
 	DARRAY(struct obs_source*)      render_order;
+	DARRAY(struct obs_source*)      render_leaves;
 	DARRAY(struct obs_source*)      root_nodes;
+	work_pool_t                     *render_pool;
 
 	uint64_t                        buffered_ts;
 	struct circlebuf                buffered_timestamps;
@@ -331,8 +375,22 @@ struct obs_core_data {
 
 	long long                       unnamed_index;
 
+	/* non-private contexts in any of the lists above, hashed by name.
+	 * chained through obs_context_data::name_next */
+	pthread_mutex_t                 context_names_mutex;
+	struct obs_context_data         **context_names;
+	size_t                          context_names_size;
+	size_t                          context_names_count;
+	uint64_t                        context_insert_count;
+
 	obs_data_t                      *private_data;
 
+	/* incremented whenever a scene item transform may need updating: a
+	 * transform setter was called, a source was removed, or the size of a
+	 * source changed since the last tick.  scenes only look at their items
+	 * when it changed */
+	volatile long                   scene_dirty_gen;
+
 	volatile bool                   valid;
 };
 
@@ -371,6 +429,31 @@ struct obs_core_hotkeys {
 	char                            *sceneitem_hide;
 };
 
+/* ------------------------------------------------------------------------- */
+/* encoder packet payload pool */
+
+#define PACKET_POOL_MIN_SHIFT 8
+#define PACKET_POOL_MAX_SHIFT 23
+#define PACKET_POOL_CLASSES \
+	((PACKET_POOL_MAX_SHIFT - PACKET_POOL_MIN_SHIFT) * 4 + 1)
+
+struct obs_packet_pool {
+	pthread_mutex_t                 mutex;
+	DARRAY(void*)                   free_blocks[PACKET_POOL_CLASSES];
+
+	uint64_t                        allocations;
+	uint64_t                        hits;
+	uint64_t                        bytes_held;
+	uint64_t                        bytes_in_use;
+};
+
+extern bool obs_init_packet_pool(struct obs_packet_pool *pool);
+extern void obs_free_packet_pool(struct obs_packet_pool *pool);
+
+/* allocates a packet payload with one reference, which is released with
+ * obs_encoder_packet_release */
+extern uint8_t *obs_packet_pool_alloc(size_t size);
+
 struct obs_core {
 	struct obs_module               *first_module;
 	DARRAY(struct obs_module_path)  module_paths;
@@ -393,12 +476,17 @@ struct obs_core {
 	bool                            name_store_owned;
 	profiler_name_store_t           *name_store;
 
+	/* video output options that take effect when video is reset */
+	bool                            video_threaded_inputs;
+	uint32_t                        video_frame_cache_size;
+
 	/* segmented into multiple sub-structures to keep things a bit more
 	 * clean and organized */
 	struct obs_core_video           video;
 	struct obs_core_audio           audio;
 	struct obs_core_data            data;
 	struct obs_core_hotkeys         hotkeys;
+	struct obs_packet_pool          packet_pool;
 };
 
 extern struct obs_core *obs;
@@ -441,6 +529,11 @@ struct obs_context_data {
 	struct obs_context_data         *next;
 	struct obs_context_data         **prev_next;
 
+	/* name lookup table, see obs_core_data */
+	struct obs_context_data         *name_next;
+	uint64_t                        name_hash;
+	uint64_t                        insert_idx;
+
 	bool                            private;
 };
 
@@ -512,6 +605,14 @@ struct async_frame {
 	bool used;
 };
 
+/* frame output with obs_source_output_video_no_copy, the data belongs to the
+ * source and is handed back with the release callback */
+struct borrowed_frame {
+	struct obs_source_frame *frame;
+	void (*release)(void *param, struct obs_source_frame *frame);
+	void *param;
+};
+
 enum audio_action_type {
 	AUDIO_ACTION_VOL,
 	AUDIO_ACTION_MUTE,
@@ -581,6 +682,10 @@ struct obs_source {
 	uint64_t                        last_sys_timestamp;
 	bool                            async_rendered;
 
+	/* size of the source at the end of the last tick */
+	uint32_t                        tick_width;
+	uint32_t                        tick_height;
+
 	/* audio */
 	bool                            audio_failed;
 	bool                            audio_pending;
@@ -631,6 +736,8 @@ struct obs_source {
 	struct obs_source_frame         *async_preload_frame;
 	DARRAY(struct async_frame)      async_cache;
 	DARRAY(struct obs_source_frame*)async_frames;
+	DARRAY(struct borrowed_frame)   async_borrowed;
+	DARRAY(struct borrowed_frame)   async_released;
 	pthread_mutex_t                 async_mutex;
 	uint32_t                        async_width;
 	uint32_t                        async_height;
@@ -660,6 +767,22 @@ struct obs_source {
 	enum obs_allow_direct_render    allow_direct;
 	bool                            rendering_filter;
 
+	/* fused filters */
+	DARRAY(struct obs_fused_shader_key) fused_shaders;
+	gs_effect_t                     *fused_effect;
+	int                             fused_index;
+
+	/* render cache (OBS_SOURCE_CACHED_RENDER, OBS_SOURCE_CACHEABLE) */
+	gs_texrender_t                  *render_cache;
+	uint32_t                        render_cache_frame;
+	uint32_t                        render_cache_cx;
+	uint32_t                        render_cache_cy;
+	volatile long                   render_cache_gen;
+	uint64_t                        render_cache_tree_gen;
+	bool                            render_cache_valid;
+	bool                            render_cache_static;
+	bool                            rendering_cache;
+
 	/* sources specific hotkeys */
 	obs_hotkey_pair_id              mute_unmute_key;
 	obs_hotkey_id                   push_to_mute_key;
@@ -766,6 +889,8 @@ static inline enum gs_color_format convert_video_format(
 extern void obs_source_activate(obs_source_t *source, enum view_type type);
 extern void obs_source_deactivate(obs_source_t *source, enum view_type type);
 extern void obs_source_video_tick(obs_source_t *source, float seconds);
+extern void obs_source_enum_full_tree(obs_source_t *source,
+		obs_source_enum_proc_t enum_callback, void *param);
 extern float obs_source_get_target_volume(obs_source_t *source,
 		obs_source_t *target);
 
@@ -783,6 +908,7 @@ extern bool set_async_texture_size(struct obs_source *source,
 		const struct obs_source_frame *frame);
 extern void remove_async_frame(obs_source_t *source,
 		struct obs_source_frame *frame);
+extern void unlock_async_mutex(obs_source_t *source);
 
 extern void set_deinterlace_texture_size(obs_source_t *source);
 extern void deinterlace_process_last_frame(obs_source_t *source,
@@ -820,6 +946,46 @@ struct caption_text {
 	struct caption_text *next;
 };
 
+/* packets waiting to be interleaved are kept in one queue per track: queue 0
+ * is video, queue 1 + track_idx is audio */
+#define INTERLEAVE_QUEUES (MAX_AUDIO_MIXES + 1)
+
+struct interleaved_packet {
+	struct encoder_packet           packet;
+	int64_t                         seq;
+};
+
+struct interleave_queue {
+	DARRAY(struct interleaved_packet) packets;
+	size_t                          start;
+};
+
+struct obs_interleaver {
+	bool                            received_video;
+	bool                            received_audio;
+	int64_t                         video_offset;
+	int64_t                         audio_offsets[MAX_AUDIO_MIXES];
+	int64_t                         highest_audio_ts;
+	int64_t                         highest_video_ts;
+	struct interleave_queue         queues[INTERLEAVE_QUEUES];
+	int64_t                         seq;
+
+	/* min-heap of the non-empty queues, ordered by their first packet */
+	size_t                          heap[INTERLEAVE_QUEUES];
+	size_t                          heap_pos[INTERLEAVE_QUEUES];
+	size_t                          heap_size;
+};
+
+/* exported so that test/interleave-stress can replay traces through it */
+
+/* if copy is false, the interleaver takes ownership of the packet */
+EXPORT void obs_interleaver_push(struct obs_interleaver *il,
+		struct encoder_packet *packet, bool copy, size_t audio_mixes);
+/* gets the next packet to send, if any; the caller must release it */
+EXPORT bool obs_interleaver_pop(struct obs_interleaver *il,
+		struct encoder_packet *packet);
+EXPORT void obs_interleaver_free(struct obs_interleaver *il);
+
 struct obs_output {
 	struct obs_context_data         context;
 	struct obs_output_info          info;
@@ -828,18 +994,12 @@ struct obs_output {
 	/* indicates ownership of the info.id buffer */
 	bool                            owns_info_id;
 
-	bool                            received_video;
-	bool                            received_audio;
 	volatile bool                   data_active;
 	volatile bool                   end_data_capture_thread_active;
-	int64_t                         video_offset;
-	int64_t                         audio_offsets[MAX_AUDIO_MIXES];
-	int64_t                         highest_audio_ts;
-	int64_t                         highest_video_ts;
 	pthread_t                       end_data_capture_thread;
 	os_event_t                      *stopping_event;
 	pthread_mutex_t                 interleaved_mutex;
-	DARRAY(struct encoder_packet)   interleaved_packets;
+	struct obs_interleaver          interleaver;
 	int                             stop_code;
 
 	int                             reconnect_retry_sec;
@@ -916,7 +1076,8 @@ extern const struct obs_output_info *find_output(const char *id);
 extern void obs_output_remove_encoder(struct obs_output *output,
 		struct obs_encoder *encoder);
 
-extern void obs_encoder_packet_create_instance(struct encoder_packet *dst,
+/* exported for test/interleave-stress */
+EXPORT void obs_encoder_packet_create_instance(struct encoder_packet *dst,
 		const struct encoder_packet *src);
 void obs_output_destroy(obs_output_t *output);
 
@@ -0,0 +1,663 @@
+/******************************************************************************
+    Copyright (C) 2026 by OBS Project
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include <stdlib.h>
+#include "obs-internal.h"
+
+static inline void check_received(struct obs_interleaver *il,
+		struct encoder_packet *out)
+{
+	if (out->type == OBS_ENCODER_VIDEO) {
+		if (!il->received_video)
+			il->received_video = true;
+	} else {
+		if (!il->received_audio)
+			il->received_audio = true;
+	}
+}
+
+static inline void apply_interleaved_packet_offset(struct obs_interleaver *il,
+		struct encoder_packet *out)
+{
+	int64_t offset;
+
+	/* audio and video need to start at timestamp 0, and the encoders
+	 * may not currently be at 0 when we get data.  so, we store the
+	 * current dts as offset and subtract that value from the dts/pts
+	 * of the output packet. */
+	offset = (out->type == OBS_ENCODER_VIDEO) ?
+		il->video_offset : il->audio_offsets[out->track_idx];
+
+	out->dts -= offset;
+	out->pts -= offset;
+
+	/* convert the newly adjusted dts to relative dts time to ensure proper
+	 * interleaving.  if we're using an audio encoder that's already been
+	 * started on another output, then the first audio packet may not be
+	 * quite perfectly synced up in terms of system time (and there's
+	 * nothing we can really do about that), but it will always at least be
+	 * within a 23ish millisecond threshold (at least for AAC) */
+	out->dts_usec = packet_dts_usec(out);
+}
+
+static inline bool has_higher_opposing_ts(struct obs_interleaver *il,
+		struct encoder_packet *packet)
+{
+	if (packet->type == OBS_ENCODER_VIDEO)
+		return il->highest_audio_ts > packet->dts_usec;
+	else
+		return il->highest_video_ts > packet->dts_usec;
+}
+
+/* ------------------------------------------------------------------------- */
+/* interleave queues
+ *
+ * Packets are ordered as if they were all inserted into one sorted list:
+ * by dts_usec, and for equal timestamps, video before audio, video that came
+ * in later before video that came in earlier, and audio in the order it came
+ * in.  Each track keeps its packets in that order, and a min-heap over the
+ * first packet of each track gives the next packet overall. */
+
+static inline bool interleaved_before(const struct interleaved_packet *a,
+		const struct interleaved_packet *b)
+{
+	bool a_audio = a->packet.type == OBS_ENCODER_AUDIO;
+	bool b_audio = b->packet.type == OBS_ENCODER_AUDIO;
+
+	if (a->packet.dts_usec != b->packet.dts_usec)
+		return a->packet.dts_usec < b->packet.dts_usec;
+	if (a_audio != b_audio)
+		return !a_audio;
+
+	return a_audio ? a->seq < b->seq : a->seq > b->seq;
+}
+
+static inline size_t queue_size(const struct interleave_queue *queue)
+{
+	return queue->packets.num - queue->start;
+}
+
+static inline struct interleaved_packet *queue_first(
+		struct interleave_queue *queue)
+{
+	return queue_size(queue) ? queue->packets.array + queue->start : NULL;
+}
+
+static inline struct interleaved_packet *queue_last(
+		struct interleave_queue *queue)
+{
+	return queue_size(queue) ? da_end(queue->packets) : NULL;
+}
+
+static inline struct interleave_queue *get_queue(struct obs_interleaver *il,
+		enum obs_encoder_type type, size_t audio_idx)
+{
+	size_t idx = type == OBS_ENCODER_VIDEO ? 0 : audio_idx + 1;
+	return &il->queues[idx];
+}
+
+static inline bool heap_less(struct obs_interleaver *il, size_t a, size_t b)
+{
+	return interleaved_before(
+			queue_first(&il->queues[a]),
+			queue_first(&il->queues[b]));
+}
+
+static inline void heap_set(struct obs_interleaver *il, size_t pos,
+		size_t queue_idx)
+{
+	il->heap[pos] = queue_idx;
+	il->heap_pos[queue_idx] = pos;
+}
+
+static void heap_sift_up(struct obs_interleaver *il, size_t pos)
+{
+	size_t queue_idx = il->heap[pos];
+
+	while (pos > 0) {
+		size_t parent = (pos - 1) / 2;
+		size_t parent_idx = il->heap[parent];
+
+		if (!heap_less(il, queue_idx, parent_idx))
+			break;
+
+		heap_set(il, pos, parent_idx);
+		pos = parent;
+	}
+
+	heap_set(il, pos, queue_idx);
+}
+
+static void heap_sift_down(struct obs_interleaver *il, size_t pos)
+{
+	size_t size = il->heap_size;
+	size_t queue_idx = il->heap[pos];
+
+	for (;;) {
+		size_t child = pos * 2 + 1;
+		size_t child_idx;
+
+		if (child >= size)
+			break;
+		if (child + 1 < size &&
+		    heap_less(il, il->heap[child + 1], il->heap[child]))
+			child++;
+
+		child_idx = il->heap[child];
+		if (!heap_less(il, child_idx, queue_idx))
+			break;
+
+		heap_set(il, pos, child_idx);
+		pos = child;
+	}
+
+	heap_set(il, pos, queue_idx);
+}
+
+/* call whenever the first packet of a queue has changed */
+static void update_interleave_heap(struct obs_interleaver *il,
+		struct interleave_queue *queue)
+{
+	size_t queue_idx = queue - il->queues;
+	size_t pos = il->heap_pos[queue_idx];
+	bool in_heap = pos < il->heap_size && il->heap[pos] == queue_idx;
+
+	if (!queue_size(queue)) {
+		size_t last;
+
+		if (!in_heap)
+			return;
+
+		last = il->heap[--il->heap_size];
+		if (last != queue_idx) {
+			heap_set(il, pos, last);
+			heap_sift_up(il, pos);
+			heap_sift_down(il, il->heap_pos[last]);
+		}
+
+	} else if (!in_heap) {
+		pos = il->heap_size++;
+		heap_set(il, pos, queue_idx);
+		heap_sift_up(il, pos);
+
+	} else {
+		heap_sift_up(il, pos);
+		heap_sift_down(il, il->heap_pos[queue_idx]);
+	}
+}
+
+static inline struct interleaved_packet *first_interleaved_packet(
+		struct obs_interleaver *il)
+{
+	if (!il->heap_size)
+		return NULL;
+
+	return queue_first(&il->queues[il->heap[0]]);
+}
+
+static inline void pop_interleaved_packet(struct interleave_queue *queue)
+{
+	if (++queue->start == queue->packets.num) {
+		queue->packets.num = 0;
+		queue->start = 0;
+	}
+}
+
+static void insert_interleaved_packet(struct obs_interleaver *il,
+		struct encoder_packet *out)
+{
+	struct interleave_queue *queue = get_queue(il, out->type,
+			out->track_idx);
+	struct interleaved_packet ip = {*out, il->seq++};
+	size_t idx;
+
+	/* popped packets are only removed here, so that pointers to queued
+	 * packets stay valid until the next insert */
+	if (queue->start && queue->start * 2 >= queue->packets.num) {
+		da_erase_range(queue->packets, 0, queue->start);
+		queue->start = 0;
+	}
+
+	/* packets of a track normally come in order */
+	idx = queue->packets.num;
+	while (idx > queue->start &&
+	       interleaved_before(&ip, queue->packets.array + idx - 1))
+		idx--;
+
+	da_insert(queue->packets, idx, &ip);
+	update_interleave_heap(il, queue);
+}
+
+/* releases all packets that come before (or up to and including) the given
+ * packet */
+static void discard_interleaved_packets(struct obs_interleaver *il,
+		const struct interleaved_packet *target, bool inclusive)
+{
+	struct interleaved_packet end = *target;
+
+	for (size_t i = 0; i < INTERLEAVE_QUEUES; i++) {
+		struct interleave_queue *queue = &il->queues[i];
+		struct interleaved_packet *packet;
+
+		while ((packet = queue_first(queue)) != NULL) {
+			if (!interleaved_before(packet, &end) &&
+			    !(inclusive && packet->seq == end.seq))
+				break;
+
+			obs_encoder_packet_release(&packet->packet);
+			pop_interleaved_packet(queue);
+		}
+
+		update_interleave_heap(il, queue);
+	}
+}
+
+static inline void set_higher_ts(struct obs_interleaver *il,
+		struct encoder_packet *packet)
+{
+	if (packet->type == OBS_ENCODER_VIDEO) {
+		if (il->highest_video_ts < packet->dts_usec)
+			il->highest_video_ts = packet->dts_usec;
+	} else {
+		if (il->highest_audio_ts < packet->dts_usec)
+			il->highest_audio_ts = packet->dts_usec;
+	}
+}
+
+static inline struct encoder_packet *find_first_packet_type(
+		struct obs_interleaver *il, enum obs_encoder_type type,
+		size_t audio_idx)
+{
+	struct interleaved_packet *packet =
+		queue_first(get_queue(il, type, audio_idx));
+	return packet ? &packet->packet : NULL;
+}
+
+static inline struct encoder_packet *find_last_packet_type(
+		struct obs_interleaver *il, enum obs_encoder_type type,
+		size_t audio_idx)
+{
+	struct interleaved_packet *packet =
+		queue_last(get_queue(il, type, audio_idx));
+	return packet ? &packet->packet : NULL;
+}
+
+/* gets the point where audio and video are closest together */
+static struct interleaved_packet *get_interleaved_start(
+		struct obs_interleaver *il)
+{
+	int64_t closest_diff = 0x7FFFFFFFFFFFFFFFLL;
+	struct interleaved_packet *first_video = queue_first(&il->queues[0]);
+	struct interleaved_packet *closest = NULL;
+
+	for (size_t i = 1; i < INTERLEAVE_QUEUES; i++) {
+		struct interleave_queue *queue = &il->queues[i];
+
+		for (size_t j = queue->start; j < queue->packets.num; j++) {
+			struct interleaved_packet *packet =
+				&queue->packets.array[j];
+			int64_t diff = llabs(packet->packet.dts_usec -
+					first_video->packet.dts_usec);
+
+			if (diff < closest_diff ||
+			    (diff == closest_diff &&
+			     interleaved_before(packet, closest))) {
+				closest_diff = diff;
+				closest = packet;
+			} else if (packet->packet.dts_usec >
+					first_video->packet.dts_usec) {
+				break;
+			}
+		}
+	}
+
+	if (!closest)
+		return NULL;
+
+	return interleaved_before(first_video, closest) ?
+		first_video : closest;
+}
+
+/* returns false if there's no video or audio yet.  if the first video packet
+ * is too far away from audio, sets prune_end to the last packet to prune */
+static bool prune_premature_packets(struct obs_interleaver *il,
+		size_t audio_mixes, struct interleaved_packet **prune_end)
+{
+	struct interleaved_packet *video;
+	struct interleaved_packet *last;
+	int64_t duration_usec;
+	int64_t diff = 0;
+
+	video = queue_first(&il->queues[0]);
+	if (!video) {
+		il->received_video = false;
+		return false;
+	}
+
+	last = video;
+	duration_usec = video->packet.timebase_num * 1000000LL /
+		video->packet.timebase_den;
+
+	for (size_t i = 0; i < audio_mixes; i++) {
+		struct interleaved_packet *audio;
+
+		audio = queue_first(&il->queues[i + 1]);
+		if (!audio) {
+			il->received_audio = false;
+			return false;
+		}
+
+		if (interleaved_before(last, audio))
+			last = audio;
+
+		diff = audio->packet.dts_usec - video->packet.dts_usec;
+	}
+
+	*prune_end = diff > duration_usec ? last : NULL;
+	return true;
+}
+
+#define DEBUG_STARTING_PACKETS 0
+
+static bool prune_interleaved_packets(struct obs_interleaver *il,
+		size_t audio_mixes)
+{
+	struct interleaved_packet *prune_end = NULL;
+	struct interleaved_packet *start;
+
+	if (!prune_premature_packets(il, audio_mixes, &prune_end))
+		return false;
+
+#if DEBUG_STARTING_PACKETS == 1
+	blog(LOG_DEBUG, "--------- Pruning! %s ---------",
+			prune_end ? "true" : "false");
+	for (size_t i = 0; i < INTERLEAVE_QUEUES; i++) {
+		struct interleave_queue *queue = &il->queues[i];
+
+		for (size_t j = queue->start; j < queue->packets.num; j++) {
+			struct interleaved_packet *packet =
+				&queue->packets.array[j];
+			bool pruned = prune_end &&
+				(packet == prune_end ||
+				 interleaved_before(packet, prune_end));
+
+			blog(LOG_DEBUG, "packet: %s %d, ts: %lld, pruned = %s",
+					packet->packet.type ==
+					OBS_ENCODER_AUDIO ? "audio" : "video",
+					(int)packet->packet.track_idx,
+					packet->packet.dts_usec,
+					pruned ? "true" : "false");
+		}
+	}
+#endif
+
+	/* prunes the first video packet if it's too far away from audio */
+	if (prune_end) {
+		discard_interleaved_packets(il, prune_end, true);
+	} else {
+		start = get_interleaved_start(il);
+		if (start)
+			discard_interleaved_packets(il, start, false);
+	}
+
+	return true;
+}
+
+static bool get_audio_and_video_packets(struct obs_interleaver *il,
+		struct encoder_packet **video,
+		struct encoder_packet **audio, size_t audio_mixes)
+{
+	*video = find_first_packet_type(il, OBS_ENCODER_VIDEO, 0);
+	if (!*video)
+		il->received_video = false;
+
+	for (size_t i = 0; i < audio_mixes; i++) {
+		audio[i] = find_first_packet_type(il, OBS_ENCODER_AUDIO, i);
+		if (!audio[i]) {
+			il->received_audio = false;
+			return false;
+		}
+	}
+
+	if (!*video) {
+		return false;
+	}
+
+	return true;
+}
+
+static int compare_interleaved(const void *a, const void *b)
+{
+	const struct interleaved_packet *pa = a;
+	const struct interleaved_packet *pb = b;
+
+	if (interleaved_before(pa, pb))
+		return -1;
+	return interleaved_before(pb, pa) ? 1 : 0;
+}
+
+static int compare_interleaved_ptr(const void *a, const void *b)
+{
+	return compare_interleaved(*(const struct interleaved_packet**)a,
+			*(const struct interleaved_packet**)b);
+}
+
+/* numbers the packets in their current order, which decides the order of
+ * packets that end up with the same timestamp once offsets are applied */
+static void number_interleaved_packets(struct obs_interleaver *il)
+{
+	DARRAY(struct interleaved_packet*) packets;
+
+	da_init(packets);
+
+	for (size_t i = 0; i < INTERLEAVE_QUEUES; i++) {
+		struct interleave_queue *queue = &il->queues[i];
+
+		for (size_t j = queue->start; j < queue->packets.num; j++) {
+			struct interleaved_packet *packet =
+				&queue->packets.array[j];
+			da_push_back(packets, &packet);
+		}
+	}
+
+	qsort(packets.array, packets.num, sizeof(*packets.array),
+			compare_interleaved_ptr);
+
+	for (size_t i = 0; i < packets.num; i++)
+		packets.array[i]->seq = (int64_t)i;
+
+	il->seq = (int64_t)packets.num;
+	da_free(packets);
+}
+
+static bool initialize_interleaved_packets(struct obs_interleaver *il,
+		size_t audio_mixes)
+{
+	struct encoder_packet *video;
+	struct encoder_packet *audio[MAX_AUDIO_MIXES];
+	struct encoder_packet *last_audio[MAX_AUDIO_MIXES];
+	struct interleaved_packet *start;
+
+	if (!get_audio_and_video_packets(il, &video, audio, audio_mixes))
+		return false;
+
+	for (size_t i = 0; i < audio_mixes; i++)
+		last_audio[i] = find_last_packet_type(il, OBS_ENCODER_AUDIO, i);
+
+	/* ensure that there is audio past the first video packet */
+	for (size_t i = 0; i < audio_mixes; i++) {
+		if (last_audio[i]->dts_usec < video->dts_usec) {
+			il->received_audio = false;
+			return false;
+		}
+	}
+
+	/* clear out excess starting audio if it hasn't been already */
+	start = get_interleaved_start(il);
+	if (start) {
+		discard_interleaved_packets(il, start, false);
+		if (!get_audio_and_video_packets(il, &video, audio,
+					audio_mixes))
+			return false;
+	}
+
+	/* get new offsets */
+	il->video_offset = video->pts;
+	for (size_t i = 0; i < audio_mixes; i++)
+		il->audio_offsets[i] = audio[i]->dts;
+
+#if DEBUG_STARTING_PACKETS == 1
+	int64_t v = video->dts_usec;
+	int64_t a = audio[0]->dts_usec;
+	int64_t diff = v - a;
+
+	blog(LOG_DEBUG, "offset for video: %lld, audio: %lld, diff: %lldms",
+			v, a, diff / 1000LL);
+#endif
+
+	/* subtract offsets from highest TS offset variables */
+	il->highest_audio_ts -= audio[0]->dts_usec;
+	il->highest_video_ts -= video->dts_usec;
+
+	number_interleaved_packets(il);
+
+	/* apply new offsets to all existing packet DTS/PTS values */
+	for (size_t i = 0; i < INTERLEAVE_QUEUES; i++) {
+		struct interleave_queue *queue = &il->queues[i];
+
+		for (size_t j = queue->start; j < queue->packets.num; j++)
+			apply_interleaved_packet_offset(il,
+					&queue->packets.array[j].packet);
+	}
+
+	return true;
+}
+
+static void resort_interleaved_packets(struct obs_interleaver *il)
+{
+	il->heap_size = 0;
+
+	for (size_t i = 0; i < INTERLEAVE_QUEUES; i++) {
+		struct interleave_queue *queue = &il->queues[i];
+
+		qsort(queue->packets.array + queue->start, queue_size(queue),
+				sizeof(*queue->packets.array),
+				compare_interleaved);
+		update_interleave_heap(il, queue);
+	}
+}
+
+static void discard_unused_audio_packets(struct obs_interleaver *il,
+		int64_t dts_usec)
+{
+	for (size_t i = 0; i < INTERLEAVE_QUEUES; i++) {
+		struct interleave_queue *queue = &il->queues[i];
+		struct interleaved_packet *packet;
+
+		while ((packet = queue_first(queue)) != NULL) {
+			if (packet->packet.dts_usec >= dts_usec)
+				break;
+
+			obs_encoder_packet_release(&packet->packet);
+			pop_interleaved_packet(queue);
+		}
+
+		update_interleave_heap(il, queue);
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+
+void obs_interleaver_push(struct obs_interleaver *il,
+		struct encoder_packet *packet, bool copy, size_t audio_mixes)
+{
+	struct encoder_packet out;
+	bool                  was_started;
+
+	/* if first video frame is not a keyframe, discard until received */
+	if (!il->received_video &&
+	    packet->type == OBS_ENCODER_VIDEO &&
+	    !packet->keyframe) {
+		discard_unused_audio_packets(il, packet->dts_usec);
+
+		if (!copy)
+			obs_encoder_packet_release(packet);
+		return;
+	}
+
+	was_started = il->received_audio && il->received_video;
+
+	if (copy)
+		obs_encoder_packet_create_instance(&out, packet);
+	else
+		out = *packet;
+
+	if (was_started)
+		apply_interleaved_packet_offset(il, &out);
+	else
+		check_received(il, packet);
+
+	insert_interleaved_packet(il, &out);
+	set_higher_ts(il, &out);
+
+	/* when both video and audio have been received for the first time,
+	 * line up the packets received so far so they can be sent */
+	if (!was_started && il->received_audio && il->received_video) {
+		if (prune_interleaved_packets(il, audio_mixes)) {
+			if (initialize_interleaved_packets(il, audio_mixes))
+				resort_interleaved_packets(il);
+		}
+	}
+}
+
+bool obs_interleaver_pop(struct obs_interleaver *il,
+		struct encoder_packet *packet)
+{
+	struct interleaved_packet *first = first_interleaved_packet(il);
+	struct interleave_queue *queue;
+
+	if (!il->received_audio || !il->received_video || !first)
+		return false;
+
+	/* do not send an interleaved packet if there's no packet of the
+	 * opposing type of a higher timestamp in the interleave buffer.
+	 * this ensures that the timestamps are monotonic */
+	if (!has_higher_opposing_ts(il, &first->packet))
+		return false;
+
+	*packet = first->packet;
+	queue = get_queue(il, packet->type, packet->track_idx);
+
+	pop_interleaved_packet(queue);
+	update_interleave_heap(il, queue);
+	return true;
+}
+
+void obs_interleaver_free(struct obs_interleaver *il)
+{
+	for (size_t i = 0; i < INTERLEAVE_QUEUES; i++) {
+		struct interleave_queue *queue = &il->queues[i];
+
+		for (size_t j = queue->start; j < queue->packets.num; j++)
+			obs_encoder_packet_release(
+					&queue->packets.array[j].packet);
+
+		da_free(queue->packets);
+	}
+
+	memset(il, 0, sizeof(*il));
+}
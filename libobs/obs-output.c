@@ -162,13 +162,6 @@ fail:
 	return NULL;
 }
 
-static inline void free_packets(struct obs_output *output)
-{
-	for (size_t i = 0; i < output->interleaved_packets.num; i++)
-		obs_encoder_packet_release(output->interleaved_packets.array+i);
-	da_free(output->interleaved_packets);
-}
-
 void obs_output_destroy(obs_output_t *output)
 {
 	if (output) {
@@ -188,7 +181,7 @@ void obs_output_destroy(obs_output_t *output)
 		if (output->context.data)
 			output->info.destroy(output->context.data);
 
-		free_packets(output);
+		obs_interleaver_free(&output->interleaver);
 
 		if (output->video_encoder) {
 			obs_encoder_remove_output(output->video_encoder,
@@ -954,51 +947,6 @@ static size_t get_track_index(const struct obs_output *output,
 	return 0;
 }
 
-static inline void check_received(struct obs_output *output,
-		struct encoder_packet *out)
-{
-	if (out->type == OBS_ENCODER_VIDEO) {
-		if (!output->received_video)
-			output->received_video = true;
-	} else {
-		if (!output->received_audio)
-			output->received_audio = true;
-	}
-}
-
-static inline void apply_interleaved_packet_offset(struct obs_output *output,
-		struct encoder_packet *out)
-{
-	int64_t offset;
-
-	/* audio and video need to start at timestamp 0, and the encoders
-	 * may not currently be at 0 when we get data.  so, we store the
-	 * current dts as offset and subtract that value from the dts/pts
-	 * of the output packet. */
-	offset = (out->type == OBS_ENCODER_VIDEO) ?
-		output->video_offset : output->audio_offsets[out->track_idx];
-
-	out->dts -= offset;
-	out->pts -= offset;
-
-	/* convert the newly adjusted dts to relative dts time to ensure proper
-	 * interleaving.  if we're using an audio encoder that's already been
-	 * started on another output, then the first audio packet may not be
-	 * quite perfectly synced up in terms of system time (and there's
-	 * nothing we can really do about that), but it will always at least be
-	 * within a 23ish millisecond threshold (at least for AAC) */
-	out->dts_usec = packet_dts_usec(out);
-}
-
-static inline bool has_higher_opposing_ts(struct obs_output *output,
-		struct encoder_packet *packet)
-{
-	if (packet->type == OBS_ENCODER_VIDEO)
-		return output->highest_audio_ts > packet->dts_usec;
-	else
-		return output->highest_video_ts > packet->dts_usec;
-}
-
 #if BUILD_CAPTIONS
 static const uint8_t nal_start[4] = {0, 0, 0, 1};
 
@@ -1009,36 +957,34 @@ static bool add_caption(struct obs_output *output, struct encoder_packet *out)
 	sei_t sei;
 	uint8_t *data;
 	size_t size;
-	long ref = 1;
-
-	DARRAY(uint8_t) out_data;
 
 	if (out->priority > 1)
 		return false;
 
 	sei_init(&sei, 0.0);
 
-	da_init(out_data);
-	da_push_back_array(out_data, &ref, sizeof(ref));
-	da_push_back_array(out_data, out->data, out->size);
-
 	caption_frame_init(&cf);
 	caption_frame_from_text(&cf, &output->caption_head->text[0]);
 
 	sei_from_caption_frame(&sei, &cf);
 
-	data = malloc(sei_render_size(&sei));
-	size = sei_render(&sei, data);
+	/* the SEI is rendered straight into the new payload, after a copy of
+	 * the original one */
+	data = obs_packet_pool_alloc(out->size + sizeof(nal_start) +
+			sei_render_size(&sei));
+	memcpy(data, out->data, out->size);
+	size = out->size;
+
 	/* TODO SEI should come after AUD/SPS/PPS, but before any VCL */
-	da_push_back_array(out_data, nal_start, 4);
-	da_push_back_array(out_data, data, size);
-	free(data);
+	memcpy(data + size, nal_start, sizeof(nal_start));
+	size += sizeof(nal_start);
+	size += sei_render(&sei, data + size);
 
 	obs_encoder_packet_release(out);
 
 	*out = backup;
-	out->data = (uint8_t*)out_data.array + sizeof(ref);
-	out->size = out_data.num - sizeof(ref);
+	out->data = data;
+	out->size = size;
 
 	sei_free(&sei);
 
@@ -1049,26 +995,17 @@ static bool add_caption(struct obs_output *output, struct encoder_packet *out)
 }
 #endif
 
-static inline void send_interleaved(struct obs_output *output)
+static inline void send_interleaved(struct obs_output *output,
+		struct encoder_packet *out)
 {
-	struct encoder_packet out = output->interleaved_packets.array[0];
-
-	/* do not send an interleaved packet if there's no packet of the
-	 * opposing type of a higher timestamp in the interleave buffer.
-	 * this ensures that the timestamps are monotonic */
-	if (!has_higher_opposing_ts(output, &out))
-		return;
-
-	da_erase(output->interleaved_packets, 0);
-
-	if (out.type == OBS_ENCODER_VIDEO) {
+	if (out->type == OBS_ENCODER_VIDEO) {
 		output->total_frames++;
 
 #if BUILD_CAPTIONS
 		pthread_mutex_lock(&output->caption_mutex);
 
-		double frame_timestamp = (out.pts * out.timebase_num) /
-			(double)out.timebase_den;
+		double frame_timestamp = (out->pts * out->timebase_num) /
+			(double)out->timebase_den;
 
 		/* TODO if output->caption_timestamp is more than 5 seconds
 		 * old, send empty frame */
@@ -1078,7 +1015,7 @@ static inline void send_interleaved(struct obs_output *output)
 					frame_timestamp,
 					&output->caption_head->text[0]);
 
-			if (add_caption(output, &out)) {
+			if (add_caption(output, out)) {
 				output->caption_timestamp =
 					frame_timestamp + 2.0;
 			}
@@ -1088,341 +1025,14 @@ static inline void send_interleaved(struct obs_output *output)
 #endif
 	}
 
-	output->info.encoded_packet(output->context.data, &out);
-	obs_encoder_packet_release(&out);
-}
-
-static inline void set_higher_ts(struct obs_output *output,
-		struct encoder_packet *packet)
-{
-	if (packet->type == OBS_ENCODER_VIDEO) {
-		if (output->highest_video_ts < packet->dts_usec)
-			output->highest_video_ts = packet->dts_usec;
-	} else {
-		if (output->highest_audio_ts < packet->dts_usec)
-			output->highest_audio_ts = packet->dts_usec;
-	}
-}
-
-static inline struct encoder_packet *find_first_packet_type(
-		struct obs_output *output, enum obs_encoder_type type,
-		size_t audio_idx);
-static int find_first_packet_type_idx(struct obs_output *output,
-		enum obs_encoder_type type, size_t audio_idx);
-
-/* gets the point where audio and video are closest together */
-static size_t get_interleaved_start_idx(struct obs_output *output)
-{
-	int64_t closest_diff = 0x7FFFFFFFFFFFFFFFLL;
-	struct encoder_packet *first_video = find_first_packet_type(output,
-			OBS_ENCODER_VIDEO, 0);
-	size_t video_idx = DARRAY_INVALID;
-	size_t idx = 0;
-
-	for (size_t i = 0; i < output->interleaved_packets.num; i++) {
-		struct encoder_packet *packet =
-			&output->interleaved_packets.array[i];
-		int64_t diff;
-
-		if (packet->type != OBS_ENCODER_AUDIO) {
-			if (packet == first_video)
-				video_idx = i;
-			continue;
-		}
-
-		diff = llabs(packet->dts_usec - first_video->dts_usec);
-		if (diff < closest_diff) {
-			closest_diff = diff;
-			idx = i;
-		}
-	}
-
-	return video_idx < idx ? video_idx : idx;
-}
-
-static int prune_premature_packets(struct obs_output *output)
-{
-	size_t audio_mixes = num_audio_mixes(output);
-	struct encoder_packet *video;
-	int video_idx;
-	int max_idx;
-	int64_t duration_usec;
-	int64_t max_diff = 0;
-	int64_t diff = 0;
-
-	video_idx = find_first_packet_type_idx(output, OBS_ENCODER_VIDEO, 0);
-	if (video_idx == -1) {
-		output->received_video = false;
-		return -1;
-	}
-
-	max_idx = video_idx;
-	video = &output->interleaved_packets.array[video_idx];
-	duration_usec = video->timebase_num * 1000000LL / video->timebase_den;
-
-	for (size_t i = 0; i < audio_mixes; i++) {
-		struct encoder_packet *audio;
-		int audio_idx;
-
-		audio_idx = find_first_packet_type_idx(output,
-				OBS_ENCODER_AUDIO, i);
-		if (audio_idx == -1) {
-			output->received_audio = false;
-			return -1;
-		}
-
-		audio = &output->interleaved_packets.array[audio_idx];
-		if (audio_idx > max_idx)
-			max_idx = audio_idx;
-
-		diff = audio->dts_usec - video->dts_usec;
-		if (diff > max_diff)
-			max_diff = diff;
-	}
-
-	return diff > duration_usec ? max_idx + 1 : 0;
-}
-
-static void discard_to_idx(struct obs_output *output, size_t idx)
-{
-	for (size_t i = 0; i < idx; i++) {
-		struct encoder_packet *packet =
-			&output->interleaved_packets.array[i];
-		obs_encoder_packet_release(packet);
-	}
-
-	da_erase_range(output->interleaved_packets, 0, idx);
-}
-
-#define DEBUG_STARTING_PACKETS 0
-
-static bool prune_interleaved_packets(struct obs_output *output)
-{
-	size_t start_idx = 0;
-	int prune_start = prune_premature_packets(output);
-
-#if DEBUG_STARTING_PACKETS == 1
-	blog(LOG_DEBUG, "--------- Pruning! %d ---------", prune_start);
-	for (size_t i = 0; i < output->interleaved_packets.num; i++) {
-		struct encoder_packet *packet =
-			&output->interleaved_packets.array[i];
-		blog(LOG_DEBUG, "packet: %s %d, ts: %lld, pruned = %s",
-				packet->type == OBS_ENCODER_AUDIO ?
-				"audio" : "video", (int)packet->track_idx,
-				packet->dts_usec,
-				(int)i < prune_start ? "true" : "false");
-	}
-#endif
-
-	/* prunes the first video packet if it's too far away from audio */
-	if (prune_start == -1)
-		return false;
-	else if (prune_start != 0)
-		start_idx = (size_t)prune_start;
-	else
-		start_idx = get_interleaved_start_idx(output);
-
-	if (start_idx)
-		discard_to_idx(output, start_idx);
-
-	return true;
-}
-
-static int find_first_packet_type_idx(struct obs_output *output,
-		enum obs_encoder_type type, size_t audio_idx)
-{
-	for (size_t i = 0; i < output->interleaved_packets.num; i++) {
-		struct encoder_packet *packet =
-			&output->interleaved_packets.array[i];
-
-		if (packet->type == type) {
-			if (type == OBS_ENCODER_AUDIO &&
-			    packet->track_idx != audio_idx) {
-				continue;
-			}
-
-			return (int)i;
-		}
-	}
-
-	return -1;
-}
-
-static int find_last_packet_type_idx(struct obs_output *output,
-		enum obs_encoder_type type, size_t audio_idx)
-{
-	for (size_t i = output->interleaved_packets.num; i > 0; i--) {
-		struct encoder_packet *packet =
-			&output->interleaved_packets.array[i - 1];
-
-		if (packet->type == type) {
-			if (type == OBS_ENCODER_AUDIO &&
-			    packet->track_idx != audio_idx) {
-				continue;
-			}
-
-			return (int)(i - 1);
-		}
-	}
-
-	return -1;
-}
-
-static inline struct encoder_packet *find_first_packet_type(
-		struct obs_output *output, enum obs_encoder_type type,
-		size_t audio_idx)
-{
-	int idx = find_first_packet_type_idx(output, type, audio_idx);
-	return (idx != -1) ? &output->interleaved_packets.array[idx] : NULL;
-}
-
-static inline struct encoder_packet *find_last_packet_type(
-		struct obs_output *output, enum obs_encoder_type type,
-		size_t audio_idx)
-{
-	int idx = find_last_packet_type_idx(output, type, audio_idx);
-	return (idx != -1) ? &output->interleaved_packets.array[idx] : NULL;
-}
-
-static bool get_audio_and_video_packets(struct obs_output *output,
-		struct encoder_packet **video,
-		struct encoder_packet **audio, size_t audio_mixes)
-{
-	*video = find_first_packet_type(output, OBS_ENCODER_VIDEO, 0);
-	if (!*video)
-		output->received_video = false;
-
-	for (size_t i = 0; i < audio_mixes; i++) {
-		audio[i] = find_first_packet_type(output, OBS_ENCODER_AUDIO, i);
-		if (!audio[i]) {
-			output->received_audio = false;
-			return false;
-		}
-	}
-
-	if (!*video) {
-		return false;
-	}
-
-	return true;
-}
-
-static bool initialize_interleaved_packets(struct obs_output *output)
-{
-	struct encoder_packet *video;
-	struct encoder_packet *audio[MAX_AUDIO_MIXES];
-	struct encoder_packet *last_audio[MAX_AUDIO_MIXES];
-	size_t audio_mixes = num_audio_mixes(output);
-	size_t start_idx;
-
-	if (!get_audio_and_video_packets(output, &video, audio, audio_mixes))
-		return false;
-
-	for (size_t i = 0; i < audio_mixes; i++)
-		last_audio[i] = find_last_packet_type(output, OBS_ENCODER_AUDIO,
-				i);
-
-	/* ensure that there is audio past the first video packet */
-	for (size_t i = 0; i < audio_mixes; i++) {
-		if (last_audio[i]->dts_usec < video->dts_usec) {
-			output->received_audio = false;
-			return false;
-		}
-	}
-
-	/* clear out excess starting audio if it hasn't been already */
-	start_idx = get_interleaved_start_idx(output);
-	if (start_idx) {
-		discard_to_idx(output, start_idx);
-		if (!get_audio_and_video_packets(output, &video, audio,
-					audio_mixes))
-			return false;
-	}
-
-	/* get new offsets */
-	output->video_offset = video->pts;
-	for (size_t i = 0; i < audio_mixes; i++)
-		output->audio_offsets[i] = audio[i]->dts;
-
-#if DEBUG_STARTING_PACKETS == 1
-	int64_t v = video->dts_usec;
-	int64_t a = audio[0]->dts_usec;
-	int64_t diff = v - a;
-
-	blog(LOG_DEBUG, "output '%s' offset for video: %lld, audio: %lld, "
-			"diff: %lldms", output->context.name, v, a,
-			diff / 1000LL);
-#endif
-
-	/* subtract offsets from highest TS offset variables */
-	output->highest_audio_ts -= audio[0]->dts_usec;
-	output->highest_video_ts -= video->dts_usec;
-
-	/* apply new offsets to all existing packet DTS/PTS values */
-	for (size_t i = 0; i < output->interleaved_packets.num; i++) {
-		struct encoder_packet *packet =
-			&output->interleaved_packets.array[i];
-		apply_interleaved_packet_offset(output, packet);
-	}
-
-	return true;
-}
-
-static inline void insert_interleaved_packet(struct obs_output *output,
-		struct encoder_packet *out)
-{
-	size_t idx;
-	for (idx = 0; idx < output->interleaved_packets.num; idx++) {
-		struct encoder_packet *cur_packet;
-		cur_packet = output->interleaved_packets.array + idx;
-
-		if (out->dts_usec == cur_packet->dts_usec &&
-		    out->type == OBS_ENCODER_VIDEO) {
-			break;
-		} else if (out->dts_usec < cur_packet->dts_usec) {
-			break;
-		}
-	}
-
-	da_insert(output->interleaved_packets, idx, out);
-}
-
-static void resort_interleaved_packets(struct obs_output *output)
-{
-	DARRAY(struct encoder_packet) old_array;
-
-	old_array.da = output->interleaved_packets.da;
-	memset(&output->interleaved_packets, 0,
-			sizeof(output->interleaved_packets));
-
-	for (size_t i = 0; i < old_array.num; i++)
-		insert_interleaved_packet(output, &old_array.array[i]);
-
-	da_free(old_array);
-}
-
-static void discard_unused_audio_packets(struct obs_output *output,
-		int64_t dts_usec)
-{
-	size_t idx = 0;
-
-	for (; idx < output->interleaved_packets.num; idx++) {
-		struct encoder_packet *p =
-			&output->interleaved_packets.array[idx];
-
-		if (p->dts_usec >= dts_usec)
-			break;
-	}
-
-	if (idx)
-		discard_to_idx(output, idx);
+	output->info.encoded_packet(output->context.data, out);
+	obs_encoder_packet_release(out);
 }
 
 static void interleave_packets(void *data, struct encoder_packet *packet)
 {
 	struct obs_output     *output = data;
 	struct encoder_packet out;
-	bool                  was_started;
 
 	if (!active(output))
 		return;
@@ -1432,47 +1042,12 @@ static void interleave_packets(void *data, struct encoder_packet *packet)
 
 	pthread_mutex_lock(&output->interleaved_mutex);
 
-	/* if first video frame is not a keyframe, discard until received */
-	if (!output->received_video &&
-	    packet->type == OBS_ENCODER_VIDEO &&
-	    !packet->keyframe) {
-		discard_unused_audio_packets(output, packet->dts_usec);
-		pthread_mutex_unlock(&output->interleaved_mutex);
-
-		if (output->active_delay_ns)
-			obs_encoder_packet_release(packet);
-		return;
-	}
-
-	was_started = output->received_audio && output->received_video;
-
-	if (output->active_delay_ns)
-		out = *packet;
-	else
-		obs_encoder_packet_create_instance(&out, packet);
-
-	if (was_started)
-		apply_interleaved_packet_offset(output, &out);
-	else
-		check_received(output, packet);
-
-	insert_interleaved_packet(output, &out);
-	set_higher_ts(output, &out);
-
-	/* when both video and audio have been received, we're ready
-	 * to start sending out packets (one at a time) */
-	if (output->received_audio && output->received_video) {
-		if (!was_started) {
-			if (prune_interleaved_packets(output)) {
-				if (initialize_interleaved_packets(output)) {
-					resort_interleaved_packets(output);
-					send_interleaved(output);
-				}
-			}
-		} else {
-			send_interleaved(output);
-		}
-	}
+	/* packets are sent one at a time, once both video and audio have been
+	 * received */
+	obs_interleaver_push(&output->interleaver, packet,
+			!output->active_delay_ns, num_audio_mixes(output));
+	if (obs_interleaver_pop(&output->interleaver, &out))
+		send_interleaved(output, &out);
 
 	pthread_mutex_unlock(&output->interleaved_mutex);
 }
@@ -1549,16 +1124,7 @@ static inline void start_raw_audio(obs_output_t *output)
 
 static void reset_packet_data(obs_output_t *output)
 {
-	output->received_audio   = false;
-	output->received_video   = false;
-	output->highest_audio_ts = 0;
-	output->highest_video_ts = 0;
-	output->video_offset     = 0;
-
-	for (size_t i = 0; i < MAX_AUDIO_MIXES; i++)
-		output->audio_offsets[i] = 0;
-
-	free_packets(output);
+	obs_interleaver_free(&output->interleaver);
 }
 
 static inline bool preserve_active(struct obs_output *output)
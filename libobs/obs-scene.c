@@ -18,6 +18,7 @@
 
 #include "util/threading.h"
 #include "graphics/math-defs.h"
+#include "media-io/audio-mix.h"
 #include "obs-scene.h"
 
 const struct obs_source_info group_info;
@@ -95,6 +96,9 @@ static void *scene_create(obs_data_t *settings, struct obs_source *source)
 
 	signal_handler_add_array(obs_source_get_signal_handler(source),
 			obs_scene_signals);
+	scene->item_transform_signal = signal_handler_get_id(
+			obs_source_get_signal_handler(source),
+			"item_transform");
 
 	if (pthread_mutexattr_init(&attr) != 0)
 		goto fail;
@@ -137,6 +141,12 @@ static inline void full_unlock(struct obs_scene *scene)
 	video_unlock(scene);
 }
 
+static inline void mark_transform_dirty(struct obs_scene_item *item)
+{
+	os_atomic_set_bool(&item->update_transform, true);
+	os_atomic_inc_long(&obs->data.scene_dirty_gen);
+}
+
 static void set_visibility(struct obs_scene_item *item, bool vis);
 static inline void detach_sceneitem(struct obs_scene_item *item);
 
@@ -179,6 +189,7 @@ static void scene_destroy(void *data)
 	struct obs_scene *scene = data;
 
 	remove_all_items(scene);
+	da_free(scene->render_items);
 
 	pthread_mutex_destroy(&scene->video_mutex);
 	pthread_mutex_destroy(&scene->audio_mutex);
@@ -411,7 +422,9 @@ static void update_item_transform(struct obs_scene_item *item, bool update_tex)
 
 	calldata_init_fixed(&params, stack, sizeof(stack));
 	calldata_set_ptr(&params, "item", item);
-	signal_parent(item->parent, "item_transform", &params);
+	calldata_set_ptr(&params, "scene", item->parent);
+	signal_handler_signal_id(item->parent->source->context.signals,
+			item->parent->item_transform_signal, &params);
 
 	if (!update_tex)
 		return;
@@ -510,10 +523,18 @@ static inline void render_item(struct obs_scene_item *item)
 	if (item->item_render) {
 		uint32_t width  = obs_source_get_width(item->source);
 		uint32_t height = obs_source_get_height(item->source);
+		uint32_t frame  = obs->video.total_frames;
 
 		if (!width || !height)
 			return;
 
+		/* only render the texture once per frame, even if the scene
+		 * is drawn more than once */
+		if (item->item_render_frame != frame) {
+			gs_texrender_reset(item->item_render);
+			item->item_render_frame = frame;
+		}
+
 		uint32_t cx = calc_cx(item, width);
 		uint32_t cy = calc_cy(item, height);
 
@@ -551,23 +572,6 @@ static inline void render_item(struct obs_scene_item *item)
 	gs_matrix_pop();
 }
 
-static void scene_video_tick(void *data, float seconds)
-{
-	struct obs_scene *scene = data;
-	struct obs_scene_item *item;
-
-	video_lock(scene);
-	item = scene->first_item;
-	while (item) {
-		if (item->item_render)
-			gs_texrender_reset(item->item_render);
-		item = item->next;
-	}
-	video_unlock(scene);
-
-	UNUSED_PARAMETER(seconds);
-}
-
 /* assumes video lock */
 static void update_transforms_and_prune_sources(obs_scene_t *scene,
 		struct darray *remove_items, obs_sceneitem_t *group_sceneitem)
@@ -611,35 +615,247 @@ static void update_transforms_and_prune_sources(obs_scene_t *scene,
 		resize_group(group_sceneitem);
 }
 
+/* ------------------------------------------------------------------------- */
+/* occlusion culling                                                         */
+
+#define MAX_OCCLUDERS 8
+
+struct occluder {
+	struct vec2 min;
+	struct vec2 max;
+};
+
+struct occluders {
+	struct occluder rects[MAX_OCCLUDERS];
+	size_t          num;
+};
+
+static inline bool transform_axis_aligned(const struct matrix4 *m)
+{
+	return close_float(m->x.y, 0.0f, EPSILON) &&
+		close_float(m->y.x, 0.0f, EPSILON);
+}
+
+/* gets the size of the quad the item draws before its draw transform */
+static inline bool get_item_draw_size(const struct obs_scene_item *item,
+		uint32_t *cx, uint32_t *cy)
+{
+	uint32_t width  = obs_source_get_width(item->source);
+	uint32_t height = obs_source_get_height(item->source);
+
+	if (!width || !height)
+		return false;
+
+	*cx = calc_cx(item, width);
+	*cy = calc_cy(item, height);
+	return true;
+}
+
+static void get_transformed_bounds(const struct matrix4 *inner,
+		const struct matrix4 *outer, uint32_t cx, uint32_t cy,
+		struct occluder *bounds)
+{
+	vec2_set(&bounds->min, M_INFINITE, M_INFINITE);
+	vec2_set(&bounds->max, -M_INFINITE, -M_INFINITE);
+
+	for (int i = 0; i < 4; i++) {
+		struct vec3 v;
+		struct vec2 v2;
+
+		vec3_set(&v, (i & 1) ? (float)cx : 0.0f,
+				(i & 2) ? (float)cy : 0.0f, 0.0f);
+		vec3_transform(&v, &v, inner);
+		if (outer)
+			vec3_transform(&v, &v, outer);
+
+		vec2_set(&v2, v.x, v.y);
+		vec2_min(&bounds->min, &bounds->min, &v2);
+		vec2_max(&bounds->max, &bounds->max, &v2);
+	}
+}
+
+static inline bool bounds_inside(const struct occluder *bounds,
+		const struct occluder *rect)
+{
+	return bounds->min.x >= rect->min.x && bounds->min.y >= rect->min.y &&
+		bounds->max.x <= rect->max.x && bounds->max.y <= rect->max.y;
+}
+
+static bool item_occluded(const struct occluders *occluders,
+		const struct occluder *bounds)
+{
+	for (size_t i = 0; i < occluders->num; i++) {
+		if (bounds_inside(bounds, &occluders->rects[i]))
+			return true;
+	}
+
+	return false;
+}
+
+static inline float occluder_area(const struct occluder *rect)
+{
+	return (rect->max.x - rect->min.x) * (rect->max.y - rect->min.y);
+}
+
+/* keeps the largest occluders if there are more than fit */
+static void add_occluder(struct occluders *occluders,
+		const struct occluder *rect)
+{
+	size_t smallest = 0;
+
+	if (occluders->num < MAX_OCCLUDERS) {
+		occluders->rects[occluders->num++] = *rect;
+		return;
+	}
+
+	for (size_t i = 1; i < MAX_OCCLUDERS; i++) {
+		if (occluder_area(&occluders->rects[i]) <
+		    occluder_area(&occluders->rects[smallest]))
+			smallest = i;
+	}
+
+	if (occluder_area(rect) > occluder_area(&occluders->rects[smallest]))
+		occluders->rects[smallest] = *rect;
+}
+
+/* only axis aligned items can be occluders, as their bounds are exactly the
+ * area they draw */
+static void add_item_occluder(struct occluders *occluders,
+		const struct obs_scene_item *item, const struct matrix4 *outer,
+		const struct occluder *bounds)
+{
+	if (!transform_axis_aligned(&item->draw_transform))
+		return;
+	if (outer && !transform_axis_aligned(outer))
+		return;
+	if (!obs_source_opaque(item->source))
+		return;
+
+	add_occluder(occluders, bounds);
+}
+
+/* the opaque items of a group cover the parent scene as well */
+static void add_group_occluders(struct occluders *occluders,
+		struct obs_scene_item *group_item)
+{
+	obs_scene_t *group_scene = group_item->source->context.data;
+	struct obs_scene_item *item;
+
+	if (!transform_axis_aligned(&group_item->draw_transform))
+		return;
+
+	video_lock(group_scene);
+
+	for (item = group_scene->first_item; item; item = item->next) {
+		struct occluder bounds;
+		uint32_t cx, cy;
+
+		if (!item->user_visible || item->is_group)
+			continue;
+		if (!get_item_draw_size(item, &cx, &cy))
+			continue;
+
+		get_transformed_bounds(&item->draw_transform,
+				&group_item->draw_transform, cx, cy, &bounds);
+		add_item_occluder(occluders, item, &group_item->draw_transform,
+				&bounds);
+	}
+
+	video_unlock(group_scene);
+}
+
+/* marks the items that are completely covered by opaque items above them.
+ * the bounds of an item are those of the quad it draws, so this assumes that
+ * sources don't draw outside of their own size */
+static void cull_occluded_items(struct obs_scene *scene)
+{
+	struct occluders occluders = {0};
+	struct obs_scene_item *item = scene->first_item;
+
+	if (!item)
+		return;
+
+	while (item->next)
+		item = item->next;
+
+	for (; item; item = item->prev) {
+		struct occluder bounds;
+		uint32_t cx, cy;
+
+		item->culled = false;
+
+		if (!item->user_visible)
+			continue;
+		if (!get_item_draw_size(item, &cx, &cy))
+			continue;
+
+		get_transformed_bounds(&item->draw_transform, NULL, cx, cy,
+				&bounds);
+
+		if (item_occluded(&occluders, &bounds)) {
+			item->culled = true;
+			continue;
+		}
+
+		if (item->is_group)
+			add_group_occluders(&occluders, item);
+		else
+			add_item_occluder(&occluders, item, NULL, &bounds);
+	}
+}
+
+/* assumes video lock */
+static void get_render_items(struct obs_scene *scene)
+{
+	struct obs_scene_item *item = scene->first_item;
+
+	while (item) {
+		if (item->user_visible && !item->culled) {
+			obs_sceneitem_addref(item);
+			da_push_back(scene->render_items, &item);
+		}
+
+		item = item->next;
+	}
+}
+
 static void scene_video_render(void *data, gs_effect_t *effect)
 {
 	DARRAY(struct obs_scene_item*) remove_items;
 	struct obs_scene *scene = data;
-	struct obs_scene_item *item;
 
 	da_init(remove_items);
 
 	video_lock(scene);
 
+	/* groups are updated by the scene that contains them */
 	if (!scene->is_group) {
-		update_transforms_and_prune_sources(scene, &remove_items.da,
-				NULL);
+		long dirty_gen = os_atomic_load_long(
+				&obs->data.scene_dirty_gen);
+
+		if (dirty_gen != scene->dirty_gen) {
+			scene->dirty_gen = dirty_gen;
+			update_transforms_and_prune_sources(scene,
+					&remove_items.da, NULL);
+		}
 	}
 
+	cull_occluded_items(scene);
+	get_render_items(scene);
+
+	video_unlock(scene);
+
 	gs_blend_state_push();
 	gs_reset_blend_state();
 
-	item = scene->first_item;
-	while (item) {
-		if (item->user_visible)
-			render_item(item);
-
-		item = item->next;
-	}
+	for (size_t i = 0; i < scene->render_items.num; i++)
+		render_item(scene->render_items.array[i]);
 
 	gs_blend_state_pop();
 
-	video_unlock(scene);
+	for (size_t i = 0; i < scene->render_items.num; i++)
+		obs_sceneitem_release(scene->render_items.array[i]);
+	da_resize(scene->render_items, 0);
 
 	for (size_t i = 0; i < remove_items.num; i++)
 		obs_sceneitem_release(remove_items.array[i]);
@@ -1001,27 +1217,16 @@ static void process_all_audio_actions(struct obs_scene_item *item,
 	while (apply_scene_item_volume(item, NULL, 0, sample_rate));
 }
 
-static void mix_audio_with_buf(float *p_out, float *p_in, float *buf_in,
-		size_t pos, size_t count)
+static inline void mix_audio_with_buf(float *p_out, float *p_in,
+		float *buf_in, size_t pos, size_t count)
 {
-	register float *out = p_out;
-	register float *buf = buf_in + pos;
-	register float *in = p_in + pos;
-	register float *end = in + count;
-
-	while (in < end)
-		*(out++) += *(in++) * *(buf++);
+	audio_mix_add_mul(p_out, p_in + pos, buf_in + pos, count);
 }
 
 static inline void mix_audio(float *p_out, float *p_in,
 		size_t pos, size_t count)
 {
-	register float *out = p_out;
-	register float *in = p_in + pos;
-	register float *end = in + count;
-
-	while (in < end)
-		*(out++) += *(in++);
+	audio_mix_add(p_out, p_in + pos, count);
 }
 
 static bool scene_audio_render(void *data, uint64_t *ts_out,
@@ -1128,7 +1333,6 @@ const struct obs_source_info scene_info =
 	.get_name      = scene_getname,
 	.create        = scene_create,
 	.destroy       = scene_destroy,
-	.video_tick    = scene_video_tick,
 	.video_render  = scene_video_render,
 	.audio_render  = scene_audio_render,
 	.get_width     = scene_getwidth,
@@ -1149,7 +1353,6 @@ const struct obs_source_info group_info =
 	.get_name      = group_getname,
 	.create        = scene_create,
 	.destroy       = scene_destroy,
-	.video_tick    = scene_video_tick,
 	.video_render  = scene_video_render,
 	.audio_render  = scene_audio_render,
 	.get_width     = scene_getwidth,
@@ -1262,7 +1465,7 @@ static inline void duplicate_item_data(struct obs_scene_item *dst,
 	obs_sceneitem_set_crop(dst, &src->crop);
 
 	if (defer_texture_update) {
-		os_atomic_set_bool(&dst->update_transform, true);
+		mark_transform_dirty(dst);
 	} else {
 		if (!dst->item_render && item_texture_enabled(dst)) {
 			obs_enter_graphics();
@@ -1627,6 +1830,7 @@ static obs_sceneitem_t *obs_scene_add_internal(obs_scene_t *scene,
 	vec2_set(&item->scale, 1.0f, 1.0f);
 	matrix4_identity(&item->draw_transform);
 	matrix4_identity(&item->box_transform);
+	mark_transform_dirty(item);
 
 	obs_source_addref(source);
 
@@ -1799,7 +2003,7 @@ bool obs_sceneitem_selected(const obs_sceneitem_t *item)
 #define do_update_transform(item) \
 	do { \
 		if (!item->parent || item->parent->is_group) \
-			os_atomic_set_bool(&item->update_transform, true); \
+			mark_transform_dirty(item); \
 		else \
 			update_item_transform(item, false); \
 	} while (false)
@@ -2207,7 +2411,7 @@ void obs_sceneitem_set_crop(obs_sceneitem_t *item,
 	if (item->crop.top < 0) item->crop.top = 0;
 	if (item->crop.bottom < 0) item->crop.bottom = 0;
 
-	os_atomic_set_bool(&item->update_transform, true);
+	mark_transform_dirty(item);
 }
 
 void obs_sceneitem_get_crop(const obs_sceneitem_t *item,
@@ -2229,7 +2433,7 @@ void obs_sceneitem_set_scale_filter(obs_sceneitem_t *item,
 
 	item->scale_filter = filter;
 
-	os_atomic_set_bool(&item->update_transform, true);
+	mark_transform_dirty(item);
 }
 
 enum obs_scale_type obs_sceneitem_get_scale_filter(
@@ -2269,8 +2473,10 @@ void obs_sceneitem_defer_group_resize_end(obs_sceneitem_t *item)
 	if (!obs_ptr_valid(item, "obs_sceneitem_defer_group_resize_end"))
 		return;
 
-	if (os_atomic_dec_long(&item->defer_group_resize) == 0)
+	if (os_atomic_dec_long(&item->defer_group_resize) == 0) {
 		os_atomic_set_bool(&item->update_group_resize, true);
+		os_atomic_inc_long(&obs->data.scene_dirty_gen);
+	}
 }
 
 int64_t obs_sceneitem_get_id(const obs_sceneitem_t *item)
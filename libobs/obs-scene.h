@@ -48,7 +48,11 @@ struct obs_scene_item {
 	bool                  selected;
 	bool                  locked;
 
+	/* completely covered by opaque items above it when last rendered */
+	bool                  culled;
+
 	gs_texrender_t        *item_render;
+	uint32_t              item_render_frame;
 	struct obs_sceneitem_crop crop;
 
 	struct vec2           pos;
@@ -93,7 +97,17 @@ struct obs_scene {
 
 	int64_t               id_counter;
 
+	signal_id_t           *item_transform_signal;
+
 	pthread_mutex_t       video_mutex;
 	pthread_mutex_t       audio_mutex;
 	struct obs_scene_item *first_item;
+
+	/* value of obs->data.scene_dirty_gen when the item transforms were
+	 * last checked */
+	long                  dirty_gen;
+
+	/* referenced copy of the items to draw, so that drawing them doesn't
+	 * hold the video mutex.  only used by the graphics thread */
+	DARRAY(struct obs_scene_item*) render_items;
 };
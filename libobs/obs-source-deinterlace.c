@@ -380,7 +380,7 @@ static void enable_deinterlacing(obs_source_t *source,
 		remove_async_frame(source, source->prev_async_frame);
 		source->prev_async_frame = NULL;
 	}
-	pthread_mutex_unlock(&source->async_mutex);
+	unlock_async_mutex(source);
 
 	obs_leave_graphics();
 }
@@ -21,8 +21,10 @@
 #include "media-io/format-conversion.h"
 #include "media-io/video-frame.h"
 #include "media-io/audio-io.h"
+#include "media-io/audio-mix.h"
 #include "util/threading.h"
 #include "util/platform.h"
+#include "util/hash.h"
 #include "callback/calldata.h"
 #include "graphics/matrix3.h"
 #include "graphics/vec3.h"
@@ -514,10 +516,59 @@ void obs_source_frame_init(struct obs_source_frame *frame,
 	}
 }
 
-static inline void obs_source_frame_decref(struct obs_source_frame *frame)
+static inline size_t find_borrowed_frame(obs_source_t *source,
+		const struct obs_source_frame *frame)
 {
-	if (os_atomic_dec_long(&frame->refs) == 0)
+	for (size_t i = 0; i < source->async_borrowed.num; i++) {
+		if (source->async_borrowed.array[i].frame == frame)
+			return i;
+	}
+
+	return DARRAY_INVALID;
+}
+
+/* frames output with obs_source_output_video_no_copy don't own their data,
+ * it's handed back to the source once async_mutex has been unlocked */
+static void free_async_frame(obs_source_t *source,
+		struct obs_source_frame *frame)
+{
+	size_t idx = frame ? find_borrowed_frame(source, frame) :
+		DARRAY_INVALID;
+
+	if (idx != DARRAY_INVALID) {
+		da_push_back(source->async_released,
+				&source->async_borrowed.array[idx]);
+		da_erase(source->async_borrowed, idx);
+	} else {
 		obs_source_frame_destroy(frame);
+	}
+}
+
+static inline void obs_source_frame_decref(obs_source_t *source,
+		struct obs_source_frame *frame)
+{
+	if (os_atomic_dec_long(&frame->refs) == 0)
+		free_async_frame(source, frame);
+}
+
+/* unlocks async_mutex and only then calls the release callbacks of borrowed
+ * frames that were freed while it was locked, so a callback can safely call
+ * back into the source */
+void unlock_async_mutex(obs_source_t *source)
+{
+	DARRAY(struct borrowed_frame) released;
+
+	released.da = source->async_released.da;
+	da_init(source->async_released);
+	pthread_mutex_unlock(&source->async_mutex);
+
+	for (size_t i = 0; i < released.num; i++) {
+		struct borrowed_frame *bf = &released.array[i];
+		bf->release(bf->param, bf->frame);
+		bfree(bf->frame);
+	}
+
+	da_free(released);
 }
 
 static bool obs_source_filter_remove_refless(obs_source_t *source,
@@ -567,8 +618,13 @@ void obs_source_destroy(struct obs_source *source)
 	obs_hotkey_unregister(source->push_to_mute_key);
 	obs_hotkey_pair_unregister(source->mute_unmute_key);
 
+	pthread_mutex_lock(&source->async_mutex);
 	for (i = 0; i < source->async_cache.num; i++)
-		obs_source_frame_decref(source->async_cache.array[i].frame);
+		obs_source_frame_decref(source,
+				source->async_cache.array[i].frame);
+	da_push_back_da(source->async_released, source->async_borrowed);
+	da_resize(source->async_borrowed, 0);
+	unlock_async_mutex(source);
 
 	gs_enter_context(obs->video.graphics);
 	if (source->async_texrender)
@@ -581,6 +637,8 @@ void obs_source_destroy(struct obs_source *source)
 		gs_texture_destroy(source->async_prev_texture);
 	if (source->filter_texrender)
 		gs_texrender_destroy(source->filter_texrender);
+	if (source->render_cache)
+		gs_texrender_destroy(source->render_cache);
 	gs_leave_context();
 
 	for (i = 0; i < MAX_AV_PLANES; i++)
@@ -599,7 +657,10 @@ void obs_source_destroy(struct obs_source *source)
 	da_free(source->audio_cb_list);
 	da_free(source->async_cache);
 	da_free(source->async_frames);
+	da_free(source->async_borrowed);
+	da_free(source->async_released);
 	da_free(source->filters);
+	da_free(source->fused_shaders);
 	pthread_mutex_destroy(&source->filter_mutex);
 	pthread_mutex_destroy(&source->audio_actions_mutex);
 	pthread_mutex_destroy(&source->audio_buf_mutex);
@@ -700,6 +761,7 @@ void obs_source_remove(obs_source_t *source)
 
 	if (!source->removed) {
 		source->removed = true;
+		os_atomic_inc_long(&obs->data.scene_dirty_gen);
 		obs_source_dosignal(source, "source_remove", "remove");
 	}
 }
@@ -803,6 +865,8 @@ static void obs_source_deferred_update(obs_source_t *source)
 		source->info.update(source->context.data,
 				source->context.settings);
 
+	obs_source_mark_dirty(source);
+
 	source->defer_update = false;
 }
 
@@ -822,6 +886,14 @@ void obs_source_update(obs_source_t *source, obs_data_t *settings)
 	}
 }
 
+void obs_source_mark_dirty(obs_source_t *source)
+{
+	if (!obs_source_valid(source, "obs_source_mark_dirty"))
+		return;
+
+	os_atomic_inc_long(&source->render_cache_gen);
+}
+
 void obs_source_update_properties(obs_source_t *source)
 {
 	if (!obs_source_valid(source, "obs_source_update_properties"))
@@ -1020,13 +1092,34 @@ static void async_tick(obs_source_t *source)
 	}
 
 	source->last_sys_timestamp = sys_time;
-	pthread_mutex_unlock(&source->async_mutex);
+	unlock_async_mutex(source);
 
 	if (source->cur_async_frame)
 		source->async_update_texture = set_async_texture_size(source,
 				source->cur_async_frame);
 }
 
+/* lets scenes know that the transforms of their items may be out of date.
+ * sizes can change at any time without any notification, so they're checked
+ * once per tick here rather than once per scene item */
+static inline void check_size_changed(obs_source_t *source)
+{
+	uint32_t cx, cy;
+
+	if (source->filter_parent ||
+	    (source->info.output_flags & OBS_SOURCE_VIDEO) == 0)
+		return;
+
+	cx = obs_source_get_width(source);
+	cy = obs_source_get_height(source);
+
+	if (cx != source->tick_width || cy != source->tick_height) {
+		source->tick_width  = cx;
+		source->tick_height = cy;
+		os_atomic_inc_long(&obs->data.scene_dirty_gen);
+	}
+}
+
 void obs_source_video_tick(obs_source_t *source, float seconds)
 {
 	bool now_showing, now_active;
@@ -1074,6 +1167,8 @@ void obs_source_video_tick(obs_source_t *source, float seconds)
 	if (source->context.data && source->info.video_tick)
 		source->info.video_tick(source->context.data, seconds);
 
+	check_size_changed(source);
+
 	source->async_rendered = false;
 	source->deinterlace_rendered = false;
 }
@@ -1528,18 +1623,6 @@ static const char *select_conversion_technique(enum video_format format)
 	return NULL;
 }
 
-static inline void set_eparam(gs_effect_t *effect, const char *name, float val)
-{
-	gs_eparam_t *param = gs_effect_get_param_by_name(effect, name);
-	gs_effect_set_float(param, val);
-}
-
-static inline void set_eparami(gs_effect_t *effect, const char *name, int val)
-{
-	gs_eparam_t *param = gs_effect_get_param_by_name(effect, name);
-	gs_effect_set_int(param, val);
-}
-
 static bool update_async_texrender(struct obs_source *source,
 		const struct obs_source_frame *frame,
 		gs_texture_t *tex, gs_texrender_t *texrender)
@@ -1554,6 +1637,7 @@ static bool update_async_texrender(struct obs_source *source,
 	float convert_width  = (float)source->async_convert_width;
 
 	gs_effect_t *conv = obs->video.conversion_effect;
+	struct obs_conversion_params *params = &obs->video.conversion_params;
 	gs_technique_t *tech = gs_effect_get_technique(conv,
 			select_conversion_technique(frame->format));
 
@@ -1563,18 +1647,20 @@ static bool update_async_texrender(struct obs_source *source,
 	gs_technique_begin(tech);
 	gs_technique_begin_pass(tech, 0);
 
-	gs_effect_set_texture(gs_effect_get_param_by_name(conv, "image"), tex);
-	set_eparam(conv, "width",  (float)cx);
-	set_eparam(conv, "height", (float)cy);
-	set_eparam(conv, "width_d2",  cx * 0.5f);
-	set_eparam(conv, "width_d2_i",  1.0f / (cx * 0.5f));
-	set_eparam(conv, "input_width_i_d2",  (1.0f / convert_width)  * 0.5f);
-
-	set_eparami(conv, "int_width", (int)cx);
-	set_eparami(conv, "int_input_width", (int)source->async_convert_width);
-	set_eparami(conv, "int_u_plane_offset",
+	gs_effect_set_texture(params->image, tex);
+	gs_effect_set_float(params->width,  (float)cx);
+	gs_effect_set_float(params->height, (float)cy);
+	gs_effect_set_float(params->width_d2,  cx * 0.5f);
+	gs_effect_set_float(params->width_d2_i,  1.0f / (cx * 0.5f));
+	gs_effect_set_float(params->input_width_i_d2,
+			(1.0f / convert_width)  * 0.5f);
+
+	gs_effect_set_int(params->int_width, (int)cx);
+	gs_effect_set_int(params->int_input_width,
+			(int)source->async_convert_width);
+	gs_effect_set_int(params->int_u_plane_offset,
 			(int)source->async_plane_offset[0]);
-	set_eparami(conv, "int_v_plane_offset",
+	gs_effect_set_int(params->int_v_plane_offset,
 			(int)source->async_plane_offset[1]);
 
 	gs_ortho(0.f, (float)cx, 0.f, (float)cy, -100.f, 100.f);
@@ -1783,7 +1869,15 @@ static inline void obs_source_main_render(obs_source_t *source)
 				custom_draw ? NULL : gs_get_effect());
 }
 
+static inline bool filter_fusable(const obs_source_t *filter)
+{
+	return filter->info.get_fused_shader &&
+		filter->info.set_fused_params &&
+		filter->context.data;
+}
+
 static bool ready_async_frame(obs_source_t *source, uint64_t sys_time);
+static bool render_fused_filters(obs_source_t *filter);
 
 static inline void render_video(obs_source_t *source)
 {
@@ -1811,6 +1905,10 @@ static inline void render_video(obs_source_t *source)
 	if (source->filters.num && !source->rendering_filter)
 		obs_source_render_filters(source);
 
+	else if (source->filter_parent && filter_fusable(source) &&
+	         render_fused_filters(source))
+		return;
+
 	else if (source->info.video_render)
 		obs_source_main_render(source);
 
@@ -1824,13 +1922,188 @@ static inline void render_video(obs_source_t *source)
 		obs_source_render_async_video(source);
 }
 
+static inline bool cacheable(const obs_source_t *source)
+{
+	return (source->info.output_flags & OBS_SOURCE_CACHEABLE) != 0 &&
+		source->filters.num == 0;
+}
+
+static inline bool use_render_cache(obs_source_t *source)
+{
+	uint32_t flags = source->info.output_flags;
+
+	/* the cached texture is drawn with its own effect, so the cache is
+	 * only used when the caller isn't rendering with its own effect */
+	return (flags & (OBS_SOURCE_CACHED_RENDER | OBS_SOURCE_CACHEABLE)) &&
+		source->info.type == OBS_SOURCE_TYPE_INPUT &&
+		!source->filter_parent &&
+		!source->rendering_filter &&
+		!source->rendering_cache &&
+		source->enabled &&
+		source->context.data &&
+		!gs_get_effect();
+}
+
+struct render_cache_tree {
+	uint64_t gen;
+	bool     changing;
+};
+
+static void get_render_cache_tree_gen(obs_source_t *parent,
+		obs_source_t *child, void *param)
+{
+	struct render_cache_tree *tree = param;
+
+	/* transitions are static unless they're transitioning, everything
+	 * else they render is checked as a child of its own */
+	if (child->info.type == OBS_SOURCE_TYPE_TRANSITION) {
+		if (child->transitioning_video)
+			tree->changing = true;
+	} else if ((child->info.output_flags & OBS_SOURCE_VIDEO) != 0 &&
+	           !cacheable(child)) {
+		tree->changing = true;
+	}
+
+	tree->gen = tree->gen * 31 + (uint64_t)(uintptr_t)child;
+	tree->gen = tree->gen * 31 +
+		(uint64_t)os_atomic_load_long(&child->render_cache_gen);
+
+	UNUSED_PARAMETER(parent);
+}
+
+/* gets a value that changes whenever the source or any of its active child
+ * sources are marked dirty, or false if they aren't static right now */
+static bool get_render_cache_gen(obs_source_t *source, uint64_t *gen)
+{
+	struct render_cache_tree tree = {
+		(uint64_t)os_atomic_load_long(&source->render_cache_gen),
+		false
+	};
+
+	obs_source_enum_active_tree(source, get_render_cache_tree_gen, &tree);
+
+	*gen = tree.gen;
+	return !tree.changing;
+}
+
+static void render_to_cache(obs_source_t *source, uint32_t cx, uint32_t cy)
+{
+	struct vec4 clear_color;
+
+	if (!source->render_cache)
+		source->render_cache = gs_texrender_create(GS_RGBA,
+				GS_ZS_NONE);
+	else
+		gs_texrender_reset(source->render_cache);
+
+	source->render_cache_valid = false;
+
+	/* composite the output with premultiplied alpha, so that sources
+	 * which draw several overlapping sprites look the same when the
+	 * texture is drawn */
+	gs_blend_state_push();
+	gs_blend_function_separate(
+			GS_BLEND_SRCALPHA, GS_BLEND_INVSRCALPHA,
+			GS_BLEND_ONE, GS_BLEND_INVSRCALPHA);
+
+	if (gs_texrender_begin(source->render_cache, cx, cy)) {
+		vec4_zero(&clear_color);
+		gs_clear(GS_CLEAR_COLOR, &clear_color, 0.0f, 0);
+		gs_ortho(0.0f, (float)cx, 0.0f, (float)cy, -100.0f, 100.0f);
+
+		source->rendering_cache = true;
+		render_video(source);
+		source->rendering_cache = false;
+
+		gs_texrender_end(source->render_cache);
+		source->render_cache_valid = true;
+	}
+
+	gs_blend_state_pop();
+
+	source->render_cache_cx = cx;
+	source->render_cache_cy = cy;
+}
+
+static inline bool render_cache_current(const obs_source_t *source,
+		uint32_t cx, uint32_t cy)
+{
+	return source->render_cache_valid &&
+		source->render_cache_cx == cx &&
+		source->render_cache_cy == cy;
+}
+
+/* draws the source from its cached texture, which is rendered once per frame,
+ * or only when the source is marked dirty if its output is static */
+static bool render_video_cached(obs_source_t *source)
+{
+	uint32_t frame = obs->video.total_frames;
+	uint32_t cx = obs_source_get_width(source);
+	uint32_t cy = obs_source_get_height(source);
+	bool per_frame;
+	bool is_static = false;
+	gs_effect_t *effect;
+	gs_technique_t *tech;
+	gs_texture_t *tex;
+	size_t passes, i;
+	uint64_t gen = 0;
+
+	if (!cx || !cy)
+		return false;
+
+	if (!render_cache_current(source, cx, cy) ||
+	    source->render_cache_frame != frame) {
+		if (cacheable(source))
+			is_static = get_render_cache_gen(source, &gen);
+
+		if (!is_static || !source->render_cache_static ||
+		    source->render_cache_tree_gen != gen ||
+		    !render_cache_current(source, cx, cy)) {
+			/* sources that are only shown once are rendered
+			 * directly unless their output is static, as caching
+			 * them would just add a pass */
+			per_frame = (source->info.output_flags &
+					OBS_SOURCE_CACHED_RENDER) != 0 &&
+				os_atomic_load_long(&source->show_refs) > 1;
+			if (!is_static && !per_frame)
+				return false;
+
+			render_to_cache(source, cx, cy);
+			source->render_cache_tree_gen = gen;
+			source->render_cache_static = is_static;
+		}
+
+		source->render_cache_frame = frame;
+	}
+
+	tex = source->render_cache_valid ?
+		gs_texrender_get_texture(source->render_cache) : NULL;
+	if (!tex)
+		return false;
+
+	effect = obs->video.premultiplied_alpha_effect;
+	tech = gs_effect_get_technique(effect, "Draw");
+	gs_effect_set_texture(gs_effect_get_param_by_name(effect, "image"),
+			tex);
+
+	passes = gs_technique_begin(tech);
+	for (i = 0; i < passes; i++) {
+		gs_technique_begin_pass(tech, i);
+		gs_draw_sprite(tex, 0, cx, cy);
+		gs_technique_end_pass(tech);
+	}
+	gs_technique_end(tech);
+	return true;
+}
+
 void obs_source_video_render(obs_source_t *source)
 {
 	if (!obs_source_valid(source, "obs_source_video_render"))
 		return;
 
 	obs_source_addref(source);
-	render_video(source);
+	if (!use_render_cache(source) || !render_video_cached(source))
+		render_video(source);
 	obs_source_release(source);
 }
 
@@ -1920,6 +2193,38 @@ uint32_t obs_source_get_height(obs_source_t *source)
 		get_base_height(source);
 }
 
+static inline bool async_format_opaque(enum video_format format)
+{
+	return format != VIDEO_FORMAT_NONE &&
+		format != VIDEO_FORMAT_RGBA &&
+		format != VIDEO_FORMAT_BGRA;
+}
+
+bool obs_source_opaque(obs_source_t *source)
+{
+	uint32_t flags;
+
+	if (!data_valid(source, "obs_source_opaque"))
+		return false;
+
+	/* filters can change the alpha or size of the output */
+	if (!source->enabled || source->filters.num)
+		return false;
+
+	flags = source->info.output_flags;
+	if ((flags & OBS_SOURCE_VIDEO) == 0)
+		return false;
+
+	if (source->info.is_opaque)
+		return source->info.is_opaque(source->context.data);
+
+	if ((flags & OBS_SOURCE_ASYNC) != 0 && !source->info.video_render)
+		return source->async_active &&
+			async_format_opaque(source->async_format);
+
+	return false;
+}
+
 uint32_t obs_source_get_base_width(obs_source_t *source)
 {
 	if (!data_valid(source, "obs_source_get_base_width"))
@@ -2320,7 +2625,8 @@ static inline bool async_texture_changed(struct obs_source *source,
 static inline void free_async_cache(struct obs_source *source)
 {
 	for (size_t i = 0; i < source->async_cache.num; i++)
-		obs_source_frame_decref(source->async_cache.array[i].frame);
+		obs_source_frame_decref(source,
+				source->async_cache.array[i].frame);
 
 	da_resize(source->async_cache, 0);
 	da_resize(source->async_frames, 0);
@@ -2338,7 +2644,7 @@ static void clean_cache(obs_source_t *source)
 		struct async_frame *af = &source->async_cache.array[i - 1];
 		if (!af->used) {
 			if (++af->unused_count == MAX_UNUSED_FRAME_DURATION) {
-				obs_source_frame_destroy(af->frame);
+				free_async_frame(source, af->frame);
 				da_erase(source->async_cache, i - 1);
 			}
 		}
@@ -2357,7 +2663,7 @@ static inline struct obs_source_frame *cache_video(struct obs_source *source,
 	if (source->async_frames.num >= MAX_ASYNC_FRAMES) {
 		free_async_cache(source);
 		source->last_frame_ts = 0;
-		pthread_mutex_unlock(&source->async_mutex);
+		unlock_async_mutex(source);
 		return NULL;
 	}
 
@@ -2399,7 +2705,7 @@ static inline struct obs_source_frame *cache_video(struct obs_source *source,
 
 	os_atomic_inc_long(&new_frame->refs);
 
-	pthread_mutex_unlock(&source->async_mutex);
+	unlock_async_mutex(source);
 
 	copy_frame_data(new_frame, frame);
 
@@ -2424,14 +2730,121 @@ void obs_source_output_video(obs_source_t *source,
 	pthread_mutex_lock(&source->async_mutex);
 	if (output) {
 		if (os_atomic_dec_long(&output->refs) == 0) {
-			obs_source_frame_destroy(output);
+			free_async_frame(source, output);
 			output = NULL;
 		} else {
 			da_push_back(source->async_frames, &output);
 			source->async_active = true;
 		}
 	}
-	pthread_mutex_unlock(&source->async_mutex);
+	unlock_async_mutex(source);
+}
+
+/* the frame is uploaded as-is, so planar formats must be laid out the same
+ * way obs_source_frame_create would lay them out */
+static bool frame_layout_matches(const struct obs_source_frame *frame)
+{
+	uint32_t width  = frame->width;
+	uint32_t height = frame->height;
+
+	switch (frame->format) {
+	case VIDEO_FORMAT_I420:
+		return frame->linesize[0] == width &&
+		       frame->linesize[1] == width / 2 &&
+		       frame->linesize[2] == width / 2 &&
+		       frame->data[1] == frame->data[0] + width * height &&
+		       frame->data[2] == frame->data[1] +
+				(width / 2) * (height / 2);
+
+	case VIDEO_FORMAT_NV12:
+		return frame->linesize[0] == width &&
+		       frame->linesize[1] == width &&
+		       frame->data[1] == frame->data[0] + width * height;
+
+	case VIDEO_FORMAT_Y800:
+	case VIDEO_FORMAT_NONE:
+		return false;
+
+	case VIDEO_FORMAT_YVYU:
+	case VIDEO_FORMAT_YUY2:
+	case VIDEO_FORMAT_UYVY:
+	case VIDEO_FORMAT_RGBA:
+	case VIDEO_FORMAT_BGRA:
+	case VIDEO_FORMAT_BGRX:
+	case VIDEO_FORMAT_I444:
+		return true;
+	}
+
+	return false;
+}
+
+void obs_source_output_video_no_copy(obs_source_t *source,
+		const struct obs_source_frame *frame,
+		void (*release)(void *param, struct obs_source_frame *frame),
+		void *param)
+{
+	struct obs_source_frame *new_frame;
+	struct borrowed_frame borrowed;
+	struct async_frame new_af;
+
+	if (!obs_ptr_valid(release, "obs_source_output_video_no_copy"))
+		return;
+	if (!obs_source_valid(source, "obs_source_output_video_no_copy")) {
+		if (frame)
+			release(param, (struct obs_source_frame*)frame);
+		return;
+	}
+
+	if (!frame) {
+		source->async_active = false;
+		return;
+	}
+
+	/* fall back to copying anything that can't be uploaded directly */
+	if (!frame_layout_matches(frame)) {
+		obs_source_output_video(source, frame);
+		release(param, (struct obs_source_frame*)frame);
+		return;
+	}
+
+	new_frame = bmemdup(frame, sizeof(*frame));
+	new_frame->refs       = 1;
+	new_frame->prev_frame = false;
+
+	borrowed.frame   = new_frame;
+	borrowed.release = release;
+	borrowed.param   = param;
+
+	pthread_mutex_lock(&source->async_mutex);
+
+	da_push_back(source->async_borrowed, &borrowed);
+
+	if (source->async_frames.num >= MAX_ASYNC_FRAMES) {
+		free_async_cache(source);
+		source->last_frame_ts = 0;
+		free_async_frame(source, new_frame);
+		unlock_async_mutex(source);
+		return;
+	}
+
+	if (async_texture_changed(source, frame)) {
+		free_async_cache(source);
+		source->async_cache_width  = frame->width;
+		source->async_cache_height = frame->height;
+		source->async_cache_format = frame->format;
+	}
+
+	clean_cache(source);
+
+	new_af.frame        = new_frame;
+	new_af.used         = true;
+	new_af.unused_count = 0;
+	da_push_back(source->async_cache, &new_af);
+
+	da_push_back(source->async_frames, &new_frame);
+	source->async_active = true;
+
+	unlock_async_mutex(source);
 }
 
 static inline bool preload_frame_changed(obs_source_t *source,
@@ -2709,7 +3122,15 @@ void remove_async_frame(obs_source_t *source, struct obs_source_frame *frame)
 		struct async_frame *f = &source->async_cache.array[i];
 
 		if (f->frame == frame) {
-			f->used = false;
+			/* borrowed frames are never reused, give the data
+			 * back to the source as soon as possible */
+			if (find_borrowed_frame(source, frame) !=
+					DARRAY_INVALID) {
+				da_erase(source->async_cache, i);
+				obs_source_frame_decref(source, frame);
+			} else {
+				f->used = false;
+			}
 			break;
 		}
 	}
@@ -2864,11 +3285,11 @@ void obs_source_release_frame(obs_source_t *source,
 		pthread_mutex_lock(&source->async_mutex);
 
 		if (os_atomic_dec_long(&frame->refs) == 0)
-			obs_source_frame_destroy(frame);
+			free_async_frame(source, frame);
 		else
 			remove_async_frame(source, frame);
 
-		pthread_mutex_unlock(&source->async_mutex);
+		unlock_async_mutex(source);
 	}
 }
 
@@ -2957,6 +3378,39 @@ static inline bool can_bypass(obs_source_t *target, obs_source_t *parent,
 		((parent_flags & OBS_SOURCE_ASYNC) == 0);
 }
 
+static void render_filter_target(obs_source_t *filter, obs_source_t *target,
+		obs_source_t *parent, enum gs_color_format format,
+		int cx, int cy)
+{
+	uint32_t parent_flags = parent->info.output_flags;
+
+	if (!filter->filter_texrender)
+		filter->filter_texrender = gs_texrender_create(format,
+				GS_ZS_NONE);
+
+	gs_blend_state_push();
+	gs_blend_function(GS_BLEND_ONE, GS_BLEND_ZERO);
+
+	if (gs_texrender_begin(filter->filter_texrender, cx, cy)) {
+		bool custom_draw = (parent_flags & OBS_SOURCE_CUSTOM_DRAW) != 0;
+		bool async = (parent_flags & OBS_SOURCE_ASYNC) != 0;
+		struct vec4 clear_color;
+
+		vec4_zero(&clear_color);
+		gs_clear(GS_CLEAR_COLOR, &clear_color, 0.0f, 0);
+		gs_ortho(0.0f, (float)cx, 0.0f, (float)cy, -100.0f, 100.0f);
+
+		if (target == parent && !custom_draw && !async)
+			obs_source_default_render(target);
+		else
+			obs_source_video_render(target);
+
+		gs_texrender_end(filter->filter_texrender);
+	}
+
+	gs_blend_state_pop();
+}
+
 bool obs_source_process_filter_begin(obs_source_t *filter,
 		enum gs_color_format format,
 		enum obs_allow_direct_render allow_direct)
@@ -3001,31 +3455,7 @@ bool obs_source_process_filter_begin(obs_source_t *filter,
 		return false;
 	}
 
-	if (!filter->filter_texrender)
-		filter->filter_texrender = gs_texrender_create(format,
-				GS_ZS_NONE);
-
-	gs_blend_state_push();
-	gs_blend_function(GS_BLEND_ONE, GS_BLEND_ZERO);
-
-	if (gs_texrender_begin(filter->filter_texrender, cx, cy)) {
-		bool custom_draw = (parent_flags & OBS_SOURCE_CUSTOM_DRAW) != 0;
-		bool async = (parent_flags & OBS_SOURCE_ASYNC) != 0;
-		struct vec4 clear_color;
-
-		vec4_zero(&clear_color);
-		gs_clear(GS_CLEAR_COLOR, &clear_color, 0.0f, 0);
-		gs_ortho(0.0f, (float)cx, 0.0f, (float)cy, -100.0f, 100.0f);
-
-		if (target == parent && !custom_draw && !async)
-			obs_source_default_render(target);
-		else
-			obs_source_video_render(target);
-
-		gs_texrender_end(filter->filter_texrender);
-	}
-
-	gs_blend_state_pop();
+	render_filter_target(filter, target, parent, format, cx, cy);
 	return true;
 }
 
@@ -3111,6 +3541,291 @@ void obs_source_skip_video_filter(obs_source_t *filter)
 	}
 }
 
+/* ------------------------------------------------------------------------- */
+/* fused filters                                                             */
+
+#define MAX_FUSED_FILTERS 8
+#define FUSED_PREFIX "FILTER_"
+
+static const char *fused_effect_header =
+"uniform float4x4 ViewProj;\n"
+"uniform texture2d image;\n"
+"\n"
+"sampler_state fused_sampler {\n"
+"	Filter   = Linear;\n"
+"	AddressU = Clamp;\n"
+"	AddressV = Clamp;\n"
+"};\n"
+"\n"
+"struct VertInOut {\n"
+"	float4 pos : POSITION;\n"
+"	float2 uv  : TEXCOORD0;\n"
+"};\n"
+"\n"
+"VertInOut VSDefault(VertInOut vert_in)\n"
+"{\n"
+"	VertInOut vert_out;\n"
+"	vert_out.pos = mul(float4(vert_in.pos.xyz, 1.0), ViewProj);\n"
+"	vert_out.uv  = vert_in.uv;\n"
+"	return vert_out;\n"
+"}\n";
+
+static const char *fused_effect_footer =
+"technique Draw\n"
+"{\n"
+"	pass\n"
+"	{\n"
+"		vertex_shader = VSDefault(vert_in);\n"
+"		pixel_shader  = PSDrawFused(vert_in);\n"
+"	}\n"
+"}\n";
+
+struct fused_filter {
+	obs_source_t                *filter;
+	const char                  *shader;
+	struct obs_fused_shader_key key;
+};
+
+/* builds the effect of a run of filters.  the filters of the run are applied
+ * from the last one (closest to the parent) to the first one, and the result
+ * of each filter is clamped as it would be when rendered to a texture */
+static void build_fused_effect(struct dstr *code,
+		const struct fused_filter *run, size_t count)
+{
+	struct dstr shader = {0};
+	size_t i;
+
+	dstr_copy(code, fused_effect_header);
+
+	for (i = 0; i < count; i++) {
+		struct dstr prefix = {0};
+
+		dstr_printf(&prefix, "f%d_", (int)i);
+		dstr_copy(&shader, run[i].shader);
+		dstr_replace(&shader, FUSED_PREFIX, prefix.array);
+
+		dstr_catf(code, "\n%s\n", shader.array);
+		dstr_free(&prefix);
+	}
+
+	dstr_cat(code, "\nfloat4 PSDrawFused(VertInOut vert_in) : TARGET\n{\n"
+			"\tfloat4 rgba = image.Sample(fused_sampler, "
+			"vert_in.uv);\n");
+
+	for (i = count; i > 1; i--)
+		dstr_catf(code, "\trgba = saturate(f%d_process(rgba));\n",
+				(int)i - 1);
+
+	dstr_cat(code, "\treturn f0_process(rgba);\n}\n\n");
+	dstr_cat(code, fused_effect_footer);
+
+	dstr_free(&shader);
+}
+
+static gs_effect_t *find_fused_effect(const struct dstr *code, uint64_t hash)
+{
+	struct obs_core_video *video = &obs->video;
+
+	for (size_t i = 0; i < video->fused_effects.num; i++) {
+		struct obs_fused_effect *fused =
+			video->fused_effects.array + i;
+
+		if (fused->hash == hash && strcmp(fused->code, code->array) == 0)
+			return fused->effect;
+	}
+
+	return NULL;
+}
+
+/* fused effects are cached by their code, so that chains of the same filter
+ * types share the same effect.  effects that fail to compile are cached as
+ * well so that they're not compiled every frame */
+static gs_effect_t *get_fused_effect(const struct fused_filter *run,
+		size_t count)
+{
+	struct obs_fused_effect fused = {0};
+	struct dstr code = {0};
+	char *errors = NULL;
+	gs_effect_t *effect;
+
+	build_fused_effect(&code, run, count);
+	fused.hash = fnv1a_hash(code.array, code.len);
+
+	effect = find_fused_effect(&code, fused.hash);
+	if (effect) {
+		dstr_free(&code);
+		return effect;
+	}
+
+	fused.code = code.array;
+	fused.effect = gs_effect_create(code.array, NULL, &errors);
+	if (!fused.effect)
+		blog(LOG_WARNING, "Failed to compile the fused effect of "
+				"filter '%s': %s", run[0].filter->context.name,
+				errors ? errors : "(unknown error)");
+
+	da_push_back(obs->video.fused_effects, &fused);
+	bfree(errors);
+	return fused.effect;
+}
+
+static inline bool same_fused_shaders(const obs_source_t *head,
+		const struct fused_filter *run, size_t count)
+{
+	if (head->fused_shaders.num != count)
+		return false;
+
+	for (size_t i = 0; i < count; i++) {
+		const struct obs_fused_shader_key *key =
+			head->fused_shaders.array + i;
+
+		if (key->hash != run[i].key.hash ||
+		    strcmp(key->id, run[i].key.id) != 0)
+			return false;
+	}
+
+	return true;
+}
+
+/* the effect is kept by the first filter of the run as long as the filters
+ * and their code don't change, so that it isn't looked up every frame */
+static gs_effect_t *get_run_effect(obs_source_t *head,
+		const struct fused_filter *run, size_t count)
+{
+	if (!same_fused_shaders(head, run, count)) {
+		da_resize(head->fused_shaders, count);
+		for (size_t i = 0; i < count; i++)
+			head->fused_shaders.array[i] = run[i].key;
+
+		head->fused_effect = get_fused_effect(run, count);
+	}
+
+	return head->fused_effect;
+}
+
+/* gets the consecutive fusable filters starting at 'filter', skipping
+ * disabled ones, along with the target of the last of them */
+static size_t get_fused_run(obs_source_t *filter, struct fused_filter *run,
+		obs_source_t **target)
+{
+	obs_source_t *parent = filter->filter_parent;
+	size_t count = 0;
+	size_t idx;
+
+	pthread_mutex_lock(&parent->filter_mutex);
+
+	idx = da_find(parent->filters, &filter, 0);
+
+	for (size_t i = idx; i < parent->filters.num; i++) {
+		obs_source_t *cur = parent->filters.array[i];
+		const char *shader;
+
+		if (count && !cur->enabled)
+			continue;
+		if (count == MAX_FUSED_FILTERS || !filter_fusable(cur))
+			break;
+
+		shader = cur->info.get_fused_shader(cur->context.data);
+		if (!shader)
+			break;
+
+		obs_source_addref(cur);
+		run[count].filter = cur;
+		run[count].shader = shader;
+		run[count].key.id = cur->info.id;
+		run[count].key.hash = fnv1a_hash(shader, strlen(shader));
+		count++;
+	}
+
+	if (count) {
+		*target = run[count - 1].filter->filter_target;
+		obs_source_addref(*target);
+	}
+
+	pthread_mutex_unlock(&parent->filter_mutex);
+	return count;
+}
+
+static void set_fused_params(struct fused_filter *run, size_t count,
+		gs_effect_t *effect)
+{
+	for (size_t i = 0; i < count; i++) {
+		obs_source_t *filter = run[i].filter;
+
+		filter->fused_index = (int)i;
+		filter->info.set_fused_params(filter->context.data, effect);
+	}
+}
+
+/* renders a run of consecutive per-pixel filters in a single pass instead of
+ * one pass per filter.  returns false if the filter should be rendered on its
+ * own */
+static bool render_fused_filters(obs_source_t *filter)
+{
+	struct fused_filter run[MAX_FUSED_FILTERS];
+	obs_source_t *parent = filter->filter_parent;
+	obs_source_t *target = NULL;
+	gs_effect_t *effect = NULL;
+	uint32_t parent_flags;
+	bool rendered = false;
+	size_t count;
+	int cx, cy;
+
+	count = get_fused_run(filter, run, &target);
+	if (count < 2)
+		goto release;
+
+	effect = get_run_effect(filter, run, count);
+	if (!effect)
+		goto release;
+
+	parent_flags = parent->info.output_flags;
+	set_fused_params(run, count, effect);
+
+	/* fused filters always allow rendering the parent directly */
+	if (can_bypass(target, parent, parent_flags,
+				OBS_ALLOW_DIRECT_RENDERING)) {
+		render_filter_bypass(target, effect, "Draw");
+		rendered = true;
+		goto release;
+	}
+
+	cx = get_base_width(target);
+	cy = get_base_height(target);
+	if (!cx || !cy)
+		goto release;
+
+	render_filter_target(filter, target, parent, GS_RGBA, cx, cy);
+
+	if (gs_texrender_get_texture(filter->filter_texrender))
+		render_filter_tex(
+				gs_texrender_get_texture(
+					filter->filter_texrender),
+				effect, 0, 0, "Draw");
+	rendered = true;
+
+release:
+	for (size_t i = 0; i < count; i++)
+		obs_source_release(run[i].filter);
+	obs_source_release(target);
+	return rendered;
+}
+
+gs_eparam_t *obs_filter_get_fused_param(obs_source_t *filter,
+		gs_effect_t *effect, const char *name)
+{
+	char fused_name[256];
+
+	if (!obs_ptr_valid(filter, "obs_filter_get_fused_param"))
+		return NULL;
+	if (!obs_ptr_valid(name, "obs_filter_get_fused_param"))
+		return NULL;
+
+	snprintf(fused_name, sizeof(fused_name), "f%d_%s",
+			filter->fused_index, name);
+	return gs_effect_get_param_by_name(effect, fused_name);
+}
+
 signal_handler_t *obs_source_get_signal_handler(const obs_source_t *source)
 {
 	return obs_source_valid(source, "obs_source_get_signal_handler") ?
@@ -3280,7 +3995,7 @@ static void enum_source_full_tree_callback(obs_source_t *parent,
 	data->enum_callback(parent, child, data->param);
 }
 
-static void obs_source_enum_full_tree(obs_source_t *source,
+void obs_source_enum_full_tree(obs_source_t *source,
 		obs_source_enum_proc_t enum_callback,
 		void *param)
 {
@@ -3828,24 +4543,16 @@ static float get_source_volume(obs_source_t *source, uint64_t os_time)
 static inline void multiply_output_audio(obs_source_t *source, size_t mix,
 		size_t channels, float vol)
 {
-	register float *out = source->audio_output_buf[mix][0];
-	register float *end = out + AUDIO_OUTPUT_FRAMES * channels;
-
-	while (out < end)
-		*(out++) *= vol;
+	audio_mix_mul_scalar(source->audio_output_buf[mix][0], vol,
+			AUDIO_OUTPUT_FRAMES * channels);
 }
 
 static inline void multiply_vol_data(obs_source_t *source, size_t mix,
 		size_t channels, float *vol_data)
 {
-	for (size_t ch = 0; ch < channels; ch++) {
-		register float *out = source->audio_output_buf[mix][ch];
-		register float *end = out + AUDIO_OUTPUT_FRAMES;
-		register float *vol = vol_data;
-
-		while (out < end)
-			*(out++) *= *(vol++);
-	}
+	for (size_t ch = 0; ch < channels; ch++)
+		audio_mix_mul(source->audio_output_buf[mix][ch], vol_data,
+				AUDIO_OUTPUT_FRAMES);
 }
 
 static inline void apply_audio_action(obs_source_t *source,
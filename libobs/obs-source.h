@@ -140,6 +140,47 @@ enum obs_balance_type {
  */
 #define OBS_SOURCE_CAP_DISABLED (1<<10)
 
+/**
+ * Source is rendered at most once per frame
+ *
+ * When used, the first time the source is rendered in a frame its output
+ * (including its filters) is rendered to a texture, and that texture is drawn
+ * for every other time the source is rendered in the same frame, such as when
+ * it's used in several scenes, projectors or the multiview.
+ *
+ * This should only be used by sources whose output looks the same when
+ * rendered to a texture first, such as sources that draw sprites with the
+ * default blending.  It must not be used by sources that render differently
+ * depending on where they are drawn.
+ */
+#define OBS_SOURCE_CACHED_RENDER (1<<11)
+
+/**
+ * Source output is static until it's marked dirty
+ *
+ * When used, the output of the source is rendered to a texture and that
+ * texture is drawn until the source calls obs_source_mark_dirty, which libobs
+ * also does after the source is updated.  The cache is only used while the
+ * source has no filters, and is also rendered again when any active child
+ * source is marked dirty or isn't static itself.
+ *
+ * The same restrictions as for OBS_SOURCE_CACHED_RENDER apply.
+ */
+#define OBS_SOURCE_CACHEABLE (1<<12)
+
+/**
+ * Source can be ticked from a worker thread
+ *
+ * When used, video_tick (and show/hide/activate/deactivate, which are called
+ * from the tick) may be called from a video worker thread at the same time as
+ * the ticks of other sources with this flag.  It is never called at the same
+ * time as the tick of a child source, a parent source or a filter of the
+ * source, and a parent source is always ticked before its children.  Sources
+ * without this flag are ticked one at a time on the graphics thread, never at
+ * the same time as any of these.
+ */
+#define OBS_SOURCE_PARALLEL_TICK (1<<13)
+
 /** @} */
 
 typedef void (*obs_source_enum_proc_t)(obs_source_t *parent,
@@ -247,7 +288,8 @@ struct obs_source_info {
 	void (*hide)(void *data);
 
 	/**
-	 * Called each video frame with the time elapsed
+	 * Called each video frame with the time elapsed.  Called from the
+	 * graphics thread unless the source has OBS_SOURCE_PARALLEL_TICK.
 	 *
 	 * @param  data     Source data
 	 * @param  seconds  Seconds elapsed since the last frame
@@ -457,6 +499,50 @@ struct obs_source_info {
 	 * @return          The properties data
 	 */
 	obs_properties_t *(*get_properties2)(void *data, void *type_data);
+
+	/**
+	 * Gets the shader code of a filter that changes each pixel of its
+	 * target without looking at any other pixel, so that libobs can
+	 * render it in the same pass as the filters next to it in the
+	 * filter chain.
+	 *
+	 * The code is added to an effect with the "image" texture of the
+	 * target, and must declare a "float4 FILTER_process(float4 rgba)"
+	 * function that returns the filtered color of a pixel.  All names
+	 * declared by the code must start with "FILTER_", which is replaced
+	 * with a prefix that's unique within the effect.
+	 *
+	 * The returned string must not change for as long as it's returned.
+	 * Fused filters always allow their parent to be rendered directly.
+	 *
+	 * @param  data  Filter data
+	 * @return       The shader code, or NULL to render the filter on its
+	 *               own with video_render
+	 */
+	const char *(*get_fused_shader)(void *data);
+
+	/**
+	 * Sets the parameters of the shader code of get_fused_shader when the
+	 * filter is rendered along with other filters.  Required if
+	 * get_fused_shader is used.  Use obs_filter_get_fused_param to get
+	 * the parameters of the code.
+	 *
+	 * @param  data    Filter data
+	 * @param  effect  Effect the code of the filter was added to
+	 */
+	void (*set_fused_params)(void *data, gs_effect_t *effect);
+
+	/**
+	 * Returns whether the source currently draws every pixel of its
+	 * area (its width and height) fully opaque.  Scenes skip drawing
+	 * items that are completely covered by opaque items.
+	 *
+	 * Asynchronous video sources don't need to implement this.
+	 *
+	 * @param  data  Source data
+	 * @return       true if the source is opaque, false if unknown
+	 */
+	bool (*is_opaque)(void *data);
 };
 
 EXPORT void obs_register_source_s(const struct obs_source_info *info,
@@ -24,7 +24,264 @@
 #include "media-io/format-conversion.h"
 #include "media-io/video-frame.h"
 
-static uint64_t tick_sources(uint64_t cur_time, uint64_t last_time)
+/* ------------------------------------------------------------------------- */
+/* source tick scheduling                                                     */
+
+/*
+ * When a work pool is available, sources are ticked one tree depth at a time,
+ * so that a parent source always ticks before its children and a source
+ * before its filters.  Within each depth, sources without
+ * OBS_SOURCE_PARALLEL_TICK are first ticked one at a time on the graphics
+ * thread in list order, and the sources with it are then ticked in parallel.
+ * Children are found through the full tree of each source, hidden children
+ * included, so related sources are never at the same depth and never tick at
+ * the same time.
+ */
+
+struct tick_entry {
+	struct obs_source *source;
+	size_t            idx;
+	size_t            level;
+	size_t            parents;
+	bool              parallel;
+};
+
+struct tick_edge {
+	size_t            from;
+	size_t            to;
+};
+
+struct tick_schedule {
+	DARRAY(struct tick_entry)  sources;
+	DARRAY(struct tick_entry)  lookup;
+	DARRAY(struct tick_edge)   edges;
+	DARRAY(size_t)             first_edges;
+	DARRAY(size_t)             ready;
+	DARRAY(struct obs_source*) order;
+	DARRAY(size_t)             phase_ends;
+};
+
+struct tick_job {
+	struct obs_source **sources;
+	float             seconds;
+};
+
+static void tick_schedule_free(struct tick_schedule *sched)
+{
+	da_free(sched->sources);
+	da_free(sched->lookup);
+	da_free(sched->edges);
+	da_free(sched->first_edges);
+	da_free(sched->ready);
+	da_free(sched->order);
+	da_free(sched->phase_ends);
+}
+
+static int cmp_tick_entry_source(const void *a, const void *b)
+{
+	uintptr_t sa = (uintptr_t)((const struct tick_entry*)a)->source;
+	uintptr_t sb = (uintptr_t)((const struct tick_entry*)b)->source;
+	return (sa > sb) - (sa < sb);
+}
+
+static int cmp_tick_edge_from(const void *a, const void *b)
+{
+	size_t fa = ((const struct tick_edge*)a)->from;
+	size_t fb = ((const struct tick_edge*)b)->from;
+	return (fa > fb) - (fa < fb);
+}
+
+static size_t find_tick_entry(struct tick_schedule *sched,
+		struct obs_source *source)
+{
+	struct tick_entry key = {source, 0, 0, 0, false};
+	struct tick_entry *entry;
+
+	entry = bsearch(&key, sched->lookup.array, sched->lookup.num,
+			sizeof(key), cmp_tick_entry_source);
+	return entry ? entry->idx : DARRAY_INVALID;
+}
+
+static void add_tick_edge(struct tick_schedule *sched,
+		struct obs_source *parent, struct obs_source *child)
+{
+	struct tick_edge edge;
+
+	edge.from = find_tick_entry(sched, parent);
+	edge.to   = find_tick_entry(sched, child);
+
+	if (edge.from == DARRAY_INVALID || edge.to == DARRAY_INVALID ||
+	    edge.from == edge.to)
+		return;
+
+	da_push_back(sched->edges, &edge);
+}
+
+static void add_tick_tree_edge(obs_source_t *parent, obs_source_t *child,
+		void *param)
+{
+	add_tick_edge(param, parent, child);
+}
+
+static void build_tick_schedule(struct tick_schedule *sched)
+{
+	struct tick_entry *sources = sched->sources.array;
+	size_t num = sched->sources.num;
+	size_t *first_edges;
+	size_t *ends;
+	size_t phases = 0;
+
+	da_copy(sched->lookup, sched->sources);
+	qsort(sched->lookup.array, num, sizeof(struct tick_entry),
+			cmp_tick_entry_source);
+
+	da_resize(sched->edges, 0);
+	for (size_t i = 0; i < num; i++) {
+		struct obs_source *source = sources[i].source;
+
+		obs_source_enum_full_tree(source, add_tick_tree_edge, sched);
+		if (source->filter_parent)
+			add_tick_edge(sched, source->filter_parent, source);
+	}
+
+	qsort(sched->edges.array, sched->edges.num, sizeof(struct tick_edge),
+			cmp_tick_edge_from);
+
+	/* first_edges[i] is the first edge leaving source i */
+	da_resize(sched->first_edges, num + 1);
+	first_edges = sched->first_edges.array;
+	memset(first_edges, 0, (num + 1) * sizeof(size_t));
+
+	for (size_t i = 0; i < sched->edges.num; i++) {
+		struct tick_edge *edge = sched->edges.array + i;
+
+		first_edges[edge->from + 1]++;
+		sources[edge->to].parents++;
+	}
+	for (size_t i = 1; i <= num; i++)
+		first_edges[i] += first_edges[i - 1];
+
+	/* give each source a level one higher than any of its parents, once
+	 * all of its parents have their final level */
+	da_resize(sched->ready, 0);
+	for (size_t i = 0; i < num; i++) {
+		if (!sources[i].parents)
+			da_push_back(sched->ready, &i);
+	}
+
+	for (size_t i = 0; i < sched->ready.num; i++) {
+		size_t from = sched->ready.array[i];
+		size_t level = sources[from].level + 1;
+
+		for (size_t j = first_edges[from]; j < first_edges[from + 1];
+				j++) {
+			size_t to = sched->edges.array[j].to;
+
+			if (sources[to].level < level)
+				sources[to].level = level;
+			if (--sources[to].parents == 0)
+				da_push_back(sched->ready, &to);
+		}
+	}
+
+	/* sources that are part of a reference loop never get all of their
+	 * parents ticked first, so at least never tick them in parallel */
+	for (size_t i = 0; i < num; i++) {
+		if (sources[i].parents)
+			sources[i].parallel = false;
+	}
+
+	/* each level has a serial phase followed by a parallel phase.  order
+	 * the sources by phase, keeping list order within a phase */
+	for (size_t i = 0; i < num; i++) {
+		size_t phase = sources[i].level * 2 + sources[i].parallel;
+		if (phase + 1 > phases)
+			phases = phase + 1;
+	}
+
+	da_resize(sched->phase_ends, phases + 1);
+	ends = sched->phase_ends.array;
+	memset(ends, 0, (phases + 1) * sizeof(size_t));
+
+	for (size_t i = 0; i < num; i++)
+		ends[sources[i].level * 2 + sources[i].parallel + 1]++;
+	for (size_t i = 1; i <= phases; i++)
+		ends[i] += ends[i - 1];
+
+	da_resize(sched->order, num);
+	for (size_t i = 0; i < num; i++) {
+		size_t phase = sources[i].level * 2 + sources[i].parallel;
+		sched->order.array[ends[phase]++] = sources[i].source;
+	}
+
+	/* ends[i] is now the end of phase i */
+	da_resize(sched->phase_ends, phases);
+}
+
+static void tick_source_job(void *param, size_t idx)
+{
+	struct tick_job *job = param;
+	obs_source_video_tick(job->sources[idx], job->seconds);
+}
+
+static void tick_sources_parallel(struct tick_schedule *sched, float seconds)
+{
+	struct obs_core_data *data = &obs->data;
+	struct obs_source    *source;
+	size_t               start = 0;
+
+	da_resize(sched->sources, 0);
+
+	/* the sources are held by references instead of the list mutex so
+	 * that a source can be released from a worker thread without
+	 * deadlocking */
+	pthread_mutex_lock(&data->sources_mutex);
+
+	source = data->first_source;
+	while (source) {
+		struct tick_entry entry = {
+			obs_source_get_ref(source), 0, 0, 0, false
+		};
+
+		if (entry.source) {
+			entry.idx = sched->sources.num;
+			entry.parallel = (source->info.output_flags &
+					OBS_SOURCE_PARALLEL_TICK) != 0;
+			da_push_back(sched->sources, &entry);
+		}
+
+		source = (struct obs_source*)source->context.next;
+	}
+
+	pthread_mutex_unlock(&data->sources_mutex);
+
+	if (!sched->sources.num)
+		return;
+
+	build_tick_schedule(sched);
+
+	for (size_t i = 0; i < sched->phase_ends.num; i++) {
+		size_t end = sched->phase_ends.array[i];
+		struct tick_job job = {sched->order.array + start, seconds};
+
+		if ((i & 1) == 0) {
+			for (size_t j = start; j < end; j++)
+				obs_source_video_tick(sched->order.array[j],
+						seconds);
+		} else if (end > start) {
+			work_pool_run(obs->video.work_pool, tick_source_job,
+					&job, end - start);
+		}
+
+		start = end;
+	}
+
+	for (size_t i = 0; i < sched->sources.num; i++)
+		obs_source_release(sched->sources.array[i].source);
+}
+
+static uint64_t tick_sources(struct tick_schedule *sched,
+		uint64_t cur_time, uint64_t last_time)
 {
 	struct obs_core_data *data = &obs->data;
 	struct obs_source    *source;
@@ -54,6 +311,11 @@ static uint64_t tick_sources(uint64_t cur_time, uint64_t last_time)
 	/* ------------------------------------- */
 	/* call the tick function of each source */
 
+	if (obs->video.work_pool) {
+		tick_sources_parallel(sched, seconds);
+		return cur_time;
+	}
+
 	pthread_mutex_lock(&data->sources_mutex);
 
 	source = data->first_source;
@@ -250,12 +512,6 @@ end:
 	profile_end(render_output_texture_name);
 }
 
-static inline void set_eparam(gs_effect_t *effect, const char *name, float val)
-{
-	gs_eparam_t *param = gs_effect_get_param_by_name(effect, name);
-	gs_effect_set_float(param, val);
-}
-
 static const char *render_convert_texture_name = "render_convert_texture";
 static void render_convert_texture(struct obs_core_video *video,
 		int cur_texture, int prev_texture)
@@ -268,27 +524,28 @@ static void render_convert_texture(struct obs_core_video *video,
 	float        fheight = (float)video->output_height;
 	size_t       passes, i;
 
-	gs_effect_t    *effect  = video->conversion_effect;
-	gs_eparam_t    *image   = gs_effect_get_param_by_name(effect, "image");
-	gs_technique_t *tech    = gs_effect_get_technique(effect,
-			video->conversion_tech);
+	struct obs_conversion_params *params = &video->conversion_params;
+	gs_technique_t *tech    = params->technique;
 
 	if (!video->textures_output[prev_texture])
 		goto end;
 
-	set_eparam(effect, "u_plane_offset", (float)video->plane_offsets[1]);
-	set_eparam(effect, "v_plane_offset", (float)video->plane_offsets[2]);
-	set_eparam(effect, "width",  fwidth);
-	set_eparam(effect, "height", fheight);
-	set_eparam(effect, "width_i",  1.0f / fwidth);
-	set_eparam(effect, "height_i", 1.0f / fheight);
-	set_eparam(effect, "width_d2",  fwidth  * 0.5f);
-	set_eparam(effect, "height_d2", fheight * 0.5f);
-	set_eparam(effect, "width_d2_i",  1.0f / (fwidth  * 0.5f));
-	set_eparam(effect, "height_d2_i", 1.0f / (fheight * 0.5f));
-	set_eparam(effect, "input_height", (float)video->conversion_height);
-
-	gs_effect_set_texture(image, texture);
+	gs_effect_set_float(params->u_plane_offset,
+			(float)video->plane_offsets[1]);
+	gs_effect_set_float(params->v_plane_offset,
+			(float)video->plane_offsets[2]);
+	gs_effect_set_float(params->width,  fwidth);
+	gs_effect_set_float(params->height, fheight);
+	gs_effect_set_float(params->width_i,  1.0f / fwidth);
+	gs_effect_set_float(params->height_i, 1.0f / fheight);
+	gs_effect_set_float(params->width_d2,  fwidth  * 0.5f);
+	gs_effect_set_float(params->height_d2, fheight * 0.5f);
+	gs_effect_set_float(params->width_d2_i,  1.0f / (fwidth  * 0.5f));
+	gs_effect_set_float(params->height_d2_i, 1.0f / (fheight * 0.5f));
+	gs_effect_set_float(params->input_height,
+			(float)video->conversion_height);
+
+	gs_effect_set_texture(params->image, texture);
 
 	gs_set_render_target(target, NULL);
 	set_render_size(video->output_width, video->conversion_height);
@@ -460,52 +717,118 @@ static void set_gpu_converted_data(struct obs_core_video *video,
 	}
 }
 
-static void convert_frame(
-		struct video_frame *output, const struct video_data *input,
-		const struct video_output_info *info)
+struct convert_job {
+	struct video_frame             *output;
+	const struct video_data        *input;
+	const struct video_output_info *info;
+	uint32_t                       slice_height;
+};
+
+/* slices are kept to an even number of lines so chroma subsampling never
+ * straddles two slices */
+static inline void get_slice(const struct convert_job *job, size_t idx,
+		uint32_t *start_y, uint32_t *end_y)
 {
+	*start_y = (uint32_t)idx * job->slice_height;
+	*end_y = *start_y + job->slice_height;
+	if (*end_y > job->info->height)
+		*end_y = job->info->height;
+}
+
+static void convert_frame_slice(void *param, size_t idx)
+{
+	const struct convert_job *job = param;
+	const struct video_data *input = job->input;
+	struct video_frame *output = job->output;
+	const struct video_output_info *info = job->info;
+	uint32_t start_y, end_y;
+
+	get_slice(job, idx, &start_y, &end_y);
+
 	if (info->format == VIDEO_FORMAT_I420) {
 		compress_uyvx_to_i420(
 				input->data[0], input->linesize[0],
-				0, info->height,
+				start_y, end_y,
 				output->data, output->linesize);
 
 	} else if (info->format == VIDEO_FORMAT_NV12) {
 		compress_uyvx_to_nv12(
 				input->data[0], input->linesize[0],
-				0, info->height,
+				start_y, end_y,
 				output->data, output->linesize);
 
 	} else if (info->format == VIDEO_FORMAT_I444) {
 		convert_uyvx_to_i444(
 				input->data[0], input->linesize[0],
-				0, info->height,
+				start_y, end_y,
 				output->data, output->linesize);
-
-	} else {
-		blog(LOG_ERROR, "convert_frame: unsupported texture format");
 	}
 }
 
-static inline void copy_rgbx_frame(
-		struct video_frame *output, const struct video_data *input,
-		const struct video_output_info *info)
+static void copy_rgbx_frame_slice(void *param, size_t idx)
 {
-	uint8_t *in_ptr = input->data[0];
-	uint8_t *out_ptr = output->data[0];
+	const struct convert_job *job = param;
+	const struct video_data *input = job->input;
+	struct video_frame *output = job->output;
+	uint32_t start_y, end_y;
+
+	get_slice(job, idx, &start_y, &end_y);
+
+	uint8_t *in_ptr = input->data[0] + start_y * input->linesize[0];
+	uint8_t *out_ptr = output->data[0] + start_y * output->linesize[0];
 
 	/* if the line sizes match, do a single copy */
 	if (input->linesize[0] == output->linesize[0]) {
-		memcpy(out_ptr, in_ptr, input->linesize[0] * info->height);
+		memcpy(out_ptr, in_ptr,
+				input->linesize[0] * (end_y - start_y));
 	} else {
-		for (size_t y = 0; y < info->height; y++) {
-			memcpy(out_ptr, in_ptr, info->width * 4);
+		for (uint32_t y = start_y; y < end_y; y++) {
+			memcpy(out_ptr, in_ptr, job->info->width * 4);
 			in_ptr += input->linesize[0];
 			out_ptr += output->linesize[0];
 		}
 	}
 }
 
+static void run_convert_job(struct obs_core_video *video,
+		work_pool_func_t func, struct video_frame *output,
+		const struct video_data *input,
+		const struct video_output_info *info)
+{
+	struct convert_job job = {output, input, info, 0};
+	size_t slices = work_pool_get_width(video->work_pool);
+
+	job.slice_height = (info->height + (uint32_t)slices - 1) /
+		(uint32_t)slices;
+	job.slice_height = (job.slice_height + 1) & ~1;
+	if (!job.slice_height)
+		return;
+
+	slices = (info->height + job.slice_height - 1) / job.slice_height;
+	work_pool_run(video->work_pool, func, &job, slices);
+}
+
+static void convert_frame(struct obs_core_video *video,
+		struct video_frame *output, const struct video_data *input,
+		const struct video_output_info *info)
+{
+	if (info->format != VIDEO_FORMAT_I420 &&
+	    info->format != VIDEO_FORMAT_NV12 &&
+	    info->format != VIDEO_FORMAT_I444) {
+		blog(LOG_ERROR, "convert_frame: unsupported texture format");
+		return;
+	}
+
+	run_convert_job(video, convert_frame_slice, output, input, info);
+}
+
+static inline void copy_rgbx_frame(struct obs_core_video *video,
+		struct video_frame *output, const struct video_data *input,
+		const struct video_output_info *info)
+{
+	run_convert_job(video, copy_rgbx_frame_slice, output, input, info);
+}
+
 static inline void output_video_data(struct obs_core_video *video,
 		struct video_data *input_frame, int count)
 {
@@ -523,9 +846,10 @@ static inline void output_video_data(struct obs_core_video *video,
 					input_frame, info);
 
 		} else if (format_is_yuv(info->format)) {
-			convert_frame(&output_frame, input_frame, info);
+			convert_frame(video, &output_frame, input_frame, info);
 		} else {
-			copy_rgbx_frame(&output_frame, input_frame, info);
+			copy_rgbx_frame(video, &output_frame, input_frame,
+					info);
 		}
 
 		video_output_unlock_frame(video->video);
@@ -626,6 +950,7 @@ static const char *render_displays_name = "render_displays";
 static const char *output_frame_name = "output_frame";
 void *obs_graphics_thread(void *param)
 {
+	struct tick_schedule tick_schedule = {0};
 	uint64_t last_time = 0;
 	uint64_t interval = video_output_get_frame_time(obs->video.video);
 	uint64_t frame_time_total_ns = 0;
@@ -656,7 +981,8 @@ void *obs_graphics_thread(void *param)
 		profile_start(video_thread_name);
 
 		profile_start(tick_sources_name);
-		last_time = tick_sources(obs->video.video_time, last_time);
+		last_time = tick_sources(&tick_schedule,
+				obs->video.video_time, last_time);
 		profile_end(tick_sources_name);
 
 		profile_start(output_frame_name);
@@ -692,6 +1018,8 @@ void *obs_graphics_thread(void *param)
 		}
 	}
 
+	tick_schedule_free(&tick_schedule);
+
 	UNUSED_PARAMETER(param);
 	return NULL;
 }
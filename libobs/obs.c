@@ -17,6 +17,7 @@
 
 #include <inttypes.h>
 
+#include "util/hash.h"
 #include "graphics/matrix4.h"
 #include "callback/calldata.h"
 
@@ -28,6 +29,24 @@ struct obs_core *obs = NULL;
 extern void add_default_module_paths(void);
 extern char *find_libobs_data_file(const char *file);
 
+#define DEFAULT_FRAME_CACHE_SIZE 6
+#define MIN_FRAME_CACHE_SIZE     2
+#define MAX_FRAME_CACHE_SIZE     60
+
+static inline size_t get_frame_cache_size(void)
+{
+	uint32_t size = obs->video_frame_cache_size;
+
+	if (!size)
+		return DEFAULT_FRAME_CACHE_SIZE;
+
+	if (size < MIN_FRAME_CACHE_SIZE)
+		size = MIN_FRAME_CACHE_SIZE;
+	else if (size > MAX_FRAME_CACHE_SIZE)
+		size = MAX_FRAME_CACHE_SIZE;
+	return size;
+}
+
 static inline void make_video_info(struct video_output_info *vi,
 		struct obs_video_info *ovi)
 {
@@ -39,7 +58,8 @@ static inline void make_video_info(struct video_output_info *vi,
 	vi->height  = ovi->output_height;
 	vi->range   = ovi->range;
 	vi->colorspace = ovi->colorspace;
-	vi->cache_size = 6;
+	vi->cache_size = get_frame_cache_size();
+	vi->threaded_inputs = obs->video_threaded_inputs;
 }
 
 #define PIXEL_SIZE 4
@@ -164,6 +184,9 @@ static bool obs_init_gpu_conversion(struct obs_video_info *ovi)
 
 	calc_gpu_conversion_sizes(ovi);
 
+	video->conversion_params.technique = gs_effect_get_technique(
+			video->conversion_effect, video->conversion_tech);
+
 	if (!video->conversion_height) {
 		blog(LOG_INFO, "GPU conversion not available for format: %u",
 				(unsigned int)ovi->output_format);
@@ -226,6 +249,35 @@ gs_effect_t *obs_load_effect(gs_effect_t **effect, const char *file)
 	return *effect;
 }
 
+#define GET_CONVERSION_PARAM(name) \
+	params->name = gs_effect_get_param_by_name(effect, #name)
+
+static void obs_init_conversion_params(struct obs_core_video *video)
+{
+	struct obs_conversion_params *params = &video->conversion_params;
+	gs_effect_t *effect = video->conversion_effect;
+
+	GET_CONVERSION_PARAM(image);
+	GET_CONVERSION_PARAM(width);
+	GET_CONVERSION_PARAM(height);
+	GET_CONVERSION_PARAM(width_i);
+	GET_CONVERSION_PARAM(height_i);
+	GET_CONVERSION_PARAM(width_d2);
+	GET_CONVERSION_PARAM(height_d2);
+	GET_CONVERSION_PARAM(width_d2_i);
+	GET_CONVERSION_PARAM(height_d2_i);
+	GET_CONVERSION_PARAM(input_height);
+	GET_CONVERSION_PARAM(input_width_i_d2);
+	GET_CONVERSION_PARAM(u_plane_offset);
+	GET_CONVERSION_PARAM(v_plane_offset);
+	GET_CONVERSION_PARAM(int_width);
+	GET_CONVERSION_PARAM(int_input_width);
+	GET_CONVERSION_PARAM(int_u_plane_offset);
+	GET_CONVERSION_PARAM(int_v_plane_offset);
+}
+
+#undef GET_CONVERSION_PARAM
+
 static int obs_init_graphics(struct obs_video_info *ovi)
 {
 	struct obs_core_video *video = &obs->video;
@@ -276,6 +328,7 @@ static int obs_init_graphics(struct obs_video_info *ovi)
 	video->conversion_effect = gs_effect_create_from_file(filename,
 			NULL);
 	bfree(filename);
+	obs_init_conversion_params(video);
 
 	filename = obs_find_data_file("bicubic_scale.effect");
 	video->bicubic_effect = gs_effect_create_from_file(filename,
@@ -347,6 +400,23 @@ static inline void set_video_matrix(struct obs_core_video *video,
 	memcpy(video->color_matrix, &mat, sizeof(float) * 16);
 }
 
+#define MAX_VIDEO_WORK_THREADS 3
+
+/* source ticks and CPU color conversion of the output frame are spread
+ * across this pool by the graphics thread */
+static void obs_init_video_work_pool(void)
+{
+	struct obs_core_video *video = &obs->video;
+	int threads = os_get_physical_cores() - 1;
+
+	if (threads > MAX_VIDEO_WORK_THREADS)
+		threads = MAX_VIDEO_WORK_THREADS;
+	if (threads > 0)
+		video->work_pool = work_pool_create(
+				"libobs: video worker thread",
+				(size_t)threads);
+}
+
 static int obs_init_video(struct obs_video_info *ovi)
 {
 	struct obs_core_video *video = &obs->video;
@@ -384,6 +454,8 @@ static int obs_init_video(struct obs_video_info *ovi)
 
 	gs_leave_context();
 
+	obs_init_video_work_pool();
+
 	errorcode = pthread_create(&video->video_thread, NULL,
 			obs_graphics_thread, obs);
 	if (errorcode != 0)
@@ -417,6 +489,9 @@ static void obs_free_video(void)
 		video_output_close(video->video);
 		video->video = NULL;
 
+		work_pool_destroy(video->work_pool);
+		video->work_pool = NULL;
+
 		if (!video->graphics)
 			return;
 
@@ -477,6 +552,15 @@ static void obs_free_graphics(void)
 		gs_effect_destroy(video->bilinear_lowres_effect);
 		video->default_effect = NULL;
 
+		for (size_t i = 0; i < video->fused_effects.num; i++) {
+			struct obs_fused_effect *fused =
+				video->fused_effects.array + i;
+
+			gs_effect_destroy(fused->effect);
+			bfree(fused->code);
+		}
+		da_free(video->fused_effects);
+
 		gs_leave_context();
 
 		gs_destroy(video->graphics);
@@ -484,6 +568,23 @@ static void obs_free_graphics(void)
 	}
 }
 
+#define MAX_AUDIO_RENDER_THREADS 3
+
+/* sources that don't render their own audio from child sources are rendered
+ * in parallel on this pool by the audio thread */
+static void obs_init_audio_render_pool(void)
+{
+	struct obs_core_audio *audio = &obs->audio;
+	int threads = os_get_physical_cores() - 1;
+
+	if (threads > MAX_AUDIO_RENDER_THREADS)
+		threads = MAX_AUDIO_RENDER_THREADS;
+	if (threads > 0)
+		audio->render_pool = work_pool_create(
+				"libobs: audio render thread",
+				(size_t)threads);
+}
+
 static bool obs_init_audio(struct audio_output_info *ai)
 {
 	struct obs_core_audio *audio = &obs->audio;
@@ -505,6 +606,8 @@ static bool obs_init_audio(struct audio_output_info *ai)
 	audio->monitoring_device_name = bstrdup("Default");
 	audio->monitoring_device_id = bstrdup("default");
 
+	obs_init_audio_render_pool();
+
 	errorcode = audio_output_open(&audio->audio, ai);
 	if (errorcode == AUDIO_OUTPUT_SUCCESS)
 		return true;
@@ -522,8 +625,11 @@ static void obs_free_audio(void)
 	if (audio->audio)
 		audio_output_close(audio->audio);
 
+	work_pool_destroy(audio->render_pool);
+
 	circlebuf_free(&audio->buffered_timestamps);
 	da_free(audio->render_order);
+	da_free(audio->render_leaves);
 	da_free(audio->root_nodes);
 
 	da_free(audio->monitors);
@@ -543,6 +649,7 @@ static bool obs_init_data(void)
 
 	pthread_mutex_init_value(&obs->data.displays_mutex);
 	pthread_mutex_init_value(&obs->data.draw_callbacks_mutex);
+	pthread_mutex_init_value(&obs->data.context_names_mutex);
 
 	if (pthread_mutexattr_init(&attr) != 0)
 		return false;
@@ -562,6 +669,8 @@ static bool obs_init_data(void)
 		goto fail;
 	if (pthread_mutex_init(&obs->data.draw_callbacks_mutex, &attr) != 0)
 		goto fail;
+	if (pthread_mutex_init(&data->context_names_mutex, NULL) != 0)
+		goto fail;
 	if (!obs_view_init(&data->main_view))
 		goto fail;
 
@@ -619,6 +728,8 @@ static void obs_free_data(void)
 	pthread_mutex_destroy(&data->encoders_mutex);
 	pthread_mutex_destroy(&data->services_mutex);
 	pthread_mutex_destroy(&data->draw_callbacks_mutex);
+	pthread_mutex_destroy(&data->context_names_mutex);
+	bfree(data->context_names);
 	da_free(data->draw_callbacks);
 	da_free(data->tick_callbacks);
 	obs_data_release(data->private_data);
@@ -753,6 +864,7 @@ static bool obs_init(const char *locale, const char *module_config_path,
 	obs = bzalloc(sizeof(struct obs_core));
 
 	pthread_mutex_init_value(&obs->audio.monitoring_mutex);
+	pthread_mutex_init_value(&obs->packet_pool.mutex);
 
 	obs->name_store_owned = !store;
 	obs->name_store = store ? store : profiler_name_store_create();
@@ -769,6 +881,8 @@ static bool obs_init(const char *locale, const char *module_config_path,
 		return false;
 	if (!obs_init_hotkeys())
 		return false;
+	if (!obs_init_packet_pool(&obs->packet_pool))
+		return false;
 
 	if (module_config_path)
 		obs->module_config_path = bstrdup(module_config_path);
@@ -951,6 +1065,8 @@ void obs_shutdown(void)
 	if (core->name_store_owned)
 		profiler_name_store_free(core->name_store);
 
+	obs_free_packet_pool(&core->packet_pool);
+
 	bfree(core->module_config_path);
 	bfree(core->locale);
 	bfree(core);
@@ -1122,6 +1238,22 @@ bool obs_get_video_info(struct obs_video_info *ovi)
 	return true;
 }
 
+void obs_set_video_threaded_inputs(bool enable)
+{
+	if (!obs)
+		return;
+
+	obs->video_threaded_inputs = enable;
+}
+
+void obs_set_video_frame_cache_size(uint32_t size)
+{
+	if (!obs)
+		return;
+
+	obs->video_frame_cache_size = size;
+}
+
 bool obs_get_audio_info(struct obs_audio_info *oai)
 {
 	struct obs_core_audio *audio = &obs->audio;
@@ -1429,24 +1561,34 @@ void obs_enum_services(bool (*enum_proc)(void*, obs_service_t*), void *param)
 			enum_proc, param);
 }
 
-static inline void *get_context_by_name(void *vfirst, const char *name,
-		pthread_mutex_t *mutex, void *(*addref)(void*))
+/* names can be shared, in which case the most recently inserted context
+ * wins, like it did when the lists were searched from the front */
+static inline void *get_context_by_name(enum obs_obj_type type,
+		const char *name, void *(*addref)(void*))
 {
-	struct obs_context_data **first = vfirst;
-	struct obs_context_data *context;
+	struct obs_core_data *data = &obs->data;
+	struct obs_context_data *context = NULL;
+	uint64_t hash = fnv1a_hash(name, strlen(name));
 
-	pthread_mutex_lock(mutex);
+	pthread_mutex_lock(&data->context_names_mutex);
 
-	context = *first;
-	while (context) {
-		if (!context->private && strcmp(context->name, name) == 0) {
-			context = addref(context);
-			break;
+	if (data->context_names) {
+		struct obs_context_data *item = data->context_names[
+			(size_t)(hash & (data->context_names_size - 1))];
+
+		while (item) {
+			if (item->type == type && item->name_hash == hash &&
+			    strcmp(item->name, name) == 0 &&
+			    (!context || item->insert_idx > context->insert_idx))
+				context = item;
+			item = item->name_next;
 		}
-		context = context->next;
 	}
 
-	pthread_mutex_unlock(mutex);
+	if (context)
+		context = addref(context);
+
+	pthread_mutex_unlock(&data->context_names_mutex);
 	return context;
 }
 
@@ -1478,29 +1620,29 @@ static inline void *obs_id_(void *data)
 obs_source_t *obs_get_source_by_name(const char *name)
 {
 	if (!obs) return NULL;
-	return get_context_by_name(&obs->data.first_source, name,
-			&obs->data.sources_mutex, obs_source_addref_safe_);
+	return get_context_by_name(OBS_OBJ_TYPE_SOURCE, name,
+			obs_source_addref_safe_);
 }
 
 obs_output_t *obs_get_output_by_name(const char *name)
 {
 	if (!obs) return NULL;
-	return get_context_by_name(&obs->data.first_output, name,
-			&obs->data.outputs_mutex, obs_output_addref_safe_);
+	return get_context_by_name(OBS_OBJ_TYPE_OUTPUT, name,
+			obs_output_addref_safe_);
 }
 
 obs_encoder_t *obs_get_encoder_by_name(const char *name)
 {
 	if (!obs) return NULL;
-	return get_context_by_name(&obs->data.first_encoder, name,
-			&obs->data.encoders_mutex, obs_encoder_addref_safe_);
+	return get_context_by_name(OBS_OBJ_TYPE_ENCODER, name,
+			obs_encoder_addref_safe_);
 }
 
 obs_service_t *obs_get_service_by_name(const char *name)
 {
 	if (!obs) return NULL;
-	return get_context_by_name(&obs->data.first_service, name,
-			&obs->data.services_mutex, obs_service_addref_safe_);
+	return get_context_by_name(OBS_OBJ_TYPE_SERVICE, name,
+			obs_service_addref_safe_);
 }
 
 gs_effect_t *obs_get_base_effect(enum obs_base_effect effect)
@@ -1981,6 +2123,73 @@ void obs_context_data_free(struct obs_context_data *context)
 	memset(context, 0, sizeof(*context));
 }
 
+#define MIN_CONTEXT_NAMES_SIZE 64
+
+static void context_names_add(struct obs_context_data *context)
+{
+	struct obs_core_data *data = &obs->data;
+	size_t idx;
+
+	if (data->context_names_count >= data->context_names_size) {
+		size_t new_size = data->context_names_size ?
+			data->context_names_size * 2 : MIN_CONTEXT_NAMES_SIZE;
+		struct obs_context_data **names = bzalloc(
+				new_size * sizeof(struct obs_context_data*));
+
+		for (size_t i = 0; i < data->context_names_size; i++) {
+			struct obs_context_data *item = data->context_names[i];
+
+			while (item) {
+				struct obs_context_data *next = item->name_next;
+
+				idx = (size_t)(item->name_hash & (new_size - 1));
+				item->name_next = names[idx];
+				names[idx] = item;
+				item = next;
+			}
+		}
+
+		bfree(data->context_names);
+		data->context_names      = names;
+		data->context_names_size = new_size;
+	}
+
+	context->name_hash = fnv1a_hash(context->name, strlen(context->name));
+	idx = (size_t)(context->name_hash &
+			(data->context_names_size - 1));
+	context->name_next = data->context_names[idx];
+	data->context_names[idx] = context;
+	data->context_names_count++;
+}
+
+static void context_names_remove(struct obs_context_data *context)
+{
+	struct obs_core_data *data = &obs->data;
+	struct obs_context_data **item;
+
+	if (!data->context_names)
+		return;
+
+	item = &data->context_names[
+		(size_t)(context->name_hash & (data->context_names_size - 1))];
+
+	while (*item) {
+		if (*item == context) {
+			*item = context->name_next;
+			context->name_next = NULL;
+			data->context_names_count--;
+			break;
+		}
+		item = &(*item)->name_next;
+	}
+}
+
+static inline bool context_has_indexed_name(
+		const struct obs_context_data *context)
+{
+	return context->mutex && !context->private && context->name;
+}
+
 void obs_context_data_insert(struct obs_context_data *context,
 		pthread_mutex_t *mutex, void *pfirst)
 {
@@ -1999,11 +2208,24 @@ void obs_context_data_insert(struct obs_context_data *context,
 	if (context->next)
 		context->next->prev_next = &context->next;
 	pthread_mutex_unlock(mutex);
+
+	if (context_has_indexed_name(context)) {
+		pthread_mutex_lock(&obs->data.context_names_mutex);
+		context->insert_idx = ++obs->data.context_insert_count;
+		context_names_add(context);
+		pthread_mutex_unlock(&obs->data.context_names_mutex);
+	}
 }
 
 void obs_context_data_remove(struct obs_context_data *context)
 {
 	if (context && context->mutex) {
+		if (context_has_indexed_name(context)) {
+			pthread_mutex_lock(&obs->data.context_names_mutex);
+			context_names_remove(context);
+			pthread_mutex_unlock(&obs->data.context_names_mutex);
+		}
+
 		pthread_mutex_lock(context->mutex);
 		if (context->prev_next)
 			*context->prev_next = context->next;
@@ -2018,12 +2240,25 @@ void obs_context_data_remove(struct obs_context_data *context)
 void obs_context_data_setname(struct obs_context_data *context,
 		const char *name)
 {
+	bool indexed;
+
 	pthread_mutex_lock(&context->rename_cache_mutex);
 
+	indexed = context_has_indexed_name(context);
+	if (indexed) {
+		pthread_mutex_lock(&obs->data.context_names_mutex);
+		context_names_remove(context);
+	}
+
 	if (context->name)
 		da_push_back(context->rename_cache, &context->name);
 	context->name = dup_name(name, context->private);
 
+	if (indexed) {
+		context_names_add(context);
+		pthread_mutex_unlock(&obs->data.context_names_mutex);
+	}
+
 	pthread_mutex_unlock(&context->rename_cache_mutex);
 }
 
@@ -2192,6 +2427,19 @@ uint32_t obs_get_lagged_frames(void)
 	return obs ? obs->video.lagged_frames : 0;
 }
 
+uint32_t obs_get_audio_buffering_ms(void)
+{
+	uint64_t ticks;
+	uint32_t sample_rate;
+
+	if (!obs || !obs->audio.audio)
+		return 0;
+
+	ticks = (uint64_t)obs->audio.total_buffering_ticks;
+	sample_rate = audio_output_get_sample_rate(obs->audio.audio);
+	return (uint32_t)(ticks * AUDIO_OUTPUT_FRAMES * 1000 / sample_rate);
+}
+
 void start_raw_video(video_t *v, const struct video_scale_info *conversion,
 		void (*callback)(void *param, struct video_data *frame),
 		void *param)
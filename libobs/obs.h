@@ -367,6 +367,20 @@ EXPORT bool obs_reset_audio(const struct obs_audio_info *oai);
 /** Gets the current video settings, returns false if no video */
 EXPORT bool obs_get_video_info(struct obs_video_info *ovi);
 
+/**
+ * Runs each encoder and raw video callback on its own thread with its own
+ * frame queue, so that one that falls behind doesn't make the others skip
+ * frames.  Off by default, takes effect the next time video is reset.
+ */
+EXPORT void obs_set_video_threaded_inputs(bool enable);
+
+/**
+ * Sets the number of output frames that can be queued for the encoders
+ * before frames are skipped, or 0 to use the default.  Takes effect the next
+ * time video is reset.
+ */
+EXPORT void obs_set_video_frame_cache_size(uint32_t size);
+
 /** Gets the current audio settings, returns false if no audio */
 EXPORT bool obs_get_audio_info(struct obs_audio_info *oai);
 
@@ -710,6 +724,10 @@ EXPORT uint64_t obs_get_average_frame_time_ns(void);
 EXPORT uint32_t obs_get_total_frames(void);
 EXPORT uint32_t obs_get_lagged_frames(void);
 
+/** Gets the amount of audio buffering currently added to compensate for
+ * audio sources with delayed timestamps, in milliseconds */
+EXPORT uint32_t obs_get_audio_buffering_ms(void);
+
 EXPORT void obs_apply_private_data(obs_data_t *settings);
 EXPORT void obs_set_private_data(obs_data_t *settings);
 EXPORT obs_data_t *obs_get_private_data(void);
@@ -857,6 +875,12 @@ EXPORT obs_properties_t *obs_source_properties(const obs_source_t *source);
 /** Updates settings for this source */
 EXPORT void obs_source_update(obs_source_t *source, obs_data_t *settings);
 
+/**
+ * Marks the output of a source as changed, so that the cached output of
+ * sources with the OBS_SOURCE_CACHEABLE flag is rendered again
+ */
+EXPORT void obs_source_mark_dirty(obs_source_t *source);
+
 /** Renders a video source. */
 EXPORT void obs_source_video_render(obs_source_t *source);
 
@@ -866,6 +890,12 @@ EXPORT uint32_t obs_source_get_width(obs_source_t *source);
 /** Gets the height of a source (if it has video) */
 EXPORT uint32_t obs_source_get_height(obs_source_t *source);
 
+/**
+ * Returns whether the source currently draws every pixel of its area fully
+ * opaque.  Returns false if it's not known.
+ */
+EXPORT bool obs_source_opaque(obs_source_t *source);
+
 /**
  * If the source is a filter, returns the parent source of the filter.  Only
  * guaranteed to be valid inside of the video_render, filter_audio,
@@ -1112,6 +1142,17 @@ EXPORT void obs_source_draw(gs_texture_t *image, int x, int y,
 EXPORT void obs_source_output_video(obs_source_t *source,
 		const struct obs_source_frame *frame);
 
+/**
+ * Outputs asynchronous video data without copying it.  libobs takes ownership
+ * of the frame data until the release callback is called, which happens
+ * exactly once when the frame has been uploaded or dropped.  The callback may
+ * be called from any thread, but never with a lock of the source held.
+ */
+EXPORT void obs_source_output_video_no_copy(obs_source_t *source,
+		const struct obs_source_frame *frame,
+		void (*release)(void *param, struct obs_source_frame *frame),
+		void *param);
+
 /** Preloads asynchronous video data to allow instantaneous playback */
 EXPORT void obs_source_preload_video(obs_source_t *source,
 		const struct obs_source_frame *frame);
@@ -1172,6 +1213,14 @@ EXPORT void obs_source_process_filter_tech_end(obs_source_t *filter,
 /** Skips the filter if the filter is invalid and cannot be rendered */
 EXPORT void obs_source_skip_video_filter(obs_source_t *filter);
 
+/**
+ * Gets a parameter of the shader code of a fused filter, by its name in the
+ * code without the "FILTER_" prefix.  Only valid in the set_fused_params
+ * callback of the filter.
+ */
+EXPORT gs_eparam_t *obs_filter_get_fused_param(obs_source_t *filter,
+		gs_effect_t *effect, const char *name);
+
 /**
  * Adds an active child source.  Must be called by parent sources on child
  * sources when the child is added and active.  This ensures that the source is
@@ -1930,6 +1979,21 @@ EXPORT void obs_encoder_packet_ref(struct encoder_packet *dst,
 		struct encoder_packet *src);
 EXPORT void obs_encoder_packet_release(struct encoder_packet *packet);
 
+/** Encoder packet payload pool statistics */
+struct obs_encoder_packet_pool_stats {
+	/** Number of packet payloads allocated */
+	uint64_t allocations;
+	/** Number of allocations that reused a payload from the pool */
+	uint64_t hits;
+	/** Bytes held by the pool for reuse */
+	uint64_t bytes_held;
+	/** Bytes of pooled payloads currently referenced by packets */
+	uint64_t bytes_in_use;
+};
+
+EXPORT void obs_get_encoder_packet_pool_stats(
+		struct obs_encoder_packet_pool_stats *stats);
+
 
 /* ------------------------------------------------------------------------- */
 /* Stream Services */
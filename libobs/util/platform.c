@@ -25,6 +25,18 @@
 #include "bmem.h"
 #include "utf8.h"
 #include "dstr.h"
+#include "threading.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || \
+    defined(__x86_64__)
+#define OS_CPU_X86 1
+#ifdef _MSC_VER
+#include <intrin.h>
+#include <immintrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
 
 FILE *os_wfopen(const wchar_t *path, const char *mode)
 {
@@ -774,3 +786,86 @@ char *os_generate_formatted_filename(const char *extension, bool space,
 
 	return sf.array;
 }
+
+/* ------------------------------------------------------------------------- */
+
+struct cpu_features {
+	bool avx;
+	bool avx2;
+};
+
+#ifdef OS_CPU_X86
+static void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t regs[4])
+{
+#ifdef _MSC_VER
+	__cpuidex((int*)regs, (int)leaf, (int)subleaf);
+#else
+	__cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+static uint64_t get_xcr0(void)
+{
+#ifdef _MSC_VER
+	return _xgetbv(0);
+#else
+	uint32_t eax, edx;
+	__asm__ volatile ("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return ((uint64_t)edx << 32) | eax;
+#endif
+}
+
+static void detect_cpu_features(struct cpu_features *features)
+{
+	uint32_t regs[4];
+	uint32_t max_leaf;
+	bool os_saves_ymm = false;
+
+	cpuid(0, 0, regs);
+	max_leaf = regs[0];
+	if (max_leaf < 1)
+		return;
+
+	cpuid(1, 0, regs);
+
+	/* AVX needs the OS to save the YMM registers on context switches */
+	if ((regs[2] & (1 << 27)) != 0)
+		os_saves_ymm = (get_xcr0() & 0x6) == 0x6;
+
+	features->avx = os_saves_ymm && (regs[2] & (1 << 28)) != 0;
+
+	if (features->avx && max_leaf >= 7) {
+		cpuid(7, 0, regs);
+		features->avx2 = (regs[1] & (1 << 5)) != 0;
+	}
+}
+#else
+static void detect_cpu_features(struct cpu_features *features)
+{
+	UNUSED_PARAMETER(features);
+}
+#endif
+
+static struct cpu_features cpu_features;
+static pthread_once_t cpu_features_token = PTHREAD_ONCE_INIT;
+
+static void init_cpu_features(void)
+{
+	detect_cpu_features(&cpu_features);
+}
+
+static const struct cpu_features *get_cpu_features(void)
+{
+	pthread_once(&cpu_features_token, init_cpu_features);
+	return &cpu_features;
+}
+
+bool os_cpu_has_avx(void)
+{
+	return get_cpu_features()->avx;
+}
+
+bool os_cpu_has_avx2(void)
+{
+	return get_cpu_features()->avx2;
+}
@@ -12,8 +12,24 @@
 
 //#define TRACK_OVERHEAD
 
+typedef struct profile_trace_event profile_trace_event;
+struct profile_trace_event {
+	const char *name;
+	long tid;
+	uint64_t start_time;
+	uint64_t end_time;
+};
+
+typedef struct profile_trace_thread profile_trace_thread;
+struct profile_trace_thread {
+	long tid;
+	const char *name;
+};
+
 struct profiler_snapshot {
 	DARRAY(profiler_snapshot_entry_t) roots;
+	DARRAY(profile_trace_event) trace_events;
+	DARRAY(profile_trace_thread) trace_threads;
 };
 
 struct profiler_snapshot_entry {
@@ -256,18 +272,222 @@ static void merge_call(profile_entry *entry, profile_call *call,
 #endif
 }
 
+/* ------------------------------------------------------------------------- */
+/* Thread event buffers
+ *
+ * profile_start/profile_end only append a timestamped event to a ring buffer
+ * owned by the calling thread.  A merge thread drains the buffers, rebuilds
+ * the call trees and merges them in to the root entries, and keeps the most
+ * recent calls for trace export. */
+
+#define THREAD_BUFFER_EVENTS (1 << 14)
+#define TRACE_EVENTS         (1 << 17)
+#define MERGE_INTERVAL_MS    10
+
+enum profile_event_type {
+	PROFILE_EVENT_BEGIN,
+	PROFILE_EVENT_END,
+
+	/* events were dropped because the buffer was full, the calls that
+	 * are still open must be discarded */
+	PROFILE_EVENT_DISCARD,
+};
+
+typedef struct profile_event profile_event;
+struct profile_event {
+	const char *name;
+	uint64_t time;
+#ifdef TRACK_OVERHEAD
+	uint64_t overhead_time;
+#endif
+	enum profile_event_type type;
+};
+
+typedef struct profile_thread_buffer profile_thread_buffer;
+struct profile_thread_buffer {
+	long tid;
+
+	/* single producer (the owning thread), single consumer (merging) */
+	profile_event *events;
+	volatile long write_count;
+	volatile long read_count;
+
+	/* owning thread only */
+	DARRAY(const char*) stack;
+	bool dropping;
+
+	/* merging only */
+	profile_call *context;
+	bool named;
+};
+
+static void *merge_thread_func(void *param);
+static void start_merge_thread(void);
+static void stop_merge_thread(void);
+
 static bool enabled = false;
 static pthread_mutex_t root_mutex = PTHREAD_MUTEX_INITIALIZER;
 static DARRAY(profile_root_entry) root_entries;
 
-static THREAD_LOCAL profile_call *thread_context = NULL;
+static pthread_mutex_t buffers_mutex = PTHREAD_MUTEX_INITIALIZER;
+static DARRAY(profile_thread_buffer*) thread_buffers;
+static long next_tid = 0;
+static pthread_once_t thread_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t thread_key;
+
+static pthread_mutex_t merge_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* started by profiler_start, stopped and joined by profiler_free */
+static pthread_mutex_t merge_thread_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t merge_thread;
+static bool merge_thread_active = false;
+static os_event_t *merge_stop_event = NULL;
+
+/* written by the merging side only, under merge_mutex */
+static profile_trace_event *trace_events = NULL;
+static size_t trace_pos = 0;
+static size_t trace_count = 0;
+static DARRAY(profile_trace_thread) trace_threads;
+
+/* incremented by profiler_free under buffers_mutex, which frees the buffers
+ * of all threads.  a thread's buffer is only valid while the generation it was
+ * created in is current */
+static volatile long buffers_generation = 0;
+
+static THREAD_LOCAL profile_thread_buffer *thread_buffer = NULL;
+static THREAD_LOCAL long thread_buffer_generation = 0;
 static THREAD_LOCAL bool thread_enabled = true;
 
+static void drain_thread_buffer(profile_thread_buffer *buf);
+static void free_thread_buffer(profile_thread_buffer *buf);
+
+/* drains and frees the buffer of an exiting thread right away, so buffers of
+ * exited threads don't pile up when the merge thread isn't running.
+ *
+ * the buffer may already have been freed by profiler_free, and its address
+ * reused for the buffer of another thread, so the exiting thread's own
+ * generation decides whether the buffer is still valid rather than the
+ * address */
+static void thread_buffer_exited(void *data)
+{
+	profile_thread_buffer *buf = thread_buffer;
+
+	pthread_mutex_lock(&merge_mutex);
+	pthread_mutex_lock(&buffers_mutex);
+
+	if (buf && thread_buffer_generation == buffers_generation) {
+		drain_thread_buffer(buf);
+		free_thread_buffer(buf);
+		da_erase_item(thread_buffers, &buf);
+	}
+
+	pthread_mutex_unlock(&buffers_mutex);
+	pthread_mutex_unlock(&merge_mutex);
+
+	thread_buffer = NULL;
+	UNUSED_PARAMETER(data);
+}
+
+static void create_thread_key(void)
+{
+	pthread_key_create(&thread_key, thread_buffer_exited);
+}
+
+static profile_thread_buffer *get_thread_buffer(void)
+{
+	long generation = os_atomic_load_long(&buffers_generation);
+	profile_thread_buffer *buf = thread_buffer;
+	if (buf && thread_buffer_generation == generation)
+		return buf;
+
+	/* don't allocate anything for threads that only run while the
+	 * profiler is disabled */
+	if (!os_atomic_load_bool(&enabled))
+		return NULL;
+
+	buf = bzalloc(sizeof(profile_thread_buffer));
+	buf->events = bmalloc(THREAD_BUFFER_EVENTS * sizeof(profile_event));
+
+	pthread_once(&thread_key_once, create_thread_key);
+	pthread_setspecific(thread_key, buf);
+
+	pthread_mutex_lock(&buffers_mutex);
+	buf->tid = ++next_tid;
+	generation = buffers_generation;
+	da_push_back(thread_buffers, &buf);
+	pthread_mutex_unlock(&buffers_mutex);
+
+	thread_buffer = buf;
+	thread_buffer_generation = generation;
+	return buf;
+}
+
+static bool push_event(profile_thread_buffer *buf,
+		enum profile_event_type type, const char *name, uint64_t time,
+		uint64_t overhead_time)
+{
+	unsigned long write = (unsigned long)buf->write_count;
+	unsigned long read  =
+		(unsigned long)os_atomic_load_long(&buf->read_count);
+	profile_event *event;
+
+	if (write - read >= THREAD_BUFFER_EVENTS)
+		return false;
+
+	event = &buf->events[write & (THREAD_BUFFER_EVENTS - 1)];
+	event->name = name;
+	event->time = time;
+	event->type = type;
+#ifdef TRACK_OVERHEAD
+	event->overhead_time = overhead_time;
+#else
+	UNUSED_PARAMETER(overhead_time);
+#endif
+
+	/* full barrier, publishes the event */
+	os_atomic_inc_long(&buf->write_count);
+	return true;
+}
+
+/* depth is the number of open calls before a begin or after an end.  if an
+ * event can't be stored, every following event is skipped until the open
+ * calls can be discarded at the next root boundary */
+static void record_event(profile_thread_buffer *buf,
+		enum profile_event_type type, const char *name, uint64_t time,
+		uint64_t overhead_time, size_t depth)
+{
+	if (buf->dropping) {
+		if (type != PROFILE_EVENT_BEGIN || depth != 0)
+			goto skip;
+		if (!push_event(buf, PROFILE_EVENT_DISCARD, NULL, 0, 0))
+			return;
+		buf->dropping = false;
+	}
+
+	if (push_event(buf, type, name, time, overhead_time))
+		return;
+
+	buf->dropping = true;
+
+skip:
+	if (type == PROFILE_EVENT_END && depth == 0 &&
+	    push_event(buf, PROFILE_EVENT_DISCARD, NULL, 0, 0))
+		buf->dropping = false;
+}
+
 void profiler_start(void)
 {
 	pthread_mutex_lock(&root_mutex);
 	enabled = true;
 	pthread_mutex_unlock(&root_mutex);
+
+	pthread_mutex_lock(&merge_mutex);
+	if (!trace_events)
+		trace_events = bmalloc(TRACE_EVENTS *
+				sizeof(profile_trace_event));
+	pthread_mutex_unlock(&merge_mutex);
+
+	start_merge_thread();
 }
 
 void profiler_stop(void)
@@ -292,7 +512,6 @@ static bool lock_root(void)
 	pthread_mutex_lock(&root_mutex);
 	if (!enabled) {
 		pthread_mutex_unlock(&root_mutex);
-		thread_enabled = false;
 		return false;
 	}
 
@@ -367,77 +586,254 @@ static void merge_context(profile_call *context)
 
 void profile_start(const char *name)
 {
+	uint64_t overhead_start = 0;
+	profile_thread_buffer *buf;
+	size_t depth;
+
 	if (!thread_enabled)
 		return;
 
-	profile_call new_call = {
-		.name = name,
 #ifdef TRACK_OVERHEAD
-		.overhead_start = os_gettime_ns(),
+	overhead_start = os_gettime_ns();
 #endif
-		.parent = thread_context,
-	};
+	buf = get_thread_buffer();
+	depth = buf ? buf->stack.num : 0;
 
-	profile_call *call = NULL;
-
-	if (new_call.parent) {
-		size_t idx = da_push_back(new_call.parent->children, &new_call);
-		call = &new_call.parent->children.array[idx];
-	} else {
-		call = bmalloc(sizeof(profile_call));
-		memcpy(call, &new_call, sizeof(profile_call));
+	if (!buf || (!depth && !os_atomic_load_bool(&enabled))) {
+		thread_enabled = false;
+		return;
 	}
 
-	thread_context = call;
-	call->start_time = os_gettime_ns();
+	da_push_back(buf->stack, &name);
+
+	record_event(buf, PROFILE_EVENT_BEGIN, name, os_gettime_ns(),
+			overhead_start, depth);
+}
+
+static void end_call(profile_thread_buffer *buf, const char *name,
+		uint64_t end)
+{
+	uint64_t overhead_end = 0;
+#ifdef TRACK_OVERHEAD
+	overhead_end = os_gettime_ns();
+#endif
+	da_pop_back(buf->stack);
+	record_event(buf, PROFILE_EVENT_END, name, end, overhead_end,
+			buf->stack.num);
 }
 
 void profile_end(const char *name)
 {
 	uint64_t end = os_gettime_ns();
-	if (!thread_enabled)
+	profile_thread_buffer *buf = thread_buffer;
+
+	if (!thread_enabled || !buf || thread_buffer_generation !=
+			os_atomic_load_long(&buffers_generation))
 		return;
 
-	profile_call *call = thread_context;
-	if (!call) {
+	if (!buf->stack.num) {
 		blog(LOG_ERROR, "Called profile end with no active profile");
 		return;
 	}
 
-	if (!call->name)
-		call->name = name;
+	const char *call_name = *(const char**)da_end(buf->stack);
 
-	if (call->name != name) {
+	if (call_name != name) {
 		blog(LOG_ERROR, "Called profile end with mismatching name: "
 				"start(\"%s\"[%p]) <-> end(\"%s\"[%p])",
-				call->name, call->name, name, name);
+				call_name, call_name, name, name);
 
-		profile_call *parent = call->parent;
-		while (parent && parent->parent &&  parent->name != name)
-			parent = parent->parent;
+		size_t idx = buf->stack.num - 1;
+		while (idx > 1 && buf->stack.array[idx - 1] != name)
+			idx--;
 
-		if (!parent || parent->name != name)
+		if (!idx || buf->stack.array[idx - 1] != name)
 			return;
 
-		while (call->name != name) {
-			profile_end(call->name);
-			call = call->parent;
+		while (*(const char**)da_end(buf->stack) != name)
+			end_call(buf, *(const char**)da_end(buf->stack), end);
+	}
+
+	end_call(buf, name, end);
+}
+
+/* ------------------------------------------------------------------------- */
+/* Merging */
+
+static void add_trace_event(profile_thread_buffer *buf, profile_call *call)
+{
+	profile_trace_event *event = &trace_events[trace_pos];
+
+	event->name       = call->name;
+	event->tid        = buf->tid;
+	event->start_time = call->start_time;
+	event->end_time   = call->end_time;
+
+	trace_pos = (trace_pos + 1) & (TRACE_EVENTS - 1);
+	if (trace_count < TRACE_EVENTS)
+		trace_count++;
+}
+
+static void process_begin(profile_thread_buffer *buf, profile_event *event)
+{
+	profile_call new_call = {
+		.name = event->name,
+		.parent = buf->context,
+	};
+
+	profile_call *call = NULL;
+
+	if (new_call.parent) {
+		size_t idx = da_push_back(new_call.parent->children, &new_call);
+		call = &new_call.parent->children.array[idx];
+	} else {
+		call = bmalloc(sizeof(profile_call));
+		memcpy(call, &new_call, sizeof(profile_call));
+
+		/* threads are labeled with their first root in traces */
+		if (!buf->named) {
+			profile_trace_thread thread = {buf->tid, call->name};
+			da_push_back(trace_threads, &thread);
+			buf->named = true;
 		}
 	}
 
-	thread_context = call->parent;
+	buf->context = call;
+	call->start_time = event->time;
+#ifdef TRACK_OVERHEAD
+	call->overhead_start = event->overhead_time;
+#endif
+}
 
-	call->end_time = end;
+static void process_end(profile_thread_buffer *buf, profile_event *event)
+{
+	profile_call *call = buf->context;
+	if (!call)
+		return;
+
+	buf->context = call->parent;
+
+	call->end_time = event->time;
 #ifdef TRACK_OVERHEAD
-	call->overhead_end = os_gettime_ns();
+	call->overhead_end = event->overhead_time;
 #endif
 
+	if (trace_events)
+		add_trace_event(buf, call);
+
 	if (call->parent)
 		return;
 
 	merge_context(call);
 }
 
+static void process_discard(profile_thread_buffer *buf)
+{
+	profile_call *root = buf->context;
+	if (!root)
+		return;
+
+	while (root->parent)
+		root = root->parent;
+
+	free_call_context(root);
+	buf->context = NULL;
+}
+
+static void drain_thread_buffer(profile_thread_buffer *buf)
+{
+	unsigned long read  = (unsigned long)buf->read_count;
+	unsigned long write =
+		(unsigned long)os_atomic_load_long(&buf->write_count);
+	unsigned long count = write - read;
+
+	for (unsigned long i = 0; i < count; i++) {
+		profile_event *event =
+			&buf->events[(read + i) & (THREAD_BUFFER_EVENTS - 1)];
+
+		if (event->type == PROFILE_EVENT_BEGIN)
+			process_begin(buf, event);
+		else if (event->type == PROFILE_EVENT_END)
+			process_end(buf, event);
+		else
+			process_discard(buf);
+	}
+
+	/* only the merging side writes read_count, the compare and swap is
+	 * used as a full barrier */
+	os_atomic_compare_swap_long(&buf->read_count, (long)read,
+			(long)(read + count));
+}
+
+static void free_thread_buffer(profile_thread_buffer *buf)
+{
+	process_discard(buf);
+	da_free(buf->stack);
+	bfree(buf->events);
+	bfree(buf);
+}
+
+static void drain_thread_buffers(void)
+{
+	pthread_mutex_lock(&merge_mutex);
+	pthread_mutex_lock(&buffers_mutex);
+
+	for (size_t i = 0; i < thread_buffers.num; i++)
+		drain_thread_buffer(thread_buffers.array[i]);
+
+	pthread_mutex_unlock(&buffers_mutex);
+	pthread_mutex_unlock(&merge_mutex);
+}
+
+static void *merge_thread_func(void *param)
+{
+	os_set_thread_name("profiler: merge thread");
+
+	while (os_event_timedwait(merge_stop_event, MERGE_INTERVAL_MS) ==
+			ETIMEDOUT)
+		drain_thread_buffers();
+
+	drain_thread_buffers();
+
+	UNUSED_PARAMETER(param);
+	return NULL;
+}
+
+static void start_merge_thread(void)
+{
+	pthread_mutex_lock(&merge_thread_mutex);
+
+	if (!merge_thread_active &&
+	    os_event_init(&merge_stop_event, OS_EVENT_TYPE_MANUAL) == 0) {
+		merge_thread_active = pthread_create(&merge_thread, NULL,
+				merge_thread_func, NULL) == 0;
+		if (!merge_thread_active) {
+			os_event_destroy(merge_stop_event);
+			merge_stop_event = NULL;
+		}
+	}
+
+	pthread_mutex_unlock(&merge_thread_mutex);
+}
+
+static void stop_merge_thread(void)
+{
+	pthread_mutex_lock(&merge_thread_mutex);
+
+	if (merge_thread_active) {
+		os_event_signal(merge_stop_event);
+		pthread_join(merge_thread, NULL);
+		os_event_destroy(merge_stop_event);
+		merge_stop_event = NULL;
+		merge_thread_active = false;
+	}
+
+	pthread_mutex_unlock(&merge_thread_mutex);
+}
+
+/* ------------------------------------------------------------------------- */
+/* Profiler data output */
+
 static int profiler_time_entry_compare(const void *first, const void *second)
 {
 	int64_t diff = ((profiler_time_entry*)second)->time_delta -
@@ -797,10 +1193,36 @@ static void free_profile_entry(profile_entry *entry)
 	da_free(entry->children);
 }
 
+static void free_thread_buffers(void)
+{
+	pthread_mutex_lock(&merge_mutex);
+	pthread_mutex_lock(&buffers_mutex);
+
+	os_atomic_inc_long(&buffers_generation);
+
+	for (size_t i = 0; i < thread_buffers.num; i++)
+		free_thread_buffer(thread_buffers.array[i]);
+	da_free(thread_buffers);
+
+	bfree(trace_events);
+	trace_events = NULL;
+	trace_pos = 0;
+	trace_count = 0;
+	da_free(trace_threads);
+
+	pthread_mutex_unlock(&buffers_mutex);
+	pthread_mutex_unlock(&merge_mutex);
+}
+
 void profiler_free(void)
 {
 	DARRAY(profile_root_entry) old_root_entries = {0};
 
+	/* the merge thread drains the buffers one last time before it exits,
+	 * it must be joined before they're freed */
+	stop_merge_thread();
+	free_thread_buffers();
+
 	pthread_mutex_lock(&root_mutex);
 	enabled = false;
 	da_move(old_root_entries, root_entries);
@@ -924,10 +1346,30 @@ static void sort_snapshot_entry(profiler_snapshot_entry_t *entry)
 		sort_snapshot_entry(&entry->children.array[i]);
 }
 
+static void add_trace_to_snapshot(profiler_snapshot_t *snap)
+{
+	pthread_mutex_lock(&merge_mutex);
+
+	size_t start = (trace_pos - trace_count) & (TRACE_EVENTS - 1);
+
+	da_reserve(snap->trace_events, trace_count);
+	for (size_t i = 0; i < trace_count; i++) {
+		size_t idx = (start + i) & (TRACE_EVENTS - 1);
+		da_push_back(snap->trace_events, &trace_events[idx]);
+	}
+
+	da_copy(snap->trace_threads, trace_threads);
+
+	pthread_mutex_unlock(&merge_mutex);
+}
+
 profiler_snapshot_t *profile_snapshot_create(void)
 {
 	profiler_snapshot_t *snap = bzalloc(sizeof(profiler_snapshot_t));
 
+	drain_thread_buffers();
+	add_trace_to_snapshot(snap);
+
 	pthread_mutex_lock(&root_mutex);
 	da_reserve(snap->roots, root_entries.num);
 	for (size_t i = 0; i < root_entries.num; i++) {
@@ -963,6 +1405,8 @@ void profile_snapshot_free(profiler_snapshot_t *snap)
 		free_snapshot_entry(&snap->roots.array[i]);
 
 	da_free(snap->roots);
+	da_free(snap->trace_events);
+	da_free(snap->trace_threads);
 	bfree(snap);
 }
 
@@ -1062,6 +1506,91 @@ bool profiler_snapshot_dump_csv_gz(const profiler_snapshot_t *snap,
 	return true;
 }
 
+static void dump_json_string(struct dstr *buffer, const char *str)
+{
+	dstr_cat_ch(buffer, '"');
+
+	for (; str && *str; str++) {
+		unsigned char ch = (unsigned char)*str;
+
+		if (ch == '"' || ch == '\\') {
+			dstr_cat_ch(buffer, '\\');
+			dstr_cat_ch(buffer, (char)ch);
+		} else if (ch < 0x20) {
+			dstr_catf(buffer, "\\u%04x", ch);
+		} else {
+			dstr_cat_ch(buffer, (char)ch);
+		}
+	}
+
+	dstr_cat_ch(buffer, '"');
+}
+
+static void dump_trace_event(struct dstr *buffer,
+		const profile_trace_event *event, uint64_t base_time)
+{
+	uint64_t start = event->start_time - base_time;
+	uint64_t duration = event->end_time - event->start_time;
+
+	dstr_cat(buffer, "{\"name\":");
+	dump_json_string(buffer, event->name);
+	dstr_catf(buffer, ",\"ph\":\"X\",\"pid\":1,\"tid\":%ld,"
+			"\"ts\":%"PRIu64".%03u,\"dur\":%"PRIu64".%03u}",
+			event->tid,
+			start / 1000, (unsigned)(start % 1000),
+			duration / 1000, (unsigned)(duration % 1000));
+}
+
+bool profiler_snapshot_dump_chrome_trace(const profiler_snapshot_t *snap,
+		const char *filename)
+{
+	struct dstr buffer = {0};
+	uint64_t base_time = ~(uint64_t)0;
+	bool first = true;
+
+	FILE *f = os_fopen(filename, "wb+");
+	if (!f)
+		return false;
+
+	for (size_t i = 0; i < snap->trace_events.num; i++) {
+		uint64_t start = snap->trace_events.array[i].start_time;
+		if (start < base_time)
+			base_time = start;
+	}
+
+	dstr_copy(&buffer, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	dump_csv_fwrite(f, &buffer);
+
+	for (size_t i = 0; i < snap->trace_threads.num; i++) {
+		const profile_trace_thread *thread =
+			&snap->trace_threads.array[i];
+
+		dstr_printf(&buffer, "%s{\"name\":\"thread_name\","
+				"\"ph\":\"M\",\"pid\":1,\"tid\":%ld,"
+				"\"args\":{\"name\":",
+				first ? "" : ",\n", thread->tid);
+		dump_json_string(&buffer, thread->name);
+		dstr_cat(&buffer, "}}");
+		dump_csv_fwrite(f, &buffer);
+		first = false;
+	}
+
+	for (size_t i = 0; i < snap->trace_events.num; i++) {
+		dstr_copy(&buffer, first ? "" : ",\n");
+		dump_trace_event(&buffer, &snap->trace_events.array[i],
+				base_time);
+		dump_csv_fwrite(f, &buffer);
+		first = false;
+	}
+
+	dstr_copy(&buffer, "\n]}\n");
+	dump_csv_fwrite(f, &buffer);
+
+	dstr_free(&buffer);
+	fclose(f);
+	return true;
+}
+
 size_t profiler_snapshot_num_roots(profiler_snapshot_t *snap)
 {
 	return snap ? snap->roots.num : 0;
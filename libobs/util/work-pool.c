@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2026 OBS Project
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "work-pool.h"
+#include "threading.h"
+#include "bmem.h"
+#include "dstr.h"
+
+struct work_pool {
+	pthread_t        *threads;
+	size_t           num_threads;
+	struct dstr      name;
+
+	pthread_mutex_t  run_mutex;
+	os_sem_t         *start_sem;
+	os_event_t       *done_event;
+	volatile bool    stop;
+
+	/* current job.  remaining counts every index plus every woken worker,
+	 * so a job is only done once no worker can touch it anymore. */
+	work_pool_func_t func;
+	void             *param;
+	long             count;
+	volatile long    next_idx;
+	volatile long    remaining;
+};
+
+static inline void finish_work(struct work_pool *pool)
+{
+	if (os_atomic_dec_long(&pool->remaining) == 0)
+		os_event_signal(pool->done_event);
+}
+
+static void process_job(struct work_pool *pool)
+{
+	long idx;
+
+	while ((idx = os_atomic_inc_long(&pool->next_idx) - 1) < pool->count) {
+		pool->func(pool->param, (size_t)idx);
+		finish_work(pool);
+	}
+}
+
+static void *work_pool_thread(void *data)
+{
+	struct work_pool *pool = data;
+
+	os_set_thread_name(pool->name.array);
+
+	while (os_sem_wait(pool->start_sem) == 0) {
+		if (pool->stop)
+			break;
+
+		process_job(pool);
+		finish_work(pool);
+	}
+
+	return NULL;
+}
+
+work_pool_t *work_pool_create(const char *name, size_t threads)
+{
+	struct work_pool *pool = bzalloc(sizeof(struct work_pool));
+
+	pthread_mutex_init_value(&pool->run_mutex);
+	dstr_copy(&pool->name, name ? name : "work pool");
+
+	if (pthread_mutex_init(&pool->run_mutex, NULL) != 0)
+		goto fail;
+	if (os_sem_init(&pool->start_sem, 0) != 0)
+		goto fail;
+	if (os_event_init(&pool->done_event, OS_EVENT_TYPE_AUTO) != 0)
+		goto fail;
+
+	pool->threads = bzalloc(sizeof(pthread_t) * threads);
+
+	for (size_t i = 0; i < threads; i++) {
+		if (pthread_create(&pool->threads[i], NULL, work_pool_thread,
+					pool) != 0)
+			goto fail;
+		pool->num_threads++;
+	}
+
+	return pool;
+
+fail:
+	work_pool_destroy(pool);
+	return NULL;
+}
+
+void work_pool_destroy(work_pool_t *pool)
+{
+	if (!pool)
+		return;
+
+	pool->stop = true;
+	for (size_t i = 0; i < pool->num_threads; i++)
+		os_sem_post(pool->start_sem);
+	for (size_t i = 0; i < pool->num_threads; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	os_event_destroy(pool->done_event);
+	os_sem_destroy(pool->start_sem);
+	pthread_mutex_destroy(&pool->run_mutex);
+	dstr_free(&pool->name);
+	bfree(pool->threads);
+	bfree(pool);
+}
+
+size_t work_pool_get_width(const work_pool_t *pool)
+{
+	return pool ? pool->num_threads + 1 : 1;
+}
+
+void work_pool_run(work_pool_t *pool, work_pool_func_t func, void *param,
+		size_t count)
+{
+	size_t wake;
+
+	if (!count)
+		return;
+
+	if (!pool || !pool->num_threads || count == 1) {
+		for (size_t i = 0; i < count; i++)
+			func(param, i);
+		return;
+	}
+
+	pthread_mutex_lock(&pool->run_mutex);
+
+	wake = count - 1 < pool->num_threads ? count - 1 : pool->num_threads;
+
+	pool->func = func;
+	pool->param = param;
+	pool->count = (long)count;
+	os_atomic_set_long(&pool->next_idx, 0);
+	os_atomic_set_long(&pool->remaining, (long)(count + wake));
+	os_event_reset(pool->done_event);
+
+	for (size_t i = 0; i < wake; i++)
+		os_sem_post(pool->start_sem);
+
+	process_job(pool);
+	os_event_wait(pool->done_event);
+
+	pthread_mutex_unlock(&pool->run_mutex);
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2026 OBS Project
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include "c99defs.h"
+
+/*
+ * Small persistent pool of worker threads for splitting a job into
+ * independent pieces.  A job is run with work_pool_run, which calls the job
+ * function once for every index in [0, count) spread across the worker
+ * threads and the calling thread, and returns once every index has been
+ * processed.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct work_pool;
+typedef struct work_pool work_pool_t;
+
+typedef void (*work_pool_func_t)(void *param, size_t idx);
+
+EXPORT work_pool_t *work_pool_create(const char *name, size_t threads);
+EXPORT void work_pool_destroy(work_pool_t *pool);
+
+/* number of threads a job is spread across, including the calling thread */
+EXPORT size_t work_pool_get_width(const work_pool_t *pool);
+
+/* only one job runs on a pool at a time; concurrent calls are serialized.
+ * if pool is NULL the job is run on the calling thread. */
+EXPORT void work_pool_run(work_pool_t *pool, work_pool_func_t func,
+		void *param, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
@@ -24,6 +24,7 @@ struct image_source {
 	float        update_time_elapsed;
 	uint64_t     last_time;
 	bool         active;
+	bool         opaque;
 
 	gs_image_file_t image;
 };
@@ -43,6 +44,27 @@ static const char *image_source_get_name(void *unused)
 	return obs_module_text("ImageInput");
 }
 
+static bool image_is_opaque(const gs_image_file_t *image)
+{
+	const uint8_t *pixel = image->texture_data;
+	size_t count;
+
+	if (!pixel || image->is_animated_gif)
+		return false;
+	if (image->format == GS_BGRX)
+		return true;
+	if (image->format != GS_RGBA && image->format != GS_BGRA)
+		return false;
+
+	count = (size_t)image->cx * image->cy;
+	for (size_t i = 0; i < count; i++, pixel += 4) {
+		if (pixel[3] != 0xFF)
+			return false;
+	}
+
+	return true;
+}
+
 static void image_source_load(struct image_source *context)
 {
 	char *file = context->file;
@@ -50,11 +72,13 @@ static void image_source_load(struct image_source *context)
 	obs_enter_graphics();
 	gs_image_file_free(&context->image);
 	obs_leave_graphics();
+	context->opaque = false;
 
 	if (file && *file) {
 		debug("loading texture '%s'", file);
 		context->file_timestamp = get_modified_timestamp(file);
 		gs_image_file_init(&context->image, file);
+		context->opaque = image_is_opaque(&context->image);
 		context->update_time_elapsed = 0;
 
 		obs_enter_graphics();
@@ -64,6 +88,8 @@ static void image_source_load(struct image_source *context)
 		if (!context->image.loaded)
 			warn("failed to load texture '%s'", file);
 	}
+
+	obs_source_mark_dirty(context->source);
 }
 
 static void image_source_unload(struct image_source *context)
@@ -71,6 +97,9 @@ static void image_source_unload(struct image_source *context)
 	obs_enter_graphics();
 	gs_image_file_free(&context->image);
 	obs_leave_graphics();
+	context->opaque = false;
+
+	obs_source_mark_dirty(context->source);
 }
 
 static void image_source_update(void *data, obs_data_t *settings)
@@ -144,6 +173,12 @@ static uint32_t image_source_getheight(void *data)
 	return context->image.cy;
 }
 
+static bool image_source_is_opaque(void *data)
+{
+	struct image_source *context = data;
+	return context->opaque && context->image.texture;
+}
+
 static void image_source_render(void *data, gs_effect_t *effect)
 {
 	struct image_source *context = data;
@@ -190,6 +225,8 @@ static void image_source_tick(void *data, float seconds)
 				obs_enter_graphics();
 				gs_image_file_update_texture(&context->image);
 				obs_leave_graphics();
+
+				obs_source_mark_dirty(context->source);
 			}
 
 			context->active = false;
@@ -206,6 +243,8 @@ static void image_source_tick(void *data, float seconds)
 			obs_enter_graphics();
 			gs_image_file_update_texture(&context->image);
 			obs_leave_graphics();
+
+			obs_source_mark_dirty(context->source);
 		}
 	}
 
@@ -253,7 +292,7 @@ static obs_properties_t *image_source_properties(void *data)
 static struct obs_source_info image_source_info = {
 	.id             = "image_source",
 	.type           = OBS_SOURCE_TYPE_INPUT,
-	.output_flags   = OBS_SOURCE_VIDEO,
+	.output_flags   = OBS_SOURCE_VIDEO | OBS_SOURCE_CACHEABLE,
 	.get_name       = image_source_get_name,
 	.create         = image_source_create,
 	.destroy        = image_source_destroy,
@@ -265,7 +304,8 @@ static struct obs_source_info image_source_info = {
 	.get_height     = image_source_getheight,
 	.video_render   = image_source_render,
 	.video_tick     = image_source_tick,
-	.get_properties = image_source_properties
+	.get_properties = image_source_properties,
+	.is_opaque      = image_source_is_opaque
 };
 
 OBS_DECLARE_MODULE()
@@ -123,6 +123,22 @@ int_fast32_t v4l2_destroy_mmap(struct v4l2_buffer_data *buf)
 	return 0;
 }
 
+bool v4l2_format_emulated(int_fast32_t dev, uint32_t pixelformat)
+{
+	struct v4l2_fmtdesc fmt;
+
+	memset(&fmt, 0, sizeof(fmt));
+	fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+
+	while (v4l2_ioctl(dev, VIDIOC_ENUM_FMT, &fmt) == 0) {
+		if (fmt.pixelformat == pixelformat)
+			return (fmt.flags & V4L2_FMT_FLAG_EMULATED) != 0;
+		fmt.index++;
+	}
+
+	return false;
+}
+
 int_fast32_t v4l2_set_input(int_fast32_t dev, int *input)
 {
 	if (!dev || !input)
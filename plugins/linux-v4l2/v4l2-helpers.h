@@ -219,6 +219,19 @@ int_fast32_t v4l2_create_mmap(int_fast32_t dev, struct v4l2_buffer_data *buf);
  */
 int_fast32_t v4l2_destroy_mmap(struct v4l2_buffer_data *buf);
 
+/**
+ * Check if a pixelformat is emulated by libv4l2
+ *
+ * Frames in emulated formats are converted into buffers owned by libv4l2,
+ * which are freed when the device is closed.
+ *
+ * @param dev handle for the v4l2 device
+ * @param pixelformat the v4l2 pixelformat
+ *
+ * @return true if the format is emulated
+ */
+bool v4l2_format_emulated(int_fast32_t dev, uint32_t pixelformat);
+
 /**
  * Set the video input on the device.
  *
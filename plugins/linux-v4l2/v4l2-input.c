@@ -63,6 +63,25 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #define blog(level, msg, ...) blog(level, "v4l2-input: " msg, ##__VA_ARGS__)
 
+/**
+ * Data structure for mapped buffers that can be lent to obs
+ *
+ * Frames are output without copying them as long as enough buffers stay
+ * queued for the device, and lent buffers are queued again once obs releases
+ * them. Since obs may hold on to a frame after the capture has stopped, the
+ * mapping is reference counted and only unmapped with the last reference.
+ * Buffers of emulated formats are never lent, since libv4l2 frees them when
+ * the device is closed.
+ */
+struct v4l2_lent_buffers {
+	pthread_mutex_t mutex;
+	long refs;
+	bool lendable;
+	uint_fast32_t lent;
+	int_fast32_t dev;
+	struct v4l2_buffer_data buffers;
+};
+
 /**
  * Data structure for the v4l2 source
  */
@@ -85,7 +104,7 @@ struct v4l2_data {
 	int width;
 	int height;
 	int linesize;
-	struct v4l2_buffer_data buffers;
+	struct v4l2_lent_buffers *mmap;
 };
 
 /* forward declarations */
@@ -142,6 +161,121 @@ static void v4l2_prep_obs_frame(struct v4l2_data *data,
 	}
 }
 
+/**
+ * Map the capture buffers of a device
+ *
+ * @param dev handle for the v4l2 device
+ * @param lendable whether the buffers may be lent to obs
+ *
+ * @return the mapped buffers or NULL on failure
+ */
+static struct v4l2_lent_buffers *v4l2_lent_buffers_create(int_fast32_t dev,
+		bool lendable)
+{
+	struct v4l2_lent_buffers *lb = bzalloc(sizeof(*lb));
+
+	lb->refs     = 1;
+	lb->lendable = lendable;
+	lb->dev      = dev;
+
+	if (pthread_mutex_init(&lb->mutex, NULL) != 0) {
+		bfree(lb);
+		return NULL;
+	}
+
+	if (v4l2_create_mmap(dev, &lb->buffers) < 0) {
+		v4l2_destroy_mmap(&lb->buffers);
+		pthread_mutex_destroy(&lb->mutex);
+		bfree(lb);
+		return NULL;
+	}
+
+	return lb;
+}
+
+static void v4l2_lent_buffers_release(struct v4l2_lent_buffers *lb)
+{
+	bool last;
+
+	pthread_mutex_lock(&lb->mutex);
+	last = --lb->refs == 0;
+	pthread_mutex_unlock(&lb->mutex);
+
+	if (last) {
+		v4l2_destroy_mmap(&lb->buffers);
+		pthread_mutex_destroy(&lb->mutex);
+		bfree(lb);
+	}
+}
+
+/**
+ * Stop queueing returned buffers and drop the reference of the source
+ *
+ * Must be called before the device is closed, buffers still lent to obs are
+ * unmapped once obs has released them.
+ */
+static void v4l2_lent_buffers_destroy(struct v4l2_lent_buffers *lb)
+{
+	if (!lb)
+		return;
+
+	pthread_mutex_lock(&lb->mutex);
+	lb->dev = -1;
+	pthread_mutex_unlock(&lb->mutex);
+
+	v4l2_lent_buffers_release(lb);
+}
+
+/**
+ * Try to lend a dequeued buffer to obs
+ *
+ * At least two buffers are always left to the device (or to the capture
+ * thread) so that capturing never stalls on frames buffered by obs.
+ */
+static bool v4l2_lend_buffer(struct v4l2_lent_buffers *lb)
+{
+	bool lend;
+
+	pthread_mutex_lock(&lb->mutex);
+	lend = lb->lendable && lb->lent + 2 < lb->buffers.count;
+	if (lend) {
+		lb->lent++;
+		lb->refs++;
+	}
+	pthread_mutex_unlock(&lb->mutex);
+
+	return lend;
+}
+
+/**
+ * Release callback for lent buffers, queues the buffer again
+ */
+static void v4l2_return_buffer(void *param, struct obs_source_frame *frame)
+{
+	struct v4l2_lent_buffers *lb = param;
+	struct v4l2_buffer buf;
+
+	memset(&buf, 0, sizeof(buf));
+	buf.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	buf.memory = V4L2_MEMORY_MMAP;
+
+	pthread_mutex_lock(&lb->mutex);
+
+	for (buf.index = 0; buf.index < lb->buffers.count; ++buf.index) {
+		if (lb->buffers.info[buf.index].start == frame->data[0])
+			break;
+	}
+
+	if (lb->dev != -1 && buf.index < lb->buffers.count &&
+	    v4l2_ioctl(lb->dev, VIDIOC_QBUF, &buf) < 0)
+		blog(LOG_DEBUG, "failed to enqueue lent buffer");
+
+	lb->lent--;
+	pthread_mutex_unlock(&lb->mutex);
+
+	v4l2_lent_buffers_release(lb);
+}
+
 /*
  * Worker thread to get video data
  */
@@ -158,7 +292,7 @@ static void *v4l2_thread(void *vptr)
 	struct obs_source_frame out;
 	size_t plane_offsets[MAX_AV_PLANES];
 
-	if (v4l2_start_capture(data->dev, &data->buffers) < 0)
+	if (v4l2_start_capture(data->dev, &data->mmap->buffers) < 0)
 		goto exit;
 
 	frames   = 0;
@@ -197,14 +331,20 @@ static void *v4l2_thread(void *vptr)
 			first_ts = out.timestamp;
 		out.timestamp -= first_ts;
 
-		start = (uint8_t *) data->buffers.info[buf.index].start;
+		start = (uint8_t *) data->mmap->buffers.info[buf.index].start;
 		for (uint_fast32_t i = 0; i < MAX_AV_PLANES; ++i)
 			out.data[i] = start + plane_offsets[i];
-		obs_source_output_video(data->source, &out);
 
-		if (v4l2_ioctl(data->dev, VIDIOC_QBUF, &buf) < 0) {
-			blog(LOG_DEBUG, "failed to enqueue buffer");
-			break;
+		if (v4l2_lend_buffer(data->mmap)) {
+			obs_source_output_video_no_copy(data->source, &out,
+					v4l2_return_buffer, data->mmap);
+		} else {
+			obs_source_output_video(data->source, &out);
+
+			if (v4l2_ioctl(data->dev, VIDIOC_QBUF, &buf) < 0) {
+				blog(LOG_DEBUG, "failed to enqueue buffer");
+				break;
+			}
 		}
 
 		frames++;
@@ -788,7 +928,8 @@ static void v4l2_terminate(struct v4l2_data *data)
 		data->thread = 0;
 	}
 
-	v4l2_destroy_mmap(&data->buffers);
+	v4l2_lent_buffers_destroy(data->mmap);
+	data->mmap = NULL;
 
 	if (data->dev != -1) {
 		v4l2_close(data->dev);
@@ -896,7 +1037,9 @@ static void v4l2_init(struct v4l2_data *data)
 	blog(LOG_INFO, "Framerate: %.2f fps", (float) fps_denom / fps_num);
 
 	/* map buffers */
-	if (v4l2_create_mmap(data->dev, &data->buffers) < 0) {
+	data->mmap = v4l2_lent_buffers_create(data->dev,
+			!v4l2_format_emulated(data->dev, data->pixfmt));
+	if (!data->mmap) {
 		blog(LOG_ERROR, "Failed to map buffers");
 		goto fail;
 	}
@@ -981,7 +1124,9 @@ struct obs_source_info v4l2_input = {
 	.id             = "v4l2_input",
 	.type           = OBS_SOURCE_TYPE_INPUT,
 	.output_flags   = OBS_SOURCE_ASYNC_VIDEO |
-	                  OBS_SOURCE_DO_NOT_DUPLICATE,
+	                  OBS_SOURCE_DO_NOT_DUPLICATE |
+	                  OBS_SOURCE_CACHED_RENDER |
+	                  OBS_SOURCE_PARALLEL_TICK,
 	.get_name       = v4l2_getname,
 	.create         = v4l2_create,
 	.destroy        = v4l2_destroy,
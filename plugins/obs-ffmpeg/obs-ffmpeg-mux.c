@@ -25,6 +25,7 @@
 #include <util/circlebuf.h>
 #include <util/threading.h>
 #include "ffmpeg-mux/ffmpeg-mux.h"
+#include "spill-file.h"
 
 #include <libavformat/avformat.h>
 
@@ -35,6 +36,25 @@
 #define warn(format, ...)  do_log(LOG_WARNING, format, ##__VA_ARGS__)
 #define info(format, ...)  do_log(LOG_INFO,    format, ##__VA_ARGS__)
 
+/* replay buffer packet of which the data is in the spill file */
+struct spill_packet {
+	int64_t           pts;
+	int64_t           dts;
+	int64_t           dts_usec;
+	uint64_t          pos;
+	uint32_t          size;
+	uint8_t           type;
+	uint8_t           track_idx;
+	bool              keyframe;
+};
+
+struct spill_mux_packet {
+	struct spill_packet packet;
+
+	/* lowest spill file position used by this or any later packet */
+	uint64_t            keep_pos;
+};
+
 struct ffmpeg_muxer {
 	obs_output_t      *output;
 	os_process_pipe_t *pipe;
@@ -56,7 +76,14 @@ struct ffmpeg_muxer {
 	int               keyframes;
 	obs_hotkey_id     hotkey;
 
+	/* if set, the packets buffer holds spill_packet entries and the packet
+	 * data is kept in this file instead of memory */
+	struct spill_file *spill;
+
 	DARRAY(struct encoder_packet) mux_packets;
+	DARRAY(struct spill_mux_packet) mux_spill_packets;
+	DARRAY(uint8_t)               mux_spill_data;
+	struct spill_file             *mux_spill;
 	pthread_t                     mux_thread;
 	bool                          mux_thread_joinable;
 	volatile bool                 muxing;
@@ -68,15 +95,55 @@ static const char *ffmpeg_mux_getname(void *type)
 	return obs_module_text("FFmpegMuxer");
 }
 
+static inline void spill_to_encoder_packet(const struct spill_packet *sp,
+		struct encoder_packet *pkt)
+{
+	memset(pkt, 0, sizeof(*pkt));
+	pkt->pts       = sp->pts;
+	pkt->dts       = sp->dts;
+	pkt->dts_usec  = sp->dts_usec;
+	pkt->size      = sp->size;
+	pkt->type      = (enum obs_encoder_type)sp->type;
+	pkt->track_idx = sp->track_idx;
+	pkt->keyframe  = sp->keyframe;
+}
+
+/* packets of the spill file come back without data */
+static inline void pop_buffered_packet(struct ffmpeg_muxer *stream,
+		struct encoder_packet *pkt)
+{
+	if (stream->spill) {
+		struct spill_packet sp;
+		circlebuf_pop_front(&stream->packets, &sp, sizeof(sp));
+		spill_to_encoder_packet(&sp, pkt);
+	} else {
+		circlebuf_pop_front(&stream->packets, pkt, sizeof(*pkt));
+	}
+}
+
+static inline void peek_buffered_packet(struct ffmpeg_muxer *stream,
+		struct encoder_packet *pkt)
+{
+	if (stream->spill) {
+		struct spill_packet sp;
+		circlebuf_peek_front(&stream->packets, &sp, sizeof(sp));
+		spill_to_encoder_packet(&sp, pkt);
+	} else {
+		circlebuf_peek_front(&stream->packets, pkt, sizeof(*pkt));
+	}
+}
+
 static inline void replay_buffer_clear(struct ffmpeg_muxer *stream)
 {
 	while (stream->packets.size > 0) {
 		struct encoder_packet pkt;
-		circlebuf_pop_front(&stream->packets, &pkt, sizeof(pkt));
+		pop_buffered_packet(stream, &pkt);
 		obs_encoder_packet_release(&pkt);
 	}
 
 	circlebuf_free(&stream->packets);
+	spill_file_release(stream->spill);
+	stream->spill = NULL;
 	stream->cur_size = 0;
 	stream->cur_time = 0;
 	stream->max_size = 0;
@@ -93,6 +160,8 @@ static void ffmpeg_mux_destroy(void *data)
 	if (stream->mux_thread_joinable)
 		pthread_join(stream->mux_thread, NULL);
 	da_free(stream->mux_packets);
+	da_free(stream->mux_spill_packets);
+	da_free(stream->mux_spill_data);
 
 	os_process_pipe_destroy(stream->pipe);
 	dstr_free(&stream->path);
@@ -367,11 +436,39 @@ static void signal_failure(struct ffmpeg_muxer *stream)
 	os_atomic_set_bool(&stream->capturing, false);
 }
 
+/* the packet data can be split in two (the second part may be empty) */
+static bool write_packet_parts(struct ffmpeg_muxer *stream,
+		const struct ffm_packet_info *info,
+		const uint8_t *data1, size_t size1,
+		const uint8_t *data2, size_t size2)
+{
+	size_t ret;
+
+	ret = os_process_pipe_write(stream->pipe, (const uint8_t*)info,
+			sizeof(*info));
+	if (ret != sizeof(*info)) {
+		warn("os_process_pipe_write for info structure failed");
+		signal_failure(stream);
+		return false;
+	}
+
+	ret = os_process_pipe_write(stream->pipe, data1, size1);
+	if (ret == size1 && size2)
+		ret += os_process_pipe_write(stream->pipe, data2, size2);
+	if (ret != size1 + size2) {
+		warn("os_process_pipe_write for packet data failed");
+		signal_failure(stream);
+		return false;
+	}
+
+	stream->total_bytes += size1 + size2;
+	return true;
+}
+
 static bool write_packet(struct ffmpeg_muxer *stream,
 		struct encoder_packet *packet)
 {
 	bool is_video = packet->type == OBS_ENCODER_VIDEO;
-	size_t ret;
 
 	struct ffm_packet_info info = {
 		.pts = packet->pts,
@@ -382,23 +479,42 @@ static bool write_packet(struct ffmpeg_muxer *stream,
 		.keyframe = packet->keyframe
 	};
 
-	ret = os_process_pipe_write(stream->pipe, (const uint8_t*)&info,
-			sizeof(info));
-	if (ret != sizeof(info)) {
-		warn("os_process_pipe_write for info structure failed");
-		signal_failure(stream);
-		return false;
-	}
+	return write_packet_parts(stream, &info, packet->data, packet->size,
+			NULL, 0);
+}
 
-	ret = os_process_pipe_write(stream->pipe, packet->data, packet->size);
-	if (ret != packet->size) {
-		warn("os_process_pipe_write for packet data failed");
-		signal_failure(stream);
-		return false;
-	}
+/* recording can overwrite the data while it's being read, so it's copied
+ * out of the spill file before it's checked and written */
+static void copy_spill_packet_data(struct ffmpeg_muxer *stream,
+		struct spill_packet *packet)
+{
+	const uint8_t *data1, *data2;
+	size_t size1, size2;
 
-	stream->total_bytes += packet->size;
-	return true;
+	spill_file_peek(stream->mux_spill, packet->pos, packet->size,
+			&data1, &size1, &data2, &size2);
+
+	da_resize(stream->mux_spill_data, packet->size);
+	memcpy(stream->mux_spill_data.array, data1, size1);
+	memcpy(stream->mux_spill_data.array + size1, data2, size2);
+}
+
+static bool write_spill_packet(struct ffmpeg_muxer *stream,
+		struct spill_packet *packet)
+{
+	bool is_video = packet->type == OBS_ENCODER_VIDEO;
+
+	struct ffm_packet_info info = {
+		.pts = packet->pts,
+		.dts = packet->dts,
+		.size = packet->size,
+		.index = (int)packet->track_idx,
+		.type = is_video ? FFM_PACKET_VIDEO : FFM_PACKET_AUDIO,
+		.keyframe = packet->keyframe
+	};
+
+	return write_packet_parts(stream, &info, stream->mux_spill_data.array,
+			packet->size, NULL, 0);
 }
 
 static bool send_audio_headers(struct ffmpeg_muxer *stream,
@@ -565,6 +681,29 @@ static void replay_buffer_destroy(void *data)
 	ffmpeg_mux_destroy(data);
 }
 
+static void replay_buffer_create_spill(struct ffmpeg_muxer *stream,
+		obs_data_t *settings)
+{
+	const char *dir = obs_data_get_string(settings, "spill_directory");
+
+	if (!stream->max_size) {
+		warn("A spill file needs a maximum size, keeping the replay "
+		     "buffer in memory");
+		return;
+	}
+
+	if (!*dir)
+		dir = obs_data_get_string(settings, "directory");
+
+	/* the extra space lets recording continue while a replay is being
+	 * saved from the file */
+	stream->spill = spill_file_create(dir,
+			(uint64_t)(stream->max_size + stream->max_size / 2));
+	if (!stream->spill)
+		warn("Failed to create a spill file in '%s', keeping the "
+		     "replay buffer in memory", dir);
+}
+
 static bool replay_buffer_start(void *data)
 {
 	struct ffmpeg_muxer *stream = data;
@@ -577,6 +716,8 @@ static bool replay_buffer_start(void *data)
 	obs_data_t *s = obs_output_get_settings(stream->output);
 	stream->max_time = obs_data_get_int(s, "max_time_sec") * 1000000LL;
 	stream->max_size = obs_data_get_int(s, "max_size_mb") * (1024 * 1024);
+	if (obs_data_get_bool(s, "use_spill_file"))
+		replay_buffer_create_spill(stream, s);
 	obs_data_release(s);
 
 	os_atomic_set_bool(&stream->active, true);
@@ -592,7 +733,7 @@ static bool purge_front(struct ffmpeg_muxer *stream)
 	struct encoder_packet pkt;
 	bool keyframe;
 
-	circlebuf_pop_front(&stream->packets, &pkt, sizeof(pkt));
+	pop_buffered_packet(stream, &pkt);
 
 	keyframe = pkt.type == OBS_ENCODER_VIDEO && pkt.keyframe;
 
@@ -604,7 +745,7 @@ static bool purge_front(struct ffmpeg_muxer *stream)
 		stream->cur_time = 0;
 	} else {
 		struct encoder_packet first;
-		circlebuf_peek_front(&stream->packets, &first, sizeof(first));
+		peek_buffered_packet(stream, &first);
 		stream->cur_time = first.dts_usec;
 		stream->cur_size -= (int64_t)pkt.size;
 	}
@@ -618,9 +759,8 @@ static inline void purge(struct ffmpeg_muxer *stream)
 	if (purge_front(stream)) {
 		struct encoder_packet pkt;
 
-		for (;;) {
-			circlebuf_peek_front(&stream->packets, &pkt,
-					sizeof(pkt));
+		while (stream->packets.size) {
+			peek_buffered_packet(stream, &pkt);
 			if (pkt.type == OBS_ENCODER_VIDEO && pkt.keyframe)
 				return;
 
@@ -648,9 +788,95 @@ static inline void replay_buffer_purge(struct ffmpeg_muxer *stream,
 		purge(stream);
 }
 
+/* unlike the memory buffer, the spill file can't go over its size, so the
+ * oldest packets are purged even if that leaves fewer keyframes */
+static bool make_spill_room(struct ffmpeg_muxer *stream,
+		struct encoder_packet *pkt)
+{
+	uint64_t capacity = spill_file_capacity(stream->spill);
+	uint64_t head = spill_file_head(stream->spill);
+
+	if (pkt->size > capacity) {
+		warn("Packet of %u bytes does not fit in the spill file",
+				(unsigned)pkt->size);
+		return false;
+	}
+
+	while (stream->packets.size) {
+		struct spill_packet first;
+		circlebuf_peek_front(&stream->packets, &first, sizeof(first));
+
+		if (head + pkt->size - first.pos <= capacity)
+			break;
+
+		purge(stream);
+	}
+
+	return true;
+}
+
+static void push_spill_packet(struct ffmpeg_muxer *stream,
+		struct encoder_packet *pkt)
+{
+	struct spill_packet sp = {
+		.pts       = pkt->pts,
+		.dts       = pkt->dts,
+		.dts_usec  = pkt->dts_usec,
+		.size      = (uint32_t)pkt->size,
+		.type      = (uint8_t)pkt->type,
+		.track_idx = (uint8_t)pkt->track_idx,
+		.keyframe  = pkt->keyframe
+	};
+
+	sp.pos = spill_file_write(stream->spill, pkt->data, pkt->size);
+	circlebuf_push_back(&stream->packets, &sp, sizeof(sp));
+}
+
+struct replay_offsets {
+	bool    found_video;
+	bool    found_audio[MAX_AUDIO_MIXES];
+	int64_t video_offset;
+	int64_t video_dts_offset;
+	int64_t audio_offsets[MAX_AUDIO_MIXES];
+	int64_t audio_dts_offsets[MAX_AUDIO_MIXES];
+};
+
+static void update_offsets(struct replay_offsets *offsets,
+		enum obs_encoder_type type, size_t track_idx,
+		int64_t dts_usec, int64_t dts)
+{
+	if (type == OBS_ENCODER_VIDEO) {
+		if (!offsets->found_video) {
+			offsets->video_offset = dts_usec;
+			offsets->video_dts_offset = dts;
+			offsets->found_video = true;
+		}
+	} else {
+		if (!offsets->found_audio[track_idx]) {
+			offsets->found_audio[track_idx] = true;
+			offsets->audio_offsets[track_idx] = dts_usec;
+			offsets->audio_dts_offsets[track_idx] = dts;
+		}
+	}
+}
+
+static void apply_offsets(const struct replay_offsets *offsets,
+		enum obs_encoder_type type, size_t track_idx,
+		int64_t *dts_usec, int64_t *dts, int64_t *pts)
+{
+	if (type == OBS_ENCODER_VIDEO) {
+		*dts_usec -= offsets->video_offset;
+		*dts -= offsets->video_dts_offset;
+		*pts -= offsets->video_dts_offset;
+	} else {
+		*dts_usec -= offsets->audio_offsets[track_idx];
+		*dts -= offsets->audio_dts_offsets[track_idx];
+		*pts -= offsets->audio_dts_offsets[track_idx];
+	}
+}
+
 static void insert_packet(struct darray *array, struct encoder_packet *packet,
-		int64_t video_offset, int64_t *audio_offsets,
-		int64_t video_dts_offset, int64_t *audio_dts_offsets)
+		const struct replay_offsets *offsets)
 {
 	struct encoder_packet pkt;
 	DARRAY(struct encoder_packet) packets;
@@ -658,16 +884,8 @@ static void insert_packet(struct darray *array, struct encoder_packet *packet,
 	size_t idx;
 
 	obs_encoder_packet_ref(&pkt, packet);
-
-	if (pkt.type == OBS_ENCODER_VIDEO) {
-		pkt.dts_usec -= video_offset;
-		pkt.dts -= video_dts_offset;
-		pkt.pts -= video_dts_offset;
-	} else {
-		pkt.dts_usec -= audio_offsets[pkt.track_idx];
-		pkt.dts -= audio_dts_offsets[pkt.track_idx];
-		pkt.pts -= audio_dts_offsets[pkt.track_idx];
-	}
+	apply_offsets(offsets, pkt.type, pkt.track_idx,
+			&pkt.dts_usec, &pkt.dts, &pkt.pts);
 
 	for (idx = packets.num; idx > 0; idx--) {
 		struct encoder_packet *p = packets.array + (idx - 1);
@@ -679,6 +897,57 @@ static void insert_packet(struct darray *array, struct encoder_packet *packet,
 	*array = packets.da;
 }
 
+static void insert_spill_packet(struct darray *array,
+		struct spill_packet *packet,
+		const struct replay_offsets *offsets)
+{
+	struct spill_mux_packet pkt = {*packet, 0};
+	DARRAY(struct spill_mux_packet) packets;
+	packets.da = *array;
+	size_t idx;
+
+	apply_offsets(offsets, pkt.packet.type, pkt.packet.track_idx,
+			&pkt.packet.dts_usec, &pkt.packet.dts,
+			&pkt.packet.pts);
+
+	for (idx = packets.num; idx > 0; idx--) {
+		struct spill_mux_packet *p = packets.array + (idx - 1);
+		if (p->packet.dts_usec < pkt.packet.dts_usec)
+			break;
+	}
+
+	da_insert(packets, idx, &pkt);
+	*array = packets.da;
+}
+
+static bool write_spill_packets(struct ffmpeg_muxer *stream)
+{
+	for (size_t i = 0; i < stream->mux_spill_packets.num; i++) {
+		struct spill_mux_packet *pkt =
+			&stream->mux_spill_packets.array[i];
+
+		copy_spill_packet_data(stream, &pkt->packet);
+
+		/* let recording reuse the part of the file that's done.  if
+		 * recording had to overwrite data that was still needed, the
+		 * replay ends at the last packet that was intact */
+		if (!spill_file_keep(stream->mux_spill,
+					i + 1 < stream->mux_spill_packets.num ?
+					pkt[1].keep_pos : SPILL_KEEP_NONE)) {
+			warn("Recording overwrote the replay buffer while it "
+			     "was being saved, '%s' only has the first %d "
+			     "of %d packets", stream->path.array, (int)i,
+			     (int)stream->mux_spill_packets.num);
+			return false;
+		}
+
+		if (!write_spill_packet(stream, &pkt->packet))
+			return false;
+	}
+
+	return true;
+}
+
 static void *replay_buffer_mux_thread(void *data)
 {
 	struct ffmpeg_muxer *stream = data;
@@ -696,10 +965,16 @@ static void *replay_buffer_mux_thread(void *data)
 		goto error;
 	}
 
-	for (size_t i = 0; i < stream->mux_packets.num; i++) {
-		struct encoder_packet *pkt = &stream->mux_packets.array[i];
-		write_packet(stream, pkt);
-		obs_encoder_packet_release(pkt);
+	if (stream->mux_spill) {
+		if (!write_spill_packets(stream))
+			goto error;
+	} else {
+		for (size_t i = 0; i < stream->mux_packets.num; i++) {
+			struct encoder_packet *pkt =
+				&stream->mux_packets.array[i];
+			write_packet(stream, pkt);
+			obs_encoder_packet_release(pkt);
+		}
 	}
 
 	info("Wrote replay buffer to '%s'", stream->path.array);
@@ -708,49 +983,78 @@ error:
 	os_process_pipe_destroy(stream->pipe);
 	stream->pipe = NULL;
 	da_free(stream->mux_packets);
+	if (stream->mux_spill) {
+		spill_file_keep(stream->mux_spill, SPILL_KEEP_NONE);
+		spill_file_release(stream->mux_spill);
+		stream->mux_spill = NULL;
+	}
+	da_free(stream->mux_spill_packets);
 	os_atomic_set_bool(&stream->muxing, false);
 	return NULL;
 }
 
-static void replay_buffer_save(struct ffmpeg_muxer *stream)
+static void replay_buffer_reorder_spill(struct ffmpeg_muxer *stream)
 {
-	const size_t size = sizeof(struct encoder_packet);
+	const size_t size = sizeof(struct spill_packet);
 	size_t num_packets = stream->packets.size / size;
+	struct replay_offsets offsets = {0};
+	uint64_t keep_pos = SPILL_KEEP_NONE;
 
-	da_reserve(stream->mux_packets, num_packets);
+	da_reserve(stream->mux_spill_packets, num_packets);
 
-	/* ---------------------------- */
-	/* reorder packets */
+	for (size_t i = 0; i < num_packets; i++) {
+		struct spill_packet *pkt;
+		pkt = circlebuf_data(&stream->packets, i * size);
+
+		update_offsets(&offsets, pkt->type, pkt->track_idx,
+				pkt->dts_usec, pkt->dts);
+		insert_spill_packet(&stream->mux_spill_packets.da, pkt,
+				&offsets);
+	}
+
+	for (size_t i = stream->mux_spill_packets.num; i > 0; i--) {
+		struct spill_mux_packet *pkt =
+			&stream->mux_spill_packets.array[i - 1];
+
+		if (pkt->packet.pos < keep_pos)
+			keep_pos = pkt->packet.pos;
+		pkt->keep_pos = keep_pos;
+	}
+
+	/* the mux thread keeps the file alive and keeps its data from being
+	 * overwritten until it's done with it */
+	spill_file_addref(stream->spill);
+	stream->mux_spill = stream->spill;
+	spill_file_keep(stream->mux_spill, keep_pos);
+}
+
+static void replay_buffer_reorder(struct ffmpeg_muxer *stream)
+{
+	const size_t size = sizeof(struct encoder_packet);
+	size_t num_packets = stream->packets.size / size;
+	struct replay_offsets offsets = {0};
 
-	bool found_video = false;
-	bool found_audio[MAX_AUDIO_MIXES] = {0};
-	int64_t video_offset = 0;
-	int64_t video_dts_offset = 0;
-	int64_t audio_offsets[MAX_AUDIO_MIXES] = {0};
-	int64_t audio_dts_offsets[MAX_AUDIO_MIXES] = {0};
+	da_reserve(stream->mux_packets, num_packets);
 
 	for (size_t i = 0; i < num_packets; i++) {
 		struct encoder_packet *pkt;
 		pkt = circlebuf_data(&stream->packets, i * size);
 
-		if (pkt->type == OBS_ENCODER_VIDEO) {
-			if (!found_video) {
-				video_offset = pkt->dts_usec;
-				video_dts_offset = pkt->dts;
-				found_video = true;
-			}
-		} else {
-			if (!found_audio[pkt->track_idx]) {
-				found_audio[pkt->track_idx] = true;
-				audio_offsets[pkt->track_idx] = pkt->dts_usec;
-				audio_dts_offsets[pkt->track_idx] = pkt->dts;
-			}
-		}
-
-		insert_packet(&stream->mux_packets.da, pkt,
-				video_offset, audio_offsets,
-				video_dts_offset, audio_dts_offsets);
+		update_offsets(&offsets, pkt->type, pkt->track_idx,
+				pkt->dts_usec, pkt->dts);
+		insert_packet(&stream->mux_packets.da, pkt, &offsets);
 	}
+}
+
+static void replay_buffer_save(struct ffmpeg_muxer *stream)
+{
+	/* ---------------------------- */
+	/* reorder packets */
+
+	if (stream->spill)
+		replay_buffer_reorder_spill(stream);
+	else
+		replay_buffer_reorder(stream);
 
 	/* ---------------------------- */
 	/* generate filename */
@@ -805,14 +1109,20 @@ static void replay_buffer_data(void *data, struct encoder_packet *packet)
 		}
 	}
 
-	obs_encoder_packet_ref(&pkt, packet);
-	replay_buffer_purge(stream, &pkt);
+	replay_buffer_purge(stream, packet);
+	if (stream->spill && !make_spill_room(stream, packet))
+		return;
 
 	if (!stream->packets.size)
-		stream->cur_time = pkt.dts_usec;
-	stream->cur_size += pkt.size;
+		stream->cur_time = packet->dts_usec;
+	stream->cur_size += packet->size;
 
-	circlebuf_push_back(&stream->packets, packet, sizeof(*packet));
+	if (stream->spill) {
+		push_spill_packet(stream, packet);
+	} else {
+		obs_encoder_packet_ref(&pkt, packet);
+		circlebuf_push_back(&stream->packets, &pkt, sizeof(pkt));
+	}
 
 	if (packet->type == OBS_ENCODER_VIDEO && packet->keyframe)
 		stream->keyframes++;
@@ -838,6 +1148,7 @@ static void replay_buffer_defaults(obs_data_t *s)
 	obs_data_set_default_string(s, "format", "%CCYY-%MM-%DD %hh-%mm-%ss");
 	obs_data_set_default_string(s, "extension", "mp4");
 	obs_data_set_default_bool(s, "allow_spaces", true);
+	obs_data_set_default_bool(s, "use_spill_file", false);
 }
 
 struct obs_output_info replay_buffer = {
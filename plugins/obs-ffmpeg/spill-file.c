@@ -0,0 +1,263 @@
+/******************************************************************************
+    Copyright (C) 2026 by OBS Project
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <util/bmem.h>
+#include <util/base.h>
+#include <util/dstr.h>
+#include <util/platform.h>
+#include <util/threading.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#include "spill-file.h"
+
+struct spill_file {
+	volatile long   refs;
+
+	uint8_t         *data;
+	uint64_t        capacity;
+	uint64_t        head;
+
+#ifdef _WIN32
+	HANDLE          file;
+	HANDLE          mapping;
+#else
+	int             fd;
+#endif
+
+	pthread_mutex_t keep_mutex;
+	uint64_t        keep_pos;
+	bool            keep_lost;
+};
+
+#ifdef _WIN32
+static bool map_file(struct spill_file *spill, const char *dir)
+{
+	struct dstr path = {0};
+	wchar_t *wpath = NULL;
+	LARGE_INTEGER size;
+
+	dstr_printf(&path, "%s/obs-replay-%lu-%p.tmp", dir,
+			(unsigned long)GetCurrentProcessId(), spill);
+	os_utf8_to_wcs_ptr(path.array, path.len, &wpath);
+	dstr_free(&path);
+
+	spill->file = CreateFileW(wpath, GENERIC_READ | GENERIC_WRITE, 0,
+			NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY |
+			FILE_FLAG_DELETE_ON_CLOSE, NULL);
+	bfree(wpath);
+
+	if (spill->file == INVALID_HANDLE_VALUE) {
+		spill->file = NULL;
+		return false;
+	}
+
+	size.QuadPart = (LONGLONG)spill->capacity;
+	spill->mapping = CreateFileMappingW(spill->file, NULL, PAGE_READWRITE,
+			size.HighPart, size.LowPart, NULL);
+	if (!spill->mapping)
+		return false;
+
+	spill->data = MapViewOfFile(spill->mapping, FILE_MAP_ALL_ACCESS, 0, 0,
+			(SIZE_T)spill->capacity);
+	return spill->data != NULL;
+}
+
+static void unmap_file(struct spill_file *spill)
+{
+	if (spill->data)
+		UnmapViewOfFile(spill->data);
+	if (spill->mapping)
+		CloseHandle(spill->mapping);
+	if (spill->file)
+		CloseHandle(spill->file);
+}
+
+#else
+static bool map_file(struct spill_file *spill, const char *dir)
+{
+	struct dstr path = {0};
+	int ret;
+
+	dstr_printf(&path, "%s/obs-replay-XXXXXX", dir);
+	spill->fd = mkstemp(path.array);
+
+	/* the file stays around for as long as it's open */
+	if (spill->fd != -1)
+		unlink(path.array);
+	dstr_free(&path);
+
+	if (spill->fd == -1)
+		return false;
+
+	/* allocate the disk space up front: writing to a sparse mapping on a
+	 * full disk would crash instead of failing */
+#ifdef __APPLE__
+	ret = ftruncate(spill->fd, (off_t)spill->capacity) == 0 ? 0 : -1;
+#else
+	ret = posix_fallocate(spill->fd, 0, (off_t)spill->capacity);
+#endif
+	if (ret != 0)
+		return false;
+
+	spill->data = mmap(NULL, (size_t)spill->capacity,
+			PROT_READ | PROT_WRITE, MAP_SHARED, spill->fd, 0);
+	if (spill->data == MAP_FAILED) {
+		spill->data = NULL;
+		return false;
+	}
+
+	return true;
+}
+
+static void unmap_file(struct spill_file *spill)
+{
+	if (spill->data)
+		munmap(spill->data, (size_t)spill->capacity);
+	if (spill->fd != -1)
+		close(spill->fd);
+}
+#endif
+
+struct spill_file *spill_file_create(const char *dir, uint64_t capacity)
+{
+	struct spill_file *spill = bzalloc(sizeof(*spill));
+	spill->refs = 1;
+	spill->capacity = capacity;
+	spill->keep_pos = SPILL_KEEP_NONE;
+#ifndef _WIN32
+	spill->fd = -1;
+#endif
+
+	pthread_mutex_init_value(&spill->keep_mutex);
+	if (pthread_mutex_init(&spill->keep_mutex, NULL) != 0)
+		goto fail;
+
+	if (!map_file(spill, dir)) {
+		blog(LOG_WARNING, "spill_file_create: Failed to create a "
+				"%"PRIu64" MB spill file in '%s'",
+				capacity / (1024 * 1024), dir);
+		goto fail;
+	}
+
+	return spill;
+
+fail:
+	spill_file_release(spill);
+	return NULL;
+}
+
+void spill_file_addref(struct spill_file *spill)
+{
+	os_atomic_inc_long(&spill->refs);
+}
+
+void spill_file_release(struct spill_file *spill)
+{
+	if (!spill || os_atomic_dec_long(&spill->refs) != 0)
+		return;
+
+	unmap_file(spill);
+	pthread_mutex_destroy(&spill->keep_mutex);
+	bfree(spill);
+}
+
+uint64_t spill_file_capacity(const struct spill_file *spill)
+{
+	return spill->capacity;
+}
+
+uint64_t spill_file_head(const struct spill_file *spill)
+{
+	return spill->head;
+}
+
+/* the reader is behind by a whole file, which only happens if saving a
+ * replay is slower than recording it.  recording can't wait for it, so the
+ * kept data is given up.  this is done before the data is overwritten, so a
+ * reader that copied data and then finds it still kept has a good copy */
+static inline void drop_overwritten_keep(struct spill_file *spill,
+		size_t size)
+{
+	pthread_mutex_lock(&spill->keep_mutex);
+	if (spill->keep_pos != SPILL_KEEP_NONE &&
+	    spill->head + size - spill->keep_pos > spill->capacity) {
+		spill->keep_pos = SPILL_KEEP_NONE;
+		spill->keep_lost = true;
+	}
+	pthread_mutex_unlock(&spill->keep_mutex);
+}
+
+uint64_t spill_file_write(struct spill_file *spill, const void *data,
+		size_t size)
+{
+	uint64_t pos = spill->head;
+	size_t offset = (size_t)(pos % spill->capacity);
+	size_t size1 = size;
+
+	drop_overwritten_keep(spill, size);
+
+	if (offset + size1 > spill->capacity)
+		size1 = (size_t)spill->capacity - offset;
+
+	memcpy(spill->data + offset, data, size1);
+	if (size1 < size)
+		memcpy(spill->data, (const uint8_t*)data + size1, size - size1);
+
+	spill->head += size;
+	return pos;
+}
+
+void spill_file_peek(const struct spill_file *spill, uint64_t pos,
+		size_t size, const uint8_t **data1, size_t *size1,
+		const uint8_t **data2, size_t *size2)
+{
+	size_t offset = (size_t)(pos % spill->capacity);
+
+	*data1 = spill->data + offset;
+	*size1 = size;
+	*data2 = spill->data;
+	*size2 = 0;
+
+	if (offset + size > spill->capacity) {
+		*size1 = (size_t)spill->capacity - offset;
+		*size2 = size - *size1;
+	}
+}
+
+bool spill_file_keep(struct spill_file *spill, uint64_t pos)
+{
+	bool kept;
+
+	pthread_mutex_lock(&spill->keep_mutex);
+	kept = !spill->keep_lost;
+	spill->keep_pos = pos;
+	spill->keep_lost = false;
+	pthread_mutex_unlock(&spill->keep_mutex);
+
+	return kept;
+}
@@ -0,0 +1,64 @@
+/******************************************************************************
+    Copyright (C) 2026 by OBS Project
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#pragma once
+
+#include <util/c99defs.h>
+
+/*
+ * Circular buffer in a memory mapped temporary file, used by the replay
+ * buffer to keep packet data out of memory.
+ *
+ * Positions are logical byte offsets that only ever increase; the data of
+ * position 'pos' lives at 'pos % capacity' in the file.  The writer is
+ * responsible for not overwriting data it still needs.  A reader on another
+ * thread (the replay mux thread) can additionally mark a position to keep.
+ * Writes never wait for the reader: if one has to overwrite kept data, the
+ * reader is told the next time it calls spill_file_keep.
+ *
+ * The file is removed when the last reference is released (or as soon as it
+ * is created where the platform allows it).
+ */
+
+struct spill_file;
+
+#define SPILL_KEEP_NONE UINT64_MAX
+
+extern struct spill_file *spill_file_create(const char *dir,
+		uint64_t capacity);
+extern void spill_file_addref(struct spill_file *spill);
+extern void spill_file_release(struct spill_file *spill);
+
+extern uint64_t spill_file_capacity(const struct spill_file *spill);
+
+/* logical position of the next write */
+extern uint64_t spill_file_head(const struct spill_file *spill);
+
+/* writes data at the head and returns its position.  size must not be larger
+ * than the capacity */
+extern uint64_t spill_file_write(struct spill_file *spill, const void *data,
+		size_t size);
+
+/* gets the data at a position, which is split in two if it wraps around the
+ * end of the file */
+extern void spill_file_peek(const struct spill_file *spill, uint64_t pos,
+		size_t size, const uint8_t **data1, size_t *size1,
+		const uint8_t **data2, size_t *size2);
+
+/* sets the lowest position the reader still needs, or SPILL_KEEP_NONE.
+ * returns false if a write overwrote kept data since the last call */
+extern bool spill_file_keep(struct spill_file *spill, uint64_t pos);
@@ -17,6 +17,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <obs-module.h>
 #include <graphics/matrix4.h>
 #include <graphics/quat.h>
+#include <util/platform.h>
 
 
 #define SETTING_GAMMA                  "gamma"
@@ -39,6 +40,7 @@ struct color_correction_filter_data {
 	obs_source_t                   *context;
 
 	gs_effect_t                    *effect;
+	char                           *fused_shader;
 
 	gs_eparam_t                    *gamma_param;
 	gs_eparam_t                    *final_matrix_param;
@@ -251,6 +253,7 @@ static void color_correction_filter_destroy(void *data)
 		obs_leave_graphics();
 	}
 
+	bfree(filter->fused_shader);
 	bfree(data);
 }
 
@@ -277,6 +280,7 @@ static void *color_correction_filter_create(obs_data_t *settings,
 	 * your filter resides in.
 	 */
 	char *effect_path = obs_module_file("color_correction_filter.effect");
+	char *fused_path = obs_module_file("color_correction_filter.fused");
 
 	filter->context = context;
 
@@ -294,15 +298,23 @@ static void *color_correction_filter_create(obs_data_t *settings,
 	/* If the filter is active pass the parameters to the filter. */
 	if (filter->effect) {
 		filter->gamma_param = gs_effect_get_param_by_name(
-				filter->effect, SETTING_GAMMA);
+				filter->effect, "FILTER_gamma");
 		filter->final_matrix_param = gs_effect_get_param_by_name(
-				filter->effect, "color_matrix");
+				filter->effect, "FILTER_color_matrix");
 	}
 
 	obs_leave_graphics();
 
 	bfree(effect_path);
 
+	/*
+	 * The same shader without its own pass, so that OBS can render this
+	 * filter in one pass together with the filters next to it.
+	 */
+	if (fused_path)
+		filter->fused_shader = os_quick_read_utf8_file(fused_path);
+	bfree(fused_path);
+
 	/*
 	 * If the filter has been removed/deactivated, destroy the filter
 	 * and exit out so we don't crash OBS by telling it to update
@@ -340,6 +352,23 @@ static void color_correction_filter_render(void *data, gs_effect_t *effect)
 	UNUSED_PARAMETER(effect);
 }
 
+static const char *color_correction_filter_fused_shader(void *data)
+{
+	struct color_correction_filter_data *filter = data;
+	return filter->fused_shader;
+}
+
+static void color_correction_filter_fused_params(void *data,
+		gs_effect_t *effect)
+{
+	struct color_correction_filter_data *filter = data;
+
+	gs_effect_set_vec3(obs_filter_get_fused_param(filter->context, effect,
+			"gamma"), &filter->gamma);
+	gs_effect_set_matrix4(obs_filter_get_fused_param(filter->context,
+			effect, "color_matrix"), &filter->final_matrix);
+}
+
 /*
  * This function sets the interface. the types (add_*_Slider), the type of
  * data collected (int), the internal name, user-facing name, minimum,
@@ -409,5 +438,7 @@ struct obs_source_info color_filter = {
 	.video_render = color_correction_filter_render,
 	.update = color_correction_filter_update,
 	.get_properties = color_correction_filter_properties,
-	.get_defaults = color_correction_filter_defaults
+	.get_defaults = color_correction_filter_defaults,
+	.get_fused_shader = color_correction_filter_fused_shader,
+	.set_fused_params = color_correction_filter_fused_params
 };
@@ -2,6 +2,7 @@
 #include <graphics/matrix4.h>
 #include <graphics/vec2.h>
 #include <graphics/vec4.h>
+#include <util/platform.h>
 
 #define SETTING_OPACITY                "opacity"
 #define SETTING_CONTRAST               "contrast"
@@ -25,6 +26,7 @@ struct color_key_filter_data {
 	obs_source_t                   *context;
 
 	gs_effect_t                    *effect;
+	char                           *fused_shader;
 
 	gs_eparam_t                    *color_param;
 	gs_eparam_t                    *contrast_param;
@@ -118,6 +120,7 @@ static void color_key_destroy(void *data)
 		obs_leave_graphics();
 	}
 
+	bfree(filter->fused_shader);
 	bfree(data);
 }
 
@@ -126,6 +129,7 @@ static void *color_key_create(obs_data_t *settings, obs_source_t *context)
 	struct color_key_filter_data *filter =
 		bzalloc(sizeof(struct color_key_filter_data));
 	char *effect_path = obs_module_file("color_key_filter.effect");
+	char *fused_path = obs_module_file("color_key_filter.fused");
 
 	filter->context = context;
 
@@ -134,25 +138,29 @@ static void *color_key_create(obs_data_t *settings, obs_source_t *context)
 	filter->effect = gs_effect_create_from_file(effect_path, NULL);
 	if (filter->effect) {
 		filter->color_param = gs_effect_get_param_by_name(
-				filter->effect, "color");
+				filter->effect, "FILTER_color");
 		filter->contrast_param = gs_effect_get_param_by_name(
-				filter->effect, "contrast");
+				filter->effect, "FILTER_contrast");
 		filter->brightness_param = gs_effect_get_param_by_name(
-				filter->effect, "brightness");
+				filter->effect, "FILTER_brightness");
 		filter->gamma_param = gs_effect_get_param_by_name(
-				filter->effect, "gamma");
+				filter->effect, "FILTER_gamma");
 		filter->key_color_param = gs_effect_get_param_by_name(
-				filter->effect, "key_color");
+				filter->effect, "FILTER_key_color");
 		filter->similarity_param = gs_effect_get_param_by_name(
-				filter->effect, "similarity");
+				filter->effect, "FILTER_similarity");
 		filter->smoothness_param = gs_effect_get_param_by_name(
-				filter->effect, "smoothness");
+				filter->effect, "FILTER_smoothness");
 	}
 
 	obs_leave_graphics();
 
 	bfree(effect_path);
 
+	if (fused_path)
+		filter->fused_shader = os_quick_read_utf8_file(fused_path);
+	bfree(fused_path);
+
 	if (!filter->effect) {
 		color_key_destroy(filter);
 		return NULL;
@@ -183,6 +191,33 @@ static void color_key_render(void *data, gs_effect_t *effect)
 	UNUSED_PARAMETER(effect);
 }
 
+static const char *color_key_fused_shader(void *data)
+{
+	struct color_key_filter_data *filter = data;
+	return filter->fused_shader;
+}
+
+static void color_key_fused_params(void *data, gs_effect_t *effect)
+{
+	struct color_key_filter_data *filter = data;
+	obs_source_t *context = filter->context;
+
+	gs_effect_set_vec4(obs_filter_get_fused_param(context, effect,
+			"color"), &filter->color);
+	gs_effect_set_float(obs_filter_get_fused_param(context, effect,
+			"contrast"), filter->contrast);
+	gs_effect_set_float(obs_filter_get_fused_param(context, effect,
+			"brightness"), filter->brightness);
+	gs_effect_set_float(obs_filter_get_fused_param(context, effect,
+			"gamma"), filter->gamma);
+	gs_effect_set_vec4(obs_filter_get_fused_param(context, effect,
+			"key_color"), &filter->key_color);
+	gs_effect_set_float(obs_filter_get_fused_param(context, effect,
+			"similarity"), filter->similarity);
+	gs_effect_set_float(obs_filter_get_fused_param(context, effect,
+			"smoothness"), filter->smoothness);
+}
+
 static bool key_type_changed(obs_properties_t *props, obs_property_t *p,
 		obs_data_t *settings)
 {
@@ -252,5 +287,7 @@ struct obs_source_info color_key_filter = {
 	.video_render                  = color_key_render,
 	.update                        = color_key_update,
 	.get_properties                = color_key_properties,
-	.get_defaults                  = color_key_defaults
+	.get_defaults                  = color_key_defaults,
+	.get_fused_shader              = color_key_fused_shader,
+	.set_fused_params              = color_key_fused_params
 };
@@ -189,16 +189,39 @@ bool flv_meta_data(obs_output_t *context, uint8_t **output, size_t *size,
 static int32_t last_time = 0;
 #endif
 
-static void flv_video(struct serializer *s, int32_t dts_offset,
+static inline uint8_t *write_b24(uint8_t *p, uint32_t val)
+{
+	*(p++) = (uint8_t)(val >> 16);
+	*(p++) = (uint8_t)(val >> 8);
+	*(p++) = (uint8_t)val;
+	return p;
+}
+
+static uint8_t *write_tag_header(uint8_t *p, uint8_t type, uint32_t size,
+		int32_t time_ms)
+{
+	*(p++) = type;
+	p = write_b24(p, size);
+	p = write_b24(p, (uint32_t)time_ms);
+	*(p++) = (uint8_t)((time_ms >> 24) & 0x7F);
+	return write_b24(p, 0);
+}
+
+static void write_tag_footer(struct flv_tag *tag)
+{
+	/* tag size (starting byte doesn't count) */
+	uint32_t size = (uint32_t)(tag->header_size + tag->data_size - 1);
+
+	tag->footer[0] = (uint8_t)(size >> 24);
+	write_b24(tag->footer + 1, size);
+}
+
+static void flv_video(struct flv_tag *tag, int32_t dts_offset,
 		struct encoder_packet *packet, bool is_header)
 {
 	int64_t offset  = packet->pts - packet->dts;
 	int32_t time_ms = get_ms_time(packet, packet->dts) - dts_offset;
-
-	if (!packet->data || !packet->size)
-		return;
-
-	s_w8(s, RTMP_PACKET_TYPE_VIDEO);
+	uint8_t *p = tag->header;
 
 #ifdef DEBUG_TIMESTAMPS
 	blog(LOG_DEBUG, "Video: %lu", time_ms);
@@ -209,30 +232,22 @@ static void flv_video(struct serializer *s, int32_t dts_offset,
 	last_time = time_ms;
 #endif
 
-	s_wb24(s, (uint32_t)packet->size + 5);
-	s_wb24(s, time_ms);
-	s_w8(s, (time_ms >> 24) & 0x7F);
-	s_wb24(s, 0);
+	p = write_tag_header(p, RTMP_PACKET_TYPE_VIDEO,
+			(uint32_t)packet->size + VIDEO_HEADER_SIZE, time_ms);
 
 	/* these are the 5 extra bytes mentioned above */
-	s_w8(s, packet->keyframe ? 0x17 : 0x27);
-	s_w8(s, is_header ? 0 : 1);
-	s_wb24(s, get_ms_time(packet, offset));
-	s_write(s, packet->data, packet->size);
+	*(p++) = packet->keyframe ? 0x17 : 0x27;
+	*(p++) = is_header ? 0 : 1;
+	p = write_b24(p, (uint32_t)get_ms_time(packet, offset));
 
-	/* write tag size (starting byte doesn't count) */
-	s_wb32(s, (uint32_t)serializer_get_pos(s) - 1);
+	tag->header_size = p - tag->header;
 }
 
-static void flv_audio(struct serializer *s, int32_t dts_offset,
+static void flv_audio(struct flv_tag *tag, int32_t dts_offset,
 		struct encoder_packet *packet, bool is_header)
 {
 	int32_t time_ms = get_ms_time(packet, packet->dts) - dts_offset;
-
-	if (!packet->data || !packet->size)
-		return;
-
-	s_w8(s, RTMP_PACKET_TYPE_AUDIO);
+	uint8_t *p = tag->header;
 
 #ifdef DEBUG_TIMESTAMPS
 	blog(LOG_DEBUG, "Audio: %lu", time_ms);
@@ -243,33 +258,29 @@ static void flv_audio(struct serializer *s, int32_t dts_offset,
 	last_time = time_ms;
 #endif
 
-	s_wb24(s, (uint32_t)packet->size + 2);
-	s_wb24(s, time_ms);
-	s_w8(s, (time_ms >> 24) & 0x7F);
-	s_wb24(s, 0);
+	p = write_tag_header(p, RTMP_PACKET_TYPE_AUDIO,
+			(uint32_t)packet->size + 2, time_ms);
 
 	/* these are the two extra bytes mentioned above */
-	s_w8(s, 0xaf);
-	s_w8(s, is_header ? 0 : 1);
-	s_write(s, packet->data, packet->size);
+	*(p++) = 0xaf;
+	*(p++) = is_header ? 0 : 1;
 
-	/* write tag size (starting byte doesn't count) */
-	s_wb32(s, (uint32_t)serializer_get_pos(s) - 1);
+	tag->header_size = p - tag->header;
 }
 
-void flv_packet_mux(struct encoder_packet *packet, int32_t dts_offset,
-		uint8_t **output, size_t *size, bool is_header)
+bool flv_packet_mux_tag(struct flv_tag *tag, struct encoder_packet *packet,
+		int32_t dts_offset, bool is_header)
 {
-	struct array_output_data data;
-	struct serializer s;
-
-	array_output_serializer_init(&s, &data);
+	if (!packet->data || !packet->size)
+		return false;
 
 	if (packet->type == OBS_ENCODER_VIDEO)
-		flv_video(&s, dts_offset, packet, is_header);
+		flv_video(tag, dts_offset, packet, is_header);
 	else
-		flv_audio(&s, dts_offset, packet, is_header);
+		flv_audio(tag, dts_offset, packet, is_header);
 
-	*output = data.bytes.array;
-	*size   = data.bytes.num;
+	tag->data      = packet->data;
+	tag->data_size = packet->size;
+	write_tag_footer(tag);
+	return true;
 }
@@ -30,5 +30,28 @@ extern void write_file_info(FILE *file, int64_t duration_ms, int64_t size);
 
 extern bool flv_meta_data(obs_output_t *context, uint8_t **output, size_t *size,
 		bool write_header, size_t audio_idx);
-extern void flv_packet_mux(struct encoder_packet *packet, int32_t dts_offset,
-		uint8_t **output, size_t *size, bool is_header);
+
+/* largest tag header: 11 byte FLV tag header plus the 5 byte AVC header */
+#define FLV_TAG_HEADER_MAX_SIZE 16
+#define FLV_TAG_FOOTER_SIZE     4
+
+/* An FLV tag that references the packet data instead of copying it: the tag
+ * consists of header, data and footer, in that order.  Write them out with
+ * writev or three writes, no allocation needed. */
+struct flv_tag {
+	uint8_t       header[FLV_TAG_HEADER_MAX_SIZE];
+	size_t        header_size;
+	const uint8_t *data;
+	size_t        data_size;
+	uint8_t       footer[FLV_TAG_FOOTER_SIZE];
+};
+
+static inline size_t flv_tag_size(const struct flv_tag *tag)
+{
+	return tag->header_size + tag->data_size + FLV_TAG_FOOTER_SIZE;
+}
+
+/* returns false if the packet has no data, in which case nothing is written */
+extern bool flv_packet_mux_tag(struct flv_tag *tag,
+		struct encoder_packet *packet, int32_t dts_offset,
+		bool is_header);
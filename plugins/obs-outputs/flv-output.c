@@ -87,16 +87,18 @@ static void *flv_output_create(obs_data_t *settings, obs_output_t *output)
 static int write_packet(struct flv_output *stream,
 		struct encoder_packet *packet, bool is_header)
 {
-	uint8_t *data;
-	size_t  size;
+	struct flv_tag tag;
 	int     ret = 0;
 
 	stream->last_packet_ts = get_ms_time(packet, packet->dts);
 
-	flv_packet_mux(packet, is_header ? 0 : stream->start_dts_offset,
-			&data, &size, is_header);
-	fwrite(data, 1, size, stream->file);
-	bfree(data);
+	if (flv_packet_mux_tag(&tag, packet,
+				is_header ? 0 : stream->start_dts_offset,
+				is_header)) {
+		fwrite(tag.header, 1, tag.header_size, stream->file);
+		fwrite(tag.data, 1, tag.data_size, stream->file);
+		fwrite(tag.footer, 1, FLV_TAG_FOOTER_SIZE, stream->file);
+	}
 
 	return ret;
 }
@@ -4469,6 +4469,7 @@ RTMP_Close(RTMP *r)
 
     r->m_write.m_nBytesRead = 0;
     RTMPPacket_Free(&r->m_write);
+    r->m_writeBodyAlloc = 0;
 
     for (i = 0; i < r->m_channelsAllocatedIn; i++)
     {
@@ -5478,11 +5479,20 @@ RTMP_Write(RTMP *r, const char *buf, int size, int streamIdx)
                 pkt->m_headerType = RTMP_PACKET_SIZE_MEDIUM;
             }
 
-            if (!RTMPPacket_Alloc(pkt, pkt->m_nBodySize))
+            /* keep the body allocated between packets */
+            if (!pkt->m_body || pkt->m_nBodySize > r->m_writeBodyAlloc)
             {
-                RTMP_Log(RTMP_LOGDEBUG, "%s, failed to allocate packet", __FUNCTION__);
-                return FALSE;
+                RTMPPacket_Free(pkt);
+                r->m_writeBodyAlloc = 0;
+
+                if (!RTMPPacket_Alloc(pkt, pkt->m_nBodySize))
+                {
+                    RTMP_Log(RTMP_LOGDEBUG, "%s, failed to allocate packet", __FUNCTION__);
+                    return FALSE;
+                }
+                r->m_writeBodyAlloc = pkt->m_nBodySize;
             }
+            pkt->m_nBytesRead = 0;
             enc = pkt->m_body;
             pend = enc + pkt->m_nBodySize;
             if (pkt->m_packetType == RTMP_PACKET_TYPE_INFO)
@@ -5505,14 +5515,18 @@ RTMP_Write(RTMP *r, const char *buf, int size, int streamIdx)
         if (pkt->m_nBytesRead == pkt->m_nBodySize)
         {
             ret = RTMP_SendPacket(r, pkt, FALSE);
-            RTMPPacket_Free(pkt);
             pkt->m_nBytesRead = 0;
             if (!ret)
                 return -1;
             buf += 4;
             s2 -= 4;
+            /* the tag size may be left out when the tag is written in
+             * several calls */
             if (s2 < 0)
+            {
+                s2 = 0;
                 break;
+            }
         }
     }
     return size+s2;
@@ -322,6 +322,7 @@ extern "C"
 
         RTMP_READ m_read;
         RTMPPacket m_write;
+        uint32_t m_writeBodyAlloc; /* body size allocated for m_write */
         RTMPSockBuf m_sb;
         RTMP_LNK Link;
         int connect_time_ms;
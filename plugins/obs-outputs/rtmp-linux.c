@@ -0,0 +1,531 @@
+#ifdef __linux__
+#include "rtmp-stream.h"
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+
+#if defined(CRYPTO) && defined(USE_MBEDTLS)
+#include <mbedtls/ssl.h>
+#define USE_TLS 1
+#endif
+
+#ifndef TCP_NOTSENT_LOWAT
+#define TCP_NOTSENT_LOWAT 25
+#endif
+
+#define LATENCY_FACTOR 20
+#define MIN_NOTSENT_LOWAT 16384
+#define SNDBUF_CHECK_INTERVAL_MS 1000
+#define WRITE_RETRY_INTERVAL_MS 100
+
+static void fatal_sock_shutdown(struct rtmp_stream *stream)
+{
+	close(stream->rtmp.m_sb.sb_socket);
+	stream->rtmp.m_sb.sb_socket = -1;
+
+	pthread_mutex_lock(&stream->write_buf_mutex);
+	stream->write_buf_len = 0;
+	pthread_mutex_unlock(&stream->write_buf_mutex);
+
+	os_event_signal(stream->buffer_space_available_event);
+}
+
+/* librtmp expects a blocking socket, so the socket is only non-blocking while
+ * this thread owns it */
+static bool set_socket_blocking(struct rtmp_stream *stream, bool blocking)
+{
+	int fd = stream->rtmp.m_sb.sb_socket;
+	int flags = fcntl(fd, F_GETFL);
+
+	if (flags == -1)
+		return false;
+
+	if (blocking)
+		flags &= ~O_NONBLOCK;
+	else
+		flags |= O_NONBLOCK;
+
+	return fcntl(fd, F_SETFL, flags) == 0;
+}
+
+static int get_socket_error(struct rtmp_stream *stream)
+{
+	int err_code = 0;
+	socklen_t size = sizeof(err_code);
+
+	getsockopt(stream->rtmp.m_sb.sb_socket, SOL_SOCKET, SO_ERROR,
+			&err_code, &size);
+	return err_code;
+}
+
+/* reads and drops what the server sent, like recv().  with TLS the data has
+ * to go through mbedtls, which also needs to read for its own messages */
+static ssize_t recv_discard(struct rtmp_stream *stream, char *buf,
+		size_t size)
+{
+#ifdef USE_TLS
+	if (stream->rtmp.m_sb.sb_ssl) {
+		int ret = mbedtls_ssl_read(stream->rtmp.m_sb.sb_ssl,
+				(unsigned char *)buf, size);
+
+		if (ret == MBEDTLS_ERR_SSL_WANT_READ ||
+		    ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+			errno = EAGAIN;
+			return -1;
+		}
+		if (ret == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY)
+			return 0;
+		if (ret < 0) {
+			blog(LOG_ERROR, "socket_thread_linux: TLS read "
+					"failed, error -0x%x", -ret);
+			errno = ECONNABORTED;
+			return -1;
+		}
+
+		return ret;
+	}
+#endif
+
+	return recv(stream->rtmp.m_sb.sb_socket, buf, size, 0);
+}
+
+static bool socket_event(struct rtmp_stream *stream, uint32_t events,
+		bool *can_write, bool tls_write_pending,
+		uint64_t last_send_time)
+{
+	if (events & EPOLLOUT)
+		*can_write = true;
+
+	if (events & EPOLLERR) {
+		int err_code = get_socket_error(stream);
+
+		blog(LOG_ERROR, "socket_thread_linux: Aborting due to socket "
+				"error %d", err_code);
+		stream->rtmp.last_error_code = err_code;
+		fatal_sock_shutdown(stream);
+		return false;
+	}
+
+	if (events & EPOLLIN) {
+		char discard[16384];
+		int err_code;
+		bool fatal = false;
+
+		for (;;) {
+			ssize_t ret = recv_discard(stream, discard,
+					sizeof(discard));
+			if (ret == -1) {
+				err_code = errno;
+				if (err_code == EAGAIN ||
+				    err_code == EWOULDBLOCK)
+					break;
+				if (err_code == EINTR)
+					continue;
+
+				fatal = true;
+			} else if (ret == 0) {
+				err_code = 0;
+				fatal = true;
+			}
+
+			if (fatal) {
+				if (ret == 0 && last_send_time) {
+					uint32_t diff = (uint32_t)(
+						(os_gettime_ns() / 1000000) -
+						last_send_time);
+
+					blog(LOG_ERROR, "socket_thread_linux: "
+							"Connection closed, "
+							"%u ms since last send "
+							"(buffer: %d / %d)",
+							diff,
+							(int)stream->write_buf_len,
+							(int)stream->write_buf_size);
+				}
+
+				blog(LOG_ERROR, "socket_thread_linux: "
+						"Socket error, recv() returned "
+						"%d, errno %d",
+						(int)ret, err_code);
+				stream->rtmp.last_error_code = err_code;
+				fatal_sock_shutdown(stream);
+				return false;
+			}
+		}
+
+		/* a TLS write may have been waiting for data to read */
+		if (tls_write_pending)
+			*can_write = true;
+	}
+
+	if (events & (EPOLLHUP | EPOLLRDHUP)) {
+		if (os_event_try(stream->stop_event) != EAGAIN)
+			blog(LOG_ERROR, "socket_thread_linux: Aborting due "
+					"to hangup during shutdown, "
+					"%d bytes lost",
+					(int)stream->write_buf_len);
+		else
+			blog(LOG_ERROR, "socket_thread_linux: Aborting due "
+					"to hangup");
+
+		stream->rtmp.last_error_code = get_socket_error(stream);
+		fatal_sock_shutdown(stream);
+		return false;
+	}
+
+	return true;
+}
+
+/* The linux counterpart of the ideal send backlog notifications on windows:
+ * keep the kernel send buffer large enough for the bandwidth-delay product
+ * of the connection (the congestion window) plus the unsent data we allow
+ * in it.  The kernel reports twice the size that was set. */
+static void adjust_sndbuf_size(struct rtmp_stream *stream, int notsent_lowat)
+{
+	struct tcp_info tcp_info;
+	socklen_t size = sizeof(tcp_info);
+	int cur_tcp_bufsize;
+	int ideal_send_backlog;
+
+	if (getsockopt(stream->rtmp.m_sb.sb_socket, IPPROTO_TCP, TCP_INFO,
+				&tcp_info, &size) != 0) {
+		blog(LOG_ERROR, "socket_thread_linux: getsockopt(TCP_INFO) "
+				"failed, errno %d", errno);
+		return;
+	}
+
+	ideal_send_backlog = (int)(tcp_info.tcpi_snd_cwnd *
+			tcp_info.tcpi_snd_mss) + notsent_lowat;
+
+	size = sizeof(cur_tcp_bufsize);
+	if (getsockopt(stream->rtmp.m_sb.sb_socket, SOL_SOCKET, SO_SNDBUF,
+				&cur_tcp_bufsize, &size) != 0) {
+		blog(LOG_ERROR, "socket_thread_linux: getsockopt(SO_SNDBUF) "
+				"failed, errno %d", errno);
+		return;
+	}
+
+	if (cur_tcp_bufsize / 2 < ideal_send_backlog) {
+		setsockopt(stream->rtmp.m_sb.sb_socket, SOL_SOCKET, SO_SNDBUF,
+				&ideal_send_backlog,
+				sizeof(ideal_send_backlog));
+
+		blog(LOG_INFO, "socket_thread_linux: Increasing send buffer "
+				"to %d (cwnd %u, buffer: %d / %d)",
+				ideal_send_backlog,
+				tcp_info.tcpi_snd_cwnd,
+				(int)stream->write_buf_len,
+				(int)stream->write_buf_size);
+	}
+}
+
+#ifdef USE_TLS
+/* mbedtls has to be called again with the same data after it couldn't send
+ * all of it, as part of the record may already be in its own buffer.
+ * tls_pending is the size of that call, 0 if there is none */
+static ssize_t send_tls(struct rtmp_stream *stream, const uint8_t *data,
+		size_t size, size_t *tls_pending)
+{
+	int ret;
+
+	if (*tls_pending)
+		size = *tls_pending;
+
+	ret = mbedtls_ssl_write(stream->rtmp.m_sb.sb_ssl, data, size);
+	if (ret == MBEDTLS_ERR_SSL_WANT_READ ||
+	    ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+		*tls_pending = size;
+		errno = EAGAIN;
+		return -1;
+	}
+
+	*tls_pending = 0;
+
+	if (ret < 0) {
+		blog(LOG_ERROR, "socket_thread_linux: TLS write failed, "
+				"error -0x%x", -ret);
+		errno = ECONNABORTED;
+		return -1;
+	}
+
+	return ret;
+}
+#endif
+
+/* sends up to len bytes of the write buffer without blocking, which may send
+ * less than requested.  returns -1 with errno set to EAGAIN if nothing could
+ * be sent yet */
+static ssize_t send_buffered(struct rtmp_stream *stream, size_t start,
+		size_t len, size_t *tls_pending)
+{
+	size_t first = stream->write_buf_size - start;
+	struct iovec iov[2];
+	struct msghdr msg = {0};
+
+	if (first > len)
+		first = len;
+
+#ifdef USE_TLS
+	/* TLS has to go through mbedtls, so only send what's contiguous */
+	if (stream->rtmp.m_sb.sb_ssl)
+		return send_tls(stream, stream->write_buf + start, first,
+				tls_pending);
+#else
+	UNUSED_PARAMETER(tls_pending);
+#endif
+
+	iov[0].iov_base = stream->write_buf + start;
+	iov[0].iov_len  = first;
+	iov[1].iov_base = stream->write_buf;
+	iov[1].iov_len  = len - first;
+
+	msg.msg_iov    = iov;
+	msg.msg_iovlen = len > first ? 2 : 1;
+
+	return sendmsg(stream->rtmp.m_sb.sb_socket, &msg,
+			MSG_NOSIGNAL | MSG_DONTWAIT);
+}
+
+enum data_ret {
+	RET_BREAK,
+	RET_FATAL,
+	RET_CONTINUE
+};
+
+static enum data_ret write_data(struct rtmp_stream *stream, bool *can_write,
+		size_t *tls_pending, uint64_t *last_send_time,
+		size_t latency_packet_size, int delay_time)
+{
+	bool exit_loop = false;
+	size_t start;
+	size_t len;
+	ssize_t ret;
+
+	pthread_mutex_lock(&stream->write_buf_mutex);
+	start = stream->write_buf_start;
+	len = stream->write_buf_len;
+	pthread_mutex_unlock(&stream->write_buf_mutex);
+
+	if (!len)
+		return RET_BREAK;
+
+	if (stream->low_latency_mode && len > latency_packet_size)
+		len = latency_packet_size;
+
+	/* only this thread consumes data, so the queued range stays valid
+	 * while the socket call runs without the lock */
+	ret = send_buffered(stream, start, len, tls_pending);
+
+	if (ret > 0) {
+		pthread_mutex_lock(&stream->write_buf_mutex);
+		stream->write_buf_start = (start + ret) %
+			stream->write_buf_size;
+		stream->write_buf_len -= ret;
+		if (!stream->write_buf_len)
+			stream->write_buf_start = 0;
+		if (stream->write_buf_len <= 1000)
+			exit_loop = true;
+		pthread_mutex_unlock(&stream->write_buf_mutex);
+
+		*last_send_time = os_gettime_ns() / 1000000;
+
+		os_event_signal(stream->buffer_space_available_event);
+	} else {
+		int err_code = ret == -1 ? errno : 0;
+
+		if (err_code == EAGAIN || err_code == EWOULDBLOCK) {
+			*can_write = false;
+			return RET_BREAK;
+		}
+		if (err_code == EINTR)
+			return RET_CONTINUE;
+
+		/* connection closed, or connection was aborted /
+		 * socket closed / etc, that's a fatal error. */
+		blog(LOG_ERROR, "socket_thread_linux: "
+				"Socket error, send() returned %d, "
+				"errno %d",
+				(int)ret, err_code);
+
+		stream->rtmp.last_error_code = err_code;
+		fatal_sock_shutdown(stream);
+		return RET_FATAL;
+	}
+
+	if (delay_time)
+		os_sleep_ms(delay_time);
+
+	return exit_loop ? RET_BREAK : RET_CONTINUE;
+}
+
+static bool buffer_empty(struct rtmp_stream *stream)
+{
+	bool empty;
+
+	pthread_mutex_lock(&stream->write_buf_mutex);
+	empty = stream->write_buf_len == 0;
+	pthread_mutex_unlock(&stream->write_buf_mutex);
+
+	return empty;
+}
+
+static inline void socket_thread_linux_internal(struct rtmp_stream *stream)
+{
+	bool can_write = false;
+	size_t tls_pending = 0;
+
+	int delay_time;
+	size_t latency_packet_size;
+	uint64_t last_send_time = 0;
+	uint64_t last_sndbuf_check = 0;
+	int notsent_lowat;
+	int epoll_fd;
+
+	struct epoll_event ev = {0};
+	struct epoll_event events[2];
+
+	if (!set_socket_blocking(stream, false)) {
+		blog(LOG_ERROR, "socket_thread_linux: Aborting due to "
+				"failure to make the socket non-blocking, "
+				"errno %d", errno);
+		fatal_sock_shutdown(stream);
+		return;
+	}
+
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd == -1) {
+		blog(LOG_ERROR, "socket_thread_linux: Aborting due to "
+				"epoll_create1 failure, errno %d", errno);
+		fatal_sock_shutdown(stream);
+		return;
+	}
+
+	ev.events = EPOLLIN;
+	ev.data.fd = stream->buffer_has_data_fd;
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, stream->buffer_has_data_fd, &ev);
+
+	/* edge triggered, like FD_WRITE on windows: can_write stays set until
+	 * a send would block */
+	ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	ev.data.fd = stream->rtmp.m_sb.sb_socket;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, stream->rtmp.m_sb.sb_socket,
+				&ev) != 0) {
+		blog(LOG_ERROR, "socket_thread_linux: Aborting due to "
+				"epoll_ctl failure, errno %d", errno);
+		close(epoll_fd);
+		fatal_sock_shutdown(stream);
+		return;
+	}
+
+	if (stream->low_latency_mode) {
+		delay_time = 1000 / LATENCY_FACTOR;
+		latency_packet_size = stream->write_buf_size / (LATENCY_FACTOR - 2);
+	} else {
+		latency_packet_size = stream->write_buf_size;
+		delay_time = 0;
+	}
+
+	/* limit the data that is queued in the kernel but not yet sent, so
+	 * that the backlog stays in the write buffer and congestion reflects
+	 * how fast the socket is actually draining */
+	notsent_lowat = (int)(stream->write_buf_size / LATENCY_FACTOR);
+	if (notsent_lowat < MIN_NOTSENT_LOWAT)
+		notsent_lowat = MIN_NOTSENT_LOWAT;
+
+	if (setsockopt(stream->rtmp.m_sb.sb_socket, IPPROTO_TCP,
+				TCP_NOTSENT_LOWAT, &notsent_lowat,
+				sizeof(notsent_lowat)) != 0)
+		blog(LOG_WARNING, "socket_thread_linux: Failed to set "
+				"TCP_NOTSENT_LOWAT, errno %d", errno);
+
+	if (stream->disable_send_window_optimization)
+		blog(LOG_INFO, "socket_thread_linux: Send window "
+				"optimization disabled by user.");
+
+	for (;;) {
+		uint64_t now;
+		int count;
+
+		if (os_event_try(stream->send_thread_signaled_exit) != EAGAIN) {
+			if (buffer_empty(stream)) {
+				os_event_reset(stream->send_thread_signaled_exit);
+				break;
+			}
+		}
+
+		count = epoll_wait(epoll_fd, events, 2,
+				WRITE_RETRY_INTERVAL_MS);
+		if (count == -1) {
+			if (errno == EINTR)
+				continue;
+
+			blog(LOG_ERROR, "socket_thread_linux: Aborting due "
+					"to epoll_wait failure, errno %d",
+					errno);
+			fatal_sock_shutdown(stream);
+			goto exit;
+		}
+
+		/* if no readiness edge arrived in a while, probe the socket
+		 * rather than relying on it */
+		if (count == 0 && !buffer_empty(stream))
+			can_write = true;
+
+		for (int i = 0; i < count; i++) {
+			if (events[i].data.fd == stream->buffer_has_data_fd) {
+				eventfd_t val;
+				eventfd_read(stream->buffer_has_data_fd, &val);
+
+			} else if (!socket_event(stream, events[i].events,
+						&can_write, tls_pending != 0,
+						last_send_time)) {
+				goto exit;
+			}
+		}
+
+		now = os_gettime_ns() / 1000000;
+		if (!stream->disable_send_window_optimization &&
+		    now - last_sndbuf_check >= SNDBUF_CHECK_INTERVAL_MS) {
+			adjust_sndbuf_size(stream, notsent_lowat);
+			last_sndbuf_check = now;
+		}
+
+		while (can_write) {
+			enum data_ret ret = write_data(
+					stream,
+					&can_write,
+					&tls_pending,
+					&last_send_time,
+					latency_packet_size,
+					delay_time);
+
+			if (ret == RET_BREAK)
+				break;
+			if (ret == RET_FATAL)
+				goto exit;
+		}
+	}
+
+	blog(LOG_INFO, "socket_thread_linux: Normal exit");
+
+exit:
+	close(epoll_fd);
+
+	if (stream->rtmp.m_sb.sb_socket != -1 &&
+	    !set_socket_blocking(stream, true))
+		blog(LOG_WARNING, "socket_thread_linux: Failed to make the "
+				"socket blocking again, errno %d", errno);
+}
+
+void *socket_thread_linux(void *data)
+{
+	struct rtmp_stream *stream = data;
+
+	os_set_thread_name("rtmp-stream: socket_thread");
+	socket_thread_linux_internal(stream);
+	return NULL;
+}
+#endif
@@ -112,6 +112,10 @@ static void rtmp_stream_destroy(void *data)
 	os_event_destroy(stream->socket_available_event);
 	os_event_destroy(stream->send_thread_signaled_exit);
 	pthread_mutex_destroy(&stream->write_buf_mutex);
+#ifdef __linux__
+	if (stream->buffer_has_data_fd != -1)
+		close(stream->buffer_has_data_fd);
+#endif
 
 	if (stream->write_buf)
 		bfree(stream->write_buf);
@@ -123,6 +127,9 @@ static void *rtmp_stream_create(obs_data_t *settings, obs_output_t *output)
 	struct rtmp_stream *stream = bzalloc(sizeof(struct rtmp_stream));
 	stream->output = output;
 	pthread_mutex_init_value(&stream->packets_mutex);
+#ifdef __linux__
+	stream->buffer_has_data_fd = -1;
+#endif
 
 	RTMP_Init(&stream->rtmp);
 	RTMP_LogSetCallback(log_rtmp);
@@ -158,6 +165,13 @@ static void *rtmp_stream_create(obs_data_t *settings, obs_output_t *output)
 		warn("Failed to initialize socket exit event");
 		goto fail;
 	}
+#ifdef __linux__
+	stream->buffer_has_data_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (stream->buffer_has_data_fd == -1) {
+		warn("Failed to initialize data buffer eventfd");
+		goto fail;
+	}
+#endif
 
 	UNUSED_PARAMETER(settings);
 	return stream;
@@ -298,6 +312,8 @@ static int socket_queue_data(RTMPSockBuf *sb, const char *data, int len, void *a
 	UNUSED_PARAMETER(sb);
 
 	struct rtmp_stream *stream = arg;
+	size_t end;
+	size_t first;
 
 retry_send:
 
@@ -317,12 +333,21 @@ retry_send:
 		goto retry_send;
 	}
 
-	memcpy(stream->write_buf + stream->write_buf_len, data, len);
+	/* the write buffer is a ring buffer; the windows socket thread always
+	 * keeps the data at the start of it, so it never wraps around there */
+	end = (stream->write_buf_start + stream->write_buf_len) %
+		stream->write_buf_size;
+	first = stream->write_buf_size - end;
+	if (first > (size_t)len)
+		first = len;
+
+	memcpy(stream->write_buf + end, data, first);
+	memcpy(stream->write_buf, data + first, len - first);
 	stream->write_buf_len += len;
 
 	pthread_mutex_unlock(&stream->write_buf_mutex);
 
-	os_event_signal (stream->buffer_has_data_event);
+	signal_buffer_has_data(stream);
 
 	return len;
 }
@@ -330,8 +355,8 @@ retry_send:
 static int send_packet(struct rtmp_stream *stream,
 		struct encoder_packet *packet, bool is_header, size_t idx)
 {
-	uint8_t *data;
-	size_t  size;
+	struct flv_tag tag;
+	size_t  size = 0;
 	int     recv_size = 0;
 	int     ret = 0;
 
@@ -349,15 +374,24 @@ static int send_packet(struct rtmp_stream *stream,
 		}
 	}
 
-	flv_packet_mux(packet, is_header ? 0 : stream->start_dts_offset,
-			&data, &size, is_header);
+	if (flv_packet_mux_tag(&tag, packet,
+				is_header ? 0 : stream->start_dts_offset,
+				is_header)) {
+		size = flv_tag_size(&tag);
 
 #ifdef TEST_FRAMEDROPS
-	droptest_cap_data_rate(stream, size);
+		droptest_cap_data_rate(stream, size);
 #endif
 
-	ret = RTMP_Write(&stream->rtmp, (char*)data, (int)size, (int)idx);
-	bfree(data);
+		/* RTMP_Write collects the body across calls, so the payload
+		 * goes straight from the packet into the RTMP packet and the
+		 * tag footer isn't needed */
+		ret = RTMP_Write(&stream->rtmp, (char*)tag.header,
+				(int)tag.header_size, (int)idx);
+		if (ret > 0)
+			ret = RTMP_Write(&stream->rtmp, (char*)tag.data,
+					(int)tag.data_size, (int)idx);
+	}
 
 	if (is_header)
 		bfree(packet->data);
@@ -494,7 +528,7 @@ static void *send_thread(void *data)
 
 	if (stream->new_socket_loop) {
 		os_event_signal(stream->send_thread_signaled_exit);
-		os_event_signal(stream->buffer_has_data_event);
+		signal_buffer_has_data(stream);
 		pthread_join(stream->socket_thread, NULL);
 		stream->socket_thread_active = false;
 		stream->rtmp.m_bCustomSend = false;
@@ -703,10 +737,15 @@ static int init_send(struct rtmp_stream *stream)
 
 		stream->write_buf_size = ideal_buffer_size;
 		stream->write_buf = bmalloc(ideal_buffer_size);
+		stream->write_buf_start = 0;
+		stream->write_buf_len = 0;
 
 #ifdef _WIN32
 		ret = pthread_create(&stream->socket_thread, NULL,
 				socket_thread_windows, stream);
+#elif defined(__linux__)
+		ret = pthread_create(&stream->socket_thread, NULL,
+				socket_thread_linux, stream);
 #else
 		warn("New socket loop not supported on this platform");
 		return OBS_OUTPUT_ERROR;
@@ -16,6 +16,11 @@
 #include <sys/ioctl.h>
 #endif
 
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
 #define do_log(level, format, ...) \
 	blog(level, "[rtmp stream: '%s'] " format, \
 			obs_output_get_name(stream->output), ##__VA_ARGS__)
@@ -97,6 +102,7 @@ struct rtmp_stream {
 	bool             socket_thread_active;
 	pthread_t        socket_thread;
 	uint8_t          *write_buf;
+	size_t           write_buf_start;
 	size_t           write_buf_len;
 	size_t           write_buf_size;
 	pthread_mutex_t  write_buf_mutex;
@@ -104,8 +110,21 @@ struct rtmp_stream {
 	os_event_t       *buffer_has_data_event;
 	os_event_t       *socket_available_event;
 	os_event_t       *send_thread_signaled_exit;
+#ifdef __linux__
+	int              buffer_has_data_fd;
+#endif
 };
 
 #ifdef _WIN32
 void *socket_thread_windows(void *data);
+#elif defined(__linux__)
+void *socket_thread_linux(void *data);
+#endif
+
+static inline void signal_buffer_has_data(struct rtmp_stream *stream)
+{
+	os_event_signal(stream->buffer_has_data_event);
+#ifdef __linux__
+	eventfd_write(stream->buffer_has_data_fd, 1);
 #endif
+}
@@ -42,7 +42,8 @@ static struct obs_source_info freetype2_source_info = {
 #ifdef _WIN32
 	                OBS_SOURCE_DEPRECATED |
 #endif
-	                OBS_SOURCE_CUSTOM_DRAW,
+	                OBS_SOURCE_CUSTOM_DRAW |
+	                OBS_SOURCE_CACHEABLE,
 	.get_name = ft2_source_get_name,
 	.create = ft2_source_create,
 	.destroy = ft2_source_destroy,
@@ -225,13 +226,22 @@ static void ft2_source_render(void *data, gs_effect_t *effect)
 	if (srcdata->tex == NULL || srcdata->vbuf == NULL) return;
 	if (srcdata->text == NULL || *srcdata->text == 0) return;
 
+	/* the outline, shadow and text are composited over each other,
+	 * alpha included, so that the text looks the same when it's rendered
+	 * to a texture first (see OBS_SOURCE_CACHEABLE) */
+	gs_blend_state_push();
 	gs_reset_blend_state();
+	gs_blend_function_separate(GS_BLEND_SRCALPHA, GS_BLEND_INVSRCALPHA,
+			GS_BLEND_ONE, GS_BLEND_INVSRCALPHA);
+
 	if (srcdata->outline_text) draw_outlines(srcdata);
 	if (srcdata->drop_shadow) draw_drop_shadow(srcdata);
 
 	draw_uv_vbuffer(srcdata->vbuf, srcdata->tex,
 		srcdata->draw_effect, (uint32_t)wcslen(srcdata->text) * 6);
 
+	gs_blend_state_pop();
+
 	UNUSED_PARAMETER(effect);
 }
 
@@ -253,6 +263,7 @@ static void ft2_video_tick(void *data, float seconds)
 					srcdata->text_file);
 			cache_glyphs(srcdata, srcdata->text);
 			set_up_vertex_buffer(srcdata);
+			obs_source_mark_dirty(srcdata->src);
 			srcdata->update_file = false;
 		}
 
@@ -911,7 +911,9 @@ struct obs_source_info vlc_source_info = {
 	.type = OBS_SOURCE_TYPE_INPUT,
 	.output_flags = OBS_SOURCE_ASYNC_VIDEO |
 	                OBS_SOURCE_AUDIO |
-	                OBS_SOURCE_DO_NOT_DUPLICATE,
+	                OBS_SOURCE_DO_NOT_DUPLICATE |
+	                OBS_SOURCE_CACHED_RENDER |
+	                OBS_SOURCE_PARALLEL_TICK,
 	.get_name = vlcs_get_name,
 	.create = vlcs_create,
 	.destroy = vlcs_destroy,
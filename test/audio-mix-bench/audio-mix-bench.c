@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <util/bmem.h>
+#include <util/platform.h>
+#include <media-io/audio-io.h>
+#include <media-io/audio-mix.h>
+
+/*
+ * Mixes NUM_SOURCES stereo sources in to every mix the same way the audio
+ * thread does, once with each implementation, and checks that every
+ * implementation gives the same result as the scalar one.
+ */
+
+#define NUM_SOURCES  64
+#define NUM_CHANNELS 2
+#define ITERATIONS   2000
+
+struct source_buf {
+	float *data[MAX_AUDIO_MIXES][NUM_CHANNELS];
+	float volume;
+};
+
+static struct source_buf sources[NUM_SOURCES];
+static float *mixes[MAX_AUDIO_MIXES][NUM_CHANNELS];
+static float *ramp;
+
+static void init_buffers(void)
+{
+	srand(1);
+
+	ramp = bmalloc(AUDIO_OUTPUT_FRAMES * sizeof(float));
+	for (size_t i = 0; i < AUDIO_OUTPUT_FRAMES; i++)
+		ramp[i] = (float)i / (float)AUDIO_OUTPUT_FRAMES;
+
+	for (size_t mix = 0; mix < MAX_AUDIO_MIXES; mix++)
+		for (size_t ch = 0; ch < NUM_CHANNELS; ch++)
+			mixes[mix][ch] = bmalloc(AUDIO_OUTPUT_FRAMES *
+					sizeof(float));
+
+	for (size_t i = 0; i < NUM_SOURCES; i++) {
+		sources[i].volume = (float)(i + 1) / (float)NUM_SOURCES;
+
+		for (size_t mix = 0; mix < MAX_AUDIO_MIXES; mix++) {
+			for (size_t ch = 0; ch < NUM_CHANNELS; ch++) {
+				float *data = bmalloc(AUDIO_OUTPUT_FRAMES *
+						sizeof(float));
+
+				for (size_t f = 0; f < AUDIO_OUTPUT_FRAMES; f++)
+					data[f] = (float)rand() /
+						(float)RAND_MAX - 0.5f;
+				sources[i].data[mix][ch] = data;
+			}
+		}
+	}
+}
+
+static void free_buffers(void)
+{
+	for (size_t mix = 0; mix < MAX_AUDIO_MIXES; mix++) {
+		for (size_t ch = 0; ch < NUM_CHANNELS; ch++) {
+			bfree(mixes[mix][ch]);
+			for (size_t i = 0; i < NUM_SOURCES; i++)
+				bfree(sources[i].data[mix][ch]);
+		}
+	}
+	bfree(ramp);
+}
+
+static void mix_all(void)
+{
+	float scratch[AUDIO_OUTPUT_FRAMES];
+
+	for (size_t mix = 0; mix < MAX_AUDIO_MIXES; mix++)
+		for (size_t ch = 0; ch < NUM_CHANNELS; ch++)
+			memset(mixes[mix][ch], 0,
+					AUDIO_OUTPUT_FRAMES * sizeof(float));
+
+	for (size_t i = 0; i < NUM_SOURCES; i++) {
+		struct source_buf *source = &sources[i];
+
+		for (size_t mix = 0; mix < MAX_AUDIO_MIXES; mix++) {
+			for (size_t ch = 0; ch < NUM_CHANNELS; ch++) {
+				float *data = source->data[mix][ch];
+				float *out = mixes[mix][ch];
+
+				/* scene sources apply their fade buffer while
+				 * mixing, other sources scale their own output
+				 * first */
+				if (i % 3 == 2) {
+					audio_mix_add_mul(out, data, ramp,
+							AUDIO_OUTPUT_FRAMES);
+					continue;
+				}
+
+				memcpy(scratch, data, sizeof(scratch));
+				if (i % 3 == 1)
+					audio_mix_mul(scratch, ramp,
+							AUDIO_OUTPUT_FRAMES);
+				else
+					audio_mix_mul_scalar(scratch,
+							source->volume,
+							AUDIO_OUTPUT_FRAMES);
+				audio_mix_add(out, scratch,
+						AUDIO_OUTPUT_FRAMES);
+			}
+		}
+	}
+}
+
+static bool matches(float *const ref[MAX_AUDIO_MIXES][NUM_CHANNELS])
+{
+	for (size_t mix = 0; mix < MAX_AUDIO_MIXES; mix++)
+		for (size_t ch = 0; ch < NUM_CHANNELS; ch++)
+			if (memcmp(ref[mix][ch], mixes[mix][ch],
+					AUDIO_OUTPUT_FRAMES * sizeof(float)))
+				return false;
+	return true;
+}
+
+static const struct {
+	enum audio_mix_impl impl;
+	const char          *name;
+} impls[] = {
+	{AUDIO_MIX_SCALAR, "scalar"},
+	{AUDIO_MIX_SSE,    "sse"},
+	{AUDIO_MIX_AVX,    "avx"},
+	{AUDIO_MIX_NEON,   "neon"},
+};
+
+int main(void)
+{
+	float *ref[MAX_AUDIO_MIXES][NUM_CHANNELS];
+	int ret = 0;
+
+	init_buffers();
+
+	audio_mix_set_impl(AUDIO_MIX_SCALAR);
+	mix_all();
+	for (size_t mix = 0; mix < MAX_AUDIO_MIXES; mix++)
+		for (size_t ch = 0; ch < NUM_CHANNELS; ch++)
+			ref[mix][ch] = bmemdup(mixes[mix][ch],
+					AUDIO_OUTPUT_FRAMES * sizeof(float));
+
+	printf("%d sources, %d mixes, %d channels, %d frames\n",
+			NUM_SOURCES, MAX_AUDIO_MIXES, NUM_CHANNELS,
+			AUDIO_OUTPUT_FRAMES);
+
+	for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+		uint64_t start, elapsed;
+		bool exact;
+
+		if (!audio_mix_set_impl(impls[i].impl)) {
+			printf("%-8s unsupported\n", impls[i].name);
+			continue;
+		}
+
+		mix_all();
+		exact = matches(ref);
+		if (!exact)
+			ret = 1;
+
+		start = os_gettime_ns();
+		for (int j = 0; j < ITERATIONS; j++)
+			mix_all();
+		elapsed = os_gettime_ns() - start;
+
+		printf("%-8s %8.2f us per tick%s\n", impls[i].name,
+				(double)elapsed / ITERATIONS / 1000.0,
+				exact ? "" : " (MISMATCH)");
+	}
+
+	for (size_t mix = 0; mix < MAX_AUDIO_MIXES; mix++)
+		for (size_t ch = 0; ch < NUM_CHANNELS; ch++)
+			bfree(ref[mix][ch]);
+	free_buffers();
+	return ret;
+}
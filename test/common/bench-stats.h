@@ -0,0 +1,47 @@
+#pragma once
+
+#include <string.h>
+#include <util/profiler.h>
+
+/* call time statistics of a profiler snapshot entry, shared by the
+ * benchmarks.  times are in microseconds */
+struct bench_time_stats {
+	uint64_t calls;
+	double   mean;
+	uint64_t median;
+	uint64_t percentile99;
+	uint64_t max;
+};
+
+static inline void bench_get_time_stats(profiler_snapshot_entry_t *entry,
+		struct bench_time_stats *stats)
+{
+	profiler_time_entries_t *times = profiler_snapshot_entry_times(entry);
+	uint64_t total = 0;
+	uint64_t accu = 0;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->calls = profiler_snapshot_entry_overall_count(entry);
+	stats->max   = profiler_snapshot_entry_max_time(entry);
+
+	if (!stats->calls)
+		return;
+
+	for (size_t i = 0; i < times->num; i++)
+		total += times->array[i].time_delta * times->array[i].count;
+	stats->mean = (double)total / stats->calls;
+
+	/* sorted from the longest to the shortest time */
+	for (size_t i = 0; i < times->num; i++) {
+		uint64_t old_accu = accu;
+		accu += times->array[i].count;
+
+		if (old_accu < stats->calls / 100 &&
+		    accu >= stats->calls / 100)
+			stats->percentile99 = times->array[i].time_delta;
+		if (old_accu < stats->calls / 2 && accu >= stats->calls / 2) {
+			stats->median = times->array[i].time_delta;
+			break;
+		}
+	}
+}
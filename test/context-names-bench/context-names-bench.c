@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdarg.h>
+
+#include <obs.h>
+#include <obs-module.h>
+#include <util/platform.h>
+
+/*
+ * Creates N sources the way a scene collection is loaded (checking each name
+ * with obs_get_source_by_name first), then looks every source up by name a
+ * few times, and reports how both scale with N.
+ */
+
+#define LOOKUPS_PER_SOURCE 10
+
+static const size_t source_counts[] = {100, 500, 1000, 2000, 5000};
+
+static const char *bench_source_name(void *unused)
+{
+	UNUSED_PARAMETER(unused);
+	return "Bench Source";
+}
+
+static void *bench_source_create(obs_data_t *settings, obs_source_t *source)
+{
+	UNUSED_PARAMETER(settings);
+	return source;
+}
+
+static void bench_source_destroy(void *data)
+{
+	UNUSED_PARAMETER(data);
+}
+
+static struct obs_source_info bench_source = {
+	.id           = "bench_source",
+	.type         = OBS_SOURCE_TYPE_INPUT,
+	.get_name     = bench_source_name,
+	.create       = bench_source_create,
+	.destroy      = bench_source_destroy
+};
+
+static void quiet_log_handler(int lvl, const char *format, va_list args,
+		void *param)
+{
+	if (lvl <= LOG_WARNING) {
+		vfprintf(stderr, format, args);
+		fprintf(stderr, "\n");
+	}
+
+	UNUSED_PARAMETER(param);
+}
+
+static void run(size_t count)
+{
+	obs_source_t **sources = bzalloc(count * sizeof(obs_source_t*));
+	char name[64];
+	uint64_t start, load_ns, lookup_ns;
+	size_t misses = 0;
+
+	start = os_gettime_ns();
+	for (size_t i = 0; i < count; i++) {
+		obs_source_t *existing;
+
+		snprintf(name, sizeof(name), "Source %zu", i);
+
+		existing = obs_get_source_by_name(name);
+		if (existing) {
+			obs_source_release(existing);
+			continue;
+		}
+
+		sources[i] = obs_source_create("bench_source", name, NULL,
+				NULL);
+	}
+	load_ns = os_gettime_ns() - start;
+
+	start = os_gettime_ns();
+	for (size_t j = 0; j < LOOKUPS_PER_SOURCE; j++) {
+		for (size_t i = 0; i < count; i++) {
+			obs_source_t *source;
+
+			snprintf(name, sizeof(name), "Source %zu", i);
+
+			source = obs_get_source_by_name(name);
+			if (source != sources[i])
+				misses++;
+			obs_source_release(source);
+		}
+	}
+	lookup_ns = os_gettime_ns() - start;
+
+	printf("%6zu sources: load %9.2f ms, lookup %8.1f ns%s\n", count,
+			(double)load_ns / 1000000.0,
+			(double)lookup_ns / (double)(count * LOOKUPS_PER_SOURCE),
+			misses ? " (LOOKUP MISMATCH)" : "");
+
+	for (size_t i = 0; i < count; i++)
+		obs_source_release(sources[i]);
+	bfree(sources);
+}
+
+int main(void)
+{
+	base_set_log_handler(quiet_log_handler, NULL);
+
+	if (!obs_startup("en-US", NULL, NULL)) {
+		fprintf(stderr, "Couldn't start libobs\n");
+		return 1;
+	}
+
+	obs_register_source(&bench_source);
+
+	for (size_t i = 0;
+	     i < sizeof(source_counts) / sizeof(source_counts[0]); i++)
+		run(source_counts[i]);
+
+	obs_shutdown();
+	return 0;
+}
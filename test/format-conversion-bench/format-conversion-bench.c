@@ -0,0 +1,407 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <util/bmem.h>
+#include <util/platform.h>
+#include <media-io/format-conversion.h>
+
+/*
+ * Runs every format conversion function with each implementation over a set
+ * of widths and heights that aren't multiples of the SIMD block sizes, and
+ * checks that every implementation gives the same result as the scalar one
+ * without writing outside of its output planes.  Then measures the
+ * throughput of each implementation at 1080p and 4K:
+ *
+ *   format-conversion-bench [--no-bench]
+ *
+ * Returns non-zero if any output differs.
+ */
+
+#define GUARD_SIZE   64
+#define GUARD_BYTE   0xA5
+#define BENCH_FRAMES 200
+
+struct impl_entry {
+	enum format_conversion_impl impl;
+	const char                  *name;
+};
+
+static const struct impl_entry impls[] = {
+	{FORMAT_CONVERSION_SCALAR, "scalar"},
+	{FORMAT_CONVERSION_SSE2,   "sse2"},
+	{FORMAT_CONVERSION_AVX2,   "avx2"},
+};
+
+#define NUM_IMPLS (sizeof(impls) / sizeof(impls[0]))
+
+static const uint32_t widths[] = {
+	1, 3, 4, 7, 8, 12, 17, 20, 36, 100, 131, 1284, 1922
+};
+
+static const uint32_t heights[] = {
+	1, 2, 3, 6, 17, 34
+};
+
+enum conversion {
+	CONVERT_I420,
+	CONVERT_NV12,
+	CONVERT_I444,
+	CONVERT_DECOMPRESS_420,
+	CONVERT_DECOMPRESS_NV12,
+	CONVERT_DECOMPRESS_422,
+	CONVERT_COUNT
+};
+
+static const char *conversion_names[] = {
+	"compress_uyvx_to_i420",
+	"compress_uyvx_to_nv12",
+	"convert_uyvx_to_i444",
+	"decompress_420",
+	"decompress_nv12",
+	"decompress_422",
+};
+
+/* a buffer with guard bytes after the part the conversion may touch */
+struct plane {
+	uint8_t  *data;
+	size_t   size;
+	uint32_t linesize;
+};
+
+struct frame_buffers {
+	struct plane in[3];
+	struct plane out[3];
+	size_t       in_planes;
+	size_t       out_planes;
+};
+
+static inline uint32_t align_to(uint32_t val, uint32_t align)
+{
+	return (val + align - 1) / align * align;
+}
+
+static void plane_alloc(struct plane *plane, uint32_t linesize, size_t size)
+{
+	plane->linesize = linesize;
+	plane->size     = size;
+	plane->data     = bmalloc(size + GUARD_SIZE);
+	memset(plane->data, GUARD_BYTE, size + GUARD_SIZE);
+}
+
+static void plane_fill_random(struct plane *plane)
+{
+	for (size_t i = 0; i < plane->size; i++)
+		plane->data[i] = (uint8_t)rand();
+}
+
+static bool plane_guard_intact(const struct plane *plane)
+{
+	for (size_t i = 0; i < GUARD_SIZE; i++) {
+		if (plane->data[plane->size + i] != GUARD_BYTE)
+			return false;
+	}
+	return true;
+}
+
+/* packed 444 input rows are in groups of four pixels and aligned the same way
+ * as the staging surfaces they come from.  the planar output linesizes are
+ * deliberately not aligned beyond the four pixel groups. */
+static void frame_buffers_init(struct frame_buffers *fb,
+		enum conversion conv, uint32_t width, uint32_t height)
+{
+	uint32_t cx    = align_to(width, 4);
+	uint32_t cy    = height;
+	uint32_t cy_d2 = (height + 1) / 2;
+
+	memset(fb, 0, sizeof(*fb));
+
+	switch (conv) {
+	case CONVERT_I420:
+		cy = align_to(height, 2);
+		fb->in_planes  = 1;
+		fb->out_planes = 3;
+		plane_alloc(&fb->in[0],  cx * 4, (size_t)cx * 4 * cy);
+		plane_alloc(&fb->out[0], cx,     (size_t)cx * cy);
+		plane_alloc(&fb->out[1], cx / 2, (size_t)cx / 2 * cy_d2);
+		plane_alloc(&fb->out[2], cx / 2, (size_t)cx / 2 * cy_d2);
+		break;
+
+	case CONVERT_NV12:
+		cy = align_to(height, 2);
+		fb->in_planes  = 1;
+		fb->out_planes = 2;
+		plane_alloc(&fb->in[0],  cx * 4, (size_t)cx * 4 * cy);
+		plane_alloc(&fb->out[0], cx,     (size_t)cx * cy);
+		plane_alloc(&fb->out[1], cx,     (size_t)cx * cy_d2);
+		break;
+
+	case CONVERT_I444:
+		cy = align_to(height, 2);
+		fb->in_planes  = 1;
+		fb->out_planes = 3;
+		plane_alloc(&fb->in[0],  cx * 4, (size_t)cx * 4 * cy);
+		plane_alloc(&fb->out[0], cx,     (size_t)cx * cy);
+		plane_alloc(&fb->out[1], cx,     (size_t)cx * cy);
+		plane_alloc(&fb->out[2], cx,     (size_t)cx * cy);
+		break;
+
+	case CONVERT_DECOMPRESS_420:
+		cy = align_to(height, 2);
+		fb->in_planes  = 3;
+		fb->out_planes = 1;
+		plane_alloc(&fb->in[0],  cx,     (size_t)cx * cy);
+		plane_alloc(&fb->in[1],  cx / 2, (size_t)cx / 2 * cy_d2);
+		plane_alloc(&fb->in[2],  cx / 2, (size_t)cx / 2 * cy_d2);
+		plane_alloc(&fb->out[0], cx * 4, (size_t)cx * 4 * cy);
+		break;
+
+	case CONVERT_DECOMPRESS_NV12:
+		cy = align_to(height, 2);
+		fb->in_planes  = 2;
+		fb->out_planes = 1;
+		plane_alloc(&fb->in[0],  cx,     (size_t)cx * cy);
+		plane_alloc(&fb->in[1],  cx,     (size_t)cx * cy_d2);
+		plane_alloc(&fb->out[0], cx * 4, (size_t)cx * 4 * cy);
+		break;
+
+	case CONVERT_DECOMPRESS_422:
+		/* each line is read and written as 32 bit words for the
+		 * whole packed linesize, so the last line reaches one line
+		 * past the end on both sides */
+		fb->in_planes  = 1;
+		fb->out_planes = 1;
+		plane_alloc(&fb->in[0],  cx * 2, (size_t)cx * 2 * (cy + 1));
+		plane_alloc(&fb->out[0], cx * 4, (size_t)cx * 4 * (cy + 1));
+		break;
+
+	case CONVERT_COUNT:
+		break;
+	}
+
+	for (size_t i = 0; i < fb->in_planes; i++)
+		plane_fill_random(&fb->in[i]);
+}
+
+static void frame_buffers_free(struct frame_buffers *fb)
+{
+	for (size_t i = 0; i < fb->in_planes; i++)
+		bfree(fb->in[i].data);
+	for (size_t i = 0; i < fb->out_planes; i++)
+		bfree(fb->out[i].data);
+}
+
+static void reset_output(struct frame_buffers *fb)
+{
+	for (size_t i = 0; i < fb->out_planes; i++)
+		memset(fb->out[i].data, GUARD_BYTE,
+				fb->out[i].size + GUARD_SIZE);
+}
+
+static void run_conversion(struct frame_buffers *fb, enum conversion conv,
+		uint32_t start_y, uint32_t end_y)
+{
+	const uint8_t *in[3];
+	uint32_t      in_linesize[3];
+	uint8_t       *out[3];
+	uint32_t      out_linesize[3];
+
+	for (size_t i = 0; i < 3; i++) {
+		in[i]           = fb->in[i].data;
+		in_linesize[i]  = fb->in[i].linesize;
+		out[i]          = fb->out[i].data;
+		out_linesize[i] = fb->out[i].linesize;
+	}
+
+	switch (conv) {
+	case CONVERT_I420:
+		compress_uyvx_to_i420(in[0], in_linesize[0], start_y, end_y,
+				out, out_linesize);
+		break;
+	case CONVERT_NV12:
+		compress_uyvx_to_nv12(in[0], in_linesize[0], start_y, end_y,
+				out, out_linesize);
+		break;
+	case CONVERT_I444:
+		convert_uyvx_to_i444(in[0], in_linesize[0], start_y, end_y,
+				out, out_linesize);
+		break;
+	case CONVERT_DECOMPRESS_420:
+		decompress_420(in, in_linesize, start_y, end_y,
+				out[0], out_linesize[0]);
+		break;
+	case CONVERT_DECOMPRESS_NV12:
+		decompress_nv12(in, in_linesize, start_y, end_y,
+				out[0], out_linesize[0]);
+		break;
+	case CONVERT_DECOMPRESS_422:
+		decompress_422(in[0], in_linesize[0], start_y, end_y,
+				out[0], out_linesize[0], true);
+		break;
+	case CONVERT_COUNT:
+		break;
+	}
+}
+
+/* the frame is converted in two slices like the parallel CPU conversion does
+ * it, split at an even line */
+static void convert_frame(struct frame_buffers *fb, enum conversion conv,
+		uint32_t height)
+{
+	uint32_t end_y = conv == CONVERT_DECOMPRESS_422 ?
+		height : align_to(height, 2);
+	uint32_t split = (end_y / 2) & ~1;
+
+	run_conversion(fb, conv, 0, split);
+	run_conversion(fb, conv, split, end_y);
+}
+
+static uint8_t **copy_output(const struct frame_buffers *fb)
+{
+	uint8_t **copy = bzalloc(sizeof(uint8_t*) * fb->out_planes);
+
+	for (size_t i = 0; i < fb->out_planes; i++)
+		copy[i] = bmemdup(fb->out[i].data,
+				fb->out[i].size + GUARD_SIZE);
+	return copy;
+}
+
+static void free_output(uint8_t **copy, size_t planes)
+{
+	for (size_t i = 0; i < planes; i++)
+		bfree(copy[i]);
+	bfree(copy);
+}
+
+static bool check_conversion(enum conversion conv, uint32_t width,
+		uint32_t height, bool *supported)
+{
+	struct frame_buffers fb;
+	uint8_t **ref = NULL;
+	bool success = true;
+
+	frame_buffers_init(&fb, conv, width, height);
+
+	for (size_t i = 0; i < NUM_IMPLS; i++) {
+		if (!supported[i] || !format_conversion_set_impl(impls[i].impl))
+			continue;
+
+		reset_output(&fb);
+		convert_frame(&fb, conv, height);
+
+		/* the 422 buffers deliberately have room for the overrun */
+		if (conv != CONVERT_DECOMPRESS_422) {
+			for (size_t p = 0; p < fb.out_planes; p++) {
+				if (plane_guard_intact(&fb.out[p]))
+					continue;
+
+				printf("%s %s %"PRIu32"x%"PRIu32": wrote "
+						"past the end of plane %d\n",
+						conversion_names[conv],
+						impls[i].name, width, height,
+						(int)p);
+				success = false;
+			}
+		}
+
+		if (!ref) {
+			ref = copy_output(&fb);
+			continue;
+		}
+
+		for (size_t p = 0; p < fb.out_planes; p++) {
+			if (memcmp(ref[p], fb.out[p].data,
+					fb.out[p].size + GUARD_SIZE) == 0)
+				continue;
+
+			printf("%s %s %"PRIu32"x%"PRIu32": plane %d differs "
+					"from scalar\n",
+					conversion_names[conv], impls[i].name,
+					width, height, (int)p);
+			success = false;
+		}
+	}
+
+	if (ref)
+		free_output(ref, fb.out_planes);
+	frame_buffers_free(&fb);
+	return success;
+}
+
+static void bench_conversion(enum conversion conv, uint32_t width,
+		uint32_t height, bool *supported)
+{
+	struct frame_buffers fb;
+	size_t bytes = 0;
+
+	frame_buffers_init(&fb, conv, width, height);
+	for (size_t i = 0; i < fb.in_planes; i++)
+		bytes += fb.in[i].size;
+
+	printf("%s %"PRIu32"x%"PRIu32":\n", conversion_names[conv],
+			width, height);
+
+	for (size_t i = 0; i < NUM_IMPLS; i++) {
+		uint64_t start, elapsed;
+
+		if (!supported[i] || !format_conversion_set_impl(impls[i].impl))
+			continue;
+
+		convert_frame(&fb, conv, height);
+
+		start = os_gettime_ns();
+		for (int j = 0; j < BENCH_FRAMES; j++)
+			convert_frame(&fb, conv, height);
+		elapsed = os_gettime_ns() - start;
+
+		printf("  %-8s %8.3f ms per frame, %6.2f GB/s\n",
+				impls[i].name,
+				(double)elapsed / BENCH_FRAMES / 1000000.0,
+				(double)bytes * BENCH_FRAMES / (double)elapsed);
+	}
+
+	frame_buffers_free(&fb);
+}
+
+int main(int argc, char *argv[])
+{
+	bool supported[NUM_IMPLS];
+	bool bench = !(argc > 1 && strcmp(argv[1], "--no-bench") == 0);
+	int ret = 0;
+
+	srand(1);
+
+	for (size_t i = 0; i < NUM_IMPLS; i++) {
+		supported[i] = format_conversion_set_impl(impls[i].impl);
+		if (!supported[i])
+			printf("%-8s unsupported\n", impls[i].name);
+	}
+
+	for (int conv = 0; conv < CONVERT_COUNT; conv++) {
+		size_t failed = 0;
+
+		for (size_t w = 0; w < sizeof(widths) / sizeof(widths[0]); w++)
+		for (size_t h = 0; h < sizeof(heights) / sizeof(heights[0]);
+				h++) {
+			if (!check_conversion(conv, widths[w], heights[h],
+						supported))
+				failed++;
+		}
+
+		printf("%-24s %s\n", conversion_names[conv],
+				failed ? "MISMATCH" : "ok");
+		if (failed)
+			ret = 1;
+	}
+
+	if (bench) {
+		for (int conv = 0; conv < CONVERT_COUNT; conv++) {
+			bench_conversion(conv, 1920, 1080, supported);
+			bench_conversion(conv, 3840, 2160, supported);
+		}
+	}
+
+	format_conversion_set_impl(FORMAT_CONVERSION_AUTO);
+	return ret;
+}
@@ -0,0 +1,489 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include <obs-internal.h>
+
+/*
+ * Checks that a color key and a color correction filter give the same result
+ * when they're rendered in a single fused pass as when each is rendered on
+ * its own:
+ *
+ *   fused-filter-test [--graphics-module NAME] [--tolerance N]
+ *
+ * Also checks that obs_filter_get_fused_param maps the parameter names of
+ * each filter to the "f<index>_" names of the fused effect, and that a second
+ * source with the same chain of filters reuses the cached fused effect.
+ *
+ * Returns non-zero if any pixel differs by more than the tolerance (4 by
+ * default, since the unfused filters round each result to an 8 bit texture),
+ * or if any of the other checks fail.
+ */
+
+#define DEFAULT_GRAPHICS_MODULE "libobs-opengl-headless"
+#define DEFAULT_TOLERANCE       4
+
+#define PATTERN_WIDTH           256
+#define PATTERN_HEIGHT          128
+
+struct test_options {
+	const char *graphics_module;
+	int        tolerance;
+};
+
+struct test_chain {
+	obs_source_t *pattern;
+	obs_source_t *color_key;
+	obs_source_t *color_correction;
+};
+
+static void quiet_log_handler(int lvl, const char *format, va_list args,
+		void *param)
+{
+	if (lvl <= LOG_WARNING) {
+		vfprintf(stderr, format, args);
+		fprintf(stderr, "\n");
+	}
+
+	UNUSED_PARAMETER(param);
+}
+
+static bool parse_options(struct test_options *opts, int argc, char *argv[])
+{
+	opts->graphics_module = DEFAULT_GRAPHICS_MODULE;
+	opts->tolerance       = DEFAULT_TOLERANCE;
+
+	for (int i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+		const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+
+		if (strcmp(arg, "--graphics-module") == 0 && val) {
+			opts->graphics_module = val;
+			i++;
+		} else if (strcmp(arg, "--tolerance") == 0 && val) {
+			opts->tolerance = atoi(val);
+			i++;
+		} else {
+			return false;
+		}
+	}
+
+	return opts->tolerance >= 0;
+}
+
+static bool reset_video(const struct test_options *opts)
+{
+	struct obs_video_info ovi = {
+		.graphics_module = opts->graphics_module,
+		.fps_num         = 30,
+		.fps_den         = 1,
+		.base_width      = 640,
+		.base_height     = 360,
+		.output_width    = 640,
+		.output_height   = 360,
+		.output_format   = VIDEO_FORMAT_NV12,
+		.gpu_conversion  = true,
+		.colorspace      = VIDEO_CS_709,
+		.range           = VIDEO_RANGE_PARTIAL,
+		.scale_type      = OBS_SCALE_BICUBIC
+	};
+
+	int ret = obs_reset_video(&ovi);
+	if (ret != OBS_VIDEO_SUCCESS) {
+		fprintf(stderr, "Failed to initialize video (%d) with '%s'\n",
+				ret, opts->graphics_module);
+		return false;
+	}
+
+	return true;
+}
+
+/* ------------------------------------------------------------------------- */
+/* pattern source, a gradient with a band of pure green to be keyed out */
+
+static const char *pattern_get_name(void *unused)
+{
+	UNUSED_PARAMETER(unused);
+	return "Fused Filter Test Pattern";
+}
+
+static void *pattern_create(obs_data_t *settings, obs_source_t *source)
+{
+	uint32_t *pixels = bmalloc(PATTERN_WIDTH * PATTERN_HEIGHT * 4);
+	const uint8_t *data = (const uint8_t*)pixels;
+	gs_texture_t *tex;
+
+	for (uint32_t y = 0; y < PATTERN_HEIGHT; y++) {
+		for (uint32_t x = 0; x < PATTERN_WIDTH; x++) {
+			uint32_t r = x;
+			uint32_t g = (y * 2) & 0xFF;
+			uint32_t b = 255 - x;
+
+			if (y >= 48 && y < 64) {
+				r = 0;
+				g = 255;
+				b = 0;
+			}
+
+			pixels[y * PATTERN_WIDTH + x] =
+				0xFF000000 | (b << 16) | (g << 8) | r;
+		}
+	}
+
+	obs_enter_graphics();
+	tex = gs_texture_create(PATTERN_WIDTH, PATTERN_HEIGHT, GS_RGBA, 1,
+			&data, 0);
+	obs_leave_graphics();
+
+	bfree(pixels);
+
+	UNUSED_PARAMETER(settings);
+	UNUSED_PARAMETER(source);
+	return tex;
+}
+
+static void pattern_destroy(void *data)
+{
+	obs_enter_graphics();
+	gs_texture_destroy(data);
+	obs_leave_graphics();
+}
+
+static uint32_t pattern_get_width(void *data)
+{
+	UNUSED_PARAMETER(data);
+	return PATTERN_WIDTH;
+}
+
+static uint32_t pattern_get_height(void *data)
+{
+	UNUSED_PARAMETER(data);
+	return PATTERN_HEIGHT;
+}
+
+static void pattern_render(void *data, gs_effect_t *effect)
+{
+	obs_source_draw(data, 0, 0, 0, 0, false);
+	UNUSED_PARAMETER(effect);
+}
+
+static struct obs_source_info pattern_source = {
+	.id           = "fused_filter_test_pattern",
+	.type         = OBS_SOURCE_TYPE_INPUT,
+	.output_flags = OBS_SOURCE_VIDEO,
+	.get_name     = pattern_get_name,
+	.create       = pattern_create,
+	.destroy      = pattern_destroy,
+	.get_width    = pattern_get_width,
+	.get_height   = pattern_get_height,
+	.video_render = pattern_render
+};
+
+/* ------------------------------------------------------------------------- */
+
+static obs_source_t *create_filter(const char *id, const char *name,
+		obs_data_t *settings)
+{
+	obs_source_t *filter = obs_source_create_private(id, name, settings);
+	if (!filter)
+		fprintf(stderr, "Failed to create the '%s' filter\n", id);
+	return filter;
+}
+
+/* the color key is added first, so it's applied first and the color
+ * correction is the first filter of the run */
+static bool create_chain(struct test_chain *chain, double gamma,
+		int similarity)
+{
+	obs_data_t *key_settings = obs_data_create();
+	obs_data_t *cc_settings = obs_data_create();
+
+	obs_data_set_int(key_settings, "similarity", similarity);
+	obs_data_set_int(key_settings, "smoothness", 80);
+
+	obs_data_set_double(cc_settings, "gamma", gamma);
+	obs_data_set_double(cc_settings, "contrast", 0.25);
+	obs_data_set_double(cc_settings, "brightness", 0.05);
+	obs_data_set_double(cc_settings, "saturation", 0.5);
+	obs_data_set_double(cc_settings, "hue_shift", 20.0);
+	obs_data_set_int(cc_settings, "opacity", 90);
+
+	chain->pattern = obs_source_create_private(pattern_source.id,
+			"fused-filter-test pattern", NULL);
+	chain->color_key = create_filter("color_key_filter",
+			"fused-filter-test color key", key_settings);
+	chain->color_correction = create_filter("color_filter",
+			"fused-filter-test color correction", cc_settings);
+
+	obs_data_release(key_settings);
+	obs_data_release(cc_settings);
+
+	if (!chain->pattern || !chain->color_key || !chain->color_correction)
+		return false;
+
+	obs_source_filter_add(chain->pattern, chain->color_key);
+	obs_source_filter_add(chain->pattern, chain->color_correction);
+	return true;
+}
+
+static void destroy_chain(struct test_chain *chain)
+{
+	if (chain->pattern) {
+		if (chain->color_key)
+			obs_source_filter_remove(chain->pattern,
+					chain->color_key);
+		if (chain->color_correction)
+			obs_source_filter_remove(chain->pattern,
+					chain->color_correction);
+	}
+
+	obs_source_release(chain->color_key);
+	obs_source_release(chain->color_correction);
+	obs_source_release(chain->pattern);
+}
+
+/* renders the source with its filters and downloads the result */
+static uint8_t *render_source(obs_source_t *source)
+{
+	gs_texrender_t *texrender = gs_texrender_create(GS_RGBA, GS_ZS_NONE);
+	gs_stagesurf_t *stagesurf = NULL;
+	uint32_t cx = PATTERN_WIDTH;
+	uint32_t cy = PATTERN_HEIGHT;
+	uint8_t *pixels = NULL;
+	uint8_t *data;
+	uint32_t linesize;
+	struct vec4 clear_color;
+
+	vec4_zero(&clear_color);
+
+	if (!gs_texrender_begin(texrender, cx, cy))
+		goto fail;
+
+	gs_clear(GS_CLEAR_COLOR, &clear_color, 0.0f, 0);
+	gs_ortho(0.0f, (float)cx, 0.0f, (float)cy, -100.0f, 100.0f);
+
+	gs_blend_state_push();
+	gs_reset_blend_state();
+	obs_source_video_render(source);
+	gs_blend_state_pop();
+
+	gs_texrender_end(texrender);
+
+	stagesurf = gs_stagesurface_create(cx, cy, GS_RGBA);
+	gs_stage_texture(stagesurf, gs_texrender_get_texture(texrender));
+
+	if (!gs_stagesurface_map(stagesurf, &data, &linesize))
+		goto fail;
+
+	pixels = bmalloc(cx * cy * 4);
+	for (uint32_t y = 0; y < cy; y++)
+		memcpy(pixels + y * cx * 4, data + y * linesize, cx * 4);
+
+	gs_stagesurface_unmap(stagesurf);
+
+fail:
+	gs_stagesurface_destroy(stagesurf);
+	gs_texrender_destroy(texrender);
+	return pixels;
+}
+
+/* renders each filter on its own by hiding its fused shader */
+static uint8_t *render_unfused(struct test_chain *chain)
+{
+	obs_source_t *key = chain->color_key;
+	obs_source_t *cc = chain->color_correction;
+	const char *(*key_shader)(void *data) = key->info.get_fused_shader;
+	const char *(*cc_shader)(void *data) = cc->info.get_fused_shader;
+	uint8_t *pixels;
+
+	key->info.get_fused_shader = NULL;
+	cc->info.get_fused_shader = NULL;
+
+	pixels = render_source(chain->pattern);
+
+	key->info.get_fused_shader = key_shader;
+	cc->info.get_fused_shader = cc_shader;
+	return pixels;
+}
+
+static bool compare(const uint8_t *fused, const uint8_t *unfused,
+		int tolerance)
+{
+	size_t size = PATTERN_WIDTH * PATTERN_HEIGHT * 4;
+	size_t mismatched = 0;
+	size_t keyed = 0;
+	int max_diff = 0;
+
+	for (size_t i = 0; i < size; i += 4) {
+		bool pixel_mismatched = false;
+
+		if (unfused[i + 3] < 128)
+			keyed++;
+
+		for (size_t c = 0; c < 4; c++) {
+			int diff = abs((int)fused[i + c] - (int)unfused[i + c]);
+
+			if (diff > max_diff)
+				max_diff = diff;
+			if (diff > tolerance)
+				pixel_mismatched = true;
+		}
+
+		if (pixel_mismatched)
+			mismatched++;
+	}
+
+	printf("%dx%d, %zu pixels keyed, %zu mismatched, max difference %d\n",
+			PATTERN_WIDTH, PATTERN_HEIGHT, keyed, mismatched,
+			max_diff);
+
+	if (!keyed)
+		fprintf(stderr, "Nothing was keyed out\n");
+
+	return keyed && !mismatched;
+}
+
+static bool check_param(obs_source_t *filter, gs_effect_t *effect,
+		const char *name)
+{
+	char fused_name[64];
+	gs_eparam_t *param = obs_filter_get_fused_param(filter, effect, name);
+	gs_eparam_t *expected;
+
+	snprintf(fused_name, sizeof(fused_name), "f%d_%s", filter->fused_index,
+			name);
+	expected = gs_effect_get_param_by_name(effect, fused_name);
+
+	if (!param || param != expected) {
+		fprintf(stderr, "'%s' of '%s' doesn't map to '%s'\n", name,
+				obs_source_get_name(filter), fused_name);
+		return false;
+	}
+
+	return true;
+}
+
+/* the color correction is the first filter of the run, the color key the
+ * second, so their parameters are prefixed with f0_ and f1_ */
+static bool check_params(struct test_chain *chain)
+{
+	obs_source_t *cc = chain->color_correction;
+	obs_source_t *key = chain->color_key;
+	gs_effect_t *effect = cc->fused_effect;
+	bool success = true;
+
+	if (!effect) {
+		fprintf(stderr, "The filters weren't fused\n");
+		return false;
+	}
+
+	if (cc->fused_index != 0 || key->fused_index != 1) {
+		fprintf(stderr, "Unexpected fused indices %d and %d\n",
+				cc->fused_index, key->fused_index);
+		return false;
+	}
+
+	success &= check_param(cc, effect, "gamma");
+	success &= check_param(cc, effect, "color_matrix");
+	success &= check_param(key, effect, "key_color");
+	success &= check_param(key, effect, "similarity");
+	success &= check_param(key, effect, "smoothness");
+
+	if (obs_filter_get_fused_param(cc, effect, "similarity") ||
+	    obs_filter_get_fused_param(key, effect, "no_such_param")) {
+		fprintf(stderr, "Got a parameter of another filter\n");
+		success = false;
+	}
+
+	return success;
+}
+
+/* a second source with the same filter types but other settings must use
+ * the same effect without compiling a new one */
+static bool check_cache_reuse(struct test_chain *first,
+		struct test_chain *second)
+{
+	size_t effects = obs->video.fused_effects.num;
+	uint8_t *pixels = render_source(second->pattern);
+	bool success = true;
+
+	bfree(pixels);
+
+	if (second->color_correction->fused_effect !=
+	    first->color_correction->fused_effect) {
+		fprintf(stderr, "The second chain didn't reuse the fused "
+				"effect\n");
+		success = false;
+	}
+
+	if (obs->video.fused_effects.num != effects) {
+		fprintf(stderr, "The second chain compiled another effect "
+				"(%zu cached, %zu before)\n",
+				obs->video.fused_effects.num, effects);
+		success = false;
+	}
+
+	return success;
+}
+
+int main(int argc, char *argv[])
+{
+	struct test_options opts = {0};
+	struct test_chain first = {0};
+	struct test_chain second = {0};
+	uint8_t *fused = NULL;
+	uint8_t *unfused = NULL;
+	bool success = false;
+	int ret = 1;
+
+	if (!parse_options(&opts, argc, argv)) {
+		fprintf(stderr, "usage: %s [--graphics-module NAME] "
+				"[--tolerance N]\n", argv[0]);
+		return 1;
+	}
+
+	base_set_log_handler(quiet_log_handler, NULL);
+
+	if (!obs_startup("en-US", NULL, NULL))
+		goto fail;
+	if (!reset_video(&opts))
+		goto fail_video;
+
+	obs_load_all_modules();
+	obs_post_load_modules();
+	obs_register_source(&pattern_source);
+
+	if (!create_chain(&first, 0.4, 300) ||
+	    !create_chain(&second, -0.3, 200))
+		goto fail_chains;
+
+	obs_enter_graphics();
+
+	unfused = render_unfused(&first);
+	fused = render_source(first.pattern);
+
+	if (!fused || !unfused) {
+		fprintf(stderr, "Failed to download the rendered filters\n");
+	} else {
+		success = compare(fused, unfused, opts.tolerance);
+		success &= check_params(&first);
+		success &= check_cache_reuse(&first, &second);
+	}
+
+	obs_leave_graphics();
+
+	bfree(fused);
+	bfree(unfused);
+
+	if (success)
+		ret = 0;
+
+fail_chains:
+	destroy_chain(&first);
+	destroy_chain(&second);
+fail_video:
+	obs_shutdown();
+fail:
+	return ret;
+}
@@ -0,0 +1,741 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <obs-internal.h>
+
+/*
+ * Replays packet traces through the output packet interleaving and through a
+ * copy of the single sorted array interleaving that it replaced, and checks
+ * that both send the same packets, with the same timestamps, in the same
+ * order:
+ *
+ *   interleave-replay [--traces N] [--seed N] [TRACE_FILE...]
+ *
+ * Trace files list the packets in the order the output received them, and
+ * can be recorded with interleave-stress --record.  Each line is one packet:
+ *
+ *   v|a TRACK DTS_USEC DTS PTS TIMEBASE_NUM TIMEBASE_DEN KEYFRAME
+ *
+ * Without trace files, N random traces (1000 by default) are generated, with
+ * 1-6 audio tracks, encoders that start at different times and arrive late,
+ * duplicate timestamps, and video that doesn't start on a keyframe.  Returns
+ * non-zero if the two interleavings differ.
+ */
+
+struct sent_packet {
+	uint64_t              id;
+	enum obs_encoder_type type;
+	size_t                track_idx;
+	int64_t               dts;
+	int64_t               pts;
+	int64_t               dts_usec;
+};
+
+typedef DARRAY(struct sent_packet) sent_packets_t;
+
+struct trace {
+	DARRAY(struct encoder_packet) packets;
+	DARRAY(uint64_t)              ids;
+	size_t                        audio_mixes;
+};
+
+static void add_sent_packet(sent_packets_t *sent, struct encoder_packet *pkt)
+{
+	struct sent_packet *s = da_push_back_new((*sent));
+	memcpy(&s->id, pkt->data, sizeof(s->id));
+	s->type      = pkt->type;
+	s->track_idx = pkt->track_idx;
+	s->dts       = pkt->dts;
+	s->pts       = pkt->pts;
+	s->dts_usec  = pkt->dts_usec;
+}
+
+/* ------------------------------------------------------------------------- */
+/* reference: the sorted array interleaving                                  */
+
+struct ref_interleaver {
+	bool                          received_video;
+	bool                          received_audio;
+	int64_t                       video_offset;
+	int64_t                       audio_offsets[MAX_AUDIO_MIXES];
+	int64_t                       highest_audio_ts;
+	int64_t                       highest_video_ts;
+	DARRAY(struct encoder_packet) interleaved_packets;
+	sent_packets_t                sent;
+};
+
+static inline void check_received(struct ref_interleaver *output,
+		struct encoder_packet *out)
+{
+	if (out->type == OBS_ENCODER_VIDEO) {
+		if (!output->received_video)
+			output->received_video = true;
+	} else {
+		if (!output->received_audio)
+			output->received_audio = true;
+	}
+}
+
+static inline void apply_interleaved_packet_offset(
+		struct ref_interleaver *output, struct encoder_packet *out)
+{
+	int64_t offset;
+
+	offset = (out->type == OBS_ENCODER_VIDEO) ?
+		output->video_offset : output->audio_offsets[out->track_idx];
+
+	out->dts -= offset;
+	out->pts -= offset;
+	out->dts_usec = packet_dts_usec(out);
+}
+
+static inline bool has_higher_opposing_ts(struct ref_interleaver *output,
+		struct encoder_packet *packet)
+{
+	if (packet->type == OBS_ENCODER_VIDEO)
+		return output->highest_audio_ts > packet->dts_usec;
+	else
+		return output->highest_video_ts > packet->dts_usec;
+}
+
+static inline void send_interleaved(struct ref_interleaver *output)
+{
+	struct encoder_packet out = output->interleaved_packets.array[0];
+
+	if (!has_higher_opposing_ts(output, &out))
+		return;
+
+	da_erase(output->interleaved_packets, 0);
+
+	add_sent_packet(&output->sent, &out);
+	obs_encoder_packet_release(&out);
+}
+
+static inline void set_higher_ts(struct ref_interleaver *output,
+		struct encoder_packet *packet)
+{
+	if (packet->type == OBS_ENCODER_VIDEO) {
+		if (output->highest_video_ts < packet->dts_usec)
+			output->highest_video_ts = packet->dts_usec;
+	} else {
+		if (output->highest_audio_ts < packet->dts_usec)
+			output->highest_audio_ts = packet->dts_usec;
+	}
+}
+
+static int find_first_packet_type_idx(struct ref_interleaver *output,
+		enum obs_encoder_type type, size_t audio_idx)
+{
+	for (size_t i = 0; i < output->interleaved_packets.num; i++) {
+		struct encoder_packet *packet =
+			&output->interleaved_packets.array[i];
+
+		if (packet->type == type) {
+			if (type == OBS_ENCODER_AUDIO &&
+			    packet->track_idx != audio_idx) {
+				continue;
+			}
+
+			return (int)i;
+		}
+	}
+
+	return -1;
+}
+
+static int find_last_packet_type_idx(struct ref_interleaver *output,
+		enum obs_encoder_type type, size_t audio_idx)
+{
+	for (size_t i = output->interleaved_packets.num; i > 0; i--) {
+		struct encoder_packet *packet =
+			&output->interleaved_packets.array[i - 1];
+
+		if (packet->type == type) {
+			if (type == OBS_ENCODER_AUDIO &&
+			    packet->track_idx != audio_idx) {
+				continue;
+			}
+
+			return (int)(i - 1);
+		}
+	}
+
+	return -1;
+}
+
+static inline struct encoder_packet *find_first_packet_type(
+		struct ref_interleaver *output, enum obs_encoder_type type,
+		size_t audio_idx)
+{
+	int idx = find_first_packet_type_idx(output, type, audio_idx);
+	return (idx != -1) ? &output->interleaved_packets.array[idx] : NULL;
+}
+
+static inline struct encoder_packet *find_last_packet_type(
+		struct ref_interleaver *output, enum obs_encoder_type type,
+		size_t audio_idx)
+{
+	int idx = find_last_packet_type_idx(output, type, audio_idx);
+	return (idx != -1) ? &output->interleaved_packets.array[idx] : NULL;
+}
+
+static size_t get_interleaved_start_idx(struct ref_interleaver *output)
+{
+	int64_t closest_diff = 0x7FFFFFFFFFFFFFFFLL;
+	struct encoder_packet *first_video = find_first_packet_type(output,
+			OBS_ENCODER_VIDEO, 0);
+	size_t video_idx = DARRAY_INVALID;
+	size_t idx = 0;
+
+	for (size_t i = 0; i < output->interleaved_packets.num; i++) {
+		struct encoder_packet *packet =
+			&output->interleaved_packets.array[i];
+		int64_t diff;
+
+		if (packet->type != OBS_ENCODER_AUDIO) {
+			if (packet == first_video)
+				video_idx = i;
+			continue;
+		}
+
+		diff = llabs(packet->dts_usec - first_video->dts_usec);
+		if (diff < closest_diff) {
+			closest_diff = diff;
+			idx = i;
+		}
+	}
+
+	return video_idx < idx ? video_idx : idx;
+}
+
+static int prune_premature_packets(struct ref_interleaver *output,
+		size_t audio_mixes)
+{
+	struct encoder_packet *video;
+	int video_idx;
+	int max_idx;
+	int64_t duration_usec;
+	int64_t diff = 0;
+
+	video_idx = find_first_packet_type_idx(output, OBS_ENCODER_VIDEO, 0);
+	if (video_idx == -1) {
+		output->received_video = false;
+		return -1;
+	}
+
+	max_idx = video_idx;
+	video = &output->interleaved_packets.array[video_idx];
+	duration_usec = video->timebase_num * 1000000LL / video->timebase_den;
+
+	for (size_t i = 0; i < audio_mixes; i++) {
+		struct encoder_packet *audio;
+		int audio_idx;
+
+		audio_idx = find_first_packet_type_idx(output,
+				OBS_ENCODER_AUDIO, i);
+		if (audio_idx == -1) {
+			output->received_audio = false;
+			return -1;
+		}
+
+		audio = &output->interleaved_packets.array[audio_idx];
+		if (audio_idx > max_idx)
+			max_idx = audio_idx;
+
+		diff = audio->dts_usec - video->dts_usec;
+	}
+
+	return diff > duration_usec ? max_idx + 1 : 0;
+}
+
+static void discard_to_idx(struct ref_interleaver *output, size_t idx)
+{
+	for (size_t i = 0; i < idx; i++) {
+		struct encoder_packet *packet =
+			&output->interleaved_packets.array[i];
+		obs_encoder_packet_release(packet);
+	}
+
+	da_erase_range(output->interleaved_packets, 0, idx);
+}
+
+static bool prune_interleaved_packets(struct ref_interleaver *output,
+		size_t audio_mixes)
+{
+	size_t start_idx = 0;
+	int prune_start = prune_premature_packets(output, audio_mixes);
+
+	if (prune_start == -1)
+		return false;
+	else if (prune_start != 0)
+		start_idx = (size_t)prune_start;
+	else
+		start_idx = get_interleaved_start_idx(output);
+
+	if (start_idx)
+		discard_to_idx(output, start_idx);
+
+	return true;
+}
+
+static bool get_audio_and_video_packets(struct ref_interleaver *output,
+		struct encoder_packet **video,
+		struct encoder_packet **audio, size_t audio_mixes)
+{
+	*video = find_first_packet_type(output, OBS_ENCODER_VIDEO, 0);
+	if (!*video)
+		output->received_video = false;
+
+	for (size_t i = 0; i < audio_mixes; i++) {
+		audio[i] = find_first_packet_type(output, OBS_ENCODER_AUDIO, i);
+		if (!audio[i]) {
+			output->received_audio = false;
+			return false;
+		}
+	}
+
+	if (!*video) {
+		return false;
+	}
+
+	return true;
+}
+
+static bool initialize_interleaved_packets(struct ref_interleaver *output,
+		size_t audio_mixes)
+{
+	struct encoder_packet *video;
+	struct encoder_packet *audio[MAX_AUDIO_MIXES];
+	struct encoder_packet *last_audio[MAX_AUDIO_MIXES];
+	size_t start_idx;
+
+	if (!get_audio_and_video_packets(output, &video, audio, audio_mixes))
+		return false;
+
+	for (size_t i = 0; i < audio_mixes; i++)
+		last_audio[i] = find_last_packet_type(output, OBS_ENCODER_AUDIO,
+				i);
+
+	for (size_t i = 0; i < audio_mixes; i++) {
+		if (last_audio[i]->dts_usec < video->dts_usec) {
+			output->received_audio = false;
+			return false;
+		}
+	}
+
+	start_idx = get_interleaved_start_idx(output);
+	if (start_idx) {
+		discard_to_idx(output, start_idx);
+		if (!get_audio_and_video_packets(output, &video, audio,
+					audio_mixes))
+			return false;
+	}
+
+	output->video_offset = video->pts;
+	for (size_t i = 0; i < audio_mixes; i++)
+		output->audio_offsets[i] = audio[i]->dts;
+
+	output->highest_audio_ts -= audio[0]->dts_usec;
+	output->highest_video_ts -= video->dts_usec;
+
+	for (size_t i = 0; i < output->interleaved_packets.num; i++) {
+		struct encoder_packet *packet =
+			&output->interleaved_packets.array[i];
+		apply_interleaved_packet_offset(output, packet);
+	}
+
+	return true;
+}
+
+static inline void insert_interleaved_packet(struct ref_interleaver *output,
+		struct encoder_packet *out)
+{
+	size_t idx;
+	for (idx = 0; idx < output->interleaved_packets.num; idx++) {
+		struct encoder_packet *cur_packet;
+		cur_packet = output->interleaved_packets.array + idx;
+
+		if (out->dts_usec == cur_packet->dts_usec &&
+		    out->type == OBS_ENCODER_VIDEO) {
+			break;
+		} else if (out->dts_usec < cur_packet->dts_usec) {
+			break;
+		}
+	}
+
+	da_insert(output->interleaved_packets, idx, out);
+}
+
+static void resort_interleaved_packets(struct ref_interleaver *output)
+{
+	DARRAY(struct encoder_packet) old_array;
+
+	old_array.da = output->interleaved_packets.da;
+	memset(&output->interleaved_packets, 0,
+			sizeof(output->interleaved_packets));
+
+	for (size_t i = 0; i < old_array.num; i++)
+		insert_interleaved_packet(output, &old_array.array[i]);
+
+	da_free(old_array);
+}
+
+static void discard_unused_audio_packets(struct ref_interleaver *output,
+		int64_t dts_usec)
+{
+	size_t idx = 0;
+
+	for (; idx < output->interleaved_packets.num; idx++) {
+		struct encoder_packet *p =
+			&output->interleaved_packets.array[idx];
+
+		if (p->dts_usec >= dts_usec)
+			break;
+	}
+
+	if (idx)
+		discard_to_idx(output, idx);
+}
+
+static void ref_interleave_packets(struct ref_interleaver *output,
+		struct encoder_packet *packet, size_t audio_mixes)
+{
+	struct encoder_packet out;
+	bool                  was_started;
+
+	if (!output->received_video &&
+	    packet->type == OBS_ENCODER_VIDEO &&
+	    !packet->keyframe) {
+		discard_unused_audio_packets(output, packet->dts_usec);
+		return;
+	}
+
+	was_started = output->received_audio && output->received_video;
+
+	obs_encoder_packet_create_instance(&out, packet);
+
+	if (was_started)
+		apply_interleaved_packet_offset(output, &out);
+	else
+		check_received(output, packet);
+
+	insert_interleaved_packet(output, &out);
+	set_higher_ts(output, &out);
+
+	if (output->received_audio && output->received_video) {
+		if (!was_started) {
+			if (prune_interleaved_packets(output, audio_mixes)) {
+				if (initialize_interleaved_packets(output,
+							audio_mixes)) {
+					resort_interleaved_packets(output);
+					send_interleaved(output);
+				}
+			}
+		} else {
+			send_interleaved(output);
+		}
+	}
+}
+
+static void ref_free(struct ref_interleaver *output)
+{
+	discard_to_idx(output, output->interleaved_packets.num);
+	da_free(output->interleaved_packets);
+	da_free(output->sent);
+}
+
+/* ------------------------------------------------------------------------- */
+
+static bool same_packet(const struct sent_packet *a,
+		const struct sent_packet *b)
+{
+	return a->id == b->id && a->type == b->type &&
+		a->track_idx == b->track_idx && a->dts == b->dts &&
+		a->pts == b->pts && a->dts_usec == b->dts_usec;
+}
+
+static void print_sent_packet(const char *prefix, const struct sent_packet *p)
+{
+	if (!p) {
+		printf("  %s: (none)\n", prefix);
+		return;
+	}
+
+	printf("  %s: packet %"PRIu64" %s %d, dts %"PRId64", pts %"PRId64
+			", dts_usec %"PRId64"\n", prefix, p->id,
+			p->type == OBS_ENCODER_VIDEO ? "video" : "audio",
+			(int)p->track_idx, p->dts, p->pts, p->dts_usec);
+}
+
+static bool replay(struct trace *trace, const char *name, size_t *total_sent)
+{
+	struct obs_interleaver il = {0};
+	struct ref_interleaver ref = {0};
+	sent_packets_t sent;
+	size_t num;
+	bool success = true;
+
+	da_init(sent);
+
+	for (size_t i = 0; i < trace->packets.num; i++) {
+		struct encoder_packet *packet = &trace->packets.array[i];
+		struct encoder_packet out;
+
+		packet->data = (uint8_t*)&trace->ids.array[i];
+		packet->size = sizeof(*trace->ids.array);
+
+		obs_interleaver_push(&il, packet, true, trace->audio_mixes);
+		if (obs_interleaver_pop(&il, &out)) {
+			add_sent_packet(&sent, &out);
+			obs_encoder_packet_release(&out);
+		}
+
+		ref_interleave_packets(&ref, packet, trace->audio_mixes);
+	}
+
+	num = sent.num > ref.sent.num ? sent.num : ref.sent.num;
+	for (size_t i = 0; i < num; i++) {
+		struct sent_packet *a = i < sent.num ? &sent.array[i] : NULL;
+		struct sent_packet *b = i < ref.sent.num ?
+			&ref.sent.array[i] : NULL;
+
+		if (a && b && same_packet(a, b))
+			continue;
+
+		printf("%s: packet %d sent differs\n", name, (int)i);
+		print_sent_packet("per-track queues", a);
+		print_sent_packet("sorted array    ", b);
+		success = false;
+		break;
+	}
+
+	*total_sent += sent.num;
+
+	obs_interleaver_free(&il);
+	ref_free(&ref);
+	da_free(sent);
+	return success;
+}
+
+static void trace_free(struct trace *trace)
+{
+	da_free(trace->packets);
+	da_free(trace->ids);
+}
+
+static void add_trace_packet(struct trace *trace, struct encoder_packet *pkt)
+{
+	uint64_t id = (uint64_t)trace->ids.num;
+
+	if (pkt->type == OBS_ENCODER_AUDIO &&
+	    pkt->track_idx + 1 > trace->audio_mixes)
+		trace->audio_mixes = pkt->track_idx + 1;
+
+	da_push_back(trace->packets, pkt);
+	da_push_back(trace->ids, &id);
+}
+
+static bool load_trace(struct trace *trace, const char *path)
+{
+	FILE *file = fopen(path, "r");
+	char line[256];
+	int line_num = 0;
+
+	if (!file) {
+		fprintf(stderr, "Failed to open '%s'\n", path);
+		return false;
+	}
+
+	while (fgets(line, sizeof(line), file)) {
+		struct encoder_packet pkt = {0};
+		char type;
+		int track, keyframe;
+
+		line_num++;
+		if (sscanf(line, "%c %d %"SCNd64" %"SCNd64" %"SCNd64" %"SCNu32
+					" %"SCNu32" %d", &type, &track,
+					&pkt.dts_usec, &pkt.dts, &pkt.pts,
+					&pkt.timebase_num, &pkt.timebase_den,
+					&keyframe) != 8 ||
+		    (type != 'v' && type != 'a') ||
+		    track < 0 || track >= MAX_AUDIO_MIXES ||
+		    !pkt.timebase_den) {
+			fprintf(stderr, "%s:%d: invalid packet\n", path,
+					line_num);
+			fclose(file);
+			return false;
+		}
+
+		pkt.type      = type == 'v' ? OBS_ENCODER_VIDEO :
+		                              OBS_ENCODER_AUDIO;
+		pkt.track_idx = (size_t)track;
+		pkt.keyframe  = keyframe != 0;
+		add_trace_packet(trace, &pkt);
+	}
+
+	fclose(file);
+	return true;
+}
+
+/* ------------------------------------------------------------------------- */
+/* random traces                                                             */
+
+static uint64_t rng;
+
+static uint32_t rnd(void)
+{
+	rng = rng * 6364136223846793005ULL + 1442695040888963407ULL;
+	return (uint32_t)(rng >> 33);
+}
+
+struct generated_packet {
+	struct encoder_packet packet;
+	int64_t               arrival;
+	size_t                order;
+};
+
+static int compare_arrival(const void *a, const void *b)
+{
+	const struct generated_packet *pa = a;
+	const struct generated_packet *pb = b;
+
+	if (pa->arrival != pb->arrival)
+		return pa->arrival < pb->arrival ? -1 : 1;
+	return pa->order < pb->order ? -1 : 1;
+}
+
+static void generate_trace(struct trace *trace)
+{
+	DARRAY(struct generated_packet) packets;
+	int tracks = 1 + rnd() % MAX_AUDIO_MIXES;
+	bool collide = rnd() % 2 == 0;
+	int frames = 200 + rnd() % 800;
+
+	da_init(packets);
+
+	/* track -1 is video */
+	for (int t = -1; t < tracks; t++) {
+		int64_t lag = rnd() % 150000;
+		int64_t offset = rnd() % 300000;
+		int64_t dts = rnd() % 1000;
+		int count = t < 0 ? frames : frames * 3 / 2;
+		int keyframe_idx = rnd() % 3 == 0 ? 5 : 0;
+
+		for (int i = 0; i < count; i++) {
+			struct generated_packet *gp =
+				da_push_back_new(packets);
+			struct encoder_packet *pkt = &gp->packet;
+
+			pkt->timebase_num = 1;
+			pkt->dts          = dts;
+			pkt->pts          = dts;
+
+			if (t < 0) {
+				pkt->type         = OBS_ENCODER_VIDEO;
+				pkt->timebase_den = collide ? 50 : 30;
+				pkt->keyframe     = i % 20 == keyframe_idx;
+				pkt->pts         += rnd() % 3;
+			} else {
+				pkt->type         = OBS_ENCODER_AUDIO;
+				pkt->track_idx    = (size_t)t;
+				pkt->timebase_den = collide ? 1000 : 48000;
+			}
+
+			/* encoders start at different times, and each one's
+			 * packets come in order but late by a varying amount */
+			pkt->dts_usec = packet_dts_usec(pkt) - offset;
+			gp->order = packets.num;
+			gp->arrival = pkt->dts_usec + lag + rnd() % 20000;
+			if (i && gp->arrival < gp[-1].arrival)
+				gp->arrival = gp[-1].arrival;
+
+			/* occasional duplicate timestamps */
+			if (rnd() % 50 != 0)
+				dts += t < 0 ? 1 : (collide ? 20 : 1024);
+		}
+	}
+
+	qsort(packets.array, packets.num, sizeof(*packets.array),
+			compare_arrival);
+
+	for (size_t i = 0; i < packets.num; i++)
+		add_trace_packet(trace, &packets.array[i].packet);
+
+	/* the output is started with all of its audio encoders */
+	trace->audio_mixes = (size_t)tracks;
+
+	da_free(packets);
+}
+
+/* ------------------------------------------------------------------------- */
+
+int main(int argc, char *argv[])
+{
+	uint32_t traces = 1000;
+	uint32_t seed = 1;
+	size_t total_packets = 0;
+	size_t total_sent = 0;
+	size_t failed = 0;
+	size_t replayed = 0;
+	int first_file = argc;
+
+	for (int i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+		const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+
+		if (strcmp(arg, "--traces") == 0 && val) {
+			traces = (uint32_t)strtoul(val, NULL, 10);
+		} else if (strcmp(arg, "--seed") == 0 && val) {
+			seed = (uint32_t)strtoul(val, NULL, 10);
+		} else if (strncmp(arg, "--", 2) == 0) {
+			fprintf(stderr, "usage: %s [--traces N] [--seed N] "
+					"[TRACE_FILE...]\n", argv[0]);
+			return 1;
+		} else {
+			first_file = i;
+			break;
+		}
+
+		i++;
+	}
+
+	if (first_file < argc) {
+		for (int i = first_file; i < argc; i++) {
+			struct trace trace = {0};
+
+			if (!load_trace(&trace, argv[i])) {
+				failed++;
+				continue;
+			}
+
+			total_packets += trace.packets.num;
+			if (!replay(&trace, argv[i], &total_sent))
+				failed++;
+			replayed++;
+			trace_free(&trace);
+		}
+	} else {
+		for (uint32_t i = 0; i < traces; i++) {
+			struct trace trace = {0};
+			char name[32];
+
+			rng = (uint64_t)(seed + i) * 7919 + 1;
+			snprintf(name, sizeof(name), "trace %u (seed %u)", i,
+					seed + i);
+
+			generate_trace(&trace);
+			total_packets += trace.packets.num;
+			if (!replay(&trace, name, &total_sent))
+				failed++;
+			replayed++;
+			trace_free(&trace);
+		}
+	}
+
+	printf("%d traces, %d packets received, %d sent, %d failed\n",
+			(int)replayed, (int)total_packets, (int)total_sent,
+			(int)failed);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,541 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <inttypes.h>
+
+#include <obs.h>
+#include <util/platform.h>
+#include <util/threading.h>
+
+/*
+ * Runs a multi-track output with one video encoder and up to six audio
+ * encoders that produce very small packets, so that the output's packet
+ * interleaving sees a high packet rate:
+ *
+ *   interleave-stress [--duration SECONDS] [--tracks N] [--frame-size N]
+ *                     [--fps N] [--graphics-module NAME] [--record FILE]
+ *
+ * The encoders don't encode anything, they only produce packets with the
+ * timestamps of the frames they receive.  The output checks that the
+ * timestamps of every track are increasing, and reports how many packets
+ * were interleaved and how long they were held before being sent.  Returns
+ * non-zero if any packet came out of order.
+ *
+ * --record writes the packets of the encoders, in the order they come in, to
+ * a trace file that interleave-replay can replay.
+ */
+
+#define DEFAULT_GRAPHICS_MODULE "libobs-opengl-headless"
+#define KEYFRAME_INTERVAL 60
+
+struct stress_options {
+	uint32_t   duration;
+	uint32_t   tracks;
+	uint32_t   frame_size;
+	uint32_t   fps;
+	const char *graphics_module;
+	const char *record;
+};
+
+static struct stress_options opts = {0};
+
+/* ------------------------------------------------------------------------- */
+/* encoders                                                                  */
+
+struct stress_encoder {
+	uint8_t  payload[16];
+	uint64_t frames;
+};
+
+static const char *stress_encoder_name(void *type_data)
+{
+	UNUSED_PARAMETER(type_data);
+	return "Interleave stress encoder";
+}
+
+static void *stress_encoder_create(obs_data_t *settings,
+		obs_encoder_t *encoder)
+{
+	UNUSED_PARAMETER(settings);
+	UNUSED_PARAMETER(encoder);
+	return bzalloc(sizeof(struct stress_encoder));
+}
+
+static void stress_encoder_destroy(void *data)
+{
+	bfree(data);
+}
+
+static bool stress_video_encode(void *data, struct encoder_frame *frame,
+		struct encoder_packet *packet, bool *received_packet)
+{
+	struct stress_encoder *enc = data;
+
+	packet->data     = enc->payload;
+	packet->size     = sizeof(enc->payload);
+	packet->pts      = frame->pts;
+	packet->dts      = frame->pts;
+	packet->keyframe = (enc->frames++ % KEYFRAME_INTERVAL) == 0;
+	packet->priority = packet->keyframe ? 3 : 2;
+	*received_packet = true;
+	return true;
+}
+
+static bool stress_audio_encode(void *data, struct encoder_frame *frame,
+		struct encoder_packet *packet, bool *received_packet)
+{
+	struct stress_encoder *enc = data;
+
+	packet->data     = enc->payload;
+	packet->size     = sizeof(enc->payload);
+	packet->pts      = frame->pts;
+	packet->dts      = frame->pts;
+	*received_packet = true;
+	return true;
+}
+
+static size_t stress_audio_frame_size(void *data)
+{
+	UNUSED_PARAMETER(data);
+	return opts.frame_size;
+}
+
+static struct obs_encoder_info stress_video_encoder_info = {
+	.id             = "stress_video_encoder",
+	.type           = OBS_ENCODER_VIDEO,
+	.codec          = "h264",
+	.get_name       = stress_encoder_name,
+	.create         = stress_encoder_create,
+	.destroy        = stress_encoder_destroy,
+	.encode         = stress_video_encode
+};
+
+static struct obs_encoder_info stress_audio_encoder_info = {
+	.id             = "stress_audio_encoder",
+	.type           = OBS_ENCODER_AUDIO,
+	.codec          = "AAC",
+	.get_name       = stress_encoder_name,
+	.create         = stress_encoder_create,
+	.destroy        = stress_encoder_destroy,
+	.encode         = stress_audio_encode,
+	.get_frame_size = stress_audio_frame_size
+};
+
+/* ------------------------------------------------------------------------- */
+/* output                                                                    */
+
+struct stress_output {
+	obs_output_t *output;
+
+	int64_t      last_dts[MAX_AUDIO_MIXES + 1];
+	bool         received[MAX_AUDIO_MIXES + 1];
+	uint64_t     packets[MAX_AUDIO_MIXES + 1];
+	uint64_t     out_of_order;
+	uint64_t     held_total_us;
+	uint64_t     held_max_us;
+};
+
+/* only one output is created, so its results are kept here */
+static struct stress_output results = {0};
+
+static const char *stress_output_name(void *type_data)
+{
+	UNUSED_PARAMETER(type_data);
+	return "Interleave stress output";
+}
+
+static void *stress_output_create(obs_data_t *settings, obs_output_t *output)
+{
+	results.output = output;
+	UNUSED_PARAMETER(settings);
+	return &results;
+}
+
+static void stress_output_destroy(void *data)
+{
+	UNUSED_PARAMETER(data);
+}
+
+static bool stress_output_start(void *data)
+{
+	struct stress_output *context = data;
+
+	if (!obs_output_can_begin_data_capture(context->output, 0))
+		return false;
+	if (!obs_output_initialize_encoders(context->output, 0))
+		return false;
+
+	obs_output_begin_data_capture(context->output, 0);
+	return true;
+}
+
+static void stress_output_stop(void *data, uint64_t ts)
+{
+	struct stress_output *context = data;
+	UNUSED_PARAMETER(ts);
+
+	obs_output_end_data_capture(context->output);
+}
+
+static void stress_output_data(void *data, struct encoder_packet *packet)
+{
+	struct stress_output *context = data;
+	size_t idx = packet->type == OBS_ENCODER_VIDEO ?
+		0 : packet->track_idx + 1;
+	uint64_t held_us;
+
+	if (context->received[idx] && packet->dts <= context->last_dts[idx])
+		context->out_of_order++;
+
+	context->received[idx] = true;
+	context->last_dts[idx] = packet->dts;
+	context->packets[idx]++;
+
+	/* sys_dts_usec is the system time of the packet without any offsets,
+	 * so this is how long ago the packet's data was captured */
+	held_us = os_gettime_ns() / 1000 - (uint64_t)packet->sys_dts_usec;
+	context->held_total_us += held_us;
+	if (held_us > context->held_max_us)
+		context->held_max_us = held_us;
+}
+
+static struct obs_output_info stress_output_info = {
+	.id             = "stress_output",
+	.flags          = OBS_OUTPUT_AV |
+	                  OBS_OUTPUT_ENCODED |
+	                  OBS_OUTPUT_MULTI_TRACK,
+	.get_name       = stress_output_name,
+	.create         = stress_output_create,
+	.destroy        = stress_output_destroy,
+	.start          = stress_output_start,
+	.stop           = stress_output_stop,
+	.encoded_packet = stress_output_data
+};
+
+/* ------------------------------------------------------------------------- */
+/* trace recording                                                           */
+
+/* outputs that only have video or only have audio get the packets of the
+ * encoders without interleaving, in the order they come in */
+
+static FILE            *trace_file = NULL;
+static pthread_mutex_t trace_mutex;
+
+static const char *recorder_name(void *type_data)
+{
+	UNUSED_PARAMETER(type_data);
+	return "Interleave trace recorder";
+}
+
+static void *recorder_create(obs_data_t *settings, obs_output_t *output)
+{
+	UNUSED_PARAMETER(settings);
+	return output;
+}
+
+static void recorder_destroy(void *data)
+{
+	UNUSED_PARAMETER(data);
+}
+
+static bool recorder_start(void *data)
+{
+	obs_output_t *output = data;
+
+	if (!obs_output_can_begin_data_capture(output, 0))
+		return false;
+	if (!obs_output_initialize_encoders(output, 0))
+		return false;
+
+	obs_output_begin_data_capture(output, 0);
+	return true;
+}
+
+static void recorder_stop(void *data, uint64_t ts)
+{
+	UNUSED_PARAMETER(ts);
+	obs_output_end_data_capture(data);
+}
+
+static void recorder_data(void *data, struct encoder_packet *packet)
+{
+	UNUSED_PARAMETER(data);
+
+	pthread_mutex_lock(&trace_mutex);
+	fprintf(trace_file, "%c %d %"PRId64" %"PRId64" %"PRId64" %"PRIu32
+			" %"PRIu32" %d\n",
+			packet->type == OBS_ENCODER_VIDEO ? 'v' : 'a',
+			(int)packet->track_idx, packet->dts_usec,
+			packet->dts, packet->pts, packet->timebase_num,
+			packet->timebase_den, packet->keyframe ? 1 : 0);
+	pthread_mutex_unlock(&trace_mutex);
+}
+
+static struct obs_output_info video_recorder_info = {
+	.id             = "stress_video_recorder",
+	.flags          = OBS_OUTPUT_VIDEO |
+	                  OBS_OUTPUT_ENCODED,
+	.get_name       = recorder_name,
+	.create         = recorder_create,
+	.destroy        = recorder_destroy,
+	.start          = recorder_start,
+	.stop           = recorder_stop,
+	.encoded_packet = recorder_data
+};
+
+static struct obs_output_info audio_recorder_info = {
+	.id             = "stress_audio_recorder",
+	.flags          = OBS_OUTPUT_AUDIO |
+	                  OBS_OUTPUT_ENCODED |
+	                  OBS_OUTPUT_MULTI_TRACK,
+	.get_name       = recorder_name,
+	.create         = recorder_create,
+	.destroy        = recorder_destroy,
+	.start          = recorder_start,
+	.stop           = recorder_stop,
+	.encoded_packet = recorder_data
+};
+
+/* ------------------------------------------------------------------------- */
+
+static void quiet_log_handler(int lvl, const char *format, va_list args,
+		void *param)
+{
+	if (lvl <= LOG_WARNING) {
+		vfprintf(stderr, format, args);
+		fprintf(stderr, "\n");
+	}
+
+	UNUSED_PARAMETER(param);
+}
+
+static bool parse_options(int argc, char *argv[])
+{
+	opts.duration        = 10;
+	opts.tracks          = 6;
+	opts.frame_size      = 32;
+	opts.fps             = 60;
+	opts.graphics_module = DEFAULT_GRAPHICS_MODULE;
+
+	for (int i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+		const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+
+		if (!val)
+			return false;
+
+		if (strcmp(arg, "--duration") == 0)
+			opts.duration = (uint32_t)strtoul(val, NULL, 10);
+		else if (strcmp(arg, "--tracks") == 0)
+			opts.tracks = (uint32_t)strtoul(val, NULL, 10);
+		else if (strcmp(arg, "--frame-size") == 0)
+			opts.frame_size = (uint32_t)strtoul(val, NULL, 10);
+		else if (strcmp(arg, "--fps") == 0)
+			opts.fps = (uint32_t)strtoul(val, NULL, 10);
+		else if (strcmp(arg, "--graphics-module") == 0)
+			opts.graphics_module = val;
+		else if (strcmp(arg, "--record") == 0)
+			opts.record = val;
+		else
+			return false;
+
+		i++;
+	}
+
+	return opts.duration && opts.frame_size && opts.fps &&
+		opts.tracks && opts.tracks <= MAX_AUDIO_MIXES;
+}
+
+static bool reset_video(void)
+{
+	struct obs_video_info ovi = {
+		.graphics_module = opts.graphics_module,
+		.fps_num         = opts.fps,
+		.fps_den         = 1,
+		.base_width      = 320,
+		.base_height     = 180,
+		.output_width    = 320,
+		.output_height   = 180,
+		.output_format   = VIDEO_FORMAT_NV12,
+		.colorspace      = VIDEO_CS_709,
+		.range           = VIDEO_RANGE_PARTIAL,
+		.scale_type      = OBS_SCALE_BICUBIC
+	};
+	struct obs_audio_info oai = {
+		.samples_per_sec = 48000,
+		.speakers        = SPEAKERS_STEREO
+	};
+
+	int ret = obs_reset_video(&ovi);
+	if (ret != OBS_VIDEO_SUCCESS) {
+		fprintf(stderr, "Failed to initialize video (%d) with '%s'\n",
+				ret, opts.graphics_module);
+		return false;
+	}
+
+	return obs_reset_audio(&oai);
+}
+
+static void report(struct stress_output *context, uint64_t elapsed_ns)
+{
+	double seconds = elapsed_ns / 1000000000.0;
+	uint64_t total = 0;
+
+	for (size_t i = 0; i <= opts.tracks; i++) {
+		total += context->packets[i];
+
+		if (i == 0)
+			printf("video:    ");
+		else
+			printf("track %2d: ", (int)i);
+		printf("%10"PRIu64" packets (%.0f/s)\n", context->packets[i],
+				context->packets[i] / seconds);
+	}
+
+	printf("total:    %10"PRIu64" packets (%.0f/s) in %.2f s\n",
+			total, total / seconds, seconds);
+	printf("held before sending: mean %.1f ms, max %.1f ms\n",
+			total ? context->held_total_us / 1000.0 / total : 0.0,
+			context->held_max_us / 1000.0);
+	printf("out of order: %"PRIu64"\n", context->out_of_order);
+}
+
+static obs_output_t *start_recorder(const char *id,
+		obs_encoder_t *video_encoder, obs_encoder_t **audio_encoders)
+{
+	obs_output_t *recorder = obs_output_create(id, id, NULL, NULL);
+	if (!recorder)
+		return NULL;
+
+	if (video_encoder)
+		obs_output_set_video_encoder(recorder, video_encoder);
+	for (uint32_t i = 0; audio_encoders && i < opts.tracks; i++)
+		obs_output_set_audio_encoder(recorder, audio_encoders[i], i);
+
+	if (!obs_output_start(recorder)) {
+		fprintf(stderr, "Failed to start trace recorder: %s\n",
+				obs_output_get_last_error(recorder));
+		obs_output_release(recorder);
+		return NULL;
+	}
+
+	return recorder;
+}
+
+int main(int argc, char *argv[])
+{
+	obs_encoder_t *video_encoder = NULL;
+	obs_encoder_t *audio_encoders[MAX_AUDIO_MIXES] = {0};
+	obs_output_t *output = NULL;
+	obs_output_t *recorders[2] = {0};
+	uint64_t start;
+	int ret = 1;
+
+	if (!parse_options(argc, argv)) {
+		fprintf(stderr, "usage: %s [--duration SECONDS] [--tracks N] "
+				"[--frame-size N] [--fps N] "
+				"[--graphics-module NAME] [--record FILE]\n",
+				argv[0]);
+		return 1;
+	}
+
+	if (opts.record) {
+		trace_file = fopen(opts.record, "w");
+		if (!trace_file) {
+			fprintf(stderr, "Failed to open '%s'\n", opts.record);
+			return 1;
+		}
+
+		pthread_mutex_init(&trace_mutex, NULL);
+	}
+
+	base_set_log_handler(quiet_log_handler, NULL);
+
+	if (!obs_startup("en-US", NULL, NULL))
+		return 1;
+	if (!reset_video())
+		goto fail;
+
+	obs_register_encoder(&stress_video_encoder_info);
+	obs_register_encoder(&stress_audio_encoder_info);
+	obs_register_output(&stress_output_info);
+	obs_register_output(&video_recorder_info);
+	obs_register_output(&audio_recorder_info);
+
+	output = obs_output_create("stress_output", "stress output", NULL,
+			NULL);
+	video_encoder = obs_video_encoder_create("stress_video_encoder",
+			"stress video", NULL, NULL);
+	if (!output || !video_encoder)
+		goto fail;
+
+	obs_encoder_set_video(video_encoder, obs_get_video());
+	obs_output_set_video_encoder(output, video_encoder);
+
+	for (uint32_t i = 0; i < opts.tracks; i++) {
+		char name[32];
+
+		snprintf(name, sizeof(name), "stress audio %u", i + 1);
+		audio_encoders[i] = obs_audio_encoder_create(
+				"stress_audio_encoder", name, NULL, i, NULL);
+		if (!audio_encoders[i])
+			goto fail;
+
+		obs_encoder_set_audio(audio_encoders[i], obs_get_audio());
+		obs_output_set_audio_encoder(output, audio_encoders[i], i);
+	}
+
+	/* the recorders are started first so that they see every packet that
+	 * the stress output gets */
+	if (trace_file) {
+		recorders[0] = start_recorder("stress_video_recorder",
+				video_encoder, NULL);
+		recorders[1] = start_recorder("stress_audio_recorder",
+				NULL, audio_encoders);
+		if (!recorders[0] || !recorders[1])
+			goto fail;
+	}
+
+	if (!obs_output_start(output)) {
+		fprintf(stderr, "Failed to start output: %s\n",
+				obs_output_get_last_error(output));
+		goto fail;
+	}
+
+	start = os_gettime_ns();
+	os_sleep_ms(opts.duration * 1000);
+
+	obs_output_stop(output);
+	for (size_t i = 0; i < 2; i++)
+		obs_output_stop(recorders[i]);
+
+	while ((obs_output_active(output) ||
+	        obs_output_active(recorders[0]) ||
+	        obs_output_active(recorders[1])) &&
+	       os_gettime_ns() - start < (opts.duration + 5) * 1000000000ULL)
+		os_sleep_ms(10);
+
+	report(&results, os_gettime_ns() - start);
+
+	if (!results.packets[0] || results.out_of_order)
+		fprintf(stderr, "Interleaving failed\n");
+	else
+		ret = 0;
+
+fail:
+	obs_output_release(output);
+	for (size_t i = 0; i < 2; i++)
+		obs_output_release(recorders[i]);
+	obs_encoder_release(video_encoder);
+	for (size_t i = 0; i < MAX_AUDIO_MIXES; i++)
+		obs_encoder_release(audio_encoders[i]);
+	obs_shutdown();
+
+	if (trace_file) {
+		fclose(trace_file);
+		pthread_mutex_destroy(&trace_mutex);
+	}
+
+	return ret;
+}
@@ -0,0 +1,726 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <inttypes.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <unistd.h>
+#include <sys/resource.h>
+#endif
+
+#include <obs.h>
+#include <util/darray.h>
+#include <util/dstr.h>
+#include <util/platform.h>
+#include <util/profiler.h>
+
+#include "../common/bench-stats.h"
+
+/*
+ * Runs the whole pipeline for a fixed amount of time using the synthetic
+ * sources of the test-input module, encoders, and null outputs, then prints
+ * a JSON report so that builds can be compared:
+ *
+ *   pipeline-bench [--duration SECONDS] [--sources N] [--filters N]
+ *                  [--audio-sources N] [--sync-pair] [--encoders N]
+ *                  [--threaded-inputs]
+ *                  [--video-encoder ID] [--audio-encoder ID]
+ *                  [--size WxH] [--fps N] [--graphics-module NAME]
+ *                  [--output FILE.json]
+ *
+ * --sources adds random pixel sources with --filters test filters each,
+ * --audio-sources adds sine wave sources, and --sync-pair adds the A/V sync
+ * pair.  --encoders is the number of null outputs to run, each with its own
+ * video and audio encoder, and --threaded-inputs runs each video encoder on
+ * its own thread.
+ *
+ * Encoder latency is the time spent in each encoder's encode call, taken
+ * from the profiler.  Per-thread CPU time is only available on Linux.
+ */
+
+#define DEFAULT_GRAPHICS_MODULE "libobs-opengl-headless"
+
+struct bench_options {
+	uint32_t   duration;
+	uint32_t   sources;
+	uint32_t   filters;
+	uint32_t   audio_sources;
+	bool       sync_pair;
+	uint32_t   encoders;
+	bool       threaded_inputs;
+	const char *video_encoder;
+	const char *audio_encoder;
+	uint32_t   cx;
+	uint32_t   cy;
+	uint32_t   fps;
+	const char *graphics_module;
+	const char *output_file;
+};
+
+struct bench_output {
+	obs_output_t  *output;
+	obs_encoder_t *video_encoder;
+	obs_encoder_t *audio_encoder;
+};
+
+struct thread_time {
+	long     tid;
+	char     name[32];
+	uint64_t cpu_ns;
+};
+
+typedef DARRAY(struct thread_time) thread_times_t;
+
+struct bench_state {
+	obs_scene_t                  *scene;
+	DARRAY(struct bench_output)  outputs;
+
+	uint32_t                     start_total_frames;
+	uint32_t                     start_lagged_frames;
+	uint32_t                     start_output_frames;
+	uint32_t                     start_skipped_frames;
+	thread_times_t               start_threads;
+};
+
+static void quiet_log_handler(int lvl, const char *format, va_list args,
+		void *param)
+{
+	if (lvl <= LOG_WARNING) {
+		vfprintf(stderr, format, args);
+		fprintf(stderr, "\n");
+	}
+
+	UNUSED_PARAMETER(param);
+}
+
+static bool parse_uint(const char *val, uint32_t *out)
+{
+	char *end;
+	unsigned long num = strtoul(val, &end, 10);
+
+	if (end == val || *end)
+		return false;
+
+	*out = (uint32_t)num;
+	return true;
+}
+
+static bool parse_options(struct bench_options *opts, int argc, char *argv[])
+{
+	opts->duration        = 30;
+	opts->sources         = 4;
+	opts->filters         = 1;
+	opts->audio_sources   = 1;
+	opts->encoders        = 1;
+	opts->video_encoder   = "obs_x264";
+	opts->audio_encoder   = "ffmpeg_aac";
+	opts->cx              = 1280;
+	opts->cy              = 720;
+	opts->fps             = 30;
+	opts->graphics_module = DEFAULT_GRAPHICS_MODULE;
+
+	for (int i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+		const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+		bool ok = true;
+
+		if (strcmp(arg, "--sync-pair") == 0) {
+			opts->sync_pair = true;
+			continue;
+		} else if (strcmp(arg, "--threaded-inputs") == 0) {
+			opts->threaded_inputs = true;
+			continue;
+		} else if (!val) {
+			return false;
+		}
+
+		if (strcmp(arg, "--duration") == 0)
+			ok = parse_uint(val, &opts->duration);
+		else if (strcmp(arg, "--sources") == 0)
+			ok = parse_uint(val, &opts->sources);
+		else if (strcmp(arg, "--filters") == 0)
+			ok = parse_uint(val, &opts->filters);
+		else if (strcmp(arg, "--audio-sources") == 0)
+			ok = parse_uint(val, &opts->audio_sources);
+		else if (strcmp(arg, "--encoders") == 0)
+			ok = parse_uint(val, &opts->encoders);
+		else if (strcmp(arg, "--video-encoder") == 0)
+			opts->video_encoder = val;
+		else if (strcmp(arg, "--audio-encoder") == 0)
+			opts->audio_encoder = val;
+		else if (strcmp(arg, "--size") == 0)
+			ok = sscanf(val, "%ux%u", &opts->cx, &opts->cy) == 2;
+		else if (strcmp(arg, "--fps") == 0)
+			ok = parse_uint(val, &opts->fps);
+		else if (strcmp(arg, "--graphics-module") == 0)
+			opts->graphics_module = val;
+		else if (strcmp(arg, "--output") == 0)
+			opts->output_file = val;
+		else
+			return false;
+
+		if (!ok)
+			return false;
+		i++;
+	}
+
+	return opts->duration && opts->cx && opts->cy && opts->fps;
+}
+
+static bool reset_video(const struct bench_options *opts)
+{
+	struct obs_video_info ovi = {
+		.graphics_module = opts->graphics_module,
+		.fps_num         = opts->fps,
+		.fps_den         = 1,
+		.base_width      = opts->cx,
+		.base_height     = opts->cy,
+		.output_width    = opts->cx,
+		.output_height   = opts->cy,
+		.output_format   = VIDEO_FORMAT_NV12,
+		.gpu_conversion  = true,
+		.colorspace      = VIDEO_CS_709,
+		.range           = VIDEO_RANGE_PARTIAL,
+		.scale_type      = OBS_SCALE_BICUBIC
+	};
+	struct obs_audio_info oai = {
+		.samples_per_sec = 48000,
+		.speakers        = SPEAKERS_STEREO
+	};
+
+	obs_set_video_threaded_inputs(opts->threaded_inputs);
+
+	int ret = obs_reset_video(&ovi);
+	if (ret != OBS_VIDEO_SUCCESS) {
+		fprintf(stderr, "Failed to initialize video (%d) with '%s'\n",
+				ret, opts->graphics_module);
+		return false;
+	}
+
+	return obs_reset_audio(&oai);
+}
+
+/* ------------------------------------------------------------------------- */
+/* scene setup                                                               */
+
+static obs_sceneitem_t *add_source(obs_scene_t *scene, const char *id,
+		const char *name, uint32_t filters)
+{
+	obs_source_t *source = obs_source_create(id, name, NULL, NULL);
+	obs_sceneitem_t *item;
+
+	if (!source) {
+		fprintf(stderr, "Failed to create source '%s' (is the "
+				"test-input module installed?)\n", id);
+		return NULL;
+	}
+
+	for (uint32_t i = 0; i < filters; i++) {
+		struct dstr filter_name = {0};
+		obs_source_t *filter;
+
+		dstr_printf(&filter_name, "%s filter %u", name, i);
+		filter = obs_source_create("test_filter", filter_name.array,
+				NULL, NULL);
+		if (filter) {
+			obs_source_filter_add(source, filter);
+			obs_source_release(filter);
+		}
+		dstr_free(&filter_name);
+	}
+
+	item = obs_scene_add(scene, source);
+	obs_source_release(source);
+	return item;
+}
+
+/* lays the video sources out in a grid so that all of them are drawn */
+static void place_item(obs_sceneitem_t *item, const struct bench_options *opts,
+		uint32_t idx, uint32_t count)
+{
+	uint32_t columns = 1;
+	struct vec2 pos;
+	struct vec2 bounds;
+
+	while (columns * columns < count)
+		columns++;
+
+	vec2_set(&bounds, (float)opts->cx / columns, (float)opts->cy / columns);
+	vec2_set(&pos, bounds.x * (idx % columns), bounds.y * (idx / columns));
+
+	obs_sceneitem_set_bounds_type(item, OBS_BOUNDS_STRETCH);
+	obs_sceneitem_set_bounds(item, &bounds);
+	obs_sceneitem_set_pos(item, &pos);
+}
+
+static bool create_scene(struct bench_state *state,
+		const struct bench_options *opts)
+{
+	uint32_t video_count = opts->sources + (opts->sync_pair ? 1 : 0);
+	struct dstr name = {0};
+	obs_sceneitem_t *item;
+
+	state->scene = obs_scene_create("pipeline-bench scene");
+
+	for (uint32_t i = 0; i < opts->sources; i++) {
+		dstr_printf(&name, "random %u", i);
+		item = add_source(state->scene, "random", name.array,
+				opts->filters);
+		if (!item)
+			goto fail;
+
+		place_item(item, opts, i, video_count);
+	}
+
+	for (uint32_t i = 0; i < opts->audio_sources; i++) {
+		dstr_printf(&name, "sine wave %u", i);
+		if (!add_source(state->scene, "test_sinewave", name.array, 0))
+			goto fail;
+	}
+
+	if (opts->sync_pair) {
+		item = add_source(state->scene, "sync_video", "sync video",
+				opts->filters);
+		if (!item || !add_source(state->scene, "sync_audio",
+					"sync audio", 0))
+			goto fail;
+
+		place_item(item, opts, opts->sources, video_count);
+	}
+
+	dstr_free(&name);
+	obs_set_output_source(0, obs_scene_get_source(state->scene));
+	return true;
+
+fail:
+	dstr_free(&name);
+	return false;
+}
+
+/* ------------------------------------------------------------------------- */
+/* outputs                                                                   */
+
+static bool create_output(struct bench_output *out,
+		const struct bench_options *opts, uint32_t idx)
+{
+	struct dstr name = {0};
+
+	dstr_printf(&name, "bench output %u", idx);
+	out->output = obs_output_create("null_output", name.array, NULL,
+			NULL);
+
+	dstr_printf(&name, "bench video %u", idx);
+	out->video_encoder = obs_video_encoder_create(opts->video_encoder,
+			name.array, NULL, NULL);
+
+	dstr_printf(&name, "bench audio %u", idx);
+	out->audio_encoder = obs_audio_encoder_create(opts->audio_encoder,
+			name.array, NULL, 0, NULL);
+
+	dstr_free(&name);
+
+	if (!out->output || !out->video_encoder || !out->audio_encoder) {
+		fprintf(stderr, "Failed to create output %u with encoders "
+				"'%s' and '%s'\n", idx,
+				opts->video_encoder, opts->audio_encoder);
+		return false;
+	}
+
+	obs_encoder_set_video(out->video_encoder, obs_get_video());
+	obs_encoder_set_audio(out->audio_encoder, obs_get_audio());
+	obs_output_set_video_encoder(out->output, out->video_encoder);
+	obs_output_set_audio_encoder(out->output, out->audio_encoder, 0);
+
+	if (!obs_output_start(out->output)) {
+		fprintf(stderr, "Failed to start output %u: %s\n", idx,
+				obs_output_get_last_error(out->output));
+		return false;
+	}
+
+	return true;
+}
+
+static void destroy_outputs(struct bench_state *state)
+{
+	for (size_t i = 0; i < state->outputs.num; i++) {
+		struct bench_output *out = state->outputs.array + i;
+
+		if (out->output && obs_output_active(out->output))
+			obs_output_stop(out->output);
+	}
+
+	for (size_t i = 0; i < state->outputs.num; i++) {
+		struct bench_output *out = state->outputs.array + i;
+		uint64_t start = os_gettime_ns();
+
+		while (out->output && obs_output_active(out->output) &&
+		       os_gettime_ns() - start < 5000000000ULL)
+			os_sleep_ms(10);
+
+		obs_output_release(out->output);
+		obs_encoder_release(out->video_encoder);
+		obs_encoder_release(out->audio_encoder);
+	}
+
+	da_free(state->outputs);
+}
+
+static bool create_outputs(struct bench_state *state,
+		const struct bench_options *opts)
+{
+	for (uint32_t i = 0; i < opts->encoders; i++) {
+		struct bench_output *out = da_push_back_new(state->outputs);
+		if (!create_output(out, opts, i))
+			return false;
+	}
+
+	return true;
+}
+
+/* ------------------------------------------------------------------------- */
+/* measurements                                                              */
+
+static uint64_t get_peak_rss(void)
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS pmc;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+		return 0;
+	return (uint64_t)pmc.PeakWorkingSetSize;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+#ifdef __APPLE__
+	return (uint64_t)usage.ru_maxrss;
+#else
+	return (uint64_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+#ifdef __linux__
+static bool read_thread_time(const char *tid, struct thread_time *tt)
+{
+	static long clock_ticks = 0;
+	unsigned long utime, stime;
+	char path[64];
+	char buf[512];
+	char *name_start, *name_end;
+	size_t name_len;
+	FILE *file;
+	bool success = false;
+
+	if (!clock_ticks)
+		clock_ticks = sysconf(_SC_CLK_TCK);
+
+	snprintf(path, sizeof(path), "/proc/self/task/%s/stat", tid);
+	file = fopen(path, "r");
+	if (!file)
+		return false;
+
+	if (!fgets(buf, sizeof(buf), file))
+		goto exit;
+
+	/* the thread name is in parentheses and may contain any character */
+	name_start = strchr(buf, '(');
+	name_end = strrchr(buf, ')');
+	if (!name_start || !name_end || name_end < name_start)
+		goto exit;
+
+	if (sscanf(name_end + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u "
+				"%*u %lu %lu", &utime, &stime) != 2)
+		goto exit;
+
+	name_len = name_end - name_start - 1;
+	if (name_len >= sizeof(tt->name))
+		name_len = sizeof(tt->name) - 1;
+
+	memcpy(tt->name, name_start + 1, name_len);
+	tt->name[name_len] = 0;
+	tt->tid = strtol(tid, NULL, 10);
+	tt->cpu_ns = (uint64_t)(utime + stime) * 1000000000ULL /
+		(uint64_t)clock_ticks;
+	success = true;
+
+exit:
+	fclose(file);
+	return success;
+}
+#endif
+
+static void sample_threads(thread_times_t *times)
+{
+#ifdef __linux__
+	os_dir_t *dir = os_opendir("/proc/self/task");
+	struct os_dirent *ent;
+
+	if (!dir)
+		return;
+
+	while ((ent = os_readdir(dir)) != NULL) {
+		struct thread_time tt;
+
+		if (ent->d_name[0] == '.')
+			continue;
+		if (read_thread_time(ent->d_name, &tt))
+			da_push_back((*times), &tt);
+	}
+
+	os_closedir(dir);
+#else
+	UNUSED_PARAMETER(times);
+#endif
+}
+
+static uint64_t start_cpu_ns(const thread_times_t *start, long tid)
+{
+	for (size_t i = 0; i < start->num; i++) {
+		if (start->array[i].tid == tid)
+			return start->array[i].cpu_ns;
+	}
+
+	return 0;
+}
+
+static void begin_measurement(struct bench_state *state)
+{
+	video_t *video = obs_get_video();
+
+	state->start_total_frames   = obs_get_total_frames();
+	state->start_lagged_frames  = obs_get_lagged_frames();
+	state->start_output_frames  = video_output_get_total_frames(video);
+	state->start_skipped_frames = video_output_get_skipped_frames(video);
+	sample_threads(&state->start_threads);
+}
+
+static bool add_encoder_times(void *context, profiler_snapshot_entry_t *entry)
+{
+	obs_data_array_t *encoders = context;
+	const char *name = profiler_snapshot_entry_name(entry);
+
+	/* see do_encode in obs-encoder.c */
+	if (strncmp(name, "encode(", 7) == 0) {
+		obs_data_t *encoder = obs_data_create();
+		struct dstr encoder_name = {0};
+		struct bench_time_stats stats;
+
+		dstr_copy(&encoder_name, name + 7);
+		dstr_resize(&encoder_name, encoder_name.len - 1);
+		bench_get_time_stats(entry, &stats);
+
+		obs_data_set_string(encoder, "name", encoder_name.array);
+		obs_data_set_int(encoder, "calls", (long long)stats.calls);
+		obs_data_set_double(encoder, "mean_us", stats.mean);
+		obs_data_set_int(encoder, "median_us", (long long)stats.median);
+		obs_data_set_int(encoder, "p99_us",
+				(long long)stats.percentile99);
+		obs_data_set_int(encoder, "max_us", (long long)stats.max);
+		obs_data_array_push_back(encoders, encoder);
+
+		obs_data_release(encoder);
+		dstr_free(&encoder_name);
+		return true;
+	}
+
+	profiler_snapshot_enumerate_children(entry, add_encoder_times,
+			context);
+	return true;
+}
+
+static obs_data_t *create_config_report(const struct bench_options *opts)
+{
+	obs_data_t *config = obs_data_create();
+
+	obs_data_set_int(config, "duration_s", opts->duration);
+	obs_data_set_int(config, "sources", opts->sources);
+	obs_data_set_int(config, "filters_per_source", opts->filters);
+	obs_data_set_int(config, "audio_sources", opts->audio_sources);
+	obs_data_set_bool(config, "sync_pair", opts->sync_pair);
+	obs_data_set_int(config, "encoders", opts->encoders);
+	obs_data_set_bool(config, "threaded_inputs", opts->threaded_inputs);
+	obs_data_set_string(config, "video_encoder", opts->video_encoder);
+	obs_data_set_string(config, "audio_encoder", opts->audio_encoder);
+	obs_data_set_int(config, "width", opts->cx);
+	obs_data_set_int(config, "height", opts->cy);
+	obs_data_set_int(config, "fps", opts->fps);
+	obs_data_set_string(config, "graphics_module", opts->graphics_module);
+	return config;
+}
+
+static obs_data_t *create_frames_report(struct bench_state *state)
+{
+	obs_data_t *frames = obs_data_create();
+	video_t *video = obs_get_video();
+
+	obs_data_set_int(frames, "rendered",
+			obs_get_total_frames() - state->start_total_frames);
+	obs_data_set_int(frames, "lagged",
+			obs_get_lagged_frames() - state->start_lagged_frames);
+	obs_data_set_int(frames, "output",
+			video_output_get_total_frames(video) -
+			state->start_output_frames);
+	obs_data_set_int(frames, "skipped",
+			video_output_get_skipped_frames(video) -
+			state->start_skipped_frames);
+	return frames;
+}
+
+static obs_data_array_t *create_outputs_report(struct bench_state *state)
+{
+	obs_data_array_t *outputs = obs_data_array_create();
+
+	for (size_t i = 0; i < state->outputs.num; i++) {
+		obs_output_t *output = state->outputs.array[i].output;
+		obs_data_t *item = obs_data_create();
+
+		obs_data_set_string(item, "name", obs_output_get_name(output));
+		obs_data_set_int(item, "total_frames",
+				obs_output_get_total_frames(output));
+		obs_data_set_int(item, "dropped_frames",
+				obs_output_get_frames_dropped(output));
+		obs_data_array_push_back(outputs, item);
+		obs_data_release(item);
+	}
+
+	return outputs;
+}
+
+static obs_data_array_t *create_threads_report(struct bench_state *state)
+{
+	obs_data_array_t *threads = obs_data_array_create();
+	thread_times_t end = {0};
+
+	sample_threads(&end);
+
+	for (size_t i = 0; i < end.num; i++) {
+		struct thread_time *tt = end.array + i;
+		uint64_t cpu_ns = tt->cpu_ns -
+			start_cpu_ns(&state->start_threads, tt->tid);
+		obs_data_t *item = obs_data_create();
+
+		obs_data_set_int(item, "tid", tt->tid);
+		obs_data_set_string(item, "name", tt->name);
+		obs_data_set_double(item, "cpu_ms", cpu_ns / 1000000.0);
+		obs_data_array_push_back(threads, item);
+		obs_data_release(item);
+	}
+
+	da_free(end);
+	return threads;
+}
+
+static bool report(struct bench_state *state,
+		const struct bench_options *opts, uint64_t elapsed_ns)
+{
+	profiler_snapshot_t *snap = profile_snapshot_create();
+	obs_data_t *data = obs_data_create();
+	obs_data_t *obj;
+	obs_data_array_t *arr;
+	bool success = true;
+
+	obs_data_set_double(data, "elapsed_s", elapsed_ns / 1000000000.0);
+
+	obj = create_config_report(opts);
+	obs_data_set_obj(data, "config", obj);
+	obs_data_release(obj);
+
+	obj = create_frames_report(state);
+	obs_data_set_obj(data, "frames", obj);
+	obs_data_release(obj);
+
+	arr = create_outputs_report(state);
+	obs_data_set_array(data, "outputs", arr);
+	obs_data_array_release(arr);
+
+	arr = obs_data_array_create();
+	profiler_snapshot_enumerate_roots(snap, add_encoder_times, arr);
+	obs_data_set_array(data, "encoders", arr);
+	obs_data_array_release(arr);
+
+	obs_data_set_int(data, "audio_buffering_ms",
+			obs_get_audio_buffering_ms());
+	obs_data_set_int(data, "peak_rss_bytes", (long long)get_peak_rss());
+
+	arr = create_threads_report(state);
+	obs_data_set_array(data, "threads", arr);
+	obs_data_array_release(arr);
+
+	if (opts->output_file) {
+		success = obs_data_save_json(data, opts->output_file);
+		if (!success)
+			fprintf(stderr, "Failed to write report to '%s'\n",
+					opts->output_file);
+	} else {
+		printf("%s\n", obs_data_get_json(data));
+	}
+
+	obs_data_release(data);
+	profile_snapshot_free(snap);
+	return success;
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_options opts = {0};
+	struct bench_state state = {0};
+	uint64_t start;
+	int ret = 1;
+
+	if (!parse_options(&opts, argc, argv)) {
+		fprintf(stderr, "usage: %s [--duration SECONDS] [--sources N] "
+				"[--filters N] [--audio-sources N] "
+				"[--sync-pair] [--encoders N] "
+				"[--threaded-inputs] "
+				"[--video-encoder ID] [--audio-encoder ID] "
+				"[--size WxH] [--fps N] "
+				"[--graphics-module NAME] "
+				"[--output FILE.json]\n", argv[0]);
+		return 1;
+	}
+
+	base_set_log_handler(quiet_log_handler, NULL);
+
+	profiler_start();
+
+	if (!obs_startup("en-US", NULL, NULL))
+		goto fail;
+	if (!reset_video(&opts))
+		goto fail_video;
+
+	obs_load_all_modules();
+	obs_post_load_modules();
+
+	if (!create_scene(&state, &opts))
+		goto fail_scene;
+	if (!create_outputs(&state, &opts))
+		goto fail_outputs;
+
+	begin_measurement(&state);
+	start = os_gettime_ns();
+
+	os_sleep_ms(opts.duration * 1000);
+
+	if (report(&state, &opts, os_gettime_ns() - start))
+		ret = 0;
+
+fail_outputs:
+	destroy_outputs(&state);
+	da_free(state.start_threads);
+fail_scene:
+	obs_set_output_source(0, NULL);
+	if (state.scene) {
+		obs_source_remove(obs_scene_get_source(state.scene));
+		obs_scene_release(state.scene);
+	}
+fail_video:
+	obs_shutdown();
+fail:
+	profiler_stop();
+	profiler_free();
+	return ret;
+}
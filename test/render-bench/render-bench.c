@@ -0,0 +1,341 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <inttypes.h>
+
+#include <obs.h>
+#include <util/darray.h>
+#include <util/platform.h>
+#include <util/profiler.h>
+#include <util/threading.h>
+
+#include "../common/bench-stats.h"
+
+/*
+ * Renders a number of frames of a scene collection through the graphics
+ * thread, by default with the headless OpenGL backend so that it can run on
+ * machines without a display, and reports how long each stage of a frame
+ * took according to the profiler:
+ *
+ *   render-bench [--frames N] [--size WxH] [--fps N]
+ *                [--graphics-module NAME] [--trace FILE.json]
+ *                [SCENE_COLLECTION.json]
+ *
+ * Without a scene collection, a scene with a few color sources is rendered.
+ * Frames are pulled through a raw video callback so that output scaling,
+ * GPU conversion and the texture download are measured as well.
+ */
+
+#define DEFAULT_FRAMES 600
+#define DEFAULT_GRAPHICS_MODULE "libobs-opengl-headless"
+
+struct bench_options {
+	uint32_t   frames;
+	uint32_t   cx;
+	uint32_t   cy;
+	uint32_t   fps;
+	const char *graphics_module;
+	const char *trace_file;
+	const char *collection;
+};
+
+static volatile long frames_received = 0;
+
+/* sources only stay alive while referenced, like the frontend does with its
+ * scene list */
+static DARRAY(obs_source_t*) loaded_sources;
+
+static void source_loaded(void *param, obs_source_t *source)
+{
+	obs_source_addref(source);
+	da_push_back(loaded_sources, &source);
+
+	UNUSED_PARAMETER(param);
+}
+
+static void release_loaded_sources(void)
+{
+	for (size_t i = 0; i < loaded_sources.num; i++)
+		obs_source_release(loaded_sources.array[i]);
+	da_free(loaded_sources);
+}
+
+static void raw_video(void *param, struct video_data *frame)
+{
+	os_atomic_inc_long(&frames_received);
+
+	UNUSED_PARAMETER(param);
+	UNUSED_PARAMETER(frame);
+}
+
+static void quiet_log_handler(int lvl, const char *format, va_list args,
+		void *param)
+{
+	if (lvl <= LOG_WARNING) {
+		vfprintf(stderr, format, args);
+		fprintf(stderr, "\n");
+	}
+
+	UNUSED_PARAMETER(param);
+}
+
+static bool parse_options(struct bench_options *opts, int argc, char *argv[])
+{
+	opts->frames          = DEFAULT_FRAMES;
+	opts->cx              = 1920;
+	opts->cy              = 1080;
+	opts->fps             = 60;
+	opts->graphics_module = DEFAULT_GRAPHICS_MODULE;
+
+	for (int i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+		const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+
+		if (strcmp(arg, "--frames") == 0 && val) {
+			opts->frames = (uint32_t)strtoul(val, NULL, 10);
+			i++;
+		} else if (strcmp(arg, "--size") == 0 && val) {
+			if (sscanf(val, "%ux%u", &opts->cx, &opts->cy) != 2)
+				return false;
+			i++;
+		} else if (strcmp(arg, "--fps") == 0 && val) {
+			opts->fps = (uint32_t)strtoul(val, NULL, 10);
+			i++;
+		} else if (strcmp(arg, "--graphics-module") == 0 && val) {
+			opts->graphics_module = val;
+			i++;
+		} else if (strcmp(arg, "--trace") == 0 && val) {
+			opts->trace_file = val;
+			i++;
+		} else if (arg[0] != '-' && !opts->collection) {
+			opts->collection = arg;
+		} else {
+			return false;
+		}
+	}
+
+	return opts->frames && opts->cx && opts->cy && opts->fps;
+}
+
+static bool reset_video(const struct bench_options *opts)
+{
+	struct obs_video_info ovi = {
+		.graphics_module = opts->graphics_module,
+		.fps_num         = opts->fps,
+		.fps_den         = 1,
+		.base_width      = opts->cx,
+		.base_height     = opts->cy,
+		.output_width    = opts->cx,
+		.output_height   = opts->cy,
+		.output_format   = VIDEO_FORMAT_NV12,
+		.gpu_conversion  = true,
+		.colorspace      = VIDEO_CS_709,
+		.range           = VIDEO_RANGE_PARTIAL,
+		.scale_type      = OBS_SCALE_BICUBIC
+	};
+	struct obs_audio_info oai = {
+		.samples_per_sec = 48000,
+		.speakers        = SPEAKERS_STEREO
+	};
+
+	int ret = obs_reset_video(&ovi);
+	if (ret != OBS_VIDEO_SUCCESS) {
+		fprintf(stderr, "Failed to initialize video (%d) with '%s'\n",
+				ret, opts->graphics_module);
+		return false;
+	}
+
+	return obs_reset_audio(&oai);
+}
+
+static obs_source_t *load_collection(const char *file)
+{
+	obs_data_t *data = obs_data_create_from_json_file(file);
+	obs_data_array_t *sources;
+	obs_source_t *scene;
+
+	if (!data) {
+		fprintf(stderr, "Failed to load scene collection '%s'\n", file);
+		return NULL;
+	}
+
+	sources = obs_data_get_array(data, "sources");
+	obs_load_sources(sources, source_loaded, NULL);
+	obs_data_array_release(sources);
+
+	scene = obs_get_source_by_name(
+			obs_data_get_string(data, "current_scene"));
+	if (!scene)
+		fprintf(stderr, "Scene collection '%s' has no current scene\n",
+				file);
+
+	obs_data_release(data);
+	return scene;
+}
+
+static obs_source_t *create_default_scene(const struct bench_options *opts)
+{
+	static const uint32_t colors[] = {
+		0xFF3050A0, 0xFFA05030, 0xFF30A050, 0xC0FFFFFF
+	};
+	obs_scene_t *scene = obs_scene_create("render-bench scene");
+
+	for (size_t i = 0; i < sizeof(colors) / sizeof(colors[0]); i++) {
+		obs_data_t *settings = obs_data_create();
+		obs_source_t *color;
+		obs_sceneitem_t *item;
+		struct vec2 pos;
+
+		obs_data_set_int(settings, "color", colors[i]);
+		obs_data_set_int(settings, "width", opts->cx / 2);
+		obs_data_set_int(settings, "height", opts->cy / 2);
+
+		color = obs_source_create("color_source", "render-bench color",
+				settings, NULL);
+		item = obs_scene_add(scene, color);
+
+		vec2_set(&pos, (float)(i % 2) * opts->cx / 2.0f + i * 16.0f,
+				(float)(i / 2) * opts->cy / 2.0f + i * 16.0f);
+		obs_sceneitem_set_pos(item, &pos);
+
+		obs_source_release(color);
+		obs_data_release(settings);
+	}
+
+	return obs_scene_get_source(scene);
+}
+
+static bool wait_for_frames(const struct bench_options *opts)
+{
+	uint64_t timeout_ns = (uint64_t)opts->frames * 3000000000ULL /
+		opts->fps + 10000000000ULL;
+	uint64_t start = os_gettime_ns();
+
+	while ((uint32_t)os_atomic_load_long(&frames_received) <
+			opts->frames) {
+		if (os_gettime_ns() - start > timeout_ns) {
+			fprintf(stderr, "Timed out after %ld frames\n",
+					os_atomic_load_long(&frames_received));
+			return false;
+		}
+
+		os_sleep_ms(10);
+	}
+
+	return true;
+}
+
+static bool print_stage(void *context, profiler_snapshot_entry_t *entry)
+{
+	int depth = *(int*)context;
+	int child_depth = depth + 1;
+	struct bench_time_stats stats;
+
+	bench_get_time_stats(entry, &stats);
+
+	printf("%*s%-*s %8"PRIu64" %10.1f %10"PRIu64" %10"PRIu64" %10"PRIu64
+			"\n", depth * 2, "", 44 - depth * 2,
+			profiler_snapshot_entry_name(entry),
+			stats.calls, stats.mean, stats.median,
+			stats.percentile99, stats.max);
+
+	profiler_snapshot_enumerate_children(entry, print_stage,
+			&child_depth);
+	return true;
+}
+
+static bool print_graphics_root(void *context,
+		profiler_snapshot_entry_t *entry)
+{
+	const char *name = profiler_snapshot_entry_name(entry);
+	int depth = 0;
+
+	if (strncmp(name, "obs_graphics_thread", 19) != 0)
+		return true;
+
+	printf("%-44s %8s %10s %10s %10s %10s\n", "stage (times in us)",
+			"calls", "mean", "median", "99th", "max");
+	print_stage(&depth, entry);
+
+	*(bool*)context = true;
+	return false;
+}
+
+static void report(const struct bench_options *opts, uint64_t elapsed_ns)
+{
+	profiler_snapshot_t *snap = profile_snapshot_create();
+	bool found = false;
+
+	printf("%u frames at %ux%u, %u lagged, %.2f s\n\n",
+			opts->frames, opts->cx, opts->cy,
+			obs_get_lagged_frames(), elapsed_ns / 1000000000.0);
+
+	profiler_snapshot_enumerate_roots(snap, print_graphics_root, &found);
+	if (!found)
+		fprintf(stderr, "No graphics thread profile was recorded\n");
+
+	if (opts->trace_file &&
+	    !profiler_snapshot_dump_chrome_trace(snap, opts->trace_file))
+		fprintf(stderr, "Failed to write trace to '%s'\n",
+				opts->trace_file);
+
+	profile_snapshot_free(snap);
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_options opts = {0};
+	obs_source_t *scene = NULL;
+	uint64_t start;
+	int ret = 1;
+
+	if (!parse_options(&opts, argc, argv)) {
+		fprintf(stderr, "usage: %s [--frames N] [--size WxH] "
+				"[--fps N] [--graphics-module NAME] "
+				"[--trace FILE.json] [SCENE_COLLECTION.json]\n",
+				argv[0]);
+		return 1;
+	}
+
+	base_set_log_handler(quiet_log_handler, NULL);
+
+	profiler_start();
+
+	if (!obs_startup("en-US", NULL, NULL))
+		goto fail;
+	if (!reset_video(&opts))
+		goto fail_video;
+
+	obs_load_all_modules();
+	obs_post_load_modules();
+
+	scene = opts.collection ?
+		load_collection(opts.collection) :
+		create_default_scene(&opts);
+	if (!scene)
+		goto fail_video;
+
+	obs_set_output_source(0, scene);
+
+	start = os_gettime_ns();
+	obs_add_raw_video_callback(NULL, raw_video, NULL);
+
+	if (wait_for_frames(&opts)) {
+		report(&opts, os_gettime_ns() - start);
+		ret = 0;
+	}
+
+	obs_remove_raw_video_callback(raw_video, NULL);
+	obs_set_output_source(0, NULL);
+	obs_source_remove(scene);
+	obs_source_release(scene);
+	release_loaded_sources();
+
+fail_video:
+	obs_shutdown();
+fail:
+	profiler_stop();
+	profiler_free();
+	return ret;
+}
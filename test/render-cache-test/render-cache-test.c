@@ -0,0 +1,260 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include <obs-internal.h>
+
+/*
+ * Checks that cacheable sources look the same when they're drawn from their
+ * render cache as when they're rendered directly, with outlined and shadowed
+ * text drawn in a translucent color, so that the outline, the shadow and the
+ * text overlap each other:
+ *
+ *   render-cache-test [--graphics-module NAME] [--tolerance N]
+ *
+ * Both are drawn over an opaque background the way a scene draws its
+ * sources.  Returns non-zero if any pixel differs by more than the tolerance
+ * (3 by default, for the rounding of the 8 bit cache texture), or if the text
+ * wasn't drawn or wasn't drawn from the cache.
+ */
+
+#define DEFAULT_GRAPHICS_MODULE "libobs-opengl-headless"
+#define DEFAULT_TOLERANCE       3
+
+struct test_options {
+	const char *graphics_module;
+	int        tolerance;
+};
+
+static void quiet_log_handler(int lvl, const char *format, va_list args,
+		void *param)
+{
+	if (lvl <= LOG_WARNING) {
+		vfprintf(stderr, format, args);
+		fprintf(stderr, "\n");
+	}
+
+	UNUSED_PARAMETER(param);
+}
+
+static bool parse_options(struct test_options *opts, int argc, char *argv[])
+{
+	opts->graphics_module = DEFAULT_GRAPHICS_MODULE;
+	opts->tolerance       = DEFAULT_TOLERANCE;
+
+	for (int i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+		const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+
+		if (strcmp(arg, "--graphics-module") == 0 && val) {
+			opts->graphics_module = val;
+			i++;
+		} else if (strcmp(arg, "--tolerance") == 0 && val) {
+			opts->tolerance = atoi(val);
+			i++;
+		} else {
+			return false;
+		}
+	}
+
+	return opts->tolerance >= 0;
+}
+
+static bool reset_video(const struct test_options *opts)
+{
+	struct obs_video_info ovi = {
+		.graphics_module = opts->graphics_module,
+		.fps_num         = 30,
+		.fps_den         = 1,
+		.base_width      = 640,
+		.base_height     = 360,
+		.output_width    = 640,
+		.output_height   = 360,
+		.output_format   = VIDEO_FORMAT_NV12,
+		.gpu_conversion  = true,
+		.colorspace      = VIDEO_CS_709,
+		.range           = VIDEO_RANGE_PARTIAL,
+		.scale_type      = OBS_SCALE_BICUBIC
+	};
+
+	int ret = obs_reset_video(&ovi);
+	if (ret != OBS_VIDEO_SUCCESS) {
+		fprintf(stderr, "Failed to initialize video (%d) with '%s'\n",
+				ret, opts->graphics_module);
+		return false;
+	}
+
+	return true;
+}
+
+static obs_source_t *create_text(void)
+{
+	obs_data_t *settings = obs_data_create();
+	obs_data_t *font = obs_data_create();
+	obs_source_t *text;
+
+	obs_data_set_int(font, "size", 72);
+	obs_data_set_obj(settings, "font", font);
+	obs_data_set_string(settings, "text", "Cached Text");
+	obs_data_set_bool(settings, "outline", true);
+	obs_data_set_bool(settings, "drop_shadow", true);
+	obs_data_set_int(settings, "color1", 0xA0FFE0C0);
+	obs_data_set_int(settings, "color2", 0x8040FFFF);
+
+	text = obs_source_create("text_ft2_source", "render-cache-test text",
+			settings, NULL);
+
+	obs_data_release(font);
+	obs_data_release(settings);
+	return text;
+}
+
+/* draws the source over an opaque background and downloads the result */
+static uint8_t *render_source(obs_source_t *source, uint32_t cx, uint32_t cy,
+		bool cached)
+{
+	gs_texrender_t *texrender = gs_texrender_create(GS_RGBA, GS_ZS_NONE);
+	gs_stagesurf_t *stagesurf = NULL;
+	uint8_t *pixels = NULL;
+	uint8_t *data;
+	uint32_t linesize;
+	struct vec4 background;
+
+	vec4_set(&background, 0.2f, 0.6f, 0.9f, 1.0f);
+
+	if (!gs_texrender_begin(texrender, cx, cy))
+		goto fail;
+
+	gs_clear(GS_CLEAR_COLOR, &background, 0.0f, 0);
+	gs_ortho(0.0f, (float)cx, 0.0f, (float)cy, -100.0f, 100.0f);
+
+	gs_blend_state_push();
+	gs_reset_blend_state();
+
+	if (cached)
+		obs_source_video_render(source);
+	else
+		source->info.video_render(source->context.data, NULL);
+
+	gs_blend_state_pop();
+	gs_texrender_end(texrender);
+
+	stagesurf = gs_stagesurface_create(cx, cy, GS_RGBA);
+	gs_stage_texture(stagesurf, gs_texrender_get_texture(texrender));
+
+	if (!gs_stagesurface_map(stagesurf, &data, &linesize))
+		goto fail;
+
+	pixels = bmalloc(cx * cy * 4);
+	for (uint32_t y = 0; y < cy; y++)
+		memcpy(pixels + y * cx * 4, data + y * linesize, cx * 4);
+
+	gs_stagesurface_unmap(stagesurf);
+
+fail:
+	gs_stagesurface_destroy(stagesurf);
+	gs_texrender_destroy(texrender);
+	return pixels;
+}
+
+static bool compare(const uint8_t *direct, const uint8_t *cached,
+		uint32_t cx, uint32_t cy, int tolerance)
+{
+	size_t size = cx * cy * 4;
+	size_t mismatched = 0;
+	size_t drawn = 0;
+	int max_diff = 0;
+
+	for (size_t i = 0; i < size; i += 4) {
+		bool pixel_mismatched = false;
+
+		if (direct[i] != direct[0] || direct[i + 1] != direct[1] ||
+		    direct[i + 2] != direct[2])
+			drawn++;
+
+		for (size_t c = 0; c < 4; c++) {
+			int diff = abs((int)direct[i + c] - (int)cached[i + c]);
+
+			if (diff > max_diff)
+				max_diff = diff;
+			if (diff > tolerance)
+				pixel_mismatched = true;
+		}
+
+		if (pixel_mismatched)
+			mismatched++;
+	}
+
+	printf("%ux%u, %zu pixels drawn, %zu mismatched, max difference %d\n",
+			cx, cy, drawn, mismatched, max_diff);
+
+	if (!drawn)
+		fprintf(stderr, "The text wasn't drawn\n");
+
+	return drawn && !mismatched;
+}
+
+int main(int argc, char *argv[])
+{
+	struct test_options opts = {0};
+	obs_source_t *text = NULL;
+	uint8_t *direct = NULL;
+	uint8_t *cached = NULL;
+	uint32_t cx, cy;
+	bool used_cache = false;
+	int ret = 1;
+
+	if (!parse_options(&opts, argc, argv)) {
+		fprintf(stderr, "usage: %s [--graphics-module NAME] "
+				"[--tolerance N]\n", argv[0]);
+		return 1;
+	}
+
+	base_set_log_handler(quiet_log_handler, NULL);
+
+	if (!obs_startup("en-US", NULL, NULL))
+		goto fail;
+	if (!reset_video(&opts))
+		goto fail_video;
+
+	obs_load_all_modules();
+	obs_post_load_modules();
+
+	text = create_text();
+	if (!text) {
+		fprintf(stderr, "Failed to create the text source\n");
+		goto fail_video;
+	}
+
+	cx = obs_source_get_width(text);
+	cy = obs_source_get_height(text);
+	if (!cx || !cy) {
+		fprintf(stderr, "The text source has no size\n");
+		goto fail_text;
+	}
+
+	obs_enter_graphics();
+	direct = render_source(text, cx, cy, false);
+	cached = render_source(text, cx, cy, true);
+	used_cache = text->render_cache_valid;
+	obs_leave_graphics();
+
+	if (!direct || !cached) {
+		fprintf(stderr, "Failed to download the rendered text\n");
+	} else if (!used_cache) {
+		fprintf(stderr, "The text wasn't drawn from its cache\n");
+	} else if (compare(direct, cached, cx, cy, opts.tolerance)) {
+		ret = 0;
+	}
+
+	bfree(direct);
+	bfree(cached);
+
+fail_text:
+	obs_source_release(text);
+fail_video:
+	obs_shutdown();
+fail:
+	return ret;
+}
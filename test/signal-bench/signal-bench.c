@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <inttypes.h>
+
+#include <callback/signal.h>
+#include <util/platform.h>
+#include <util/bmem.h>
+
+/*
+ * Measures the cost of emitting a signal with 0, 1 and 10 connected
+ * callbacks, both by name and through a signal ID resolved up front.
+ */
+
+#define EMISSIONS 1000000
+
+static const size_t callback_counts[] = {0, 1, 10};
+
+static const char *signals[] = {
+	"void destroy(ptr source)",
+	"void remove(ptr source)",
+	"void activate(ptr source)",
+	"void deactivate(ptr source)",
+	"void show(ptr source)",
+	"void hide(ptr source)",
+	"void mute(ptr source, bool muted)",
+	"void volume(ptr source, in out float volume)",
+	"void item_transform(ptr scene, ptr item)",
+	NULL
+};
+
+static void callback(void *data, calldata_t *cd)
+{
+	long *count = data;
+	(*count)++;
+	UNUSED_PARAMETER(cd);
+}
+
+static double emit_by_name(signal_handler_t *handler, calldata_t *cd)
+{
+	uint64_t start = os_gettime_ns();
+
+	for (size_t i = 0; i < EMISSIONS; i++)
+		signal_handler_signal(handler, "item_transform", cd);
+
+	return (double)(os_gettime_ns() - start) / EMISSIONS;
+}
+
+static double emit_by_id(signal_handler_t *handler, signal_id_t *id,
+		calldata_t *cd)
+{
+	uint64_t start = os_gettime_ns();
+
+	for (size_t i = 0; i < EMISSIONS; i++)
+		signal_handler_signal_id(handler, id, cd);
+
+	return (double)(os_gettime_ns() - start) / EMISSIONS;
+}
+
+static void run(size_t callbacks)
+{
+	signal_handler_t *handler = signal_handler_create();
+	long counts[10] = {0};
+	struct calldata cd;
+	uint8_t stack[128];
+	signal_id_t *id;
+	double name_ns, id_ns;
+
+	signal_handler_add_array(handler, signals);
+	id = signal_handler_get_id(handler, "item_transform");
+
+	for (size_t i = 0; i < callbacks; i++)
+		signal_handler_connect(handler, "item_transform", callback,
+				&counts[i]);
+
+	calldata_init_fixed(&cd, stack, sizeof(stack));
+	calldata_set_ptr(&cd, "scene", NULL);
+	calldata_set_ptr(&cd, "item", NULL);
+
+	name_ns = emit_by_name(handler, &cd);
+	id_ns   = emit_by_id(handler, id, &cd);
+
+	printf("%2zu callbacks: by name %7.1f ns, by id %7.1f ns\n",
+			callbacks, name_ns, id_ns);
+
+	for (size_t i = 0; i < callbacks; i++) {
+		if (counts[i] != 2 * EMISSIONS)
+			printf("  callback %zu was called %ld times\n",
+					i, counts[i]);
+	}
+
+	signal_handler_destroy(handler);
+}
+
+int main(void)
+{
+	for (size_t i = 0; i < sizeof(callback_counts) / sizeof(size_t); i++)
+		run(callback_counts[i]);
+
+	printf("leaks: %ld\n", bnum_allocs());
+	return 0;
+}